@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <lxe/syscalls.h>
+
+#define TICK_US       100000
+#define SAMPLE_US     250000
+#define TICKS         50
+#define MAX_EVENTS    4
+
+#define TAG_STDIN  0
+#define TAG_TIMER  1
+#define TAG_SAMPLE 2
+
+
+// Child side. Produces a sample on every expiry of its own timer, until the parent closes the pipe.
+static void produce(int fd) {
+    int timer = lxe_timerfd_create(SAMPLE_US, SAMPLE_US);
+    uint64_t expirations;
+    uint32_t sample = 0;
+    while(read(timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        if(write(fd, &sample, sizeof(sample)) != sizeof(sample)) {
+            break;
+        }
+        sample++;
+    }
+}
+
+
+static int watch(int epfd, int fd, uint64_t tag) {
+    struct epoll_event ev = {.events = POLLIN, .data = tag};
+    return lxe_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+// Single threaded event loop over the console, a periodic timer and a pipe fed by another process.
+// Reports how late the timer wakeups are. Press q to stop early.
+int main(int argc, char **argv) {
+    int fds[2];
+    if(lxe_pipe(fds)) {
+        printf("Failed to create pipe\n");
+        return EXIT_FAILURE;
+    }
+    int pid = lxe_fork();
+    if(pid < 0) {
+        printf("fork failed\n");
+        return EXIT_FAILURE;
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        produce(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    int epfd = lxe_epoll_create();
+    int timer = lxe_timerfd_create(TICK_US, TICK_US);
+    if(epfd < 0 || timer < 0 || watch(epfd, STDIN_FILENO, TAG_STDIN) || watch(epfd, timer, TAG_TIMER) || watch(epfd, fds[0], TAG_SAMPLE)) {
+        printf("Failed to set up event sources\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t freq = lxe_counter_frequency();
+    uint64_t next_tick = lxe_read_counter() + TICK_US * freq / 1000000;
+    uint64_t max_late = 0, total_late = 0;
+    int ticks = 0, samples = 0, wakeups = 0;
+    int running = 1;
+    while(running && ticks < TICKS) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = lxe_epoll_wait(epfd, events, MAX_EVENTS, -1);
+        uint64_t now = lxe_read_counter();
+        wakeups++;
+        for(int i = 0; i < n; i++) {
+            if(events[i].data == TAG_TIMER) {
+                uint64_t expirations;
+                read(timer, &expirations, sizeof(expirations));
+                uint64_t late = now > next_tick ? now - next_tick : 0;
+                total_late += late;
+                if(late > max_late) {
+                    max_late = late;
+                }
+                ticks += expirations;
+                next_tick += expirations * TICK_US * freq / 1000000;
+            } else if(events[i].data == TAG_SAMPLE) {
+                uint32_t sample;
+                if(read(fds[0], &sample, sizeof(sample)) != sizeof(sample)) {
+                    running = 0;
+                }
+                samples++;
+            } else if(events[i].data == TAG_STDIN) {
+                char c;
+                if(read(STDIN_FILENO, &c, 1) == 1 && c == 'q') {
+                    running = 0;
+                }
+            }
+        }
+    }
+    close(fds[0]);
+
+    printf("%d ticks, %d samples in %d wakeups\n", ticks, samples, wakeups);
+    if(ticks) {
+        printf("Timer latency: avg %llu us, max %llu us\n",
+            (unsigned long long)(total_late * 1000000 / freq / ticks), (unsigned long long)(max_late * 1000000 / freq));
+    }
+    return EXIT_SUCCESS;
+}
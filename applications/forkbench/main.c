@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <lxe/syscalls.h>
+
+#define FORK_COUNT 32
+
+
+// Measures the latency of fork() with a parent of configurable size.
+// With copy-on-write, the latency should not depend on the amount of memory.
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        printf("Usage: forkbench [MiB]\n");
+        return EXIT_FAILURE;
+    }
+    int mib = atoi(argv[1]);
+    size_t size = (size_t)mib * 1024 * 1024;
+    char *buf = malloc(size);
+    if(!buf && size) {
+        printf("Failed to allocate %d MiB\n", mib);
+        return EXIT_FAILURE;
+    }
+    // Touch all of the memory, so that it is actually backed by pages
+    memset(buf, 0xAA, size);
+
+    uint64_t freq = lxe_counter_frequency();
+    uint64_t total = 0;
+    uint64_t worst = 0;
+    for(int i = 0; i < FORK_COUNT; i++) {
+        uint64_t start = lxe_read_counter();
+        int pid = lxe_fork();
+        if(pid == 0) {
+            _exit(0);
+        }
+        uint64_t elapsed = lxe_read_counter() - start;
+        if(pid < 0) {
+            printf("fork failed\n");
+            return EXIT_FAILURE;
+        }
+        total += elapsed;
+        if(elapsed > worst) {
+            worst = elapsed;
+        }
+    }
+
+    printf("fork with %d MiB: avg %llu us, worst %llu us\n", mib,
+        (unsigned long long)(total * 1000000 / FORK_COUNT / freq),
+        (unsigned long long)(worst * 1000000 / freq));
+    free(buf);
+    return EXIT_SUCCESS;
+}
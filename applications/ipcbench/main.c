@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <lxe/syscalls.h>
+
+#define ROUND_TRIPS 10000
+#define MSG_QUIT 0xFFFFFFFFFFFFFFFFul
+
+
+// Echo server. Increments the first message word.
+static void server() {
+    struct lxe_ipc_msg msg;
+    int client = lxe_ipc_reply_wait(0, &msg);
+    while(client > 0 && msg.w[0] != MSG_QUIT) {
+        msg.w[0]++;
+        client = lxe_ipc_reply_wait(client, &msg);
+    }
+    // The final call fails once we exit
+    _exit(0);
+}
+
+
+// Measures the round trip latency of synchronous IPC between two processes
+int main(int argc, char **argv) {
+    int pid = lxe_fork();
+    if(pid < 0) {
+        printf("fork failed\n");
+        return EXIT_FAILURE;
+    }
+    if(pid == 0) {
+        server();
+    }
+
+    uint64_t total = 0;
+    uint64_t best = ~0ul;
+    struct lxe_ipc_msg msg = {0};
+    for(int i = 0; i < ROUND_TRIPS; i++) {
+        uint64_t expected = msg.w[0] + 1;
+        uint64_t start = lxe_read_cycles();
+        if(lxe_ipc_call(pid, &msg)) {
+            printf("ipc_call failed\n");
+            return EXIT_FAILURE;
+        }
+        uint64_t cycles = lxe_read_cycles() - start;
+        if(msg.w[0] != expected) {
+            printf("Unexpected reply %llu\n", (unsigned long long)msg.w[0]);
+            return EXIT_FAILURE;
+        }
+        total += cycles;
+        if(cycles < best) {
+            best = cycles;
+        }
+    }
+    printf("ipc round trip: avg %llu cycles, best %llu cycles\n",
+        (unsigned long long)(total / ROUND_TRIPS), (unsigned long long)best);
+
+    msg.w[0] = MSG_QUIT;
+    lxe_ipc_call(pid, &msg);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <lxe/syscalls.h>
+#include <lxe/mutex.h>
+
+#define ITERATIONS 100000
+#define MAX_THREADS 8
+#define THREAD_STACK_SIZE (16 * 1024)
+
+
+static lxe_mutex_t lock = LXE_MUTEX_INITIALIZER;
+static volatile uint64_t counter = 0;
+static volatile int threads_done = 0;
+static int yield_interval = 0;
+
+
+static void worker(void *arg) {
+    for(int i = 0; i < ITERATIONS; i++) {
+        lxe_mutex_lock(&lock);
+        counter++;
+        // Yielding while holding the lock forces the other threads onto the slow path
+        if(yield_interval && i % yield_interval == 0) {
+            lxe_yield();
+        }
+        lxe_mutex_unlock(&lock);
+    }
+    __atomic_add_fetch(&threads_done, 1, __ATOMIC_RELEASE);
+    lxe_thread_exit();
+}
+
+
+static uint64_t run(int nr_threads, int interval) {
+    counter = 0;
+    threads_done = 0;
+    yield_interval = interval;
+
+    uint64_t start = lxe_read_counter();
+    for(int i = 0; i < nr_threads; i++) {
+        char *stack = aligned_alloc(16, THREAD_STACK_SIZE);
+        if(!stack || lxe_clone(worker, stack + THREAD_STACK_SIZE, 0, 0) < 0) {
+            printf("Failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while(__atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < nr_threads) {
+        lxe_yield();
+    }
+    uint64_t elapsed = lxe_read_counter() - start;
+
+    if(counter != (uint64_t)nr_threads * ITERATIONS) {
+        printf("Counter mismatch: %llu\n", (unsigned long long)counter);
+    }
+    return elapsed;
+}
+
+
+// Measures the cost of lock and unlock with and without contention
+int main(int argc, char **argv) {
+    int nr_threads = argc > 1 ? atoi(argv[1]) : 4;
+    if(nr_threads < 1 || nr_threads > MAX_THREADS) {
+        printf("Usage: mutexbench [threads (1-%d)]\n", MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+    uint64_t freq = lxe_counter_frequency();
+    uint64_t ops = (uint64_t)nr_threads * ITERATIONS;
+
+    uint64_t uncontended = run(nr_threads, 0);
+    printf("uncontended: %llu ns/op\n", (unsigned long long)(uncontended * 1000000000 / freq / ops));
+    uint64_t contended = run(nr_threads, 16);
+    printf("contended:   %llu ns/op\n", (unsigned long long)(contended * 1000000000 / freq / ops));
+    return EXIT_SUCCESS;
+}
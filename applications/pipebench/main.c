@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <lxe/syscalls.h>
+
+#define TRANSFER_SIZE (16 * 1024 * 1024)
+#define MAX_MESSAGE_SIZE (256 * 1024)
+#define PAGE_SIZE 4096
+
+
+static const int message_sizes[] = {64, 512, 4096, 65536, 262144};
+
+
+// Child side. Reads until the write end is closed.
+static void drain(int fd, char *buf, int message_size) {
+    while(read(fd, buf, message_size) > 0) {
+    }
+}
+
+
+// Measures pipe throughput between two processes for several message sizes.
+// Page aligned messages of a page or more can be passed without copying.
+int main(int argc, char **argv) {
+    // Both processes use page aligned buffers
+    char *buf = aligned_alloc(PAGE_SIZE, MAX_MESSAGE_SIZE);
+    if(!buf) {
+        printf("Failed to allocate buffer\n");
+        return EXIT_FAILURE;
+    }
+    for(int i = 0; i < MAX_MESSAGE_SIZE; i++) {
+        buf[i] = (char)i;
+    }
+    uint64_t freq = lxe_counter_frequency();
+
+    for(unsigned int s = 0; s < sizeof(message_sizes) / sizeof(message_sizes[0]); s++) {
+        int message_size = message_sizes[s];
+        int fds[2];
+        if(lxe_pipe(fds)) {
+            printf("Failed to create pipe\n");
+            return EXIT_FAILURE;
+        }
+        int pid = lxe_fork();
+        if(pid < 0) {
+            printf("fork failed\n");
+            return EXIT_FAILURE;
+        }
+        if(pid == 0) {
+            close(fds[1]);
+            drain(fds[0], buf, message_size);
+            _exit(0);
+        }
+        close(fds[0]);
+
+        uint64_t start = lxe_read_counter();
+        for(int sent = 0; sent < TRANSFER_SIZE; sent += message_size) {
+            if(write(fds[1], buf, message_size) != message_size) {
+                printf("write failed\n");
+                return EXIT_FAILURE;
+            }
+        }
+        close(fds[1]);
+        uint64_t elapsed = lxe_read_counter() - start;
+        uint64_t kib_per_s = (uint64_t)TRANSFER_SIZE / 1024 * freq / elapsed;
+        printf("%6d byte messages: %llu.%02llu MB/s\n", message_size,
+            (unsigned long long)(kib_per_s / 1024), (unsigned long long)(kib_per_s % 1024 * 100 / 1024));
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <lxe/syscalls.h>
+
+#define MAX_THREADS 16
+#define THREAD_STACK_SIZE (16 * 1024)
+
+
+struct prime_job {
+    long limit;
+    long first;
+    long stride;
+    long number_of_primes;
+};
+
+static volatile int jobs_done = 0;
+
+
+static bool is_prime(long n) {
+    // Try numbers from 3 to sqrt(n) as factors
+    for(long m = 3; m <= static_cast<long>(sqrt((double)n)) + 1; m++) {
+        if(n % m == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Each thread tests every stride-th odd number, so that the work is spread evenly.
+static void prime_thread(void *arg) {
+    prime_job *job = static_cast<prime_job*>(arg);
+    for(long n = job->first; n <= job->limit; n += job->stride) {
+        if(is_prime(n)) {
+            job->number_of_primes++;
+        }
+    }
+    __atomic_add_fetch(&jobs_done, 1, __ATOMIC_RELEASE);
+    lxe_thread_exit();
+}
+
+
+int main(int argc, char **argv) {
+    if(argc != 3) {
+        std::cerr << "Incorrect number of arguments!" << std::endl;
+        std::cerr << "Usage: primes_mt [limit] [threads]     Finds primes up to the number 'limit'" << std::endl;
+        return EXIT_FAILURE;
+    }
+    long limit = atol(argv[1]);
+    int nr_threads = atoi(argv[2]);
+    if(nr_threads < 1 || nr_threads > MAX_THREADS) {
+        std::cerr << "Thread count must be between 1 and " << MAX_THREADS << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Generating " << limit << " primes with " << nr_threads << " threads..." << std::endl;
+
+    uint64_t start = lxe_read_counter();
+    prime_job jobs[MAX_THREADS];
+    for(int i = 0; i < nr_threads; i++) {
+        jobs[i].limit = limit;
+        jobs[i].first = 3 + 2 * i;
+        jobs[i].stride = 2 * nr_threads;
+        jobs[i].number_of_primes = 0;
+
+        char *stack = static_cast<char*>(aligned_alloc(16, THREAD_STACK_SIZE));
+        if(!stack || lxe_clone(prime_thread, stack + THREAD_STACK_SIZE, &jobs[i], 0) < 0) {
+            std::cerr << "Failed to create thread " << i << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    while(__atomic_load_n(&jobs_done, __ATOMIC_ACQUIRE) < nr_threads) {
+        lxe_yield();
+    }
+    uint64_t elapsed = lxe_read_counter() - start;
+
+    // Edge case
+    long number_of_primes = limit >= 2 ? 1 : 0;
+    for(int i = 0; i < nr_threads; i++) {
+        number_of_primes += jobs[i].number_of_primes;
+    }
+    std::cout << number_of_primes << " primes found in " << elapsed * 1000 / lxe_counter_frequency() << " ms" << std::endl;
+    // The thread stacks are not freed, the threads may still be exiting.
+    return EXIT_SUCCESS;
+}
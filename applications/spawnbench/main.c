@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <lxe/syscalls.h>
+
+#define SPAWN_COUNT 16
+
+
+// Measures the time from spawn() in the parent until main() runs in the child.
+// The benchmark spawns itself. The child receives the start timestamp as an argument.
+int main(int argc, char **argv) {
+    uint64_t now = lxe_read_counter();
+    if(argc == 3 && strcmp(argv[1], "child") == 0) {
+        uint64_t start = strtoull(argv[2], 0, 10);
+        printf("spawn to main: %" PRIu64 " us\n", (now - start) * 1000000 / lxe_counter_frequency());
+        return EXIT_SUCCESS;
+    }
+
+    char timestamp[24];
+    char *child_argv[] = {argv[0], "child", timestamp, 0};
+    for(int i = 0; i < SPAWN_COUNT; i++) {
+        snprintf(timestamp, sizeof(timestamp), "%" PRIu64, lxe_read_counter());
+        if(lxe_spawn(argv[0], child_argv, 0, 0) < 0) {
+            printf("spawn failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -3,17 +3,30 @@
 #include <kernel/types.h>
 
 
+// Mapping flags
+#define MAPPING_FLAG_READONLY  0x00000001  // Mapped without write permissions
+#define MAPPING_FLAG_COW       0x00000002  // Shared copy-on-write. Mapped read-only until written to.
+#define MAPPING_FLAG_SHARED    0x00000004  // Shared memory. Remains shared after fork().
+#define MAPPING_FLAG_PAGES     0x00000008  // Backed by user pages. The mapping holds a reference to each of its pages.
+
+
 struct address_mapping {
     struct address_mapping *next, *prev;
     uint64_t vaddress;
     uint64_t paddress;
     uint64_t size;
+    uint32_t flags;
     bool_t   active;
 };
 
 
+// The mappings of an address space never overlap, even if they are inactive.
+// They are kept in a list and in an array, both sorted by virtual address. The array is binary searched.
 struct address_space {
     struct address_mapping *mappings;
+    struct address_mapping **index;
+    uint32_t index_count;
+    uint32_t index_capacity;
     uint64_t *page_table;
 };
 
@@ -26,7 +39,12 @@ struct address_mapping* create_memory_region(struct address_space *aspace, uint6
 struct address_mapping* create_memory_region_virt(struct address_space *aspace, uint64_t vaddr, uint64_t kaddr, uint64_t size);
 int unmap_memory_region(struct address_space *aspace, struct address_mapping *mapping);
 int unmap_and_remove_memory_region(struct address_space *aspace, struct address_mapping *mapping);
+int protect_memory_region(struct address_space *aspace, struct address_mapping *mapping, uint32_t flags);
+struct address_mapping* remap_memory_page(struct address_space *aspace, struct address_mapping *mapping, uint64_t vaddr, uint64_t paddr, uint32_t flags);
+struct address_mapping* address_space_find_mapping(struct address_space *s, uint64_t vaddr);
+uint64_t address_space_find_free(struct address_space *s, uint64_t base, uint64_t limit, uint64_t size);
 struct address_space* allocate_address_space();
+void free_address_space(struct address_space *s);
 struct address_space* init_kernel_address_space_struct();
 void* address_space_virtual_to_physical(struct address_space *s, void* address);
 void print_address_space(struct address_space* s);
\ No newline at end of file
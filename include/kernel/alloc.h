@@ -6,6 +6,7 @@
 /* Allocation flags */
 #define ALLOC_ZERO_INIT  0x00000001  // Initialize memory region to zero.
 #define ALLOC_PAGE_ALIGN 0x00000002  // Allocations must be page aligned
+#define ALLOC_HUGE_PAGE  0x00000004  // vmalloc: back large allocations with 2 MiB blocks where possible
 
 void* kmalloc(unsigned long size, uint32_t flags);
 void* kmalloc_largest_available(uint64_t size, uint32_t flags, uint64_t *allocated_size);
@@ -13,5 +14,6 @@ void free(void* memory);
 int try_free(void* memory);
 
 void* vmalloc(unsigned long size, uint32_t flags);
+void vfree(void* address);
 
 #endif
\ No newline at end of file
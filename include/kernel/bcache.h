@@ -0,0 +1,38 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/block.h>
+
+/*
+* Buffer cache for block devices.
+* Cached blocks are found through a hash table keyed by (device, block). Unreferenced buffers are kept on an
+* LRU list and recycled from its cold end, dirty buffers are written back before they are reused.
+* A buffer stays valid while the caller holds its reference.
+*/
+
+#define BUFFER_VALID 0x1
+#define BUFFER_DIRTY 0x2
+// Being read from the device. Other users of the block wait until the read has finished.
+#define BUFFER_BUSY  0x4
+
+struct buffer_head {
+    struct block_dev *dev;
+    unsigned int blk;
+    uint8_t *data;
+    uint32_t refcount;
+    uint32_t flags;
+    struct buffer_head *hash_next;
+    // Position in the LRU list while the refcount is zero
+    struct buffer_head *lru_prev;
+    struct buffer_head *lru_next;
+};
+
+
+int init_bcache();
+struct buffer_head *bcache_read(struct block_dev *dev, unsigned int blk);
+void bcache_release(struct buffer_head *b);
+void bcache_get(struct buffer_head *b);
+void bcache_mark_dirty(struct buffer_head *b);
+int bcache_write(struct buffer_head *b);
+int bcache_sync(struct block_dev *dev);
+void print_bcache_stats();
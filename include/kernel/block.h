@@ -2,29 +2,75 @@
 
 #include <kernel/mem.h>
 #include <kernel/alloc.h>
+#include <kernel/waitqueue.h>
 
 /*
 * Block devices model hardware that supports block-based reads.
 * This includes devices such as SD cards and hard drives.
 *
-* Block devices can define the following interface:
-*   int read_blk(unsigned int blk, void *buff);             // Returns the number of bytes read (1 block)
-*   int read_nblk(unsigned int blk, void *buff, n);         // Returns the number of bytes read (1 block). Limit to buffer size.
-*   int read_blks(unsigned int blk, void *buff, int n);     // Returns the number of bytes read
-*   int write_blk(unsigned int blk, void *buff);            // Returns the number of bytes written (1 block)
-*   int write_blks(unsigned int blk, void *buff, int n);    // Returns the number of bytes written
+* I/O is submitted as requests (struct bio): a start block, a list of buffers and a completion callback.
+* Requests wait in a per device queue sorted by block. The process that finds the device idle dispatches
+* the queue, merging adjacent requests of the same direction into a single transfer, while further
+* submitters only queue and return. Completion callbacks run in the dispatching process.
+*
+* The seek based interface below is a synchronous wrapper around requests:
+*   int read_blk(unsigned int blk, void *buff);             // Returns the number of blocks read (1)
+*   int read_nblk(unsigned int blk, void *buff, n);         // Returns the number of blocks read (1). Limit to buffer size.
+*   int read_blks(unsigned int blk, void *buff, int n);     // Returns the number of blocks read (n)
+*   int write_blk(unsigned int blk, void *buff);            // Returns the number of blocks written (1)
+*   int write_blks(unsigned int blk, void *buff, int n);    // Returns the number of blocks written (n)
 */
 
+// Largest number of buffers merged into one transfer
+#define BIO_MAX_MERGED_VECS 32
+
+struct block_dev;
+
+struct bio_vec {
+    void *buf;
+    unsigned int blocks;
+};
+
+struct bio {
+    struct block_dev *dev;
+    unsigned int blk;
+    bool_t write;
+    struct bio_vec *vecs;
+    uint32_t vec_count;
+    // Called once the request has completed. May be null.
+    void (*done)(struct bio *b);
+    void *data;
+    // Set on completion. 0 on success, -1 on error.
+    int status;
+    volatile bool_t completed;
+
+    // Queue state
+    unsigned int count;
+    struct bio *next;
+};
+
+struct bio_queue {
+    // Pending requests, sorted by block
+    struct bio *head;
+    // Set while a process dispatches the queue
+    bool_t busy;
+    // Block following the last dispatched transfer. The next transfer starts at or after it, if possible.
+    unsigned int position;
+    // Processes waiting for their requests
+    struct wait_queue waiters;
+    uint64_t submitted;
+    uint64_t merged;
+    uint64_t transfers;
+};
+
 struct block_dev {
-    unsigned int iblk;  // Block index
+    unsigned int iblk;  // Block index of the seek based interface
     int block_size;  // Size of blocks in bytes
-    // Block dev interface
-    int (*read_blk)(struct block_dev *dev, void *buf);
-    int (*read_nblk)(struct block_dev *dev, void *buf, unsigned int n);
-    int (*read_blks)(struct block_dev *dev, int n, void *buf);
-    int (*write_blk)(struct block_dev *dev, void *buf);
-    int (*write_blks)(struct block_dev *dev, int n, void *buf);
-    int (*seek_blk)(struct block_dev *dev, unsigned int iblk);
+    // Largest number of blocks of a single transfer, 0 if unlimited
+    unsigned int max_transfer_blocks;
+    // Driver interface. Transfers the blocks starting at blk from or into a list of buffers. Returns 0 on success.
+    int (*transfer)(struct block_dev *dev, unsigned int blk, struct bio_vec *vecs, uint32_t vec_count, bool_t write);
+    struct bio_queue queue;
 
     // Utility data:
     char driver_str[16];
@@ -32,9 +78,15 @@ struct block_dev {
 
 struct block_dev *alloc_block_dev();
 
+void bio_submit(struct bio *b);
+int bio_wait(struct bio *b);
+int bio_submit_wait(struct bio *b);
+int block_transfer(struct block_dev *dev, unsigned int blk, int n, void *buf, bool_t write);
+void print_block_queue_stats(struct block_dev *dev);
+
 int read_blk(struct block_dev *dev, void *buf);
 int read_nblk(struct block_dev *dev, void *buf, unsigned int n);
 int read_blks(struct block_dev *dev, int n, void *buf);
 int write_blk(struct block_dev *dev, void *buf);
 int write_blks(struct block_dev *dev, int n, void *buf);
-int seek_blk(struct block_dev *dev, unsigned int iblk);
\ No newline at end of file
+int seek_blk(struct block_dev *dev, unsigned int iblk);
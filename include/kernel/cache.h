@@ -0,0 +1,12 @@
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+* Data cache maintenance for buffers shared with DMA masters.
+* Clean before a device reads memory, invalidate after a device has written it.
+*/
+
+void dcache_clean_range(void *start, uint64_t size);
+void dcache_clean_invalidate_range(void *start, uint64_t size);
+void dcache_invalidate_range(void *start, uint64_t size);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <kernel/types.h>
+#include <kernel/poll.h>
 
 extern struct char_dev global_uart;
 
@@ -8,6 +9,11 @@ struct char_dev {
     // Char dev interface
     int64_t (*read)(struct char_dev *dev, char *buf, int64_t count);
     int64_t (*write)(struct char_dev *dev, char *buf, int64_t count);
+    // Returns the POLL* readiness mask. May be null for devices that never block.
+    uint32_t (*poll)(struct char_dev *dev);
+
+    // Notified by the driver when the readiness changes
+    struct poll_head pollers;
 
     // Utility data:
     char driver_str[16];
@@ -17,5 +23,6 @@ struct char_dev {
 struct char_dev *alloc_char_dev();
 int64_t read_char(struct char_dev *dev, char* buf, int64_t count);
 int64_t write_char(struct char_dev *dev, void *buf, int64_t count);
+uint32_t char_dev_poll(struct char_dev *dev, struct poll_head **head);
 // Wrapper function
 int64_t write_string_char(struct char_dev *dev, char *buf);
\ No newline at end of file
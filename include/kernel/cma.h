@@ -0,0 +1,22 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/device_tree.h>
+
+/*
+* Contiguous memory region for allocations larger than the biggest buddy block.
+* The region is made of top level buddy blocks taken out of the heap at boot. Its size comes from the
+* "linux,cma" node of the device tree. Allocations are placed best fit at page granularity.
+* Blocks without allocations are lent back to the buddy allocator when the heap runs out of memory,
+* and are reclaimed by later allocations once the heap has released them again.
+*/
+
+#define CMA_DEFAULT_SIZE 0x1000000ul
+// The lent blocks are tracked in a 64 bit mask
+#define CMA_MAX_BLOCKS 64
+
+int init_cma(struct device_tree *dt);
+void* cma_alloc(uint64_t size, uint32_t flags);
+int cma_free(void* memory);
+int cma_lend_block();
+void print_cma_usage();
@@ -76,5 +76,31 @@ struct device_tree* load_device_tree(void *dtb_address);
  */
 uint32_t* load_device_tree_node(uint32_t *node_tokens, uint32_t *node_tokens_end, struct dt_node* node, char* prop_strings);
 
+/**
+ * @brief Finds a child node by name. The unit address of the child ("name@address") is ignored.
+ * 
+ * @param node Parent node
+ * @param name Node name without unit address
+ * @return The child node, or null
+ */
+struct dt_node* dt_find_child(struct dt_node* node, char* name);
+
+/**
+ * @brief Finds a property of a node.
+ * 
+ * @param node Device tree node
+ * @param key Property name
+ * @return The property, or null
+ */
+struct dt_property* dt_find_property(struct dt_node* node, char* key);
+
+/**
+ * @brief Reads a property consisting of one or two big endian cells.
+ * 
+ * @param prop Property
+ * @return The value, or 0 if the property has a different length
+ */
+uint64_t dt_property_read_cells(struct dt_property* prop);
+
 void print_device_tree(struct device_tree* dt);
 void print_device_tree_node(struct dt_node* node, uint32_t depth);
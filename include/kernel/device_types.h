@@ -2,4 +2,7 @@
 
 #define DEVICE_TYPE_NONE  0
 #define DEVICE_TYPE_BLOCK 1
-#define DEVICE_TYPE_CHAR  2
\ No newline at end of file
+#define DEVICE_TYPE_CHAR  2
+#define DEVICE_TYPE_PIPE  3
+#define DEVICE_TYPE_EPOLL 4
+#define DEVICE_TYPE_TIMER 5
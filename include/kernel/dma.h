@@ -0,0 +1,70 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/timer.h>
+#include <kernel/waitqueue.h>
+
+/*
+* BCM2835 DMA engine.
+* A transfer is a chain of control blocks, which the channel processes in order. Memory buffers are split
+* into physically contiguous pieces, so they may be virtually contiguous only (vmalloc).
+* Completion is signalled by the channel interrupt. The caller sleeps until then, or waits for
+* interrupts if no process is running yet.
+*/
+
+#define DMA_PHYSICAL 0x3F007000
+#define DMA_MAPPING_SIZE 0x1000
+// Channels not used by the firmware. Only the full channels 0 to 6 are used.
+#define DMA_CHANNEL_MASK 0x35
+#define DMA_CHANNEL_COUNT 7
+#define DMA_TIMEOUT_US 1000000
+
+// Transfer information
+#define DMA_TI_INTEN       (1 << 0)
+#define DMA_TI_WAIT_RESP   (1 << 3)
+#define DMA_TI_DEST_INC    (1 << 4)
+#define DMA_TI_DEST_DREQ   (1 << 6)
+#define DMA_TI_SRC_INC     (1 << 8)
+#define DMA_TI_SRC_DREQ    (1 << 10)
+#define DMA_TI_PERMAP(dreq) ((dreq) << 16)
+
+// Peripheral data requests
+#define DMA_DREQ_EMMC 11
+
+// Alias of RAM as seen by DMA masters, bypassing the VideoCore L2 cache
+#define DMA_BUS_RAM_ALIAS 0xC0000000
+#define DMA_BUS_PERIPHERAL(phys) ((phys) - 0x3F000000 + 0x7E000000)
+
+
+struct dma_control_block {
+    uint32_t ti;
+    uint32_t source_ad;
+    uint32_t dest_ad;
+    uint32_t txfr_len;
+    uint32_t stride;
+    uint32_t nextconbk;
+    uint32_t reserved[2];
+};
+
+
+struct dma_channel {
+    int index;
+    uint64_t regs;
+    // Chain of the next transfer. Allocated from the buddy heap, so it is aligned to 32 bytes.
+    struct dma_control_block *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    // Set by the interrupt handler
+    volatile bool_t done;
+    volatile uint32_t status;
+    struct wait_queue waiters;
+    struct timer timeout;
+};
+
+
+int init_dma();
+struct dma_channel *dma_channel_alloc();
+void dma_chain_reset(struct dma_channel *ch);
+int dma_chain_to_memory(struct dma_channel *ch, uint32_t ti, uint32_t source_ad, void *dest, uint64_t size);
+int dma_chain_from_memory(struct dma_channel *ch, uint32_t ti, void *source, uint32_t dest_ad, uint64_t size);
+int dma_run(struct dma_channel *ch);
@@ -13,6 +13,10 @@
 #define ELF_INSTR_ARM64 0xB7
 // Object types
 #define ELF_OBJ_EXECUTABLE 0x02
+// Program header flags
+#define ELF_SEGMENT_FLAG_WRITE 0x2
+
+#define ELF_HEADER_SIZE 0x40
 
 
 struct elf_header {
@@ -48,10 +52,29 @@ struct elf_program_header {
 };
 
 
+// Page aligned memory layout of a program header, prepared once per ELF file.
+struct elf_segment {
+    // Page aligned virtual address and size of the mapping
+    uint64_t vaddr;
+    uint64_t size;
+    // Data to copy to the start of the mapping
+    uint64_t file_offset;
+    uint64_t file_size;
+    // Read-only segments map the page cache pages holding their data, instead of copying it
+    bool_t writable;
+};
+
+
 struct elf_data {
     struct inode *node;
     struct elf_header header;
     struct elf_program_header *pheader;
+    struct elf_segment *segments;
+    // Used to detect changes to the file contents of cached ELF files
+    unsigned int node_data_size;
+    uint32_t node_generation;
+    // Next entry in the ELF cache
+    struct elf_data *next;
 };
 
 
@@ -60,4 +83,8 @@ int is_elf(void* data);
 int load_elf_header(struct elf_data *elf);
 int load_elf_program_header(struct elf_data *elf);
 int load_elf(struct inode* elf_file, struct elf_data *elf);
-int elf_create_process(struct elf_data *elf, struct process *p);
\ No newline at end of file
+int elf_prepare_segments(struct elf_data *elf);
+struct elf_data *elf_cache_lookup(struct inode* elf_file);
+void free_elf_data(struct elf_data *elf);
+int elf_create_process(struct elf_data *elf, struct process *p);
+struct process *elf_spawn_process(struct inode* elf_file, int32_t argc, char **argv);
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <kernel/types.h>
+
 #define PERIPHERAL_INTERRUPT_CLOCK1  1
 #define PERIPHERAL_INTERRUPT_CLOCK3  3
 #define PERIPHERAL_INTERRUPT_USB     9
+// Channel n of the DMA engine raises interrupt 16 + n
+#define PERIPHERAL_INTERRUPT_DMA0    16
 #define PERIPHERAL_INTERRUPT_AUX_INT 29
 #define PERIPHERAL_INTERRUPT_I2C_SPI_SLV 43
 #define PERIPHERAL_INTERRUPT_PWA0    45
@@ -16,10 +20,31 @@
 #define PERIPHERAL_INTERRUPT_SPI     54
 #define PERIPHERAL_INTERRUPT_PCM     55
 #define PERIPHERAL_INTERRUPT_UART    57
+#define PERIPHERAL_INTERRUPT_EMMC    62
+
+#define PSTATE_DEBUG_INT_MASK (0b1000ul << 6)
+#define PSTATE_SERROR_INT_MASK (0b0100ul << 6)
+#define PSTATE_IRQ_INT_MASK (0b0010ul << 6)
+#define PSTATE_FIQ_INT_MASK (0b0001ul << 6)
+// EL0t. IRQs are taken in user space, so that devices can wake up blocked threads.
+#define PSTATE_USER_DEFAULT (PSTATE_FIQ_INT_MASK)
+
+// Layout of the register frame pushed onto the kernel stack by kernel_entry (vectors.S).
+// Entries 0 to 29 contain x0 to x29. Index the frame as an uint64_t array.
+#define EXCEPTION_FRAME_X30     30
+#define EXCEPTION_FRAME_SP_EL0  31
+#define EXCEPTION_FRAME_ELR     32
+#define EXCEPTION_FRAME_SPSR    33
+#define EXCEPTION_FRAME_SIZE    (34 * 8)
 
 
 // From vectors.s
 void init_exceptions();
+uint64_t irq_save();
+void irq_restore(uint64_t flags);
+void wait_for_interrupt();
 
 void enable_peripheral_interrupt(int interrupt_number);
-void disable_peripheral_interrupt(int interrupt_number);
\ No newline at end of file
+void disable_peripheral_interrupt(int interrupt_number);
+int register_interrupt_handler(int interrupt_number, void (*handler)(void *data), void *data);
+void unregister_interrupt_handler(int interrupt_number);
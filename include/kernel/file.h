@@ -0,0 +1,38 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/inode.h>
+
+/*
+* Open files with streaming reads.
+* File data is read through the page cache. A sequential reader works through readahead windows of pages:
+* entering a window queues the following one, and the window size doubles with each readahead, up to
+* READAHEAD_MAX_BYTES. A read outside of the windows, or a seek, starts over with READAHEAD_MIN_BYTES.
+* Readahead batches the pages of a window into few large requests, it does not overlap I/O with the reader:
+* a request is dispatched by the process submitting it whenever the device is idle, which is the usual case
+* with a single reader, so the window is read before the reader continues. Only requests submitted while
+* another process is dispatching the device are queued and complete without the submitter waiting.
+*/
+
+#define READAHEAD_MIN_BYTES (16 * 1024)
+#define READAHEAD_MAX_BYTES (256 * 1024)
+
+struct file {
+    struct inode *node;
+    uint64_t pos;
+    // End of the previous read, which a sequential read starts at
+    uint64_t last_end;
+    uint32_t readahead_size;
+    // Current window [window_start, window_end) and the window queued after it, which ends at next_end.
+    // Page indices. next_end equals window_end while no further window is queued.
+    uint64_t window_start;
+    uint64_t window_end;
+    uint64_t next_end;
+};
+
+
+struct file *file_open(struct inode *node);
+void file_close(struct file *f);
+int64_t file_read(struct file *f, void *dest, uint64_t n);
+void file_seek(struct file *f, uint64_t pos);
+void print_readahead_stats();
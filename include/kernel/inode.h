@@ -16,7 +16,16 @@ struct inode;
 
 struct inode_ops {
     int (*fetch_data)(struct inode *n);
+    // Writes back modified data and metadata of the inode
     int (*push_data)(struct inode *n);
+    // Maps a file offset to a device block, and returns the number of blocks stored contiguously from there (at most max_blocks)
+    int (*map_blocks)(struct inode *n, uint64_t offset, unsigned int max_blocks, unsigned int *blk, unsigned int *blocks);
+    // Sets the file size and allocates or releases the storage behind it. New storage holds undefined data.
+    int (*resize)(struct inode *n, uint64_t size);
+    // Creates an empty file in a directory
+    struct inode *(*create)(struct inode *dir, char *name);
+    // Removes the file from its directory and releases its storage
+    int (*unlink)(struct inode *n);
 };
 
 
@@ -25,11 +34,12 @@ struct inode {
     struct inode_ops ops;
     // File system specific data, such as the cluster number for FAT32
     void *fs_data;
-    // Contains file data.
-    void *data;
     // Points to the byte in the file we are reading next
     uint64_t seek_address;
+    // File size. File data is read through the page cache.
     unsigned int data_size;
+    // Incremented whenever the file contents change
+    uint32_t generation;
     // Struct is only not-null for directories.
     struct inode *child_nodes;
     struct inode *parent_node;
@@ -43,8 +53,13 @@ struct inode {
 
 struct inode *alloc_inode();
 int inode_fetch_data(struct inode *n);
-int inode_write_data(struct inode *n);
+int inode_push_data(struct inode *n);
 int inode_read(struct inode *node, void* dest, uint32_t n);
+uint64_t inode_read_at(struct inode *node, uint64_t offset, void *dest, uint64_t n);
+int64_t inode_write_at(struct inode *node, uint64_t offset, void *src, uint64_t n);
+int inode_truncate(struct inode *node, uint64_t size);
+struct inode *inode_create(struct inode *dir, char *name);
+int inode_unlink(struct inode *node);
 int inode_is_file(struct inode *node);
 void inode_insert_child(struct inode *parent, struct inode *child);
 struct inode *inode_from_path(struct inode *root, char *path);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <kernel/types.h>
+
+struct process;
+
+// Messages are passed in registers x2 to x7
+#define IPC_MSG_FIRST_REG 2
+#define IPC_MSG_WORDS     6
+
+#define IPC_STATE_NONE       0
+#define IPC_STATE_RECEIVING  1 // Blocked in reply_wait until a call arrives
+#define IPC_STATE_SENDING    2 // Blocked in call, queued on the senders queue of the partner
+#define IPC_STATE_WAIT_REPLY 3 // Blocked in call, the message has been received by the partner
+
+int syscall_ipc_call(uint16_t dest_pid);
+int syscall_ipc_reply_wait(uint16_t reply_to);
+void ipc_abort(struct process *p);
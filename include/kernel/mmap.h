@@ -2,4 +2,5 @@
 
 #include <kernel/types.h>
 
-void* mmap(uint64_t pa, uint64_t size);
\ No newline at end of file
+void* mmap(uint64_t pa, uint64_t size);
+int munmap(void *vaddr);
@@ -5,6 +5,8 @@
 
 #define VA_OFFSET 0x0000800000000000
 #define PAGE_SIZE 4096
+// Level 2 block size. Naturally aligned regions of this size are mapped with a single descriptor.
+#define HUGE_PAGE_SIZE 0x200000ul
 #define PAGE_TABLE_ENTRIES 512
 #define PAGE_TABLE_LEVELS 3
 
@@ -12,6 +14,44 @@
 #define PT_KERN_TO_PHYS(addr) ((uint64_t*)((char*)addr - VA_OFFSET))
 
 #define PHYS_TO_KERN(addr) ((void*)((char*)addr + VA_OFFSET))
-#define KERN_TO_PHYS(addr) ((void*)((char*)addr + VA_OFFSET))
+#define KERN_TO_PHYS(addr) ((void*)((char*)addr - VA_OFFSET))
 
-uint64_t round_up_to_page(uint64_t a);
\ No newline at end of file
+#define PHYS_MEMORY_SIZE 0x40000000ul
+#define PHYS_PAGE_COUNT (PHYS_MEMORY_SIZE / PAGE_SIZE)
+
+
+// User memory is allocated in naturally aligned chunks of 2^order pages
+#define USER_CHUNK_ORDER_PAGE 0
+#define USER_CHUNK_ORDER_RUN  4  // 64 KiB, mapped with the contiguous hint
+#define USER_CHUNK_ORDER_HUGE 9  // 2 MiB, mapped as a level 2 block
+
+
+// Per physical page bookkeeping
+struct page_descriptor {
+    union {
+        // Page tables
+        struct {
+            // Number of valid entries
+            uint16_t table_entries;
+            // Index of the entry referencing this table in its parent table
+            uint16_t table_parent_index;
+        };
+        // User memory
+        struct {
+            // Pages of the chunk that are still referenced. Only valid in the first page of a chunk.
+            uint16_t chunk_live_pages;
+            uint8_t chunk_order;
+        };
+    };
+    // Number of user mappings referencing the page
+    uint16_t map_count;
+};
+
+
+uint64_t round_up_to_page(uint64_t a);
+int init_page_descriptors();
+struct page_descriptor *page_descriptor(uint64_t paddr);
+uint64_t user_chunk_alloc(uint8_t order);
+void user_page_get(uint64_t paddr);
+void user_page_put(uint64_t paddr);
+uint16_t user_page_refcount(uint64_t paddr);
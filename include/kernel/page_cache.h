@@ -0,0 +1,53 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/inode.h>
+
+/*
+* Page cache for file data.
+* File contents are cached in pages found through a hash table keyed by (inode, file offset / PAGE_SIZE), so a
+* read only fetches the pages it touches. Cached pages are user pages (see page.h): the cache holds one reference,
+* and processes may map the same page, for example the read-only segments of an executable.
+* Pages that are neither referenced by a kernel user nor mapped by a process are kept on an LRU list. They are
+* evicted from its cold end once the cache is full, or when kmalloc runs out of memory.
+* File data past the end of the file reads as zero. Writers modify pages returned by page_cache_grab() and mark
+* them dirty. Dirty pages are not evicted, page_cache_sync() writes them back in requests of consecutive blocks.
+*/
+
+#define PAGE_CACHE_VALID 0x1
+// Being read from the device. Other users of the page wait until the read has finished.
+#define PAGE_CACHE_BUSY  0x2
+// Modified and not yet written back
+#define PAGE_CACHE_DIRTY 0x4
+// Dropped from the cache by truncation while still referenced. Freed with the last reference.
+#define PAGE_CACHE_REMOVED 0x8
+
+struct cached_page {
+    struct inode *node;
+    // File offset / PAGE_SIZE
+    uint64_t index;
+    uint64_t paddr;
+    // Kernel address of the page
+    uint8_t *data;
+    uint32_t refcount;
+    uint32_t flags;
+    struct cached_page *hash_next;
+    // Position in the LRU list while the refcount is zero
+    struct cached_page *lru_prev;
+    struct cached_page *lru_next;
+    // Position in the dirty list
+    struct cached_page *dirty_next;
+};
+
+
+int init_page_cache();
+struct cached_page *page_cache_read(struct inode *node, uint64_t index);
+void page_cache_release(struct cached_page *page);
+struct cached_page *page_cache_grab(struct inode *node, uint64_t index, bool_t read);
+void page_cache_mark_dirty(struct cached_page *page);
+uint32_t page_cache_dirty_pages();
+int page_cache_sync(struct inode *node);
+void page_cache_truncate(struct inode *node, uint64_t size);
+uint32_t page_cache_prefetch(struct inode *node, uint64_t index, uint32_t count);
+uint64_t page_cache_reclaim(uint64_t pages);
+void print_page_cache_stats();
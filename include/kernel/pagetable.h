@@ -2,11 +2,16 @@
 
 #include <kernel/types.h>
 
+// Descriptor attributes accepted by page_table_map_address()
+#define PT_ATTR_READONLY (1ul << 7)  // AP[2]: Read-only at EL0 and EL1
+#define PT_ATTR_CONTIGUOUS (1ul << 52)  // Part of an aligned run of 16 entries, which the TLB may cache as one entry
+
 extern uint64_t *kernel_page_table;
 
 void page_table_init();
-int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint64_t size);
+int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint64_t size, uint64_t attr);
 int page_table_unmap_address(uint64_t* root_table, uint64_t va, uint64_t size);
+void page_table_count_entries(uint64_t *root_table);
 int page_table_alignment(uint64_t address);
 uint64_t page_table_block_size(int level);
 uint64_t page_table_virtual_to_physical(uint64_t* table, uint64_t a);
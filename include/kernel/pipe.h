@@ -0,0 +1,51 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/waitqueue.h>
+#include <kernel/poll.h>
+
+/*
+* Pipes are unidirectional byte streams between processes.
+* Data is passed through a single producer, single consumer ring buffer. Writes block while the ring is full,
+* reads block while it is empty.
+* If a reader is blocked with a page aligned buffer, whole pages of a page aligned write are instead
+* mapped copy-on-write into the readers address space, without copying the data.
+*/
+
+#define PIPE_BUFFER_SIZE (64 * 1024) // Must be a power of two
+
+struct pipe;
+
+struct pipe_end {
+    struct pipe *pipe;
+    // Number of stream descriptors referring to this end
+    uint32_t refcount;
+    bool_t write;
+};
+
+
+struct pipe {
+    char *buffer;
+    // Free running indices. head is only written by the writer, tail only by the reader.
+    uint32_t head;
+    uint32_t tail;
+    struct pipe_end read_end;
+    struct pipe_end write_end;
+    struct wait_queue read_queue;
+    struct wait_queue write_queue;
+    // Pollers of both ends
+    struct poll_head pollers;
+    // Pending splice destination of a blocked reader
+    struct process *splice_thread;
+    uint64_t splice_addr;
+    uint64_t splice_len;
+    uint64_t splice_done;
+};
+
+
+struct pipe *alloc_pipe();
+void pipe_end_get(struct pipe_end *end);
+void pipe_end_put(struct pipe_end *end);
+int64_t pipe_read(struct pipe_end *end, char *buf, int64_t count);
+int64_t pipe_write(struct pipe_end *end, char *buf, int64_t count);
+uint32_t pipe_poll(struct pipe_end *end, struct poll_head **head);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/waitqueue.h>
+#include <kernel/syscall.h>
+
+/*
+* Readiness notifications for stream devices.
+* Devices embed a poll_head and call poll_notify() whenever their readiness changes.
+* A poller attaches one poll_entry per watched stream to the device heads. Entries belong to a poll_set,
+* which queues the entries that became ready and wakes the threads sleeping on the set.
+* poll() builds a temporary set, while an epoll instance keeps its set between calls, so waiting on it
+* only costs work proportional to the number of ready streams.
+*/
+
+struct poll_set;
+
+struct poll_head {
+    struct poll_entry *entries;
+};
+
+
+struct poll_entry {
+    // Null once the device is gone
+    struct poll_head *head;
+    struct poll_entry *head_next;
+    struct poll_set *set;
+    struct poll_entry *set_next;
+    struct poll_entry *ready_next;
+    void *dev;
+    uint8_t dev_type;
+    bool_t ready;
+    int32_t fd;
+    uint32_t events;
+    // Returned with the events by epoll_wait
+    uint64_t data;
+};
+
+
+struct poll_set {
+    struct poll_entry *entries;
+    // Entries which might be ready. Checked and refilled when waiting on the set.
+    struct poll_entry *ready_head;
+    struct poll_entry *ready_tail;
+    struct wait_queue waiters;
+    // Number of stream descriptors referring to an epoll set
+    uint32_t refcount;
+};
+
+
+void poll_notify(struct poll_head *head, uint32_t events);
+void poll_head_release(struct poll_head *head);
+uint32_t stream_poll(void *dev, uint8_t dev_type, struct poll_head **head);
+struct poll_entry *poll_set_add(struct poll_set *set, int32_t fd, void *dev, uint8_t dev_type, uint32_t events, uint64_t data);
+struct poll_entry *poll_set_find(struct poll_set *set, int32_t fd);
+void poll_set_remove(struct poll_set *set, struct poll_entry *e);
+void poll_set_clear(struct poll_set *set);
+int poll_set_sleep(struct poll_set *set, uint64_t deadline);
+struct poll_set *alloc_epoll_set();
+void epoll_set_get(struct poll_set *set);
+void epoll_set_put(struct poll_set *set);
+int epoll_set_harvest(struct poll_set *set, struct epoll_event *events, int max_events);
+void poll_abort(struct process *p);
@@ -4,11 +4,15 @@
 #include <kernel/page.h>
 #include <kernel/thread.h>
 #include <kernel/address_space.h>
+#include <kernel/waitqueue.h>
+#include <kernel/timer.h>
 
 
 // Kernel address: 0x0000800000000000
 #define USERSPACE_STACK_ADDRESS             0x0000010000000000
 #define USERSPACE_HEAP_ADDRESS              0x0000020000000000
+#define USERSPACE_SHM_ADDRESS               0x0000030000000000
+#define USERSPACE_SHM_END                   0x0000040000000000
 #define USERSPACE_PREALLOCATED_STACK_SIZE   PAGE_SIZE
 #define KERNEL_STACK_SIZE                   PAGE_SIZE*4
 
@@ -17,6 +21,7 @@
 #define PROCESS_STATE_WAITING    2
 #define PROCESS_STATE_TERMINATED 3
 #define PROCESS_STATE_FAULTED    4 // Do not clean up right away, so we can dump data from the struct
+#define PROCESS_STATE_BLOCKED    5 // Sleeping on a wait queue
 
 // TOOD: Hmmm, I don't think that user threads actually need to save their registers in this way.
 // The only way that user space context switches is via exception into kernel space, where we store the registers on the stack anyway.
@@ -29,6 +34,12 @@ struct process {
 
     struct process *next;
 
+    // Threads of a process share the resources of the leader. The leader points to itself.
+    // Memory, streams and the heap must be accessed through the leader.
+    struct process *leader;
+    // Number of threads in the group. Only valid for the leader.
+    uint32_t thread_count;
+
     struct address_space *addr_space;
     struct process_memory_handle *allocated_list;
     struct kthread *kern_thread;
@@ -43,13 +54,47 @@ struct process {
     struct stream_descriptor* streams;
     int32_t stream_count;
 
+    // Kernel stack of this thread. It is not shared with forked processes.
+    void *kernel_stack;
+    // User space thread pointer (TPIDR_EL0)
+    uint64_t tls;
+
+    // Wait queue the process is blocked on
+    struct wait_queue *wait_queue;
+    struct process *wait_next;
+    uint64_t wait_key;
+
+    // Synchronous IPC (see process/ipc.c)
+    uint8_t ipc_state;
+    int32_t ipc_status;
+    uint16_t ipc_sender;
+    struct process *ipc_partner;
+    struct wait_queue ipc_senders;
+
+    // Temporary poll set of a thread blocked in poll()
+    struct poll_set *poll_set;
+    // Wakes the thread when a blocking call times out
+    struct timer timeout;
+
     uint16_t pid;
     uint8_t state;
 };
 
 
-struct process_memory_handle {
+// A kernel allocation owned by a process, such as a kernel stack or a shared memory region.
+// User mappings are backed by reference counted pages instead (see process_map_pages()).
+struct process_memory {
     void* memory;
+    uint64_t size;
+    // Number of process_memory_handles referencing the allocation
+    uint32_t refcount;
+    // Called instead of freeing the memory when the last reference is dropped. May be null.
+    void (*release)(struct process_memory *mem);
+};
+
+
+struct process_memory_handle {
+    struct process_memory* mem;
     struct process_memory_handle* next;
 };
 
@@ -70,9 +115,24 @@ extern struct process *process_list_head;
 void print_process(struct process *p);
 void print_process_brief(struct process *p);
 void *new_process_memory_region(struct process *p, uint64_t size);
-struct address_mapping* new_mapped_process_memory(struct process *p, uint64_t target_addr, uint64_t size);
+int process_add_memory_handle(struct process *p, struct process_memory *mem);
+int process_remove_memory_handle(struct process *p, struct process_memory *mem);
+void process_memory_put(struct process_memory *mem);
+struct process_memory* process_find_memory(struct process *p, uint64_t paddr);
+int process_map_pages(struct process *p, uint64_t vaddr, uint64_t size, bool_t activate);
+int process_map_shared_pages(struct process *p, uint64_t vaddr, uint64_t paddr, uint64_t size, uint32_t flags);
+void process_release_pages(struct process *p);
+int process_resolve_cow_fault(struct process *p, uint64_t address);
+int process_prepare_user_write(struct process *p, uint64_t address, uint64_t size);
 struct process* allocate_process();
+struct process* allocate_thread(struct process *leader);
+struct process* process_from_pid(uint16_t pid);
 int32_t process_new_stream_descriptor(struct process* p, void* dev, uint8_t dev_type);
+void stream_descriptor_get(struct stream_descriptor *s);
+void stream_descriptor_put(struct stream_descriptor *s);
+int32_t process_close_stream(struct process* p, int32_t id);
+struct stream_descriptor* process_get_stream(struct process* p, int32_t id);
+int32_t process_copy_streams(struct process* dest, struct process* src);
 int32_t process_entry_point_args(struct process* p, int32_t argc, char** argv);
 void switch_to_user_thread();
 void switch_to_process(struct process *p, uint8_t new_state);
@@ -80,4 +140,5 @@ void free_process_memory(struct process *p);
 void restore_process_mappings(struct process *p);
 void remove_process_mappings(struct process *p);
 void free_process_streams(struct process *p);
-void destroy_process(struct process *p);
\ No newline at end of file
+void destroy_process(struct process *p);
+void terminate_thread_group(struct process *leader);
\ No newline at end of file
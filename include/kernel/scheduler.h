@@ -2,5 +2,5 @@
 
 #include <kernel/types.h>
 
-void switch_to_next_process(bool_t terminating);
+void switch_to_next_process(uint8_t new_state);
 void yield();
\ No newline at end of file
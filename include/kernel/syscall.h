@@ -8,7 +8,66 @@
 #define __NR_open    6
 #define __NR_close   7
 #define __NR_sbrk    8
+#define __NR_fork    9
+#define __NR_spawn   10
+#define __NR_clone   11
+#define __NR_thread_exit 12
+#define __NR_yield   13
+#define __NR_futex   14
+#define __NR_pipe    15
+#define __NR_shm_create 16
+#define __NR_shm_map    17
+#define __NR_shm_unmap  18
+#define __NR_ipc_call   19
+#define __NR_ipc_reply_wait 20
+#define __NR_poll         21
+#define __NR_epoll_create 22
+#define __NR_epoll_ctl    23
+#define __NR_epoll_wait   24
+#define __NR_timerfd_create 25
 #define __NR_notimpl 255
 
 
+// Futex operations
+#define FUTEX_WAIT    0
+#define FUTEX_WAKE    1
+#define FUTEX_REQUEUE 3
+
+
+// File actions applied to the stream descriptors of a spawned process
+#define SPAWN_FD_DUP   1 // Child fd refers to the same stream as parent_fd
+#define SPAWN_FD_CLOSE 2 // Child fd is closed
+
+struct spawn_fd_action {
+    int32_t action;
+    int32_t fd;
+    int32_t parent_fd;
+};
+
+
+// Stream readiness events
+#define POLLIN   0x001 // Data can be read without blocking
+#define POLLOUT  0x004 // Data can be written without blocking
+#define POLLERR  0x008 // Write end without readers. Always reported.
+#define POLLHUP  0x010 // Read end without writers. Always reported.
+#define POLLNVAL 0x020 // Invalid stream id
+
+struct pollfd {
+    int32_t fd;
+    int16_t events;
+    int16_t revents;
+};
+
+// Operations on epoll interest sets
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+struct epoll_event {
+    uint32_t events;
+    uint32_t reserved;
+    uint64_t data;
+};
+
+
 uint64_t handle_syscall(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6);
\ No newline at end of file
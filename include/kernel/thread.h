@@ -23,7 +23,10 @@ struct kthread {
 struct kthread *allocate_kthread();
 
 void switch_context(struct kthread *from, struct kthread *to);
+// From vectors.S
+void ret_from_fork();
 void load_user_context(struct kthread *to);
 void print_thread_context(struct kthread *t);
 void print_register_block(uint64_t* registers);
+void print_exception_frame(uint64_t* frame);
 void switch_to_thread(struct kthread *t);
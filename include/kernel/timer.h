@@ -3,7 +3,24 @@
 #include <kernel/types.h>
 
 
+// Software timer driven by the system timer interrupt.
+// The callback runs in interrupt context once the system timer reaches expires, it must not block.
+struct timer {
+    // System timer value in microseconds
+    uint64_t expires;
+    void (*callback)(struct timer *t);
+    void *data;
+    struct timer *next;
+    bool_t pending;
+};
+
+
 uint64_t read_system_timer();
+void enable_user_counter_access();
+void enable_user_cycle_counter();
 void enable_system_timer_interrupt();
 void disable_system_timer_interrupt();
-void set_system_timer_interrupt(uint32_t compare_val);
\ No newline at end of file
+void set_system_timer_interrupt(uint32_t compare_val);
+int init_timers();
+void timer_add(struct timer *t, uint64_t expires);
+void timer_cancel(struct timer *t);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/timer.h>
+#include <kernel/poll.h>
+#include <kernel/waitqueue.h>
+
+/*
+* Timer streams expire once after an initial delay, then optionally periodically.
+* Reading returns the number of expirations since the last read as an uint64_t, and blocks while there are none.
+* They become readable on expiry, so timers can be waited on together with other streams.
+*/
+
+struct timer_stream {
+    struct timer timer;
+    // Period in microseconds, or 0 for a one shot timer
+    uint64_t interval;
+    uint64_t expirations;
+    struct wait_queue read_queue;
+    struct poll_head pollers;
+    // Number of stream descriptors referring to the timer
+    uint32_t refcount;
+};
+
+
+struct timer_stream *alloc_timer_stream(uint64_t initial_us, uint64_t interval_us);
+void timer_stream_get(struct timer_stream *t);
+void timer_stream_put(struct timer_stream *t);
+int64_t timerfd_read(struct timer_stream *t, char *buf, int64_t count);
+uint32_t timerfd_poll(struct timer_stream *t, struct poll_head **head);
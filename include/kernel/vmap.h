@@ -0,0 +1,19 @@
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+* Allocator for kernel virtual address ranges, used by mmap() and vmalloc().
+* Free and reserved ranges are kept in arrays sorted by address. Adjacent free ranges are merged on release.
+* The free ranges are also kept sorted by size, reservations take the smallest fitting range found by binary search.
+* Every reservation is followed by an unmapped guard page, so that overruns fault instead of corrupting a neighbour.
+*/
+
+#define VMAP_BASE_ADDR 0x0000A00000000000ul
+#define VMAP_END_ADDR  0x0000C00000000000ul
+
+int init_vmap();
+uint64_t vmap_reserve(uint64_t size);
+uint64_t vmap_reserve_aligned(uint64_t size, uint64_t align);
+uint64_t vmap_reserved_size(uint64_t vaddr);
+int vmap_release(uint64_t vaddr);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <kernel/types.h>
+
+struct process;
+
+
+// FIFO of blocked processes. The queue is intrusive, a process can wait on a single queue at a time.
+struct wait_queue {
+    struct process *head;
+    struct process *tail;
+};
+
+
+void wait_queue_add(struct wait_queue *q, struct process *p, uint64_t key);
+void wait_queue_sleep(struct wait_queue *q, uint64_t key);
+void wait_queue_remove(struct wait_queue *q, struct process *p);
+struct process *wait_queue_find(struct wait_queue *q, uint64_t key);
+void wait_queue_wake(struct process *p);
+int wait_queue_wake_key(struct wait_queue *q, uint64_t key, int n);
+int wait_queue_wake_all(struct wait_queue *q);
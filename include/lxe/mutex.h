@@ -0,0 +1,38 @@
+#pragma once
+
+// Futex based mutex. Locking and unlocking only enter the kernel if the mutex is contended.
+
+#include <lxe/syscalls.h>
+
+#define LXE_MUTEX_UNLOCKED  0
+#define LXE_MUTEX_LOCKED    1
+#define LXE_MUTEX_CONTENDED 2 // Locked, and there may be waiters
+
+typedef struct {
+    volatile uint32_t state;
+} lxe_mutex_t;
+
+#define LXE_MUTEX_INITIALIZER {LXE_MUTEX_UNLOCKED}
+
+
+static inline void lxe_mutex_lock(lxe_mutex_t *m) {
+    uint32_t c = LXE_MUTEX_UNLOCKED;
+    if(__atomic_compare_exchange_n(&m->state, &c, LXE_MUTEX_LOCKED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Slow path. Mark the mutex as contended, so that the owner wakes us on unlock.
+    if(c != LXE_MUTEX_CONTENDED) {
+        c = __atomic_exchange_n(&m->state, LXE_MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+    while(c != LXE_MUTEX_UNLOCKED) {
+        lxe_futex(&m->state, FUTEX_WAIT, LXE_MUTEX_CONTENDED, 0, 0);
+        c = __atomic_exchange_n(&m->state, LXE_MUTEX_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+}
+
+
+static inline void lxe_mutex_unlock(lxe_mutex_t *m) {
+    if(__atomic_exchange_n(&m->state, LXE_MUTEX_UNLOCKED, __ATOMIC_RELEASE) == LXE_MUTEX_CONTENDED) {
+        lxe_futex(&m->state, FUTEX_WAKE, 1, 0, 0);
+    }
+}
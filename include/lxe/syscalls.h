@@ -0,0 +1,246 @@
+#pragma once
+
+// User space interface to LXE specific syscalls, which are not exposed by the C library.
+// Arguments are passed in x1 to x6, the syscall number in x0. The result is returned in x0.
+
+#include <stdint.h>
+#include <kernel/syscall.h>
+
+
+static inline uint64_t lxe_syscall(uint64_t nr, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    register uint64_t x0 asm("x0") = nr;
+    register uint64_t x1 asm("x1") = a1;
+    register uint64_t x2 asm("x2") = a2;
+    register uint64_t x3 asm("x3") = a3;
+    register uint64_t x4 asm("x4") = a4;
+    register uint64_t x5 asm("x5") = a5;
+    register uint64_t x6 asm("x6") = a6;
+    asm volatile("svc #0" : "+r"(x0) : "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5), "r"(x6) : "memory");
+    return x0;
+}
+
+
+/**
+ * @brief Creates a copy of the calling process.
+ * 
+ * @return PID of the child in the parent, 0 in the child, -1 on failure
+ */
+static inline int lxe_fork() {
+    return (int)lxe_syscall(__NR_fork, 0, 0, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Runs the ELF file at path as a new process. The new process runs before this call returns.
+ * 
+ * @param path Path of the ELF file
+ * @param argv Null terminated argument list. argv[0] should be the path.
+ * @param actions Changes to the stream descriptors inherited by the new process. May be null.
+ * @param n_actions Number of actions
+ * @return PID of the new process, or -1 on failure
+ */
+static inline int lxe_spawn(const char *path, char *const argv[], const struct spawn_fd_action *actions, int n_actions) {
+    return (int)lxe_syscall(__NR_spawn, (uint64_t)path, (uint64_t)argv, (uint64_t)actions, (uint64_t)n_actions, 0, 0);
+}
+
+
+/**
+ * @brief Starts a new thread in the calling process. The entry function must not return, it has to call lxe_thread_exit.
+ * 
+ * @param entry Entry function of the new thread
+ * @param stack Top of the stack of the new thread. Must be 16 byte aligned.
+ * @param arg Argument passed to the entry function
+ * @param tls Initial thread pointer (TPIDR_EL0)
+ * @return Thread id, or -1 on failure
+ */
+static inline int lxe_clone(void (*entry)(void*), void *stack, void *arg, void *tls) {
+    return (int)lxe_syscall(__NR_clone, (uint64_t)entry, (uint64_t)stack, (uint64_t)arg, (uint64_t)tls, 0, 0);
+}
+
+
+/**
+ * @brief Terminates the calling thread. The process exits once its last thread exits.
+ */
+static inline void lxe_thread_exit() {
+    lxe_syscall(__NR_thread_exit, 0, 0, 0, 0, 0, 0);
+    __builtin_unreachable();
+}
+
+
+/**
+ * @brief Runs other threads and processes before returning.
+ */
+static inline void lxe_yield() {
+    lxe_syscall(__NR_yield, 0, 0, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Blocks while *uaddr equals val, or wakes waiters on uaddr. See FUTEX_WAIT, FUTEX_WAKE and FUTEX_REQUEUE.
+ */
+static inline int lxe_futex(volatile uint32_t *uaddr, int op, uint32_t val, uint32_t val2, volatile uint32_t *uaddr2) {
+    return (int)lxe_syscall(__NR_futex, (uint64_t)uaddr, (uint64_t)op, val, val2, (uint64_t)uaddr2, 0);
+}
+
+
+/**
+ * @brief Creates a pipe. Data written to fds[1] can be read from fds[0].
+ * 
+ * @return 0 for success, -1 on failure
+ */
+static inline int lxe_pipe(int fds[2]) {
+    return (int)lxe_syscall(__NR_pipe, (uint64_t)fds, 0, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Creates a shared memory region. It stays available until the creator exits and all mappings are removed.
+ * 
+ * @param size Size of the region in bytes
+ * @return Region id, or -1 on failure
+ */
+static inline int lxe_shm_create(uint64_t size) {
+    return (int)lxe_syscall(__NR_shm_create, size, 0, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Maps a shared memory region into the calling process. Mappings are inherited by fork().
+ * 
+ * @param id Region id returned by lxe_shm_create
+ * @return Address of the mapping, or null on failure
+ */
+static inline void *lxe_shm_map(int id) {
+    return (void*)lxe_syscall(__NR_shm_map, (uint64_t)id, 0, 0, 0, 0, 0);
+}
+
+
+static inline int lxe_shm_unmap(void *addr) {
+    return (int)lxe_syscall(__NR_shm_unmap, (uint64_t)addr, 0, 0, 0, 0, 0);
+}
+
+
+// IPC message. Passed in registers x2 to x7.
+struct lxe_ipc_msg {
+    uint64_t w[6];
+};
+
+
+static inline int lxe_ipc_syscall(uint64_t nr, uint64_t a1, struct lxe_ipc_msg *msg) {
+    register uint64_t x0 asm("x0") = nr;
+    register uint64_t x1 asm("x1") = a1;
+    register uint64_t x2 asm("x2") = msg->w[0];
+    register uint64_t x3 asm("x3") = msg->w[1];
+    register uint64_t x4 asm("x4") = msg->w[2];
+    register uint64_t x5 asm("x5") = msg->w[3];
+    register uint64_t x6 asm("x6") = msg->w[4];
+    register uint64_t x7 asm("x7") = msg->w[5];
+    asm volatile("svc #0" : "+r"(x0), "+r"(x2), "+r"(x3), "+r"(x4), "+r"(x5), "+r"(x6), "+r"(x7) : "r"(x1) : "memory");
+    msg->w[0] = x2;
+    msg->w[1] = x3;
+    msg->w[2] = x4;
+    msg->w[3] = x5;
+    msg->w[4] = x6;
+    msg->w[5] = x7;
+    return (int)x0;
+}
+
+
+/**
+ * @brief Sends msg to the server thread and waits for the reply, which replaces msg.
+ * 
+ * @return 0 for success, -1 on failure
+ */
+static inline int lxe_ipc_call(int server, struct lxe_ipc_msg *msg) {
+    return lxe_ipc_syscall(__NR_ipc_call, (uint64_t)server, msg);
+}
+
+
+/**
+ * @brief Replies to client with msg (unless client is 0), then waits for the next call, which replaces msg.
+ * 
+ * @return PID of the calling client, or -1 on failure
+ */
+static inline int lxe_ipc_reply_wait(int client, struct lxe_ipc_msg *msg) {
+    return lxe_ipc_syscall(__NR_ipc_reply_wait, (uint64_t)client, msg);
+}
+
+
+/**
+ * @brief Waits until one of the streams is ready. revents of each entry is filled in.
+ * 
+ * @param timeout_ms Timeout in milliseconds. 0 returns immediately, a negative value waits indefinitely.
+ * @return Number of ready streams, 0 on timeout, or -1 on failure
+ */
+static inline int lxe_poll(struct pollfd *fds, int nfds, int timeout_ms) {
+    return (int)lxe_syscall(__NR_poll, (uint64_t)fds, (uint64_t)nfds, (uint64_t)timeout_ms, 0, 0, 0);
+}
+
+
+/**
+ * @brief Creates an epoll instance, a persistent set of watched streams.
+ * 
+ * @return Stream id of the instance, or -1 on failure
+ */
+static inline int lxe_epoll_create() {
+    return (int)lxe_syscall(__NR_epoll_create, 0, 0, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Adds (EPOLL_CTL_ADD), changes (EPOLL_CTL_MOD) or removes (EPOLL_CTL_DEL) a watched stream.
+ * 
+ * @return 0 for success, -1 on failure
+ */
+static inline int lxe_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    return (int)lxe_syscall(__NR_epoll_ctl, (uint64_t)epfd, (uint64_t)op, (uint64_t)fd, (uint64_t)event, 0, 0);
+}
+
+
+/**
+ * @brief Waits for ready streams of the epoll instance. Streams are reported as long as they stay ready.
+ * 
+ * @return Number of events, 0 on timeout, or -1 on failure
+ */
+static inline int lxe_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout_ms) {
+    return (int)lxe_syscall(__NR_epoll_wait, (uint64_t)epfd, (uint64_t)events, (uint64_t)max_events, (uint64_t)timeout_ms, 0, 0);
+}
+
+
+/**
+ * @brief Creates a timer stream. Reading it returns the number of expirations as an uint64_t.
+ * 
+ * @param initial_us Delay of the first expiry in microseconds
+ * @param interval_us Period of the following expiries, or 0 for a one shot timer
+ * @return Stream id, or -1 on failure
+ */
+static inline int lxe_timerfd_create(uint64_t initial_us, uint64_t interval_us) {
+    return (int)lxe_syscall(__NR_timerfd_create, initial_us, interval_us, 0, 0, 0, 0);
+}
+
+
+/**
+ * @brief Reads the PMU cycle counter.
+ */
+static inline uint64_t lxe_read_cycles() {
+    uint64_t val;
+    asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(val));
+    return val;
+}
+
+
+/**
+ * @brief Reads the virtual counter. It runs at lxe_counter_frequency() Hz.
+ */
+static inline uint64_t lxe_read_counter() {
+    uint64_t val;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+
+static inline uint64_t lxe_counter_frequency() {
+    uint64_t val;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(val));
+    return val;
+}
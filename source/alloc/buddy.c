@@ -5,7 +5,10 @@
 #include <kernel/panic.h>
 #include <kernel/alloc.h>
 #include <kernel/mem.h>
+#include <kernel/cma.h>
+#include <kernel/page_cache.h>
 #include "pool.h"
+#include "buddy.h"
 
 
 // TODO: Hashing based on max-sized block address, to reduce free-lookups to O(1) complexity
@@ -255,6 +258,17 @@ static int buddy_reserve_block(void* addr, int size) {
 }
 
 
+// Returns the top level block at addr, if it is free and not split
+static struct mem_blk *find_free_top_block(void* addr) {
+    for(struct mem_blk *b = blk_heads[BLK_HEAD_IDX(MAX_MEM_BLK_SIZE)]; b; b = b->next_free) {
+        if(b->start_addr == addr) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+
 // Block size is 2^size * min_size
 static struct mem_blk *next_free_block(int size) {
     if(size > MAX_MEM_BLK_SIZE || size < 0) {
@@ -300,6 +314,10 @@ static struct mem_blk *next_free_block(int size) {
 
 
 void* kmalloc(unsigned long size, uint32_t flags) {
+    if(size > size_to_bytes(MAX_MEM_BLK_SIZE)) {
+        // Too large for a buddy block
+        return cma_alloc(size, flags);
+    }
     if(flags & ALLOC_PAGE_ALIGN) {
         // An easy way to ensure alignment with buddy blocks is to just make sure the size is at least one page.
         if(size < PAGE_SIZE) {
@@ -311,6 +329,14 @@ void* kmalloc(unsigned long size, uint32_t flags) {
         i++;
     }
     struct mem_blk *b = next_free_block(i);
+    // Borrow idle blocks of the contiguous memory region once the heap is exhausted
+    while(b == 0 && !cma_lend_block()) {
+        b = next_free_block(i);
+    }
+    // Then evict clean file pages
+    while(b == 0 && page_cache_reclaim((size + PAGE_SIZE - 1) / PAGE_SIZE)) {
+        b = next_free_block(i);
+    }
     if(b == 0) {
         // A block was not found
         return 0;
@@ -354,7 +380,7 @@ int try_free(void* memory) {
 
 
 void free(void* memory) {
-    if(try_free(memory)) {
+    if(cma_free(memory) && try_free(memory)) {
         print("Attempted to free invalid pointer!\n");
     }
 }
@@ -449,6 +475,51 @@ int init_buddy_allocator() {
 }
 
 
+/**
+ * @brief Takes the highest run of contiguous, completely free top level blocks out of the heap.
+ * The blocks can be handed back individually with try_free().
+ * 
+ * @param count Number of blocks
+ * @return Start of the run, or null
+ */
+void* buddy_reserve_top_blocks(uint32_t count) {
+    uint64_t block_bytes = size_to_bytes(MAX_MEM_BLK_SIZE);
+    uint32_t found = 0;
+    for(uint64_t addr = (uint64_t)heap_end - block_bytes; addr >= (uint64_t)heap_start && found < count; addr -= block_bytes) {
+        found = find_free_top_block((void*)addr) ? found + 1 : 0;
+        if(found == count) {
+            for(uint32_t i = 0; i < count; i++) {
+                buddy_reclaim_block((void*)(addr + i * block_bytes));
+            }
+            return (void*)addr;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Takes a top level block out of the heap again, if it is completely free.
+ * 
+ * @param addr Start of the block
+ * @return 0 for success
+ */
+int buddy_reclaim_block(void* addr) {
+    struct mem_blk *b = find_free_top_block(addr);
+    if(!b) {
+        return 1;
+    }
+    remove_from_free_list(b);
+    b->allocated = 1;
+    return 0;
+}
+
+
+unsigned long buddy_max_block_size() {
+    return size_to_bytes(MAX_MEM_BLK_SIZE);
+}
+
+
 unsigned long memory_allocated() {
     unsigned long sum = 0;
     struct mem_blk *b = blk_all_head;
@@ -1,6 +1,8 @@
 #ifndef BUDDY_H
 #define BUDDY_H
 
+#include <kernel/types.h>
+
 int init_buddy_allocator();
 
 unsigned long memory_allocated();
@@ -8,6 +10,9 @@ unsigned int buddy_free_block_structs();
 unsigned int buddy_used_block_structs();
 void* buddy_heap_start();
 void* buddy_heap_end();
+void* buddy_reserve_top_blocks(uint32_t count);
+int buddy_reclaim_block(void* addr);
+unsigned long buddy_max_block_size();
 
 int monoterm_buddy_print_map(int argc, char* argv[]);
 
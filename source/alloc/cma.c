@@ -0,0 +1,215 @@
+#include <kernel/cma.h>
+#include <kernel/alloc.h>
+#include <kernel/print.h>
+#include <kernel/page.h>
+#include <kernel/mem.h>
+#include "buddy.h"
+
+
+struct cma_allocation {
+    struct cma_allocation *next;
+    uint64_t start;
+    uint64_t size;
+};
+
+
+static uint64_t cma_start = 0;
+static uint64_t cma_end = 0;
+static uint64_t cma_block_size = 0;
+// Blocks that are currently part of the buddy heap
+static uint64_t cma_lent = 0;
+// Sorted by address
+static struct cma_allocation *cma_allocations = 0;
+
+
+static uint64_t cma_block_address(uint32_t block) {
+    return cma_start + block * cma_block_size;
+}
+
+
+static bool_t cma_block_used(uint32_t block) {
+    uint64_t start = cma_block_address(block);
+    for(struct cma_allocation *a = cma_allocations; a; a = a->next) {
+        if(a->start < start + cma_block_size && start < a->start + a->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Returns the start of the first lent block at or above addr, or the end of the region
+static uint64_t cma_next_lent(uint64_t addr) {
+    for(uint32_t block = (addr - cma_start) / cma_block_size; cma_block_address(block) < cma_end; block++) {
+        if((cma_lent & (1ul << block)) && cma_block_address(block) >= addr) {
+            return cma_block_address(block);
+        }
+    }
+    return cma_end;
+}
+
+
+/**
+ * @brief Reserves the contiguous memory region. Requires the buddy allocator.
+ * 
+ * @param dt Device tree. The size is taken from /reserved-memory/linux,cma, if present.
+ * @return 0 for success
+ */
+int init_cma(struct device_tree *dt) {
+    uint64_t size = CMA_DEFAULT_SIZE;
+    struct dt_node *reserved = dt_find_child(dt->root_node, "reserved-memory");
+    struct dt_node *node = reserved ? dt_find_child(reserved, "linux,cma") : 0;
+    struct dt_property *prop = node ? dt_find_property(node, "size") : 0;
+    if(prop && dt_property_read_cells(prop)) {
+        size = dt_property_read_cells(prop);
+    }
+
+    cma_block_size = buddy_max_block_size();
+    uint64_t blocks = (size + cma_block_size - 1) / cma_block_size;
+    if(blocks > CMA_MAX_BLOCKS) {
+        blocks = CMA_MAX_BLOCKS;
+    }
+    void *start = buddy_reserve_top_blocks(blocks);
+    if(!start) {
+        print("CMA: failed to reserve {ul} bytes\n", blocks * cma_block_size);
+        return 1;
+    }
+    cma_start = (uint64_t)start;
+    cma_end = cma_start + blocks * cma_block_size;
+    print("CMA: {ul} MiB at 0x{xl}\n", (cma_end - cma_start) >> 20, cma_start);
+    return 0;
+}
+
+
+/**
+ * @brief Allocates physically contiguous, page aligned memory from the contiguous memory region.
+ * Lent blocks that the heap no longer uses are reclaimed first. The smallest fitting free range is used.
+ * 
+ * @param size Size in bytes. Rounded up to whole pages.
+ * @param flags ALLOC_* flags
+ * @return Kernel virtual address, or null
+ */
+void* cma_alloc(uint64_t size, uint32_t flags) {
+    if(!cma_start || !size) {
+        return 0;
+    }
+    size = round_up_to_page(size);
+    // Allocated before searching, as it may cause a block to be lent to the heap
+    struct cma_allocation *a = kmalloc(sizeof(struct cma_allocation), 0);
+    if(!a) {
+        return 0;
+    }
+    for(uint32_t block = 0; cma_block_address(block) < cma_end; block++) {
+        if((cma_lent & (1ul << block)) && !buddy_reclaim_block((void*)cma_block_address(block))) {
+            cma_lent &= ~(1ul << block);
+        }
+    }
+
+    // Walk the free ranges between allocations and lent blocks
+    uint64_t best = 0;
+    uint64_t best_size = ~0ul;
+    uint64_t pos = cma_start;
+    struct cma_allocation *next = cma_allocations;
+    struct cma_allocation *best_prev = 0;
+    struct cma_allocation *prev = 0;
+    while(pos < cma_end) {
+        uint64_t free_end = next ? next->start : cma_end;
+        uint64_t lent = cma_next_lent(pos);
+        uint64_t skip_to;
+        if(lent < free_end) {
+            free_end = lent;
+            skip_to = lent + cma_block_size;
+        } else if(next) {
+            skip_to = next->start + next->size;
+        } else {
+            skip_to = cma_end;
+        }
+        if(free_end - pos >= size && free_end - pos < best_size) {
+            best = pos;
+            best_size = free_end - pos;
+            best_prev = prev;
+        }
+        if(next && skip_to == next->start + next->size) {
+            prev = next;
+            next = next->next;
+        }
+        pos = skip_to;
+    }
+    if(!best) {
+        free(a);
+        return 0;
+    }
+
+    a->start = best;
+    a->size = size;
+    if(best_prev) {
+        a->next = best_prev->next;
+        best_prev->next = a;
+    } else {
+        a->next = cma_allocations;
+        cma_allocations = a;
+    }
+    if(flags & ALLOC_ZERO_INIT) {
+        memset(0, (void*)best, size);
+    }
+    return (void*)best;
+}
+
+
+/**
+ * @brief Frees memory returned by cma_alloc().
+ * 
+ * @param memory Start of the allocation
+ * @return 0 for success, 1 if the memory was not allocated from the region
+ */
+int cma_free(void* memory) {
+    // Called for every free(), most pointers are outside of the region
+    if((uint64_t)memory < cma_start || (uint64_t)memory >= cma_end) {
+        return 1;
+    }
+    struct cma_allocation *prev = 0;
+    for(struct cma_allocation *a = cma_allocations; a; a = a->next) {
+        if(a->start == (uint64_t)memory) {
+            if(prev) {
+                prev->next = a->next;
+            } else {
+                cma_allocations = a->next;
+            }
+            free(a);
+            return 0;
+        }
+        prev = a;
+    }
+    return 1;
+}
+
+
+/**
+ * @brief Hands an idle block of the region to the buddy allocator. The highest idle block is lent first,
+ * to keep the start of the region contiguous.
+ * 
+ * @return 0 if a block was lent
+ */
+int cma_lend_block() {
+    if(!cma_start) {
+        return 1;
+    }
+    for(uint32_t block = (cma_end - cma_start) / cma_block_size; block-- > 0;) {
+        if(!(cma_lent & (1ul << block)) && !cma_block_used(block)) {
+            cma_lent |= 1ul << block;
+            try_free((void*)cma_block_address(block));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+void print_cma_usage() {
+    uint64_t allocated = 0;
+    for(struct cma_allocation *a = cma_allocations; a; a = a->next) {
+        allocated += a->size;
+    }
+    uint32_t lent = __builtin_popcountll(cma_lent);
+    print("CMA: {ul} of {ul} bytes allocated, {u} blocks lent to the heap\n", allocated, cma_end - cma_start, lent);
+}
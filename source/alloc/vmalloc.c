@@ -1,13 +1,16 @@
 #include <kernel/alloc.h>
 #include <kernel/types.h>
 #include <kernel/print.h>
+#include <kernel/page.h>
 #include <kernel/address_space.h>
+#include <kernel/vmap.h>
 
-// TODO: All sections of this file are only partially implemented!
 
+// Physically discontiguous memory, mapped to a contiguous kernel virtual range.
 struct vmalloc_mapping_block {
     struct vmalloc_mapping_block* next;
     void* mapped_block;
+    struct address_mapping* mapping;
 };
 
 struct vmalloc_mapping {
@@ -15,50 +18,45 @@ struct vmalloc_mapping {
     struct vmalloc_mapping_block* block_list;
     uint64_t vaddress;
     uint64_t mapped_bytes;
+    // Size of the virtual address reservation
+    uint64_t reserved_bytes;
     uint32_t allocation_flags;
 };
 
-// Up to 1024 vmalloc mappings
-#define VMALLOC_BASE_ADDR          0x0000B00000000000ul
-#define VMALLOC_MAX_MAPPING_SIZE   0x0000000100000000ul
-#define VMALLOC_MAX_MAPPINGS 1024
-#define VMALLOC_MAPPING_LIST_LENGTH (VMALLOC_MAX_MAPPINGS / 64)
-static uint64_t vmalloc_free_mask[VMALLOC_MAPPING_LIST_LENGTH]; 
-
 struct vmalloc_mapping* vmalloc_mapping_list;
 
 
-/**
- * @brief Returns the next free virtual address slot
- * 
- * @return uint64_t 
- */
-static uint64_t vmalloc_get_free_vaddr() {
-    for(int i = 0; i < VMALLOC_MAX_MAPPINGS; i++) {
-        int list_idx = i / 64;
-        int bit_idx = i % 64;
-        if(!(vmalloc_free_mask[list_idx] & (1ul << bit_idx))) {
-            vmalloc_free_mask[list_idx] |= 1ul << bit_idx;
-            return VMALLOC_BASE_ADDR + (VMALLOC_MAX_MAPPING_SIZE * (uint64_t)i);
-        }
-    }
-    print("mmap: error: out of virtual addresses!\n");
-    return 0;
-}
-
-
 int vmalloc_reallocate(struct vmalloc_mapping* mapping, unsigned long new_size) {
+    if(new_size > mapping->reserved_bytes) {
+        print("vmalloc: error: allocation exceeds its reserved address range\n");
+        return 1;
+    }
+    uint32_t kmalloc_flags = (mapping->allocation_flags & ~ALLOC_HUGE_PAGE) | ALLOC_PAGE_ALIGN;
     while(mapping->mapped_bytes < new_size) {
-        // Allocate the new memory
         uint64_t appended_bytes;
-        void* new_mem = kmalloc_largest_available(new_size - mapping->mapped_bytes, mapping->allocation_flags, &appended_bytes);
+        void* new_mem = 0;
+        // Buddy blocks are naturally aligned, so a 2 MiB block at a 2 MiB aligned address is mapped as a level 2 block
+        if((mapping->allocation_flags & ALLOC_HUGE_PAGE) && new_size - mapping->mapped_bytes >= HUGE_PAGE_SIZE
+            && !((mapping->vaddress + mapping->mapped_bytes) & (HUGE_PAGE_SIZE - 1))) {
+            new_mem = kmalloc(HUGE_PAGE_SIZE, kmalloc_flags);
+            appended_bytes = HUGE_PAGE_SIZE;
+        }
+        // Allocate the new memory. Blocks are mapped page by page, so they have to be page aligned.
+        if(!new_mem) {
+            new_mem = kmalloc_largest_available(new_size - mapping->mapped_bytes, kmalloc_flags, &appended_bytes);
+        }
         if(!new_mem) {
             // Not enough system memory left!
             return 1;
         }
+        // Blocks can be larger than requested. Only the reserved range is mapped.
+        if(appended_bytes > mapping->reserved_bytes - mapping->mapped_bytes) {
+            appended_bytes = mapping->reserved_bytes - mapping->mapped_bytes;
+        }
         
         struct vmalloc_mapping_block* new_blk = kmalloc(sizeof(struct vmalloc_mapping_block), 0);
         if(!new_blk) {
+            free(new_mem);
             return 1;
         }
 
@@ -69,6 +67,7 @@ int vmalloc_reallocate(struct vmalloc_mapping* mapping, unsigned long new_size)
         if(!new_mapping) {
             print("vmalloc: error: failed to create map for {x} bytes from 0x{xl} -> 0x{xl}\n", appended_bytes, (uint64_t)new_mem, vaddr);
             free(new_mem);
+            free(new_blk);
             return 1;
         }
 
@@ -77,13 +76,14 @@ int vmalloc_reallocate(struct vmalloc_mapping* mapping, unsigned long new_size)
             print("vmalloc: error: failed to create map for {x} bytes from 0x{xl} -> 0x{xl}\n", appended_bytes, (uint64_t)new_mem, vaddr);
             // This tolerates the mapping not being mapped. It will remove it from the linked list.
             unmap_and_remove_memory_region(kernel_address_space, new_mapping);
-            free(new_mapping);
             free(new_mem);
+            free(new_blk);
             return 1;
         }
 
         // Insert mappings into lists
         new_blk->mapped_block = new_mem;
+        new_blk->mapping = new_mapping;
         new_blk->next = mapping->block_list;
         mapping->block_list = new_blk;
         // Update size of mapping
@@ -93,6 +93,25 @@ int vmalloc_reallocate(struct vmalloc_mapping* mapping, unsigned long new_size)
 }
 
 
+// Unmaps and frees all blocks of the allocation, then releases its address range.
+static void vmalloc_release(struct vmalloc_mapping* mapping) {
+    struct vmalloc_mapping_block* blk = mapping->block_list;
+    while(blk) {
+        struct vmalloc_mapping_block* next_blk = blk->next;
+        if(unmap_and_remove_memory_region(kernel_address_space, blk->mapping)) {
+            // The memory may still be reachable through the page table, so it cannot be reused
+            print("vmalloc: error: failed to unmap 0x{xl}\n", blk->mapping->vaddress);
+        } else {
+            free(blk->mapped_block);
+        }
+        free(blk);
+        blk = next_blk;
+    }
+    mapping->block_list = 0;
+    vmap_release(mapping->vaddress);
+}
+
+
 void* vmalloc(unsigned long size, uint32_t flags) {
     // Allocate space for the metadata
     struct vmalloc_mapping* new = kmalloc(sizeof(struct vmalloc_mapping), 0);
@@ -100,8 +119,15 @@ void* vmalloc(unsigned long size, uint32_t flags) {
         return 0;
     }
     new->allocation_flags = flags;
-    new->vaddress = vmalloc_get_free_vaddr();
+    // Empty allocations still get a unique address
+    new->reserved_bytes = round_up_to_page(size ? size : 1);
+    if((flags & ALLOC_HUGE_PAGE) && new->reserved_bytes >= HUGE_PAGE_SIZE) {
+        new->vaddress = vmap_reserve_aligned(new->reserved_bytes, HUGE_PAGE_SIZE);
+    } else {
+        new->vaddress = vmap_reserve(new->reserved_bytes);
+    }
     if(!new->vaddress) {
+        free(new);
         return 0;
     }
     new->mapped_bytes = 0;
@@ -110,6 +136,7 @@ void* vmalloc(unsigned long size, uint32_t flags) {
 
     // Allocate and map the requested memory
     if(vmalloc_reallocate(new, size)) {
+        vmalloc_release(new);
         free(new);
         return 0;
     }
@@ -121,33 +148,27 @@ void* vmalloc(unsigned long size, uint32_t flags) {
 }
 
 
-void vmalloc_free(void* address) {
-    print("vmalloc_free: maybe unimplemented!\n");
-    struct vmalloc_mapping* i = vmalloc_mapping_list;
+/**
+ * @brief Frees memory allocated with vmalloc(). The pages are unmapped, and the address range can be reused.
+ * 
+ * @param address Address returned by vmalloc()
+ */
+void vfree(void* address) {
     struct vmalloc_mapping* prev = 0;
-    while(i) {
+    for(struct vmalloc_mapping* i = vmalloc_mapping_list; i; i = i->next) {
         if(i->vaddress == (uint64_t)address) {
-            // This is the mapping to delete
             // Remove mapping from list
             if(prev) {
                 prev->next = i->next;
             } else {
                 // The root node
                 vmalloc_mapping_list = i->next;
-            }  
-            // Remove allocated blocks
-            struct vmalloc_mapping_block* blk = i->block_list;
-            while(blk) {
-                // Free block and its descriptor
-                free(blk->mapped_block);
-                struct vmalloc_mapping_block* next_blk = blk->next;
-                free(blk);
-                blk = next_blk;
             }
-            // Free mapping
+            vmalloc_release(i);
             free(i);
+            return;
         }
         prev = i;
-        i = i->next;
     }
-}
\ No newline at end of file
+    print("vfree: error: 0x{xl} was not allocated with vmalloc\n", (uint64_t)address);
+}
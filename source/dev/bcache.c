@@ -0,0 +1,362 @@
+#include <kernel/bcache.h>
+#include <kernel/alloc.h>
+#include <kernel/exception.h>
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/waitqueue.h>
+#include "../alloc/buddy.h"
+
+// Share of the free heap used for cached blocks
+#define BCACHE_MEMORY_DIVISOR 64
+#define BCACHE_MIN_BUFFERS 64
+#define BCACHE_MAX_BUFFERS 8192
+// Sizing assumes blocks of this size
+#define BCACHE_NOMINAL_BLOCK_SIZE 512
+
+static struct buffer_head **bcache_hash;
+static uint32_t bcache_hash_mask;
+static uint32_t bcache_capacity;
+static uint32_t bcache_count;
+// Cold end first
+static struct buffer_head *bcache_lru_head;
+static struct buffer_head *bcache_lru_tail;
+static struct wait_queue bcache_waiters;
+
+static uint64_t bcache_hits;
+static uint64_t bcache_misses;
+static uint64_t bcache_writebacks;
+static uint64_t bcache_evictions;
+
+
+static uint32_t bcache_hash_index(struct block_dev *dev, unsigned int blk) {
+    uint64_t key = ((uint64_t)dev >> 4) ^ (blk * 0x9E3779B1u);
+    return (key ^ (key >> 16)) & bcache_hash_mask;
+}
+
+
+static void bcache_lru_remove(struct buffer_head *b) {
+    if(b->lru_prev) {
+        b->lru_prev->lru_next = b->lru_next;
+    } else {
+        bcache_lru_head = b->lru_next;
+    }
+    if(b->lru_next) {
+        b->lru_next->lru_prev = b->lru_prev;
+    } else {
+        bcache_lru_tail = b->lru_prev;
+    }
+    b->lru_prev = 0;
+    b->lru_next = 0;
+}
+
+
+static void bcache_lru_append(struct buffer_head *b) {
+    b->lru_next = 0;
+    b->lru_prev = bcache_lru_tail;
+    if(bcache_lru_tail) {
+        bcache_lru_tail->lru_next = b;
+    } else {
+        bcache_lru_head = b;
+    }
+    bcache_lru_tail = b;
+}
+
+
+static void bcache_lru_prepend(struct buffer_head *b) {
+    b->lru_prev = 0;
+    b->lru_next = bcache_lru_head;
+    if(bcache_lru_head) {
+        bcache_lru_head->lru_prev = b;
+    } else {
+        bcache_lru_tail = b;
+    }
+    bcache_lru_head = b;
+}
+
+
+static void bcache_hash_remove(struct buffer_head *b) {
+    for(struct buffer_head **i = &bcache_hash[bcache_hash_index(b->dev, b->blk)]; *i; i = &(*i)->hash_next) {
+        if(*i == b) {
+            *i = b->hash_next;
+            break;
+        }
+    }
+    b->hash_next = 0;
+}
+
+
+static struct buffer_head *bcache_lookup(struct block_dev *dev, unsigned int blk) {
+    for(struct buffer_head *b = bcache_hash[bcache_hash_index(dev, blk)]; b; b = b->hash_next) {
+        if(b->dev == dev && b->blk == blk) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Sizes the cache from the free heap and allocates its hash table. Buffers are allocated on demand.
+ * 
+ * @return 0 on success, -1 if the hash table cannot be allocated
+ */
+int init_bcache() {
+    uint64_t heap = (uint64_t)buddy_heap_end() - (uint64_t)buddy_heap_start();
+    uint64_t available = heap - memory_allocated();
+    bcache_capacity = available / BCACHE_MEMORY_DIVISOR / BCACHE_NOMINAL_BLOCK_SIZE;
+    if(bcache_capacity < BCACHE_MIN_BUFFERS) {
+        bcache_capacity = BCACHE_MIN_BUFFERS;
+    } else if(bcache_capacity > BCACHE_MAX_BUFFERS) {
+        bcache_capacity = BCACHE_MAX_BUFFERS;
+    }
+    // About two buffers per bucket when full
+    uint32_t buckets = 1;
+    while(buckets * 2 < bcache_capacity) {
+        buckets *= 2;
+    }
+    bcache_hash = kmalloc(buckets * sizeof(struct buffer_head*), ALLOC_ZERO_INIT);
+    if(!bcache_hash) {
+        print("bcache: error: failed to allocate hash table\n");
+        return -1;
+    }
+    bcache_hash_mask = buckets - 1;
+    print("Buffer cache: up to {u} buffers, {u} buckets\n", bcache_capacity, buckets);
+    return 0;
+}
+
+
+/*
+ * Writes a dirty buffer to its device. Called with interrupts disabled, the device may sleep meanwhile.
+ * The buffer is referenced during the write, so that it cannot be recycled. An unreferenced buffer returns to
+ * the cold or the hot end of the LRU list.
+ */
+static int bcache_writeback(struct buffer_head *b, bool_t cold) {
+    if(!b->refcount) {
+        bcache_lru_remove(b);
+    }
+    b->refcount++;
+    int ret = 0;
+    if(block_transfer(b->dev, b->blk, 1, b->data, true)) {
+        print("bcache: failed to write back block {u}\n", b->blk);
+        ret = -1;
+    } else {
+        b->flags &= ~BUFFER_DIRTY;
+        bcache_writebacks++;
+    }
+    b->refcount--;
+    if(!b->refcount) {
+        if(cold) {
+            bcache_lru_prepend(b);
+        } else {
+            bcache_lru_append(b);
+        }
+    }
+    return ret;
+}
+
+
+/*
+ * Returns an unused buffer for the block. It is inserted into the hash table, but holds no data yet.
+ * Writing back a victim may sleep, meanwhile another process may have cached the block. That buffer is returned
+ * instead, and cached is set.
+ */
+static struct buffer_head *bcache_alloc(struct block_dev *dev, unsigned int blk, bool_t *cached) {
+    *cached = false;
+    struct buffer_head *b = 0;
+    if(bcache_count < bcache_capacity) {
+        b = kmalloc(sizeof(struct buffer_head), ALLOC_ZERO_INIT);
+        if(b) {
+            b->data = kmalloc(dev->block_size, 0);
+            if(!b->data) {
+                free(b);
+                b = 0;
+            } else {
+                bcache_count++;
+            }
+        }
+    }
+    // Recycle the least recently used buffer. Dirty buffers are written back first.
+    for(uint32_t attempts = 0; !b && attempts <= bcache_count; attempts++) {
+        struct buffer_head *victim = bcache_lru_head;
+        if(!victim) {
+            break;
+        }
+        if(victim->flags & BUFFER_DIRTY) {
+            // Returns to the cold end while unused. Buffers that cannot be written move to the hot end.
+            bcache_writeback(victim, true);
+            if((victim->flags & BUFFER_DIRTY) && victim == bcache_lru_head) {
+                bcache_lru_remove(victim);
+                bcache_lru_append(victim);
+            }
+            continue;
+        }
+        if(victim->dev->block_size != dev->block_size) {
+            uint8_t *data = kmalloc(dev->block_size, 0);
+            if(!data) {
+                break;
+            }
+            free(victim->data);
+            victim->data = data;
+        }
+        bcache_lru_remove(victim);
+        bcache_hash_remove(victim);
+        bcache_evictions++;
+        b = victim;
+    }
+    if(!b) {
+        return 0;
+    }
+    b->dev = dev;
+    b->blk = blk;
+    b->flags = 0;
+    b->refcount = 0;
+    struct buffer_head *existing = bcache_lookup(dev, blk);
+    if(existing) {
+        // Lost the race. The spare buffer is recycled first.
+        b->hash_next = 0;
+        bcache_lru_prepend(b);
+        *cached = true;
+        return existing;
+    }
+    uint32_t index = bcache_hash_index(dev, blk);
+    b->hash_next = bcache_hash[index];
+    bcache_hash[index] = b;
+    return b;
+}
+
+
+/**
+ * @brief Returns a referenced buffer holding the contents of a block. Reads the block from the device on a miss.
+ * Release the buffer with bcache_release().
+ * 
+ * @param dev Block device
+ * @param blk Block index
+ * @return The buffer, or null on a read error or if no buffer is available
+ */
+struct buffer_head *bcache_read(struct block_dev *dev, unsigned int blk) {
+    uint64_t flags = irq_save();
+    bool_t cached = true;
+    struct buffer_head *b = bcache_lookup(dev, blk);
+    if(!b) {
+        b = bcache_alloc(dev, blk, &cached);
+        if(!b) {
+            irq_restore(flags);
+            print("bcache: no buffer available\n");
+            return 0;
+        }
+    }
+    if(cached) {
+        if(!b->refcount) {
+            bcache_lru_remove(b);
+        }
+        b->refcount++;
+        while(b->flags & BUFFER_BUSY) {
+            wait_queue_sleep(&bcache_waiters, 0);
+        }
+        if(b->flags & BUFFER_VALID) {
+            bcache_hits++;
+            irq_restore(flags);
+            return b;
+        }
+    } else {
+        b->refcount++;
+    }
+
+    bcache_misses++;
+    b->flags |= BUFFER_BUSY;
+    int ret = block_transfer(dev, blk, 1, b->data, false);
+    b->flags &= ~BUFFER_BUSY;
+    if(!ret) {
+        b->flags |= BUFFER_VALID;
+    }
+    wait_queue_wake_all(&bcache_waiters);
+    irq_restore(flags);
+    if(ret) {
+        bcache_release(b);
+        return 0;
+    }
+    return b;
+}
+
+
+// Takes another reference to a buffer the caller already holds
+void bcache_get(struct buffer_head *b) {
+    uint64_t flags = irq_save();
+    b->refcount++;
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Drops a reference to a buffer. Unreferenced buffers stay cached until they are recycled.
+ * 
+ * @param b Buffer returned by bcache_read()
+ */
+void bcache_release(struct buffer_head *b) {
+    uint64_t flags = irq_save();
+    b->refcount--;
+    if(!b->refcount) {
+        if(b->flags & BUFFER_VALID) {
+            bcache_lru_append(b);
+        } else {
+            // Failed reads are not cached. Unused buffers are recycled first.
+            bcache_hash_remove(b);
+            bcache_lru_prepend(b);
+        }
+    }
+    irq_restore(flags);
+}
+
+
+// The caller has modified the buffer. It is written back when it is recycled or synced.
+void bcache_mark_dirty(struct buffer_head *b) {
+    b->flags |= BUFFER_DIRTY;
+}
+
+
+/**
+ * @brief Writes a buffer to its device right away.
+ * 
+ * @param b Referenced buffer
+ * @return 0 on success, -1 on a write error
+ */
+int bcache_write(struct buffer_head *b) {
+    uint64_t flags = irq_save();
+    b->flags |= BUFFER_DIRTY;
+    int ret = bcache_writeback(b, false);
+    irq_restore(flags);
+    return ret;
+}
+
+
+/**
+ * @brief Writes back all dirty buffers of a device.
+ * 
+ * @param dev Block device, or null for all devices
+ * @return 0 on success, -1 if a buffer could not be written
+ */
+int bcache_sync(struct block_dev *dev) {
+    int ret = 0;
+    uint64_t flags = irq_save();
+    for(uint32_t i = 0; i <= bcache_hash_mask; i++) {
+        for(struct buffer_head *b = bcache_hash[i]; b; b = b->hash_next) {
+            if((!dev || b->dev == dev) && (b->flags & BUFFER_DIRTY) && bcache_writeback(b, false)) {
+                ret = -1;
+            }
+        }
+    }
+    irq_restore(flags);
+    return ret;
+}
+
+
+void print_bcache_stats() {
+    uint64_t lookups = bcache_hits + bcache_misses;
+    print("Buffer cache\n");
+    print("  Buffers:     {u} / {u} ({u} KiB)\n", bcache_count, bcache_capacity, bcache_count * BCACHE_NOMINAL_BLOCK_SIZE / 1024);
+    print("  Hits:        {ul}\n", bcache_hits);
+    print("  Misses:      {ul}\n", bcache_misses);
+    print("  Hit rate:    {ul}%\n", lookups ? bcache_hits * 100 / lookups : 0);
+    print("  Evictions:   {ul}\n", bcache_evictions);
+    print("  Write-backs: {ul}\n", bcache_writebacks);
+}
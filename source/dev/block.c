@@ -1,4 +1,7 @@
 #include <kernel/block.h>
+#include <kernel/exception.h>
+#include <kernel/print.h>
+#include <kernel/process.h>
 
 
 /* Allocates and registers a new block device */
@@ -7,44 +10,230 @@ struct block_dev *alloc_block_dev() {
     return dev;
 }
 
-int read_blk(struct block_dev *dev, void *buf) {
-    if(!dev->read_blk) {
-        return -1;
+
+// Inserts a request into the queue, sorted by block. Called with interrupts disabled.
+static void bio_queue_insert(struct bio_queue *q, struct bio *b) {
+    struct bio **i = &q->head;
+    while(*i && (*i)->blk <= b->blk) {
+        i = &(*i)->next;
+    }
+    b->next = *i;
+    *i = b;
+}
+
+
+/*
+ * Takes the next transfer off the queue: the first request at or after the current position, wrapping around
+ * to the lowest block otherwise. Following requests which continue it in the same direction are merged.
+ * Returns the number of requests taken, which are linked through their next pointers.
+ */
+static int bio_queue_take(struct bio_queue *q, unsigned int max_blocks, struct bio **first) {
+    struct bio **start = &q->head;
+    while(*start && (*start)->blk < q->position) {
+        start = &(*start)->next;
+    }
+    if(!*start) {
+        start = &q->head;
+    }
+    struct bio *b = *start;
+    struct bio *last = b;
+    unsigned int blocks = b->count;
+    uint32_t vecs = b->vec_count;
+    int taken = 1;
+    while(last->next) {
+        struct bio *n = last->next;
+        if(n->blk != b->blk + blocks || n->write != b->write || vecs + n->vec_count > BIO_MAX_MERGED_VECS) {
+            break;
+        }
+        if(max_blocks && blocks + n->count > max_blocks) {
+            break;
+        }
+        blocks += n->count;
+        vecs += n->vec_count;
+        last = n;
+        taken++;
+    }
+    *start = last->next;
+    last->next = 0;
+    *first = b;
+    q->position = b->blk + blocks;
+    return taken;
+}
+
+
+// Runs transfers until the queue is empty. Called with interrupts disabled by the process that found the queue idle.
+static void bio_queue_dispatch(struct block_dev *dev) {
+    struct bio_queue *q = &dev->queue;
+    while(q->head) {
+        struct bio *first;
+        int taken = bio_queue_take(q, dev->max_transfer_blocks, &first);
+        q->merged += taken - 1;
+        q->transfers++;
+
+        struct bio_vec vecs[BIO_MAX_MERGED_VECS];
+        uint32_t vec_count = 0;
+        for(struct bio *b = first; b; b = b->next) {
+            for(uint32_t i = 0; i < b->vec_count; i++) {
+                vecs[vec_count++] = b->vecs[i];
+            }
+        }
+        int status = dev->transfer(dev, first->blk, vecs, vec_count, first->write) ? -1 : 0;
+
+        struct bio *b = first;
+        while(b) {
+            // The callback may free or reuse the request
+            struct bio *next = b->next;
+            b->status = status;
+            b->completed = true;
+            if(b->done) {
+                b->done(b);
+            }
+            b = next;
+        }
+        wait_queue_wake_all(&q->waiters);
+    }
+    q->busy = false;
+}
+
+
+/**
+ * @brief Queues a request. If the device is idle, the calling process dispatches the queue before returning.
+ * Otherwise the request is merged into the queue of the process already dispatching.
+ * 
+ * @param b Request with dev, blk, write and vecs set. Must stay valid until it has completed.
+ */
+void bio_submit(struct bio *b) {
+    struct block_dev *dev = b->dev;
+    struct bio_queue *q = &dev->queue;
+    b->count = 0;
+    for(uint32_t i = 0; i < b->vec_count; i++) {
+        b->count += b->vecs[i].blocks;
+    }
+    b->completed = false;
+    b->status = 0;
+    if(!dev->transfer || !b->count || b->vec_count > BIO_MAX_MERGED_VECS
+       || (dev->max_transfer_blocks && b->count > dev->max_transfer_blocks)) {
+        b->status = -1;
+        b->completed = true;
+        if(b->done) {
+            b->done(b);
+        }
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    q->submitted++;
+    bio_queue_insert(q, b);
+    if(!q->busy) {
+        q->busy = true;
+        bio_queue_dispatch(dev);
     }
-    return dev->read_blk(dev, buf);
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Blocks until a submitted request has completed.
+ * 
+ * @param b Request
+ * @return 0 on success, -1 on error
+ */
+int bio_wait(struct bio *b) {
+    uint64_t flags = irq_save();
+    while(!b->completed) {
+        wait_queue_sleep(&b->dev->queue.waiters, 0);
+    }
+    irq_restore(flags);
+    return b->status;
+}
+
+
+int bio_submit_wait(struct bio *b) {
+    bio_submit(b);
+    return bio_wait(b);
+}
+
+
+/**
+ * @brief Synchronously transfers blocks at a given position. Does not use or move the seek position.
+ * 
+ * @param dev Block device
+ * @param blk First block
+ * @param n Number of blocks
+ * @param buf Buffer of n blocks
+ * @param write Direction
+ * @return 0 on success, -1 on error
+ */
+int block_transfer(struct block_dev *dev, unsigned int blk, int n, void *buf, bool_t write) {
+    while(n > 0) {
+        unsigned int count = n;
+        if(dev->max_transfer_blocks && count > dev->max_transfer_blocks) {
+            count = dev->max_transfer_blocks;
+        }
+        struct bio_vec vec = {.buf = buf, .blocks = count};
+        struct bio b = {.dev = dev, .blk = blk, .write = write, .vecs = &vec, .vec_count = 1};
+        if(bio_submit_wait(&b)) {
+            return -1;
+        }
+        blk += count;
+        n -= count;
+        buf = (char*)buf + count * dev->block_size;
+    }
+    return 0;
+}
+
+
+void print_block_queue_stats(struct block_dev *dev) {
+    struct bio_queue *q = &dev->queue;
+    print("Block requests ({s})\n", dev->driver_str);
+    print("  Submitted: {ul}\n", q->submitted);
+    print("  Merged:    {ul}\n", q->merged);
+    print("  Transfers: {ul}\n", q->transfers);
+}
+
+
+int read_blk(struct block_dev *dev, void *buf) {
+    return read_blks(dev, 1, buf);
 }
 
 int read_nblk(struct block_dev *dev, void *buf, unsigned int n) {
-    if(!dev->read_nblk) {
+    if(n >= (unsigned int)dev->block_size) {
+        return read_blks(dev, 1, buf);
+    }
+    // Partial block, read through a bounce buffer
+    void *block = kmalloc(dev->block_size, 0);
+    if(!block) {
         return -1;
     }
-    return dev->read_nblk(dev, buf, n);
+    int ret = read_blks(dev, 1, block);
+    if(ret == 1) {
+        memcpy((char*)buf, (char*)block, n);
+    }
+    free(block);
+    return ret;
 }
 
 int read_blks(struct block_dev *dev, int n, void *buf) {
-    if(!dev->read_blks) {
+    if(block_transfer(dev, dev->iblk, n, buf, false)) {
         return -1;
     }
-    return dev->read_blks(dev, n, buf);
+    dev->iblk += n;
+    return n;
 }
 
 int write_blk(struct block_dev *dev, void *buf) {
-    if(!dev->write_blk) {
-        return -1;
-    }
-    return dev->write_blk(dev, buf);
+    return write_blks(dev, 1, buf);
 }
 
 int write_blks(struct block_dev *dev, int n, void *buf) {
-    if(!dev->write_blks) {
+    if(block_transfer(dev, dev->iblk, n, buf, true)) {
         return -1;
     }
-    return dev->write_blks(dev, n, buf);
+    dev->iblk += n;
+    return n;
 }
 
 int seek_blk(struct block_dev *dev, unsigned int iblk) {
-    if(!dev->seek_blk) {
-        return -1;
-    }
-    return dev->seek_blk(dev, iblk);
-}
\ No newline at end of file
+    dev->iblk = iblk;
+    return 0;
+}
@@ -22,6 +22,22 @@ int64_t write_char(struct char_dev *dev, void *buf, int64_t count) {
     return dev->write(dev, buf, count);
 }
 
+/**
+ * @brief Returns the readiness of a character device.
+ * 
+ * @param dev The device
+ * @param head Receives the poll head of the device, or null if it never blocks
+ * @return POLL* event mask
+ */
+uint32_t char_dev_poll(struct char_dev *dev, struct poll_head **head) {
+    if(!dev->poll) {
+        *head = 0;
+        return POLLIN | POLLOUT;
+    }
+    *head = &dev->pollers;
+    return dev->poll(dev);
+}
+
 int64_t write_string_char(struct char_dev *dev, char *buf) {
     return write_char(dev, buf, strlen(buf));
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <kernel/alloc.h>
 #include <kernel/print.h>
 #include <kernel/mem.h>
+#include <kernel/string.h>
 
 struct device_tree *kernel_dt;
 
@@ -196,6 +197,36 @@ uint32_t* load_device_tree_node(uint32_t *node_tokens, uint32_t *node_tokens_end
     return 0;
 }
 
+struct dt_node* dt_find_child(struct dt_node* node, char* name) {
+    uint32_t len = strlen(name);
+    for(struct dt_node* i = node->children; i; i = i->next) {
+        if(!strncmp(i->name, name, len) && (i->name[len] == 0 || i->name[len] == '@')) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+struct dt_property* dt_find_property(struct dt_node* node, char* key) {
+    for(struct dt_property* i = node->properties; i; i = i->next) {
+        if(!strcmp(i->key, key)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+uint64_t dt_property_read_cells(struct dt_property* prop) {
+    uint32_t *cells = (uint32_t*)prop->value;
+    if(prop->length == 8) {
+        return ((uint64_t)__builtin_bswap32(cells[0]) << 32) | __builtin_bswap32(cells[1]);
+    }
+    if(prop->length == 4) {
+        return __builtin_bswap32(cells[0]);
+    }
+    return 0;
+}
+
 void print_device_tree(struct device_tree *dt) {
     print("Reserved memory regions:\n");
     {
@@ -0,0 +1,261 @@
+#include <kernel/dma.h>
+#include <kernel/alloc.h>
+#include <kernel/cache.h>
+#include <kernel/exception.h>
+#include <kernel/mem.h>
+#include <kernel/mmap.h>
+#include <kernel/page.h>
+#include <kernel/pagetable.h>
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/register.h>
+
+#define DMA_CS(ch)        ((ch)->regs + 0x0ul)
+#define DMA_CONBLK_AD(ch) ((ch)->regs + 0x4ul)
+#define DMA_DEBUG(ch)     ((ch)->regs + 0x20ul)
+#define DMA_ENABLE        (dma_base + 0xFF0ul)
+
+#define DMA_CS_ACTIVE (1 << 0)
+#define DMA_CS_END    (1 << 1)
+#define DMA_CS_INT    (1 << 2)
+#define DMA_CS_ERROR  (1 << 8)
+#define DMA_CS_WAIT_FOR_OUTSTANDING_WRITES (1 << 28)
+#define DMA_CS_RESET  (1u << 31)
+
+// Initial number of control blocks per channel. Fragmented buffers grow the chain.
+#define DMA_INITIAL_BLOCKS 16
+// Maximum length of a single control block in full channels is 1 GiB, we never come close
+#define DMA_MAX_BLOCK_LENGTH 0x3FFFFFFF
+
+static uint64_t dma_base;
+static struct dma_channel dma_channels[DMA_CHANNEL_COUNT];
+static uint32_t dma_channels_used;
+
+
+static void dma_acknowledge(struct dma_channel *ch) {
+    uint32_t cs = get32(DMA_CS(ch));
+    if(!(cs & (DMA_CS_INT | DMA_CS_END | DMA_CS_ERROR))) {
+        return;
+    }
+    // INT and END are write one to clear
+    put32(DMA_CS(ch), cs & (DMA_CS_INT | DMA_CS_END));
+    ch->status = cs;
+    ch->done = true;
+    wait_queue_wake_all(&ch->waiters);
+}
+
+
+static void dma_interrupt(void *data) {
+    dma_acknowledge(data);
+}
+
+
+static void dma_timeout(struct timer *t) {
+    struct dma_channel *ch = t->data;
+    ch->done = true;
+    wait_queue_wake_all(&ch->waiters);
+}
+
+
+int init_dma() {
+    dma_base = (uint64_t)mmap(DMA_PHYSICAL, DMA_MAPPING_SIZE);
+    if(!dma_base) {
+        print("dma: error: failed to create io mapping!\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Claims a free DMA channel for exclusive use by a driver.
+ * 
+ * @return The channel, or null if all channels are in use
+ */
+struct dma_channel *dma_channel_alloc() {
+    if(!dma_base) {
+        return 0;
+    }
+    for(int i = 0; i < DMA_CHANNEL_COUNT; i++) {
+        if(!(DMA_CHANNEL_MASK & (1 << i)) || (dma_channels_used & (1 << i))) {
+            continue;
+        }
+        struct dma_channel *ch = &dma_channels[i];
+        ch->index = i;
+        ch->regs = dma_base + i * 0x100ul;
+        ch->block_capacity = DMA_INITIAL_BLOCKS;
+        ch->block_count = 0;
+        ch->blocks = kmalloc(DMA_INITIAL_BLOCKS * sizeof(struct dma_control_block), ALLOC_ZERO_INIT);
+        if(!ch->blocks) {
+            return 0;
+        }
+        if(register_interrupt_handler(PERIPHERAL_INTERRUPT_DMA0 + i, dma_interrupt, ch)) {
+            free(ch->blocks);
+            return 0;
+        }
+        dma_channels_used |= 1 << i;
+        put32(DMA_ENABLE, get32(DMA_ENABLE) | (1 << i));
+        put32(DMA_CS(ch), DMA_CS_RESET);
+        return ch;
+    }
+    return 0;
+}
+
+
+void dma_chain_reset(struct dma_channel *ch) {
+    ch->block_count = 0;
+}
+
+
+static uint32_t dma_bus_address(uint64_t phys) {
+    return (uint32_t)phys | DMA_BUS_RAM_ALIAS;
+}
+
+
+static uint64_t dma_physical_address(void *va) {
+    if((uint64_t)va >= VA_OFFSET && (uint64_t)va < VA_OFFSET + PHYS_MEMORY_SIZE) {
+        return (uint64_t)KERN_TO_PHYS(va);
+    }
+    return page_table_virtual_to_physical(kernel_page_table, (uint64_t)va);
+}
+
+
+static struct dma_control_block *dma_chain_append(struct dma_channel *ch) {
+    if(ch->block_count == ch->block_capacity) {
+        struct dma_control_block *blocks = kmalloc(2 * ch->block_capacity * sizeof(struct dma_control_block), ALLOC_ZERO_INIT);
+        if(!blocks) {
+            return 0;
+        }
+        memcpy((char*)blocks, (char*)ch->blocks, ch->block_count * sizeof(struct dma_control_block));
+        free(ch->blocks);
+        ch->blocks = blocks;
+        ch->block_capacity *= 2;
+    }
+    return &ch->blocks[ch->block_count++];
+}
+
+
+// Splits a kernel buffer at physical discontinuities and appends one control block per piece
+static int dma_chain_memory(struct dma_channel *ch, uint32_t ti, uint32_t peripheral_ad, void *buf, uint64_t size, bool_t to_memory) {
+    char *va = buf;
+    ti |= to_memory ? DMA_TI_DEST_INC : DMA_TI_SRC_INC;
+    while(size) {
+        uint64_t phys = dma_physical_address(va);
+        if(!phys) {
+            return -1;
+        }
+        uint64_t length = PAGE_SIZE - ((uint64_t)va & (PAGE_SIZE - 1));
+        // Extend the piece over physically contiguous pages
+        while(length < size && length < DMA_MAX_BLOCK_LENGTH && dma_physical_address(va + length) == phys + length) {
+            length += PAGE_SIZE;
+        }
+        if(length > size) {
+            length = size;
+        }
+
+        uint32_t memory_ad = dma_bus_address(phys);
+        uint32_t source_ad = to_memory ? peripheral_ad : memory_ad;
+        uint32_t dest_ad = to_memory ? memory_ad : peripheral_ad;
+        struct dma_control_block *prev = ch->block_count ? &ch->blocks[ch->block_count - 1] : 0;
+        if(prev && prev->ti == ti && (to_memory ? (prev->source_ad == source_ad && prev->dest_ad + prev->txfr_len == dest_ad)
+                                                : (prev->dest_ad == dest_ad && prev->source_ad + prev->txfr_len == source_ad))) {
+            prev->txfr_len += length;
+        } else {
+            struct dma_control_block *cb = dma_chain_append(ch);
+            if(!cb) {
+                return -1;
+            }
+            *cb = (struct dma_control_block){0};
+            cb->ti = ti;
+            cb->source_ad = source_ad;
+            cb->dest_ad = dest_ad;
+            cb->txfr_len = length;
+        }
+        va += length;
+        size -= length;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Appends a transfer from a fixed bus address (a peripheral FIFO) into a kernel buffer.
+ * The buffer is split at physical discontinuities, every piece gets its own control block.
+ * 
+ * @param ch Channel
+ * @param ti Transfer information flags of the peripheral side (DREQ, PERMAP, WAIT_RESP)
+ * @param source_ad Bus address of the source
+ * @param dest Kernel buffer. Must be 4 byte aligned.
+ * @param size Size of the buffer
+ * @return 0 on success, -1 if the buffer is unmapped or the chain cannot grow
+ */
+int dma_chain_to_memory(struct dma_channel *ch, uint32_t ti, uint32_t source_ad, void *dest, uint64_t size) {
+    return dma_chain_memory(ch, ti, source_ad, dest, size, true);
+}
+
+
+/**
+ * @brief Appends a transfer from a kernel buffer to a fixed bus address (a peripheral FIFO).
+ * 
+ * @param ch Channel
+ * @param ti Transfer information flags of the peripheral side (DREQ, PERMAP, WAIT_RESP)
+ * @param source Kernel buffer. Must be 4 byte aligned.
+ * @param dest_ad Bus address of the destination
+ * @param size Size of the buffer
+ * @return 0 on success, -1 if the buffer is unmapped or the chain cannot grow
+ */
+int dma_chain_from_memory(struct dma_channel *ch, uint32_t ti, void *source, uint32_t dest_ad, uint64_t size) {
+    return dma_chain_memory(ch, ti, dest_ad, source, size, false);
+}
+
+
+/**
+ * @brief Starts the chain of the channel and blocks until it completes.
+ * The calling thread sleeps until the completion interrupt. Before the scheduler runs, the CPU waits for interrupts instead.
+ * 
+ * @param ch Channel with a prepared chain
+ * @return 0 on success, -1 on a bus error or timeout
+ */
+int dma_run(struct dma_channel *ch) {
+    if(!ch->block_count) {
+        return 0;
+    }
+    // Link the chain, only the last block raises the interrupt
+    for(uint32_t i = 0; i < ch->block_count; i++) {
+        struct dma_control_block *cb = &ch->blocks[i];
+        if(i + 1 < ch->block_count) {
+            cb->ti &= ~DMA_TI_INTEN;
+            cb->nextconbk = dma_bus_address(dma_physical_address(&ch->blocks[i + 1]));
+        } else {
+            cb->ti |= DMA_TI_INTEN;
+            cb->nextconbk = 0;
+        }
+    }
+    // Control blocks are read by the engine
+    dcache_clean_range(ch->blocks, ch->block_count * sizeof(struct dma_control_block));
+
+    uint64_t flags = irq_save();
+    ch->done = false;
+    ch->status = 0;
+    ch->timeout.callback = dma_timeout;
+    ch->timeout.data = ch;
+    timer_add(&ch->timeout, read_system_timer() + DMA_TIMEOUT_US);
+    put32(DMA_CONBLK_AD(ch), dma_bus_address(dma_physical_address(ch->blocks)));
+    put32(DMA_CS(ch), DMA_CS_ACTIVE | DMA_CS_WAIT_FOR_OUTSTANDING_WRITES);
+    while(!ch->done) {
+        if(kernel_curr_process) {
+            wait_queue_sleep(&ch->waiters, 0);
+        } else {
+            wait_for_interrupt();
+        }
+    }
+    timer_cancel(&ch->timeout);
+    irq_restore(flags);
+
+    if(!(ch->status & DMA_CS_END) || (ch->status & DMA_CS_ERROR)) {
+        print("dma: channel {i} failed (CS 0x{x}, DEBUG 0x{x})\n", ch->index, get32(DMA_CS(ch)), get32(DMA_DEBUG(ch)));
+        put32(DMA_CS(ch), DMA_CS_RESET);
+        return -1;
+    }
+    return 0;
+}
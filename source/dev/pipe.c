@@ -0,0 +1,254 @@
+#include <kernel/pipe.h>
+#include <kernel/alloc.h>
+#include <kernel/mem.h>
+#include <kernel/page.h>
+#include <kernel/process.h>
+#include <kernel/address_space.h>
+
+#define PIPE_WAIT_READ   0
+#define PIPE_WAIT_SPLICE 1
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+
+/**
+ * @brief Allocates a pipe. Both ends start without references.
+ * 
+ * @return The new pipe or null
+ */
+struct pipe *alloc_pipe() {
+    struct pipe *p = kmalloc(sizeof(struct pipe), ALLOC_ZERO_INIT);
+    if(!p) {
+        return 0;
+    }
+    p->buffer = kmalloc(PIPE_BUFFER_SIZE, 0);
+    if(!p->buffer) {
+        free(p);
+        return 0;
+    }
+    p->read_end.pipe = p;
+    p->read_end.write = false;
+    p->write_end.pipe = p;
+    p->write_end.write = true;
+    return p;
+}
+
+
+void pipe_end_get(struct pipe_end *end) {
+    end->refcount++;
+}
+
+
+/**
+ * @brief Drops a reference to a pipe end. Closing the last write end wakes readers, which will then read EOF.
+ * Closing the last read end wakes writers, which will fail. The pipe is freed once both ends are closed.
+ * 
+ * @param end The pipe end
+ */
+void pipe_end_put(struct pipe_end *end) {
+    struct pipe *p = end->pipe;
+    end->refcount--;
+    if(end->refcount) {
+        return;
+    }
+    if(end->write) {
+        wait_queue_wake_all(&p->read_queue);
+        poll_notify(&p->pollers, POLLHUP);
+    } else {
+        wait_queue_wake_all(&p->write_queue);
+        poll_notify(&p->pollers, POLLERR);
+    }
+    if(!p->read_end.refcount && !p->write_end.refcount) {
+        poll_head_release(&p->pollers);
+        free(p->buffer);
+        free(p);
+    }
+}
+
+
+/**
+ * @brief Shares whole pages of the writers buffer with the blocked reader. The pages are mapped
+ * copy-on-write into both address spaces.
+ * 
+ * @param p The pipe
+ * @param src Page aligned user address of the data
+ * @param count Number of bytes available at src
+ * @return Number of bytes passed to the reader
+ */
+static int64_t pipe_splice_pages(struct pipe *p, uint64_t src, int64_t count) {
+    struct process *writer = kernel_curr_process->leader;
+    struct process *reader = p->splice_thread->leader;
+    uint64_t len = min((uint64_t)count, p->splice_len) & ~(PAGE_SIZE - 1ul);
+
+    uint64_t done = 0;
+    for(; done < len; done += PAGE_SIZE) {
+        uint64_t vaddr = src + done;
+        uint64_t dest = p->splice_addr + done;
+        struct address_mapping *sm = address_space_find_mapping(writer->addr_space, vaddr);
+        struct address_mapping *dm = address_space_find_mapping(reader->addr_space, dest);
+        // Only user pages can be shared. Shared memory must stay shared, it cannot be made copy-on-write.
+        if(!sm || !dm || !(sm->flags & MAPPING_FLAG_PAGES) || !(dm->flags & MAPPING_FLAG_PAGES) || (dm->flags & MAPPING_FLAG_READONLY)) {
+            break;
+        }
+        uint64_t paddr = sm->paddress + (vaddr - sm->vaddress);
+        uint64_t old_paddr = dm->paddress + (dest - dm->vaddress);
+        // Only the spliced page of the writer becomes copy-on-write
+        if(!(sm->flags & MAPPING_FLAG_COW) && !remap_memory_page(writer->addr_space, sm, vaddr, paddr, sm->flags | MAPPING_FLAG_COW)) {
+            break;
+        }
+        user_page_get(paddr);
+        if(!remap_memory_page(reader->addr_space, dm, dest, paddr, dm->flags | MAPPING_FLAG_COW)) {
+            user_page_put(paddr);
+            break;
+        }
+        // The page that the reader had mapped before is replaced
+        user_page_put(old_paddr);
+    }
+
+    if(done) {
+        p->splice_done = done;
+        p->splice_thread = 0;
+        wait_queue_wake_all(&p->read_queue);
+    }
+    return done;
+}
+
+
+/**
+ * @brief Reads from a pipe. Blocks until data is available, or all write ends have been closed.
+ * 
+ * @param end Read end of the pipe
+ * @param buf User buffer
+ * @param count Size of the buffer
+ * @return Number of bytes read, 0 for EOF, or -1 on failure
+ */
+int64_t pipe_read(struct pipe_end *end, char *buf, int64_t count) {
+    struct pipe *p = end->pipe;
+    if(end->write) {
+        return -1;
+    }
+    if(count <= 0) {
+        return 0;
+    }
+
+    while(1) {
+        uint32_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = p->tail;
+        if(head != tail) {
+            uint32_t n = min((uint64_t)(head - tail), (uint64_t)count);
+            uint32_t offset = tail & (PIPE_BUFFER_SIZE - 1);
+            uint32_t first = min(n, PIPE_BUFFER_SIZE - offset);
+            memcpy(buf, p->buffer + offset, first);
+            memcpy(buf + first, p->buffer, n - first);
+            __atomic_store_n(&p->tail, tail + n, __ATOMIC_RELEASE);
+            wait_queue_wake_all(&p->write_queue);
+            poll_notify(&p->pollers, POLLOUT);
+            return n;
+        }
+        if(!p->write_end.refcount) {
+            return 0;
+        }
+
+        // Offer the buffer to the writer for splicing, if it spans whole pages
+        uint64_t key = PIPE_WAIT_READ;
+        if(!((uint64_t)buf & (PAGE_SIZE - 1)) && count >= PAGE_SIZE) {
+            p->splice_thread = kernel_curr_process;
+            p->splice_addr = (uint64_t)buf;
+            p->splice_len = count & ~(PAGE_SIZE - 1ul);
+            p->splice_done = 0;
+            key = PIPE_WAIT_SPLICE;
+        }
+        wait_queue_sleep(&p->read_queue, key);
+        if(key == PIPE_WAIT_SPLICE) {
+            uint64_t done = p->splice_done;
+            p->splice_thread = 0;
+            p->splice_done = 0;
+            if(done) {
+                return done;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Writes to a pipe. Blocks until all data has been written, or all read ends have been closed.
+ * 
+ * @param end Write end of the pipe
+ * @param buf User buffer
+ * @param count Number of bytes to write
+ * @return Number of bytes written, or -1 if there are no readers
+ */
+int64_t pipe_write(struct pipe_end *end, char *buf, int64_t count) {
+    struct pipe *p = end->pipe;
+    if(!end->write) {
+        return -1;
+    }
+
+    int64_t written = 0;
+    while(written < count) {
+        if(!p->read_end.refcount) {
+            return written ? written : -1;
+        }
+        uint32_t head = p->head;
+        uint32_t tail = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+
+        // Zero-copy path. The ring must be empty to preserve the order of the data.
+        uint64_t src = (uint64_t)buf + written;
+        if(head == tail && count - written >= PAGE_SIZE && !(src & (PAGE_SIZE - 1))
+            && p->splice_thread && wait_queue_find(&p->read_queue, PIPE_WAIT_SPLICE) == p->splice_thread) {
+            int64_t n = pipe_splice_pages(p, src, count - written);
+            if(n) {
+                written += n;
+                continue;
+            }
+        }
+
+        uint32_t space = PIPE_BUFFER_SIZE - (head - tail);
+        if(space) {
+            uint32_t n = min((uint64_t)space, (uint64_t)(count - written));
+            uint32_t offset = head & (PIPE_BUFFER_SIZE - 1);
+            uint32_t first = min(n, PIPE_BUFFER_SIZE - offset);
+            memcpy(p->buffer + offset, buf + written, first);
+            memcpy(p->buffer, buf + written + first, n - first);
+            __atomic_store_n(&p->head, head + n, __ATOMIC_RELEASE);
+            wait_queue_wake_all(&p->read_queue);
+            poll_notify(&p->pollers, POLLIN);
+            written += n;
+            continue;
+        }
+        wait_queue_sleep(&p->write_queue, 0);
+    }
+    return written;
+}
+
+
+/**
+ * @brief Returns the readiness of a pipe end.
+ * 
+ * @param end Pipe end
+ * @param head Receives the poll head of the pipe
+ * @return POLL* event mask
+ */
+uint32_t pipe_poll(struct pipe_end *end, struct poll_head **head) {
+    struct pipe *p = end->pipe;
+    uint32_t used = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+    uint32_t mask = 0;
+    *head = &p->pollers;
+    if(end->write) {
+        if(used < PIPE_BUFFER_SIZE) {
+            mask |= POLLOUT;
+        }
+        if(!p->read_end.refcount) {
+            mask |= POLLERR;
+        }
+    } else {
+        if(used) {
+            mask |= POLLIN;
+        }
+        if(!p->write_end.refcount) {
+            mask |= POLLHUP;
+        }
+    }
+    return mask;
+}
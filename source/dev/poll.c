@@ -0,0 +1,331 @@
+#include <kernel/poll.h>
+#include <kernel/alloc.h>
+#include <kernel/chardev.h>
+#include <kernel/device_types.h>
+#include <kernel/exception.h>
+#include <kernel/pipe.h>
+#include <kernel/process.h>
+#include <kernel/timer.h>
+#include <kernel/timerfd.h>
+
+#define POLL_ALWAYS (POLLERR | POLLHUP | POLLNVAL)
+
+
+// Appends the entry to the ready list of its set, unless it is already queued.
+static void poll_entry_queue(struct poll_entry *e) {
+    struct poll_set *set = e->set;
+    if(e->ready) {
+        return;
+    }
+    e->ready = true;
+    e->ready_next = 0;
+    if(set->ready_tail) {
+        set->ready_tail->ready_next = e;
+    } else {
+        set->ready_head = e;
+    }
+    set->ready_tail = e;
+}
+
+
+static void poll_entry_unqueue(struct poll_entry *e) {
+    struct poll_set *set = e->set;
+    struct poll_entry *prev = 0;
+    for(struct poll_entry *i = set->ready_head; i; i = i->ready_next) {
+        if(i == e) {
+            if(prev) {
+                prev->ready_next = e->ready_next;
+            } else {
+                set->ready_head = e->ready_next;
+            }
+            if(set->ready_tail == e) {
+                set->ready_tail = prev;
+            }
+            break;
+        }
+        prev = i;
+    }
+    e->ready = false;
+    e->ready_next = 0;
+}
+
+
+static void poll_entry_detach(struct poll_entry *e) {
+    if(!e->head) {
+        return;
+    }
+    for(struct poll_entry **i = &e->head->entries; *i; i = &(*i)->head_next) {
+        if(*i == e) {
+            *i = e->head_next;
+            break;
+        }
+    }
+    e->head = 0;
+    e->head_next = 0;
+}
+
+
+/**
+ * @brief Called by devices when their readiness changes. Queues the interested entries and wakes their pollers.
+ * May be called from interrupt handlers.
+ * 
+ * @param head Poll head of the device
+ * @param events Events that may have become ready
+ */
+void poll_notify(struct poll_head *head, uint32_t events) {
+    uint64_t flags = irq_save();
+    for(struct poll_entry *e = head->entries; e; e = e->head_next) {
+        if(events & (e->events | POLL_ALWAYS)) {
+            poll_entry_queue(e);
+            wait_queue_wake_all(&e->set->waiters);
+        }
+    }
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Called by devices before they are freed. Attached entries stay in their sets and report POLLNVAL.
+ * 
+ * @param head Poll head of the device
+ */
+void poll_head_release(struct poll_head *head) {
+    uint64_t flags = irq_save();
+    struct poll_entry *e = head->entries;
+    while(e) {
+        struct poll_entry *next = e->head_next;
+        e->head = 0;
+        e->head_next = 0;
+        e->dev = 0;
+        poll_entry_queue(e);
+        wait_queue_wake_all(&e->set->waiters);
+        e = next;
+    }
+    head->entries = 0;
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Returns the current readiness of a stream device.
+ * 
+ * @param dev Device of a stream descriptor
+ * @param dev_type Device type
+ * @param head Receives the poll head that is notified on changes, or null if the readiness never changes
+ * @return POLL* event mask
+ */
+uint32_t stream_poll(void *dev, uint8_t dev_type, struct poll_head **head) {
+    *head = 0;
+    if(!dev) {
+        return POLLNVAL;
+    }
+    switch(dev_type) {
+    case DEVICE_TYPE_CHAR:
+        return char_dev_poll(dev, head);
+    case DEVICE_TYPE_PIPE:
+        return pipe_poll(dev, head);
+    case DEVICE_TYPE_TIMER:
+        return timerfd_poll(dev, head);
+    default:
+        // Nested epoll sets are not supported
+        return POLLNVAL;
+    }
+}
+
+
+/**
+ * @brief Starts watching a stream. The entry is queued right away if the stream is already ready.
+ * 
+ * @param set Poll set
+ * @param fd Stream id, used to find the entry again
+ * @param dev Device of the stream
+ * @param dev_type Device type
+ * @param events POLL* events of interest. POLLERR and POLLHUP are always reported.
+ * @param data Value returned with the events
+ * @return The new entry or null
+ */
+struct poll_entry *poll_set_add(struct poll_set *set, int32_t fd, void *dev, uint8_t dev_type, uint32_t events, uint64_t data) {
+    struct poll_entry *e = kmalloc(sizeof(struct poll_entry), ALLOC_ZERO_INIT);
+    if(!e) {
+        return 0;
+    }
+    e->set = set;
+    e->fd = fd;
+    e->dev = dev;
+    e->dev_type = dev_type;
+    e->events = events;
+    e->data = data;
+
+    uint64_t flags = irq_save();
+    struct poll_head *head;
+    uint32_t mask = stream_poll(dev, dev_type, &head);
+    if(head) {
+        e->head = head;
+        e->head_next = head->entries;
+        head->entries = e;
+    }
+    e->set_next = set->entries;
+    set->entries = e;
+    if(mask & (events | POLL_ALWAYS)) {
+        poll_entry_queue(e);
+    }
+    irq_restore(flags);
+    return e;
+}
+
+
+struct poll_entry *poll_set_find(struct poll_set *set, int32_t fd) {
+    for(struct poll_entry *e = set->entries; e; e = e->set_next) {
+        if(e->fd == fd) {
+            return e;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Stops watching the stream of the entry and frees it.
+ * 
+ * @param set Poll set
+ * @param e Entry of the set
+ */
+void poll_set_remove(struct poll_set *set, struct poll_entry *e) {
+    uint64_t flags = irq_save();
+    poll_entry_detach(e);
+    if(e->ready) {
+        poll_entry_unqueue(e);
+    }
+    for(struct poll_entry **i = &set->entries; *i; i = &(*i)->set_next) {
+        if(*i == e) {
+            *i = e->set_next;
+            break;
+        }
+    }
+    irq_restore(flags);
+    free(e);
+}
+
+
+void poll_set_clear(struct poll_set *set) {
+    while(set->entries) {
+        poll_set_remove(set, set->entries);
+    }
+}
+
+
+static void poll_timeout(struct timer *t) {
+    wait_queue_wake(t->data);
+}
+
+
+/**
+ * @brief Blocks the current thread until an entry of the set is notified, or the deadline passes.
+ * Entries queued before the call are dropped from the ready list, the caller must already have checked them.
+ * 
+ * @param set Poll set
+ * @param deadline System timer value in microseconds, or 0 to wait without timeout
+ * @return 0 if the thread slept, 1 if the deadline had already passed
+ */
+int poll_set_sleep(struct poll_set *set, uint64_t deadline) {
+    struct process *p = kernel_curr_process;
+    uint64_t flags = irq_save();
+    while(set->ready_head) {
+        poll_entry_unqueue(set->ready_head);
+    }
+    if(deadline) {
+        if(read_system_timer() >= deadline) {
+            irq_restore(flags);
+            return 1;
+        }
+        p->timeout.callback = poll_timeout;
+        p->timeout.data = p;
+        timer_add(&p->timeout, deadline);
+    }
+    wait_queue_sleep(&set->waiters, 0);
+    timer_cancel(&p->timeout);
+    irq_restore(flags);
+    return 0;
+}
+
+
+struct poll_set *alloc_epoll_set() {
+    return kmalloc(sizeof(struct poll_set), ALLOC_ZERO_INIT);
+}
+
+
+void epoll_set_get(struct poll_set *set) {
+    set->refcount++;
+}
+
+
+/**
+ * @brief Drops a reference to an epoll set. The set and its entries are freed with the last reference.
+ * 
+ * @param set Epoll set
+ */
+void epoll_set_put(struct poll_set *set) {
+    set->refcount--;
+    if(set->refcount) {
+        return;
+    }
+    poll_set_clear(set);
+    free(set);
+}
+
+
+/**
+ * @brief Collects the ready entries of an epoll set. The set is level triggered: reported entries stay queued,
+ * and are dropped from the ready list once a later check finds them idle.
+ * 
+ * @param set Epoll set
+ * @param events Output array. Must be writable.
+ * @param max_events Size of the output array
+ * @return Number of events stored
+ */
+int epoll_set_harvest(struct poll_set *set, struct epoll_event *events, int max_events) {
+    uint64_t flags = irq_save();
+    struct poll_entry *e = set->ready_head;
+    set->ready_head = 0;
+    set->ready_tail = 0;
+
+    int count = 0;
+    while(e) {
+        struct poll_entry *next = e->ready_next;
+        e->ready = false;
+        if(count == max_events) {
+            poll_entry_queue(e);
+            e = next;
+            continue;
+        }
+        struct poll_head *head;
+        uint32_t mask = stream_poll(e->dev, e->dev_type, &head) & (e->events | POLL_ALWAYS);
+        if(mask) {
+            events[count].events = mask;
+            events[count].reserved = 0;
+            events[count].data = e->data;
+            count++;
+            // Streams without a device are reported once
+            if(e->dev) {
+                poll_entry_queue(e);
+            }
+        }
+        e = next;
+    }
+    irq_restore(flags);
+    return count;
+}
+
+
+/**
+ * @brief Releases the poll state of a thread that is being destroyed.
+ * 
+ * @param p The thread
+ */
+void poll_abort(struct process *p) {
+    timer_cancel(&p->timeout);
+    if(p->poll_set) {
+        poll_set_clear(p->poll_set);
+        p->poll_set = 0;
+    }
+}
@@ -0,0 +1,92 @@
+#include <kernel/timerfd.h>
+#include <kernel/alloc.h>
+#include <kernel/exception.h>
+
+
+static void timer_stream_expired(struct timer *timer) {
+    struct timer_stream *t = timer->data;
+    t->expirations++;
+    if(t->interval) {
+        // Catch up without drifting. Missed periods are counted as expirations.
+        uint64_t next = timer->expires + t->interval;
+        uint64_t now = read_system_timer();
+        if(next <= now) {
+            uint64_t missed = (now - next) / t->interval + 1;
+            t->expirations += missed;
+            next += missed * t->interval;
+        }
+        timer_add(timer, next);
+    }
+    wait_queue_wake_all(&t->read_queue);
+    poll_notify(&t->pollers, POLLIN);
+}
+
+
+/**
+ * @brief Allocates and starts a timer stream. It has no references yet.
+ * 
+ * @param initial_us Delay of the first expiry in microseconds. Must not be zero.
+ * @param interval_us Period after the first expiry, or 0 for a one shot timer
+ * @return The timer stream or null
+ */
+struct timer_stream *alloc_timer_stream(uint64_t initial_us, uint64_t interval_us) {
+    struct timer_stream *t = kmalloc(sizeof(struct timer_stream), ALLOC_ZERO_INIT);
+    if(!t) {
+        return 0;
+    }
+    t->interval = interval_us;
+    t->timer.callback = timer_stream_expired;
+    t->timer.data = t;
+    timer_add(&t->timer, read_system_timer() + initial_us);
+    return t;
+}
+
+
+void timer_stream_get(struct timer_stream *t) {
+    t->refcount++;
+}
+
+
+void timer_stream_put(struct timer_stream *t) {
+    t->refcount--;
+    if(t->refcount) {
+        return;
+    }
+    timer_cancel(&t->timer);
+    poll_head_release(&t->pollers);
+    free(t);
+}
+
+
+/**
+ * @brief Reads the number of expirations since the last read. Blocks until the timer has expired.
+ * 
+ * @param t Timer stream
+ * @param buf User buffer
+ * @param count Size of the buffer. Must be at least 8 bytes.
+ * @return 8, or -1 on failure
+ */
+int64_t timerfd_read(struct timer_stream *t, char *buf, int64_t count) {
+    if(count < (int64_t)sizeof(uint64_t)) {
+        return -1;
+    }
+    uint64_t flags = irq_save();
+    while(!t->expirations) {
+        // A one shot timer that has already expired and was read never becomes readable again
+        if(!t->timer.pending) {
+            irq_restore(flags);
+            return -1;
+        }
+        wait_queue_sleep(&t->read_queue, 0);
+    }
+    *(uint64_t*)buf = t->expirations;
+    t->expirations = 0;
+    irq_restore(flags);
+    return sizeof(uint64_t);
+}
+
+
+uint32_t timerfd_poll(struct timer_stream *t, struct poll_head **head) {
+    *head = &t->pollers;
+    return t->expirations ? POLLIN : 0;
+}
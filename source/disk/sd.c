@@ -5,6 +5,12 @@
 #include <kernel/string.h>
 #include <kernel/block.h>
 #include <kernel/mmap.h>
+#include <kernel/timer.h>
+#include <kernel/cache.h>
+#include <kernel/dma.h>
+#include <kernel/exception.h>
+#include <kernel/process.h>
+#include <kernel/waitqueue.h>
 
 #define SDEMMC_PHYSICAL 0x3F300000
 #define SDEMMC_MAPPING_SIZE 0x10000
@@ -39,6 +45,8 @@ static uint64_t sdemmc_base = SDEMMC_PHYSICAL;
 #define SDEMMC_TUNE_STEPS_DDR (sdemmc_base + 0x90ul)
 #define SDEMMC_SPI_INT_SPT (sdemmc_base + 0xf0ul)
 #define SDEMMC_SLOTISR_VER (sdemmc_base + 0xfcul)
+// Data FIFO as seen by the DMA engine
+#define SDEMMC_DATA_BUS DMA_BUS_PERIPHERAL(SDEMMC_PHYSICAL + 0x20ul)
 
 /*
 * SDEMMC Interrupt flags
@@ -53,8 +61,56 @@ static uint64_t sdemmc_base = SDEMMC_PHYSICAL;
 #define SD_INTERRUPT_CTO_ERR (1<<16)
 #define SD_INTERRUPT_ERR (1<<15)
 #define SD_INTERRUPT_DATA_READY (1<<5)
+#define SD_INTERRUPT_WRITE_READY (1<<4)
+#define SD_INTERRUPT_DATA_DONE (1<<1)
+#define SD_INTERRUPT_CMD_DONE (1<<0)
+// Error flags, ERR is only their summary and cannot be enabled as an interrupt
+#define SD_INTERRUPT_ERRORS 0x01FF0000
+
+#define SDEMMC_CONTROL0_HCTL_DWIDTH (1<<1)
+#define SDEMMC_CONTROL0_HCTL_HS_EN (1<<2)
+
+#define SDEMMC_CONTROL1_CLK_INTLEN (1<<0)
+#define SDEMMC_CONTROL1_CLK_STABLE (1<<1)
+#define SDEMMC_CONTROL1_CLK_EN (1<<2)
+// 10 bit divider, low 8 bits in CLK_FREQ8 and high 2 bits in CLK_FREQ_MS2
+#define SDEMMC_CONTROL1_CLK_FREQ_MASK 0xFFE0
+#define SDEMMC_CONTROL1_DATA_TOUNIT(x) ((x)<<16)
+#define SDEMMC_CONTROL1_SRST_DATA (1<<26)
+
+#define SDEMMC_STATUS_CMD_INHIBIT (1<<0)
+#define SDEMMC_STATUS_DAT_INHIBIT (1<<1)
+
+// Clock of the EMMC controller as set up by the firmware
+#define SD_BASE_CLOCK_HZ 41666666
+#define SD_CLOCK_ID_HZ 400000
+#define SD_CLOCK_NORMAL_HZ 25000000
+#define SD_CLOCK_HIGH_HZ 50000000
+
+// OCR bits in the response of ACMD41
+#define SD_OCR_READY (1u<<31)
+#define SD_OCR_CCS (1<<30)
+
+// Size of the switch function status returned by CMD6
+#define SD_SWITCH_STATUS_SIZE 64
 
 #define SDMMC_SLEEP (4000000)
+// Timeout of a single command or data phase
+#define SD_TIMEOUT_US 1000000
+#define SD_LATENCY_BUCKETS 16
+#define SD_BLOCK_SIZE 512
+// Limit of the BLKCNT field
+#define SD_MAX_BLOCK_COUNT 0xFFFF
+// Multi block writes of at least this many blocks tell the card to pre-erase them (ACMD23)
+#define SD_PRE_ERASE_MIN_BLOCKS 128
+
+#define SD_BENCH_BYTES (4 * 1024 * 1024)
+#define SD_BENCH_CHUNK (64 * 1024)
+// Sustained throughput is measured with large requests over a larger range
+#define SD_BENCH_SUSTAINED_BYTES (32 * 1024 * 1024)
+#define SD_BENCH_SUSTAINED_CHUNK (1024 * 1024)
+// The write benchmark rewrites the blocks after the first MiB with their own contents
+#define SD_BENCH_WRITE_START_BLK 2048
 
 struct sd_cmd {
     unsigned char cmd_idx;
@@ -96,6 +152,27 @@ struct sd_status {
 };
 
 static unsigned int rca;
+// SDHC and SDXC cards are addressed in blocks, standard capacity cards in bytes
+static bool_t sd_high_capacity;
+static unsigned int sd_bus_width = 1;
+static uint32_t sd_clock_hz;
+// Device initialized by sd_initialize(), used by the monoterm command
+static struct block_dev *sd_dev;
+// Channel feeding the data FIFO into memory. Null if reads use PIO.
+static struct dma_channel *sd_dma;
+
+// Set once the EMMC interrupt is routed to sd_interrupt(). Until then interrupt flags are polled.
+static bool_t sd_irq;
+// Flags collected by the interrupt handler, consumed by sd_wait_interrupt()
+static volatile uint32_t sd_interrupts;
+static volatile bool_t sd_timed_out;
+static struct wait_queue sd_waiters;
+static struct timer sd_timer;
+// The controller handles one request at a time. Further callers sleep until it is released.
+static bool_t sd_busy;
+static struct wait_queue sd_request_queue;
+// Bucket i counts requests that completed in less than 2^(i+1) microseconds, the last bucket the rest
+static uint32_t sd_latency[SD_LATENCY_BUCKETS];
 
 /*
 static void sd_print_err() {
@@ -189,6 +266,107 @@ static struct sd_cid sd_unpack_cid(unsigned int r[4]) {
     return cid;
 }
 
+static void sd_interrupt(void *data) {
+    uint32_t interrupt = get32(SDEMMC_INTERRUPT);
+    // Acknowledge, and keep the line quiet until the next wait enables the flags it needs
+    put32(SDEMMC_INTERRUPT, interrupt);
+    put32(SDEMMC_IRPT_EN, 0);
+    sd_interrupts |= interrupt;
+    wait_queue_wake_all(&sd_waiters);
+}
+
+static void sd_timeout(struct timer *t) {
+    sd_timed_out = true;
+    wait_queue_wake_all(&sd_waiters);
+}
+
+/**
+ * @brief Blocks until one of the interrupt flags is raised, or an error occurs.
+ * The calling process sleeps until the EMMC interrupt. Before the scheduler runs, the CPU waits for interrupts instead.
+ * 
+ * @param mask SD_INTERRUPT_* flags to wait for. They are acknowledged.
+ * @param interrupt Receives all flags collected during the wait, may be null
+ * @return 0 on success, -1 on error or timeout
+ */
+static int sd_wait_interrupt(uint32_t mask, uint32_t *interrupt) {
+    uint64_t flags = irq_save();
+    uint64_t deadline = read_system_timer() + SD_TIMEOUT_US;
+    sd_timed_out = false;
+    if(sd_irq) {
+        sd_timer.callback = sd_timeout;
+        timer_add(&sd_timer, deadline);
+    }
+    while(!(sd_interrupts & (mask | SD_INTERRUPT_ERR)) && !sd_timed_out) {
+        if(!sd_irq) {
+            uint32_t pending = get32(SDEMMC_INTERRUPT);
+            put32(SDEMMC_INTERRUPT, pending);
+            sd_interrupts |= pending;
+            sd_timed_out = read_system_timer() >= deadline;
+        } else {
+            put32(SDEMMC_IRPT_EN, mask | SD_INTERRUPT_ERRORS);
+            if(kernel_curr_process) {
+                wait_queue_sleep(&sd_waiters, 0);
+            } else {
+                wait_for_interrupt();
+            }
+        }
+    }
+    if(sd_irq) {
+        timer_cancel(&sd_timer);
+    }
+    uint32_t collected = sd_interrupts;
+    sd_interrupts &= ~mask;
+    irq_restore(flags);
+
+    if(interrupt) {
+        *interrupt = collected;
+    }
+    if(collected & SD_INTERRUPT_ERR) {
+        return -1;
+    }
+    return (collected & mask) ? 0 : -1;
+}
+
+static void sd_record_latency(uint64_t start) {
+    uint64_t elapsed = read_system_timer() - start;
+    int bucket = 0;
+    while(bucket < SD_LATENCY_BUCKETS - 1 && elapsed >= (2ul << bucket)) {
+        bucket++;
+    }
+    sd_latency[bucket]++;
+}
+
+static void sd_print_latency() {
+    print("Request latency:\n");
+    for(int i = 0; i < SD_LATENCY_BUCKETS; i++) {
+        if(!sd_latency[i]) {
+            continue;
+        }
+        if(i == SD_LATENCY_BUCKETS - 1) {
+            print("  >= {ul} us: {u}\n", 1ul << i, sd_latency[i]);
+        } else {
+            print("  <  {ul} us: {u}\n", 2ul << i, sd_latency[i]);
+        }
+    }
+}
+
+// Waits until the controller is free and claims it for the calling process
+static void sd_request_begin() {
+    uint64_t flags = irq_save();
+    while(sd_busy) {
+        wait_queue_sleep(&sd_request_queue, 0);
+    }
+    sd_busy = true;
+    irq_restore(flags);
+}
+
+static void sd_request_end() {
+    uint64_t flags = irq_save();
+    sd_busy = false;
+    wait_queue_wake_all(&sd_request_queue);
+    irq_restore(flags);
+}
+
 static int sd_exec_cmd(struct sd_cmd cmd, unsigned int arg, unsigned int *ret) {
     uint32_t cmd_word;
     cmd_word = 0;
@@ -203,17 +381,22 @@ static int sd_exec_cmd(struct sd_cmd cmd, unsigned int arg, unsigned int *ret) {
     cmd_word |= (cmd.xfer_auto_cmd_en & 0b11) << 2;
     cmd_word |= (cmd.xfer_blkcnt_en & 0b1) << 1;
 
+    uint64_t start = read_system_timer();
     put32(SDEMMC_INTERRUPT, 0xFFFFFFFF);
+    sd_interrupts = 0;
     put32(SDEMMC_ARG1, arg);
     put32(SDEMMC_CMDTM, cmd_word);
-    
-    unsigned int timeout = SDMMC_SLEEP;
-    while(!(get32(SDEMMC_INTERRUPT) & 0x01)) {
-        if(!timeout--) return -1;
+
+    uint32_t interrupt;
+    int timed_out = sd_wait_interrupt(SD_INTERRUPT_CMD_DONE, &interrupt) && !(interrupt & SD_INTERRUPT_ERR);
+    if(!cmd.is_data) {
+        // Data commands are accounted once their data phase completes
+        sd_record_latency(start);
     }
     // Check if error occured
-    uint32_t interrupt = get32(SDEMMC_INTERRUPT);
-    if(interrupt & SD_INTERRUPT_CTO_ERR) {
+    if(timed_out) {
+        return -1;
+    } else if(interrupt & SD_INTERRUPT_CTO_ERR) {
         #ifdef DEBUG_SD
         print("SD Timeout during CMD{i}\n", (int)cmd.cmd_idx);
         #endif /* DEBUG_SD */
@@ -388,7 +571,8 @@ static int sd_exec_cmd55() {
     cmd.index_check_en = 1;
     cmd.crc_check_en = 1;
     cmd.response_type = 0x02;
-    if(sd_exec_cmd(cmd, 0, &resp)) {
+    // Addressed to the selected card. The RCA is still 0 during identification.
+    if(sd_exec_cmd(cmd, rca << 16, &resp)) {
         #ifdef DEBUG_SD
         print("SD card error during CMD55\n");
         #endif /* DEBUG_SD */
@@ -423,7 +607,7 @@ static int sd_exec_acmd41(unsigned int *resp) {
 
 static int sd_exec_cmd17(uint32_t block) {
     // Read one block of data from the SD card
-    put32(SDEMMC_BLKSIZECNT, (1 << 16) | 512);
+    put32(SDEMMC_BLKSIZECNT, (1 << 16) | SD_BLOCK_SIZE);
 
     struct sd_cmd cmd;
     unsigned int resp;
@@ -445,6 +629,222 @@ static int sd_exec_cmd17(uint32_t block) {
     return 0;
 }
 
+static int sd_exec_cmd18(uint32_t block, unsigned int count) {
+    // Read multiple blocks of data from the SD card. The controller stops the transfer with CMD12.
+    put32(SDEMMC_BLKSIZECNT, (count << 16) | SD_BLOCK_SIZE);
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    int ret;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 18;
+    cmd.is_data = 1;
+    cmd.xfer_data_dir = 1;
+    cmd.xfer_multi_block = 1;
+    cmd.xfer_blkcnt_en = 1;
+    cmd.xfer_auto_cmd_en = 0x01; // Auto CMD12
+    cmd.index_check_en = 0;
+    cmd.crc_check_en = 0;
+    cmd.response_type = 0x02;
+
+    if((ret = sd_exec_cmd(cmd, block, &resp))) {
+        #ifdef DEBUG_SD
+        print("SD card error during CMD18\n");
+        #endif /* DEBUG_SD */
+        return ret;
+    }
+    return 0;
+}
+
+
+static int sd_exec_cmd24(uint32_t block) {
+    // Write one block of data to the SD card
+    put32(SDEMMC_BLKSIZECNT, (1 << 16) | SD_BLOCK_SIZE);
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    int ret;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 24;
+    cmd.is_data = 1;
+    cmd.xfer_data_dir = 0;
+    cmd.index_check_en = 0;
+    cmd.crc_check_en = 0;
+    cmd.response_type = 0x02;
+
+    if((ret = sd_exec_cmd(cmd, block, &resp))) {
+        #ifdef DEBUG_SD
+        print("SD card error during CMD24\n");
+        #endif /* DEBUG_SD */
+        return ret;
+    }
+    return 0;
+}
+
+static int sd_exec_cmd25(uint32_t block, unsigned int count) {
+    // Write multiple blocks of data to the SD card. The controller stops the transfer with CMD12.
+    put32(SDEMMC_BLKSIZECNT, (count << 16) | SD_BLOCK_SIZE);
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    int ret;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 25;
+    cmd.is_data = 1;
+    cmd.xfer_data_dir = 0;
+    cmd.xfer_multi_block = 1;
+    cmd.xfer_blkcnt_en = 1;
+    cmd.xfer_auto_cmd_en = 0x01; // Auto CMD12
+    cmd.index_check_en = 0;
+    cmd.crc_check_en = 0;
+    cmd.response_type = 0x02;
+
+    if((ret = sd_exec_cmd(cmd, block, &resp))) {
+        #ifdef DEBUG_SD
+        print("SD card error during CMD25\n");
+        #endif /* DEBUG_SD */
+        return ret;
+    }
+    return 0;
+}
+
+static int sd_exec_acmd23(unsigned int count) {
+    // Number of blocks the card may erase before the next multi block write
+    if(sd_exec_cmd55()) {
+        return -1;
+    }
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 23;
+    cmd.index_check_en = 1;
+    cmd.crc_check_en = 1;
+    cmd.response_type = 0x02;
+
+    if(sd_exec_cmd(cmd, count & 0x7FFFFF, &resp)) {
+        #ifdef DEBUG_SD
+        print("SD card error during ACMD23\n");
+        #endif /* DEBUG_SD */
+        return -1;
+    }
+    return 0;
+}
+
+static int sd_exec_acmd6(unsigned int bus_width) {
+    // Set the data bus width of the card, 1 or 4 bits
+    if(sd_exec_cmd55()) {
+        return -1;
+    }
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 6;
+    cmd.index_check_en = 1;
+    cmd.crc_check_en = 1;
+    cmd.response_type = 0x02;
+
+    if(sd_exec_cmd(cmd, bus_width == 4 ? 0x2 : 0x0, &resp)) {
+        #ifdef DEBUG_SD
+        print("SD card error during ACMD6\n");
+        #endif /* DEBUG_SD */
+        return -1;
+    }
+    return 0;
+}
+
+static int sd_exec_cmd6(unsigned int arg) {
+    // Check or switch card functions. The card returns its switch function status as a data block.
+    put32(SDEMMC_BLKSIZECNT, (1 << 16) | SD_SWITCH_STATUS_SIZE);
+
+    struct sd_cmd cmd;
+    unsigned int resp;
+    int ret;
+    cmd = (struct sd_cmd){0};
+    cmd.cmd_idx = 6;
+    cmd.is_data = 1;
+    cmd.xfer_data_dir = 1;
+    cmd.index_check_en = 1;
+    cmd.crc_check_en = 1;
+    cmd.response_type = 0x02;
+
+    if((ret = sd_exec_cmd(cmd, arg, &resp))) {
+        #ifdef DEBUG_SD
+        print("SD card error during CMD6\n");
+        #endif /* DEBUG_SD */
+        return ret;
+    }
+    return 0;
+}
+
+static void sd_reset_data_lines() {
+    put32(SDEMMC_CONTROL1, get32(SDEMMC_CONTROL1) | SDEMMC_CONTROL1_SRST_DATA);
+    unsigned int timeout = SDMMC_SLEEP;
+    while(get32(SDEMMC_CONTROL1) & SDEMMC_CONTROL1_SRST_DATA) {
+        if(!timeout--) return;
+    }
+}
+
+static int sd_read_data(void *buf, unsigned int blocks, unsigned int block_size) {
+    // Read the data of a read command from the FIFO. The caller waits for the end of the transfer.
+    for(unsigned int blk = 0; blk < blocks; blk++) {
+        if(sd_wait_interrupt(SD_INTERRUPT_DATA_READY, 0)) {
+            return -1;
+        }
+        if((uint64_t)buf & 0x3) {
+            uint8_t *buf8 = (uint8_t*)buf + blk * block_size;
+            for(unsigned int i = 0; i < block_size; i += 4) {
+                uint32_t word = get32(SDEMMC_DATA);
+                buf8[i] = word;
+                buf8[i + 1] = word >> 8;
+                buf8[i + 2] = word >> 16;
+                buf8[i + 3] = word >> 24;
+            }
+        } else {
+            uint32_t *buf32 = (uint32_t*)buf + blk * (block_size / 4);
+            for(unsigned int i = 0; i < block_size / 4; i++) {
+                buf32[i] = get32(SDEMMC_DATA);
+            }
+        }
+    }
+    return 0;
+}
+
+static int sd_write_data(void *buf, unsigned int blocks) {
+    // Write the data of a write command into the FIFO. The caller waits for the end of the transfer.
+    for(unsigned int blk = 0; blk < blocks; blk++) {
+        if(sd_wait_interrupt(SD_INTERRUPT_WRITE_READY, 0)) {
+            return -1;
+        }
+        if((uint64_t)buf & 0x3) {
+            uint8_t *buf8 = (uint8_t*)buf + blk * SD_BLOCK_SIZE;
+            for(int i = 0; i < SD_BLOCK_SIZE; i += 4) {
+                put32(SDEMMC_DATA, buf8[i] | (buf8[i + 1] << 8) | (buf8[i + 2] << 16) | ((uint32_t)buf8[i + 3] << 24));
+            }
+        } else {
+            uint32_t *buf32 = (uint32_t*)buf + blk * (SD_BLOCK_SIZE / 4);
+            for(int i = 0; i < SD_BLOCK_SIZE / 4; i++) {
+                put32(SDEMMC_DATA, buf32[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+static int sd_transfer_data_dma(struct bio_vec *vecs, uint32_t vec_count, bool_t write) {
+    // The channel is paced by the data requests of the controller, the FIFO holds the data until it runs
+    if(dma_run(sd_dma)) {
+        return -1;
+    }
+    if(!write) {
+        for(uint32_t i = 0; i < vec_count; i++) {
+            dcache_invalidate_range(vecs[i].buf, vecs[i].blocks * SD_BLOCK_SIZE);
+        }
+    }
+    return 0;
+}
+
 static int sd_get_rca(unsigned int *rca, unsigned int *status) {
     if(sd_exec_cmd3(rca, status)) {
         return -1;
@@ -484,9 +884,73 @@ static void sd_print_cid(struct sd_cid *cid) {
     print("  Serial Number: {u}\n", cid->product_serial);
 }
 
-static int sd_reset() {
-    // TODO: Set clock frequency
+/**
+ * @brief Programs the SD clock to the highest frequency not above the given one.
+ * 
+ * @param hz Target frequency
+ * @return 0 on success, -1 if the clock does not become stable
+ */
+static int sd_set_clock(uint32_t hz) {
+    unsigned int timeout = SDMMC_SLEEP;
+    while(get32(SDEMMC_STATUS) & (SDEMMC_STATUS_CMD_INHIBIT | SDEMMC_STATUS_DAT_INHIBIT)) {
+        if(!timeout--) return -1;
+    }
+    put32(SDEMMC_CONTROL1, get32(SDEMMC_CONTROL1) & ~SDEMMC_CONTROL1_CLK_EN);
 
+    // The divided clock is base / (2 * divisor), a divisor of 0 passes the base clock through
+    uint32_t divisor = 0;
+    if(hz < SD_BASE_CLOCK_HZ) {
+        divisor = (SD_BASE_CLOCK_HZ + 2 * hz - 1) / (2 * hz);
+        if(divisor > 0x3FF) {
+            divisor = 0x3FF;
+        }
+    }
+    uint32_t control1 = get32(SDEMMC_CONTROL1) & ~SDEMMC_CONTROL1_CLK_FREQ_MASK;
+    control1 |= (divisor & 0xFF) << 8;
+    control1 |= ((divisor >> 8) & 0x3) << 6;
+    control1 |= SDEMMC_CONTROL1_CLK_INTLEN;
+    put32(SDEMMC_CONTROL1, control1);
+
+    timeout = SDMMC_SLEEP;
+    while(!(get32(SDEMMC_CONTROL1) & SDEMMC_CONTROL1_CLK_STABLE)) {
+        if(!timeout--) return -1;
+    }
+    put32(SDEMMC_CONTROL1, get32(SDEMMC_CONTROL1) | SDEMMC_CONTROL1_CLK_EN);
+    sd_clock_hz = divisor ? SD_BASE_CLOCK_HZ / (2 * divisor) : SD_BASE_CLOCK_HZ;
+    return 0;
+}
+
+/**
+ * @brief Switches a selected card from the identification setup to a 4 bit bus and the fastest supported clock.
+ * Failures leave the card in a slower, working configuration.
+ */
+static void sd_configure_bus() {
+    // ACMD6: 4 bit data bus. Mandatory for all SD memory cards.
+    if(!sd_exec_acmd6(4)) {
+        put32(SDEMMC_CONTROL0, get32(SDEMMC_CONTROL0) | SDEMMC_CONTROL0_HCTL_DWIDTH);
+        sd_bus_width = 4;
+    } else {
+        print("SD card stays on a 1 bit bus\n");
+    }
+
+    // CMD6: Switch function group 1 to high speed. The card reports the selected function in bits 379:376.
+    uint32_t switch_status[SD_SWITCH_STATUS_SIZE / 4];
+    uint32_t clock = SD_CLOCK_NORMAL_HZ;
+    if(!sd_exec_cmd6(0x80FFFFF1) && !sd_read_data(switch_status, 1, SD_SWITCH_STATUS_SIZE)
+       && !sd_wait_interrupt(SD_INTERRUPT_DATA_DONE, 0)) {
+        if((((uint8_t*)switch_status)[16] & 0xF) == 1) {
+            put32(SDEMMC_CONTROL0, get32(SDEMMC_CONTROL0) | SDEMMC_CONTROL0_HCTL_HS_EN);
+            clock = SD_CLOCK_HIGH_HZ;
+        }
+    } else {
+        sd_reset_data_lines();
+    }
+    if(sd_set_clock(clock)) {
+        print("SD error switching clock\n");
+    }
+}
+
+static int sd_reset() {
     put32(SDEMMC_CONTROL0, 0);
     put32(SDEMMC_CONTROL1, 0);
     // Set SRST_HC bit
@@ -495,21 +959,16 @@ static int sd_reset() {
     while(get32(SDEMMC_CONTROL1) & 1<<24) {
         if(!timeout--) return -1;
     }
-    // Set CLK_INTLEN bit
-    put32(SDEMMC_CONTROL1, get32(SDEMMC_CONTROL1) | 0x1);
-
-    // Set clock
-    // Set CLK_EN bit
-    put32(SDEMMC_CONTROL1, get32(SDEMMC_CONTROL1) | 0x1<<2);
+    put32(SDEMMC_CONTROL1, SDEMMC_CONTROL1_DATA_TOUNIT(0xE));
 
-    timeout = SDMMC_SLEEP;
-    while(!(get32(SDEMMC_CONTROL1) & 0x1<<1)) {
-        if(!timeout--) return -1;
+    // Identification runs at 400 kHz
+    if(sd_set_clock(SD_CLOCK_ID_HZ)) {
+        return -1;
     }
 
-    // Enable all the interrupt bits
+    // Report all flags in the interrupt register. They are routed to the interrupt controller on demand.
     put32(SDEMMC_IRPT_MASK, ~0);
-    put32(SDEMMC_IRPT_EN, ~0);
+    put32(SDEMMC_IRPT_EN, 0);
 
     // CMD0: Send into idle mode
     // -> idle
@@ -530,7 +989,8 @@ static int sd_reset() {
         if(sd_exec_acmd41(&resp)) {
             return -1;
         }
-        if(resp & 0x80000000) {
+        if(resp & SD_OCR_READY) {
+            sd_high_capacity = (resp & SD_OCR_CCS) != 0;
             break;
         }
 
@@ -565,49 +1025,95 @@ static int sd_reset() {
     //sd_exec_cmd13(rca, &status);
     //sd_print_status(&status);
 
+    sd_configure_bus();
     return 0;
 }
 
-static int sd_read_nblk(struct block_dev *dev, void *buf, unsigned int n) {
-    // struct sd_cid cid = sd_get_cid();
-    // print_cid(&cid);
-
-    if(sd_exec_cmd17(dev->iblk * dev->block_size)) {
-        print("SD card error during read!\n");
-        return -1;
-    }
-    int i = 0;
-    unsigned int *buf2 = (unsigned int*)buf;
-    while(get32(SDEMMC_INTERRUPT) & SD_INTERRUPT_DATA_READY && i < 128) {
-        buf2[i] = get32(SDEMMC_DATA);
-        uint8_t data[4];
-        *(uint32_t*)data = buf2[i];
-        if(n > i*4) {
-            ((uint8_t*)buf)[i*4] = data[0];
-        } if(n > i*4 + 1) {
-            ((uint8_t*)buf)[i*4 + 1] = data[1];
-        } if(n > i*4 + 2) {
-            ((uint8_t*)buf)[i*4 + 2] = data[2];
-        } if(n > i*4 + 3) {
-            ((uint8_t*)buf)[i*4 + 3] = data[3];
+static uint32_t sd_block_address(unsigned int blk) {
+    return sd_high_capacity ? blk : blk * SD_BLOCK_SIZE;
+}
+
+// Prepares the DMA chain of a transfer. Returns false if the transfer has to use PIO.
+static bool_t sd_prepare_dma(struct bio_vec *vecs, uint32_t vec_count, bool_t write) {
+    if(!sd_dma) {
+        return false;
+    }
+    // DMA transfers words, unaligned buffers go through the FIFO
+    for(uint32_t i = 0; i < vec_count; i++) {
+        if((uint64_t)vecs[i].buf & 0x3) {
+            return false;
         }
-        i++;
     }
-    dev->iblk++;
-
-    return 1;
+    dma_chain_reset(sd_dma);
+    uint32_t ti = DMA_TI_WAIT_RESP | DMA_TI_PERMAP(DMA_DREQ_EMMC);
+    for(uint32_t i = 0; i < vec_count; i++) {
+        uint64_t size = vecs[i].blocks * SD_BLOCK_SIZE;
+        if(write) {
+            if(dma_chain_from_memory(sd_dma, ti | DMA_TI_DEST_DREQ, vecs[i].buf, SDEMMC_DATA_BUS, size)) {
+                return false;
+            }
+            dcache_clean_range(vecs[i].buf, size);
+        } else {
+            if(dma_chain_to_memory(sd_dma, ti | DMA_TI_SRC_DREQ, SDEMMC_DATA_BUS, vecs[i].buf, size)) {
+                return false;
+            }
+            // Dirty lines must not be written back over the transferred data
+            dcache_clean_invalidate_range(vecs[i].buf, size);
+        }
+    }
+    return true;
 }
 
-static int sd_read_blk(struct block_dev *dev, void *buf) {
-    return sd_read_nblk(dev, buf, dev->block_size);
+static int sd_issue_transfer(unsigned int blk, unsigned int count, bool_t write) {
+    uint32_t address = sd_block_address(blk);
+    if(!write) {
+        return count == 1 ? sd_exec_cmd17(address) : sd_exec_cmd18(address, count);
+    }
+    if(count == 1) {
+        return sd_exec_cmd24(address);
+    }
+    // Only a hint, the write goes ahead if the card rejects it
+    if(count >= SD_PRE_ERASE_MIN_BLOCKS) {
+        sd_exec_acmd23(count);
+    }
+    return sd_exec_cmd25(address, count);
 }
 
-static int sd_seek_blk(struct block_dev *dev, unsigned int iblk) {
-    // Seeking for SD cards is trivial.
-    dev->iblk = iblk;
+// Block device transfer. The blocks of all buffers are moved with a single read or write command.
+static int sd_transfer(struct block_dev *dev, unsigned int blk, struct bio_vec *vecs, uint32_t vec_count, bool_t write) {
+    unsigned int count = 0;
+    for(uint32_t i = 0; i < vec_count; i++) {
+        count += vecs[i].blocks;
+    }
+    sd_request_begin();
+    bool_t use_dma = sd_prepare_dma(vecs, vec_count, write);
+    uint64_t start = read_system_timer();
+    int ret = sd_issue_transfer(blk, count, write);
+    if(!ret) {
+        if(use_dma) {
+            ret = sd_transfer_data_dma(vecs, vec_count, write);
+        } else {
+            for(uint32_t i = 0; i < vec_count && !ret; i++) {
+                ret = write ? sd_write_data(vecs[i].buf, vecs[i].blocks) : sd_read_data(vecs[i].buf, vecs[i].blocks, SD_BLOCK_SIZE);
+            }
+        }
+    }
+    // For writes, this is raised once the card releases DAT0 after programming the last block
+    if(ret || sd_wait_interrupt(SD_INTERRUPT_DATA_DONE, 0)) {
+        print("SD card error during {s}!\n", write ? "write" : "read");
+        sd_reset_data_lines();
+        sd_request_end();
+        return -1;
+    }
+    sd_record_latency(start);
+    sd_request_end();
     return 0;
 }
 
+static void sd_print_bus() {
+    print("SD bus: {u} bit, {u} kHz, {s} addressing\n", sd_bus_width, sd_clock_hz / 1000, sd_high_capacity ? "block" : "byte");
+}
+
 int sd_initialize(struct block_dev *dev) {
     sdemmc_base = (uint64_t)mmap(SDEMMC_PHYSICAL, SDEMMC_MAPPING_SIZE);
     if(!sdemmc_base) {
@@ -615,17 +1121,27 @@ int sd_initialize(struct block_dev *dev) {
         return -1;
     }
     print("SD EMMC peripheral mapped @ 0x{xl}\n", sdemmc_base);
+    if(register_interrupt_handler(PERIPHERAL_INTERRUPT_EMMC, sd_interrupt, 0)) {
+        print("sd: error: failed to register interrupt handler, polling instead\n");
+    } else {
+        sd_irq = true;
+    }
 
     if(sd_reset() != 0) {
         print("SD card initialization failed!\n");
         return -1;
     }
     print("Initalized SD card!\n");
-    dev->block_size = 512;
+    sd_print_bus();
+    sd_dma = dma_channel_alloc();
+    if(sd_dma) {
+        print("SD card transfers use DMA channel {i}\n", sd_dma->index);
+    }
+    dev->block_size = SD_BLOCK_SIZE;
+    dev->max_transfer_blocks = SD_MAX_BLOCK_COUNT;
     strncpy(dev->driver_str, "SD_DEVICE", sizeof(dev->driver_str));
-    dev->read_blk = sd_read_blk;
-    dev->read_nblk = sd_read_nblk;
-    dev->seek_blk = sd_seek_blk;
+    dev->transfer = sd_transfer;
+    sd_dev = dev;
 
     return 0;
 }
@@ -635,27 +1151,108 @@ int sd_initialize(struct block_dev *dev) {
 //}
 
 static int monoterm_sd_help() {
-    print("Usage: 'sd [help|status|cid]'\n");
+    print("Usage: 'sd [help|status|cid|bench|writebench]'\n");
     return 0;
 }
 
 static int monoterm_sd_status() {
     // CMD13: Get status
     struct sd_status status;
-    if(sd_exec_cmd13(rca, &status)) {
+    sd_request_begin();
+    int ret = sd_exec_cmd13(rca, &status);
+    sd_request_end();
+    if(ret) {
         print("SD card returned error for CMD13\n");
         return -1;
     }
     sd_print_status(&status);
+    sd_print_latency();
     return 0;
 }
 
 static int monoterm_sd_cid() {
+    sd_request_begin();
     struct sd_cid cid = sd_get_cid();
+    sd_request_end();
     sd_print_cid(&cid);
     return 0;
 }
 
+// Reads the start of the card with the given number of blocks per request. Prints and returns KiB/s.
+static uint64_t sd_bench_read(struct block_dev *dev, void *buf, uint64_t bytes, int blocks_per_read) {
+    uint64_t start = read_system_timer();
+    seek_blk(dev, 0);
+    for(uint64_t i = 0; i < bytes / SD_BLOCK_SIZE; i += blocks_per_read) {
+        int ret = blocks_per_read == 1 ? read_blk(dev, buf) : read_blks(dev, blocks_per_read, buf);
+        if(ret != blocks_per_read) {
+            print("  Read failed\n");
+            return 0;
+        }
+    }
+    uint64_t elapsed = read_system_timer() - start;
+    uint64_t kib_per_sec = elapsed ? (bytes / 1024) * 1000000ul / elapsed : 0;
+    print("  {u} blocks per request: {ul} KiB/s\n", blocks_per_read, kib_per_sec);
+    return kib_per_sec;
+}
+
+// Rewrites a range of the card in place with the given number of blocks per request. Only the writes are timed.
+static uint64_t sd_bench_write(struct block_dev *dev, void *buf, uint64_t bytes, int blocks_per_write) {
+    uint64_t elapsed = 0;
+    for(uint64_t i = 0; i < bytes / SD_BLOCK_SIZE; i += blocks_per_write) {
+        seek_blk(dev, SD_BENCH_WRITE_START_BLK + i);
+        if(read_blks(dev, blocks_per_write, buf) != blocks_per_write) {
+            print("  Read failed\n");
+            return 0;
+        }
+        seek_blk(dev, SD_BENCH_WRITE_START_BLK + i);
+        uint64_t start = read_system_timer();
+        int ret = blocks_per_write == 1 ? write_blk(dev, buf) : write_blks(dev, blocks_per_write, buf);
+        elapsed += read_system_timer() - start;
+        if(ret != blocks_per_write) {
+            print("  Write failed\n");
+            return 0;
+        }
+    }
+    uint64_t kib_per_sec = elapsed ? (bytes / 1024) * 1000000ul / elapsed : 0;
+    print("  {u} blocks per request: {ul} KiB/s\n", blocks_per_write, kib_per_sec);
+    return kib_per_sec;
+}
+
+static int monoterm_sd_bench() {
+    if(!sd_dev) {
+        return -1;
+    }
+    void *buf = kmalloc(SD_BENCH_SUSTAINED_CHUNK, 0);
+    if(!buf) {
+        return -1;
+    }
+    sd_print_bus();
+    print("Sequential read of {u} KiB:\n", SD_BENCH_BYTES / 1024);
+    sd_bench_read(sd_dev, buf, SD_BENCH_BYTES, 1);
+    sd_bench_read(sd_dev, buf, SD_BENCH_BYTES, SD_BENCH_CHUNK / SD_BLOCK_SIZE);
+    print("Sustained read of {u} KiB:\n", SD_BENCH_SUSTAINED_BYTES / 1024);
+    sd_bench_read(sd_dev, buf, SD_BENCH_SUSTAINED_BYTES, SD_BENCH_SUSTAINED_CHUNK / SD_BLOCK_SIZE);
+    free(buf);
+    return 0;
+}
+
+static int monoterm_sd_writebench() {
+    if(!sd_dev) {
+        return -1;
+    }
+    void *buf = kmalloc(SD_BENCH_SUSTAINED_CHUNK, 0);
+    if(!buf) {
+        return -1;
+    }
+    sd_print_bus();
+    print("Sequential write of {u} KiB:\n", SD_BENCH_BYTES / 1024);
+    sd_bench_write(sd_dev, buf, SD_BENCH_BYTES, 1);
+    sd_bench_write(sd_dev, buf, SD_BENCH_BYTES, SD_BENCH_CHUNK / SD_BLOCK_SIZE);
+    sd_bench_write(sd_dev, buf, SD_BENCH_BYTES, SD_BENCH_SUSTAINED_CHUNK / SD_BLOCK_SIZE);
+    free(buf);
+    return 0;
+}
+
 int monoterm_sd(int argc, char *argv[]) {
     if(argc == 1) {
         return monoterm_sd_help();
@@ -664,6 +1261,10 @@ int monoterm_sd(int argc, char *argv[]) {
             return monoterm_sd_status();
         } else if(!strcmp(argv[1], "cid")) {
             return monoterm_sd_cid();
+        } else if(!strcmp(argv[1], "bench")) {
+            return monoterm_sd_bench();
+        } else if(!strcmp(argv[1], "writebench")) {
+            return monoterm_sd_writebench();
         } else {
             // Command not recognized
             return monoterm_sd_help();
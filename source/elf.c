@@ -7,6 +7,13 @@
 #include <kernel/pagetable.h>
 #include <kernel/util.h>
 #include <kernel/address_space.h>
+#include <kernel/page_cache.h>
+
+
+/**
+ * @brief Parsed ELF files, keyed by inode. Launching the same binary again reuses the prepared segment layout.
+ */
+static struct elf_data *elf_cache_head = 0;
 
 
 struct elf_data *alloc_elf_data() {
@@ -14,6 +21,17 @@ struct elf_data *alloc_elf_data() {
 }
 
 
+void free_elf_data(struct elf_data *elf) {
+    if(elf->pheader) {
+        free(elf->pheader);
+    }
+    if(elf->segments) {
+        free(elf->segments);
+    }
+    free(elf);
+}
+
+
 /**
  * @brief Checks if the elf magic is legit.
  * 
@@ -37,11 +55,14 @@ int is_elf(void* data) {
  * @return 0 for success 
  */
 int load_elf_header(struct elf_data *elf) {
-    void* data = elf->node->data;
+    uint8_t data[ELF_HEADER_SIZE];
     struct elf_header *header = &elf->header;
     if(!(elf->node->state & INODE_STATE_VALID)) {
         return 1;
     }
+    if(inode_read_at(elf->node, 0, data, ELF_HEADER_SIZE) != ELF_HEADER_SIZE) {
+        return 1;
+    }
 
     memset(0, header, sizeof(*header));
 
@@ -87,14 +108,33 @@ int load_elf_program_header(struct elf_data *elf) {
     }
     
     int nr_headers = elf->header.pheader_num;
+    if(!nr_headers) {
+        return 1;
+    }
     if(!elf->pheader) {
-        elf->pheader = kmalloc(elf->header.pheader_size * nr_headers, 0);
+        elf->pheader = kmalloc(sizeof(struct elf_program_header) * nr_headers, 0);
+        if(!elf->pheader) {
+            return 1;
+        }
+    }
+
+    // Only the pages holding the table are read
+    uint64_t table_size = (uint64_t)elf->header.pheader_size * nr_headers;
+    if(elf->header.pheader_addr + table_size > elf->node->data_size) {
+        return 1;
+    }
+    uint8_t *data = kmalloc(table_size, 0);
+    if(!data) {
+        return 1;
+    }
+    if(inode_read_at(elf->node, elf->header.pheader_addr, data, table_size) != table_size) {
+        free(data);
+        return 1;
     }
 
     struct elf_program_header *hdr = elf->pheader;
-    void *data = elf->node->data;
     for(int i = 0; i < nr_headers; i++) {
-        uint64_t offset = (uint64_t)data + elf->header.pheader_addr + elf->header.pheader_size*i;
+        uint64_t offset = (uint64_t)data + elf->header.pheader_size*i;
         hdr[i].segment_type = unpack_from(offset, uint32_t, 0x00);
         hdr[i].segment_flags = unpack_from(offset, uint32_t, 0x04);
         hdr[i].file_address = unpack_from(offset, uint64_t, 0x08);
@@ -102,18 +142,19 @@ int load_elf_program_header(struct elf_data *elf) {
         hdr[i].file_size = unpack_from(offset, uint64_t, 0x20);
         hdr[i].proc_size = unpack_from(offset, uint64_t, 0x28);
         hdr[i].alignment = unpack_from(offset, uint64_t, 0x30);
-        if(hdr > 0) {
+        if(i > 0) {
             hdr[i - 1].next = &hdr[i];
         }
     }
     hdr[nr_headers - 1].next = 0;
+    free(data);
 
     return 0;
 }
 
 
 /**
- * @brief Loads the complete ELF file into an elf_data struct
+ * @brief Parses the headers of an ELF file into an elf_data struct. Segment data is read when a process is created.
  * 
  * @param elf_file Inode pointing to ELF file.
  * @param elf Target allocated empty struct.
@@ -124,19 +165,26 @@ int load_elf(struct inode* elf_file, struct elf_data *elf) {
         print("Target is a directory.\n");
         return 1;
     }
-    inode_fetch_data(elf_file);
+    if(elf_file->state & INODE_STATE_NEW) {
+        inode_fetch_data(elf_file);
+    }
 
     if(!(elf_file->state & INODE_STATE_VALID)) {
         print("Failed to read file.\n");
         return 1;
     }
 
-    if(elf_file->data_size < 0x40) {
+    if(elf_file->data_size < ELF_HEADER_SIZE) {
         print("File must be 64 bytes or larger to contain an ELF header.\n");
         return 1;
     }
 
-    if(!is_elf(elf_file->data)) {
+    char magic[4];
+    if(inode_read_at(elf_file, 0, magic, sizeof(magic)) != sizeof(magic)) {
+        print("Failed to read file.\n");
+        return 1;
+    }
+    if(!is_elf(magic)) {
         print("File does not contain an ELF header!\n");
         return 1;
     }
@@ -157,10 +205,182 @@ int load_elf(struct inode* elf_file, struct elf_data *elf) {
 }
 
 
+/**
+ * @brief Computes the page aligned mappings for each program header. Requires the program headers to be loaded.
+ * 
+ * @param elf ELF with loaded program headers
+ * @return 0 for success
+ */
+int elf_prepare_segments(struct elf_data *elf) {
+    int nr_headers = elf->header.pheader_num;
+    if(!elf->segments) {
+        elf->segments = kmalloc(sizeof(struct elf_segment) * nr_headers, 0);
+        if(!elf->segments) {
+            return 1;
+        }
+    }
+
+    for(int i = 0; i < nr_headers; i++) {
+        struct elf_program_header *hdr = &(elf->pheader[i]);
+        struct elf_segment *seg = &(elf->segments[i]);
+
+        // The offset to the previous page boundary within the file
+        uint64_t file_page_offset = hdr->file_address % PAGE_SIZE;
+        // We will start mapping from the previous page boundary,
+        // this means that the target virtual address should also be
+        // offset by file_page_offset
+        seg->vaddr = hdr->proc_address - file_page_offset;
+        if(seg->vaddr % PAGE_SIZE) {
+            print("ELF segments not page aligned!\n");
+            return 1;
+        }
+        seg->size = round_up_to_page(hdr->proc_size + file_page_offset);
+        seg->file_offset = hdr->file_address - file_page_offset;
+        seg->file_size = hdr->file_size + file_page_offset;
+        seg->writable = (hdr->segment_flags & ELF_SEGMENT_FLAG_WRITE) != 0;
+        if(seg->file_offset + seg->file_size > elf->node->data_size) {
+            print("ELF segment exceeds file size!\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Returns the parsed ELF file for the inode. Files are only parsed on the first lookup,
+ * or if the file has been modified since.
+ * 
+ * @param elf_file Inode pointing to ELF file.
+ * @return The cached ELF data or null
+ */
+struct elf_data *elf_cache_lookup(struct inode* elf_file) {
+    struct elf_data *prev = 0;
+    for(struct elf_data *i = elf_cache_head; i; i = i->next) {
+        if(i->node == elf_file) {
+            if(i->node_data_size == elf_file->data_size && i->node_generation == elf_file->generation) {
+                return i;
+            }
+            // Stale entry
+            if(prev) {
+                prev->next = i->next;
+            } else {
+                elf_cache_head = i->next;
+            }
+            free_elf_data(i);
+            break;
+        }
+        prev = i;
+    }
+
+    struct elf_data *elf = alloc_elf_data();
+    if(!elf) {
+        return 0;
+    }
+    if(load_elf(elf_file, elf) || elf_prepare_segments(elf)) {
+        free_elf_data(elf);
+        return 0;
+    }
+    elf->node_data_size = elf_file->data_size;
+    elf->node_generation = elf_file->generation;
+
+    elf->next = elf_cache_head;
+    elf_cache_head = elf;
+    return elf;
+}
+
+
+// Copies data into the pages backing a mapped range of the process address space.
+static int elf_copy_to_process(struct process *p, uint64_t vaddr, char *src, uint64_t size) {
+    while(size) {
+        struct address_mapping *m = address_space_find_mapping(p->addr_space, vaddr);
+        if(!m) {
+            print("ELF: No mapping at 0x{xl}\n", vaddr);
+            return 1;
+        }
+        uint64_t offset = vaddr - m->vaddress;
+        uint64_t len = m->size - offset;
+        if(len > size) {
+            len = size;
+        }
+        memcpy((char*)PHYS_TO_KERN(m->paddress + offset), src, len);
+        vaddr += len;
+        src += len;
+        size -= len;
+    }
+    return 0;
+}
+
+
+// Copies file data through the page cache into the pages backing a mapped range of the process address space.
+static int elf_copy_file_to_process(struct process *p, uint64_t vaddr, struct inode *node, uint64_t offset, uint64_t size) {
+    while(size) {
+        struct cached_page *page = page_cache_read(node, offset / PAGE_SIZE);
+        if(!page) {
+            return 1;
+        }
+        uint64_t in_page = offset % PAGE_SIZE;
+        uint64_t len = PAGE_SIZE - in_page;
+        if(len > size) {
+            len = size;
+        }
+        int ret = elf_copy_to_process(p, vaddr, (char*)page->data + in_page, len);
+        page_cache_release(page);
+        if(ret) {
+            return 1;
+        }
+        vaddr += len;
+        offset += len;
+        size -= len;
+    }
+    return 0;
+}
+
+
+/*
+ * Maps the page cache pages holding a read-only segment into the process, instead of copying them.
+ * Only whole pages of file data are shared, physically adjacent pages share a mapping.
+ * Returns the number of bytes mapped from the start of the segment. The rest of the segment is left to the caller.
+ */
+static uint64_t elf_map_cached_pages(struct process *p, struct inode *node, struct elf_segment *seg) {
+    uint64_t pages = (seg->file_size < seg->size ? seg->file_size : seg->size) / PAGE_SIZE;
+    uint64_t first = seg->file_offset / PAGE_SIZE;
+    uint64_t mapped = 0;
+    uint64_t run_paddr = 0;
+    uint64_t run_size = 0;
+    for(uint64_t i = 0; i < pages; i++) {
+        struct cached_page *page = page_cache_read(node, first + i);
+        if(!page) {
+            break;
+        }
+        // The process reference keeps the page from being evicted until it is mapped
+        user_page_get(page->paddr);
+        uint64_t paddr = page->paddr;
+        page_cache_release(page);
+        if(run_size && paddr != run_paddr + run_size) {
+            if(process_map_shared_pages(p, seg->vaddr + mapped, run_paddr, run_size, MAPPING_FLAG_READONLY)) {
+                user_page_put(paddr);
+                return mapped;
+            }
+            mapped += run_size;
+            run_size = 0;
+        }
+        if(!run_size) {
+            run_paddr = paddr;
+        }
+        run_size += PAGE_SIZE;
+    }
+    if(run_size && !process_map_shared_pages(p, seg->vaddr + mapped, run_paddr, run_size, MAPPING_FLAG_READONLY)) {
+        mapped += run_size;
+    }
+    return mapped;
+}
+
+
 /**
  * @brief Creates a new process from an elf file.
  * 
- * @param elf Populated elf_data struct containing program headers.
+ * @param elf Populated elf_data struct containing the prepared segments.
  * @param p Allocated empty process struct.
  * @return 0 for success 
  */
@@ -172,50 +392,33 @@ int elf_create_process(struct elf_data *elf, struct process *p) {
 
     // Create memory mappings and allocate RAM
     for(int i = 0; i < elf->header.pheader_num; i++) {
-        struct elf_program_header *hdr = &(elf->pheader[i]);
-        // Map this header to memory
+        struct elf_segment *seg = &(elf->segments[i]);
 
-        // The offset to the previous page boundary within the file
-        uint64_t file_page_offset = hdr->file_address % PAGE_SIZE;
-        // We will start mapping from the previous page boundary,
-        // this means that the target virtual address should also be
-        // offset by file_page_offset
+        // Queue the reads of the whole segment, so that its data arrives in large requests
+        page_cache_prefetch(elf->node, seg->file_offset / PAGE_SIZE, (seg->file_size + PAGE_SIZE - 1) / PAGE_SIZE);
 
-        uint64_t map_from = hdr->proc_address - file_page_offset;
-        if(map_from % PAGE_SIZE) {
-            // ELF segments not page aligned!
-            // TODO: Free all of the process memory allocated up to now.
-            return 1;
+        uint64_t shared = 0;
+        if(!seg->writable) {
+            shared = elf_map_cached_pages(p, elf->node, seg);
         }
 
-        // Append memory region to the processes allocation lists
-        void* header_memory = new_process_memory_region(p, hdr->proc_size + file_page_offset);
-        if(!header_memory) {
+        // Cleanup of partially mapped segments is handled by the address space of the process
+        if(process_map_pages(p, seg->vaddr + shared, seg->size - shared, false)) {
             print("Failed to allocate memory for user memory\n");
             return 1;
         }
 
-        struct address_mapping* m = create_memory_region_virt(p->addr_space, map_from, (uint64_t)header_memory, round_up_to_page(hdr->proc_size + file_page_offset));
-        if(!m) {
-            // Cleanup is handled by the 'header_memory' memory region already being in the linked list.
+        // Copy data
+        if(seg->file_size > shared && elf_copy_file_to_process(p, seg->vaddr + shared, elf->node, seg->file_offset + shared, seg->file_size - shared)) {
+            print("Failed to read ELF segment\n");
             return 1;
         }
-
-        // Copy data
-        memcpy((char*)header_memory + file_page_offset, elf->node->data + hdr->file_address, hdr->file_size);
     }
 
     // Allocate ram for the stack
-    // Allocate memory. This returns a kernel virtual address.
-    void* stack_memory = new_process_memory_region(p, p->user_thread->stack_size);
-    if(!stack_memory) {
-        print("Failed to allocate process user stack!\n");
-        return 1;
-    }
     uint64_t stack_begin = (uint64_t)p->user_thread->sp - p->user_thread->stack_size;
-    struct address_mapping* m = create_memory_region_virt(p->addr_space, stack_begin, (uint64_t)stack_memory, p->user_thread->stack_size);
-    if(!m) {
-        // Cleanup is handled by the 'stack_memory' memory region already being in the linked list.
+    if(process_map_pages(p, stack_begin, p->user_thread->stack_size, false)) {
+        print("Failed to allocate process user stack!\n");
         return 1;
     }
 
@@ -225,8 +428,45 @@ int elf_create_process(struct elf_data *elf, struct process *p) {
         print("Failed to allocate process kernel stack!\n");
         return 1;
     }
+    p->kernel_stack = kernel_stack;
     p->kern_thread->sp = (uint64_t)kernel_stack + p->kern_thread->stack_size;
     p->kern_thread->link_reg = (uint64_t)(switch_to_user_thread);
 
     return 0;
 }
+
+
+/**
+ * @brief Creates a process for the ELF file. The process is not scheduled.
+ * 
+ * @param elf_file Inode pointing to ELF file.
+ * @param argc Number of arguments
+ * @param argv Arguments passed to the process. Copied onto the new processes stack.
+ * @return The new process or null
+ */
+struct process *elf_spawn_process(struct inode* elf_file, int32_t argc, char **argv) {
+    struct elf_data *elf = elf_cache_lookup(elf_file);
+    if(!elf) {
+        return 0;
+    }
+
+    // Create the process
+    struct process *p = allocate_process();
+    if(!p) {
+        print("Failed to allocate process struct\n");
+        return 0;
+    }
+
+    if(elf_create_process(elf, p)) {
+        destroy_process(p);
+        print("Failed to create process!\n");
+        return 0;
+    }
+
+    // Put argc and argv into the context and onto the stack to call main
+    if(process_entry_point_args(p, argc, argv)) {
+        destroy_process(p);
+        return 0;
+    }
+    return p;
+}
@@ -6,6 +6,7 @@
 #include <kernel/scheduler.h>
 #include <kernel/process.h>
 #include <kernel/syscall.h>
+#include <kernel/exception.h>
 
 #define INT_BASE 0x3F00B000
 
@@ -16,17 +17,21 @@
 #define INT_DISABLE_IRQS_1 (INT_BASE + 0x21C)
 #define INT_DISABLE_IRQS_2 (INT_BASE + 0x220)
 
-#define PSTATE_DEBUG_INT_MASK (0b1000ul << 6)
-#define PSTATE_SERROR_INT_MASK (0b0100ul << 6)
-#define PSTATE_IRQ_INT_MASK (0b0010ul << 6)
-#define PSTATE_FIQ_INT_MASK (0b0001ul << 6)
+#define ESR_DFSC_MASK 0b111111
+#define ESR_DFSC_PERMISSION_FAULT 0b001100
+#define ESR_WNR (1ul << 6)
 
-#define TIMER_BASE 0x3F003000
-
-#define TIMER_CS  (TIMER_BASE + 0x00)
+#define PERIPHERAL_INTERRUPT_COUNT 64
 
 extern int vectors;
 
+struct interrupt_handler {
+	void (*handler)(void *data);
+	void *data;
+};
+
+static struct interrupt_handler interrupt_handlers[PERIPHERAL_INTERRUPT_COUNT];
+
 
 void apply_exception_formatting() {
 	term_set_color(COLORCODE_WARNING);
@@ -46,6 +51,31 @@ void mask_exception_class(uint64_t mask) {
 	write_system_reg(DAIF, daif);
 }
 
+/**
+ * @brief Masks IRQs on this core.
+ * 
+ * @return The previous interrupt mask, to be passed to irq_restore
+ */
+uint64_t irq_save() {
+	uint64_t daif = read_system_reg(DAIF);
+	write_system_reg(DAIF, daif | PSTATE_IRQ_INT_MASK);
+	return daif;
+}
+
+
+void irq_restore(uint64_t flags) {
+	write_system_reg(DAIF, flags);
+}
+
+
+/**
+ * @brief Sleeps until an interrupt arrives and has been handled. Must be called with IRQs masked,
+ * they are masked again when this returns.
+ */
+void wait_for_interrupt() {
+	asm volatile("msr daifclr, #2\n\twfi\n\tmsr daifset, #2" ::: "memory");
+}
+
 void init_exceptions() {
     write_system_reg(VBAR_EL1, (uint64_t)&vectors);
     unmask_exception_class(PSTATE_IRQ_INT_MASK);
@@ -93,12 +123,30 @@ void handle_exception_sync()
 	}
 }
 
+/**
+ * @brief Calls the registered handlers of all pending peripheral interrupts.
+ * Interrupts without a handler are disabled, so that they do not fire continuously.
+ */
+static void dispatch_peripheral_interrupts() {
+	// See page 113 of BCM2835 peripheral manual
+	uint64_t pending = get32(INT_PENDING_1) | ((uint64_t)get32(INT_PENDING_2) << 32);
+	while(pending) {
+		int irq = __builtin_ctzll(pending);
+		pending &= pending - 1;
+		struct interrupt_handler *h = &interrupt_handlers[irq];
+		if(h->handler) {
+			h->handler(h->data);
+		} else {
+			apply_exception_formatting();
+			print("Unhandled peripheral interrupt {d}, disabling it.\n", irq);
+			term_reset_font();
+			disable_peripheral_interrupt(irq);
+		}
+	}
+}
+
 void handle_exception_irq() {
-	apply_exception_formatting();
-	print(".");
-	// TODO: Allow us to register interrupt handlers.
-	uint64_t time = read_system_timer();
-	set_system_timer_interrupt((time + 1000000) & 0xFFFFFFFF);
+	dispatch_peripheral_interrupts();
 }
 
 void handle_exception_fiq() {
@@ -113,9 +161,10 @@ void handle_exception_serror() {
 	panic();
 }
 
-uint64_t handle_exception_sync_el0(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+void handle_exception_sync_el0(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
 	uint64_t esr = read_system_reg(ESR_EL1);
 	uint64_t far = read_system_reg(FAR_EL1);
+	uint64_t *frame = kernel_curr_process->exception_stack_pointer;
 	unsigned int error_class = (esr & (0b111111 << 26)) >> 26;
 
 	switch(error_class) {
@@ -124,16 +173,24 @@ uint64_t handle_exception_sync_el0(uint64_t syscall, uint64_t a1, uint64_t a2, u
 		print("## EL0 SYNC EXCEPTION ##\n");
 		print("Invalid vector instruction.\n");
 		print_esr_and_far(esr, far, error_class);
+		break;
 	case 36:
-		// 0b100101: Data Abort taken without change in exception level.
+		// 0b100100: Data Abort from a lower exception level.
+		if(((esr & ESR_DFSC_MASK) & ~0b11) == ESR_DFSC_PERMISSION_FAULT && (esr & ESR_WNR)) {
+			// Writes to copy-on-write memory are resolved and the instruction is retried.
+			if(!process_resolve_cow_fault(kernel_curr_process->leader, far)) {
+				return;
+			}
+		}
 		apply_exception_formatting();
 		print("## EL0 SYNC EXCEPTION ##\n");
 		print("Invalid memory access from userspace!\n");
 		print_esr_and_far(esr, far, error_class);
 		break;
 	case 21:
-		// Syscall
-		return handle_syscall(syscall, a1, a2, a3, a4, a5, a6);
+		// Syscall. The return value is restored into x0 by kernel_exit.
+		frame[0] = handle_syscall(syscall, a1, a2, a3, a4, a5, a6);
+		return;
 	default:
 		apply_exception_formatting();
 		print("## EL0 SYNC EXCEPTION ##\n");
@@ -147,9 +204,8 @@ uint64_t handle_exception_sync_el0(uint64_t syscall, uint64_t a1, uint64_t a2, u
 }
 
 void handle_exception_irq_el0() {
-	apply_exception_formatting();
-	print("## UNHANDLED EL0 IRQ EXCEPTION ##\n");
-	panic();
+	// Handlers only wake up threads. The interrupted thread keeps running.
+	dispatch_peripheral_interrupts();
 }
 
 void handle_exception_fiq_el0() {
@@ -180,4 +236,41 @@ void disable_peripheral_interrupt(int interrupt_number) {
 	} else if(interrupt_number < 64) {
 		put32(INT_DISABLE_IRQS_2, 1u << (interrupt_number - 32));
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Registers the handler of a peripheral interrupt and enables the interrupt.
+ * Handlers run with IRQs masked, on the stack of the interrupted thread. They must not block.
+ * 
+ * @param interrupt_number Peripheral interrupt number (PERIPHERAL_INTERRUPT_*)
+ * @param handler Handler function
+ * @param data Argument passed to the handler
+ * @return 0 for success
+ */
+int register_interrupt_handler(int interrupt_number, void (*handler)(void *data), void *data) {
+	if(interrupt_number < 0 || interrupt_number >= PERIPHERAL_INTERRUPT_COUNT) {
+		return 1;
+	}
+	if(interrupt_handlers[interrupt_number].handler) {
+		print("Interrupt {d} already has a handler!\n", interrupt_number);
+		return 1;
+	}
+	uint64_t flags = irq_save();
+	interrupt_handlers[interrupt_number].handler = handler;
+	interrupt_handlers[interrupt_number].data = data;
+	enable_peripheral_interrupt(interrupt_number);
+	irq_restore(flags);
+	return 0;
+}
+
+
+void unregister_interrupt_handler(int interrupt_number) {
+	if(interrupt_number < 0 || interrupt_number >= PERIPHERAL_INTERRUPT_COUNT) {
+		return;
+	}
+	uint64_t flags = irq_save();
+	disable_peripheral_interrupt(interrupt_number);
+	interrupt_handlers[interrupt_number].handler = 0;
+	interrupt_handlers[interrupt_number].data = 0;
+	irq_restore(flags);
+}
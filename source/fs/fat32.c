@@ -1,7 +1,10 @@
 #include <kernel/block.h>
+#include <kernel/bcache.h>
 #include <kernel/mem.h>
 #include <kernel/alloc.h>
 #include <kernel/inode.h>
+#include <kernel/page_cache.h>
+#include <kernel/string.h>
 #include "fat32.h"
 
 
@@ -10,14 +13,16 @@ struct fat32_disk *g_root_fs = 0;
 static struct inode_ops fat32_inode_ops;
 
 static int read_fat32_bpb(struct bios_parameter_block *bpb, struct block_dev *dev) {
-    unsigned char *blk_buff = kmalloc(dev->block_size, 0);
-    if(read_blk(dev, blk_buff) != 1) {
+    struct buffer_head *b = bcache_read(dev, 0);
+    if(!b) {
         print("Failed to read block device.\n");
         return -1;
     }
+    unsigned char *blk_buff = b->data;
 
     if(*(uint16_t*)(blk_buff + FAT32_MAGIC_NUMBER_OFFSET) != FAT32_MAGIC_NUMBER) {
         print("Block device does not contain FAT signature.\n");
+        bcache_release(b);
         return -1;
     }
 
@@ -27,12 +32,14 @@ static int read_fat32_bpb(struct bios_parameter_block *bpb, struct block_dev *de
     bpb->nr_file_allocation_tables = *((uint8_t*)(blk_buff + BPB_OFF_NR_FILE_ALLOC_TABLES));
     bpb->nr_root_dir_entry = *((uint16_t*)(blk_buff + BPB_OFF_NR_ROOT_DIR_ENTRIES));
     bpb->fat16_sectors_per_fat = *((uint16_t*)(blk_buff + BPB_OFF_FAT16_SECTORS_PER_FAT));
-    bpb->sectors_per_fat = *((uint16_t*)(blk_buff + BPB_OFF_SECTORS_PER_FAT));
+    bpb->sectors_per_fat = *((uint32_t*)(blk_buff + BPB_OFF_SECTORS_PER_FAT));
     bpb->nr_sectors = *((uint32_t*)(blk_buff + BPB_OFF_TOTAL_SECTORS));
     bpb->nr_fat16_sectors = *((uint16_t*)(blk_buff + BPB_OFF_FAT16_TOTAL_SECTORS));
     bpb->root_cluster = *((uint32_t*)(blk_buff + BPB_OFF_ROOT_DIR_CLUSTER));
+    bpb->fsinfo_sector = *((uint16_t*)(blk_buff + BPB_OFF_FSINFO_SECTOR));
     strncpy(bpb->volume_label, (char*)(blk_buff + BPB_OFF_VOLUME_LABEL), 11);
     bpb->volume_label[10] = 0;
+    bcache_release(b);
 
     return 0;
 }
@@ -56,78 +63,108 @@ static int fat32_check_valid(struct bios_parameter_block *bpb) {
     return 0;
 }
 
-static int fat32_load_fat(struct fat32_disk *part) {
-    unsigned int fat_bytes = part->fat_entries * 4;
-    
-    unsigned int fat_start = part->bpb->nr_reserved_sectors * part->bpb->bytes_per_sector;
-    if(seek_blk(part->dev, fat_start / part->dev->block_size)) {
-        return -1;
+/*
+ * Returns the FAT block holding the entry of a cluster. FAT blocks are kept referenced in a small direct mapped
+ * cache, on a miss the block is read through the buffer cache. The returned buffer is owned by the cache.
+ */
+static struct buffer_head *fat32_fat_block(struct fat32_disk *partition, uint32_t cluster) {
+    unsigned int fat_index = cluster / (partition->dev->block_size / 4);
+    struct buffer_head **slot = &partition->fat_cache[fat_index % FAT32_FAT_CACHE_SLOTS];
+    partition->fat_lookups++;
+    struct buffer_head *b = *slot;
+    if(!b || b->blk != partition->fat_block + fat_index) {
+        b = bcache_read(partition->dev, partition->fat_block + fat_index);
+        if(!b) {
+            print("FAT32: Failed to read FAT block\n");
+            return 0;
+        }
+        partition->fat_loads++;
+        // The slot may have changed while the block was read
+        struct buffer_head *old = *slot;
+        *slot = b;
+        if(old) {
+            bcache_release(old);
+        }
     }
+    return b;
+}
 
-    part->fat = kmalloc(fat_bytes, 0);
-    unsigned int read_entries = 0;
-    while(1) {
-        unsigned char *blk_buff = kmalloc(part->dev->block_size, 0);
-        if(read_blk(part->dev, blk_buff) != 1) {
-            print("Failed to read block device.\n");
-            free(blk_buff);
-            free(part->fat);
-            return -1;
-        }
-        
-        int i = 0;
-        while(i < (part->dev->block_size / 4)) {
-            part->fat[read_entries] = *(uint32_t*)(blk_buff + (i * 4));
-            read_entries++;
-            i++;
 
-            if(read_entries >= part->fat_entries) {
-                free(blk_buff);
-                return 0;
-            }
-        }
-        free(blk_buff);
+static int fat32_read_entry(struct fat32_disk *partition, uint32_t cluster, uint32_t *value) {
+    if(cluster >= partition->fat_entries) {
+        return -1;
+    }
+    struct buffer_head *b = fat32_fat_block(partition, cluster);
+    if(!b) {
+        return -1;
     }
+    *value = ((uint32_t*)b->data)[cluster % (partition->dev->block_size / 4)] & FAT32_CLUSTER_MASK;
+    return 0;
 }
 
 
-static int fat32_load_cluster(struct fat32_disk *partition, uint8_t *buffer, unsigned int n, uint32_t cluster_index) {
-    unsigned int blk = partition->data_sector + (cluster_index - 2) * partition->bpb->sectors_per_cluster;
-    if(seek_blk(partition->dev, (blk*partition->bpb->bytes_per_sector) / partition->dev->block_size)) {
-        print("FAT32: Failed to load cluster (seek)\n");
-        return 1;
+static int fat32_write_fsinfo(struct fat32_disk *partition) {
+    partition->fsinfo_dirty = false;
+    if(!partition->fsinfo_block) {
+        return 0;
+    }
+    struct buffer_head *b = bcache_read(partition->dev, partition->fsinfo_block);
+    if(!b) {
+        return -1;
     }
+    *(uint32_t*)(b->data + FSINFO_OFF_FREE_COUNT) = partition->free_count;
+    *(uint32_t*)(b->data + FSINFO_OFF_NEXT_FREE) = partition->next_free;
+    int ret = bcache_write(b);
+    bcache_release(b);
+    return ret;
+}
 
-    if(n == 0) {
-        if(read_blk(partition->dev, buffer) != 1) {
-            print("FAT32: Failed to load cluster (read)\n");
-            return 1;
-        }
-    } else {
-        if(read_nblk(partition->dev, buffer, n) != 1) {
-            print("FAT32: Failed to load cluster (readn)\n");
-            return 1;
+
+static int fat32_flush(struct fat32_disk *partition);
+
+
+/*
+ * Keeps a FAT or directory block referenced until the next flush. Call before modifying the block, a full set
+ * is flushed first.
+ */
+static int fat32_pin(struct fat32_disk *partition, struct buffer_head *b) {
+    for(uint32_t i = 0; i < partition->pinned_count; i++) {
+        if(partition->pinned[i] == b) {
+            return 0;
         }
     }
+    if(partition->pinned_count == FAT32_PINNED_BLOCKS && fat32_flush(partition)) {
+        return -1;
+    }
+    bcache_get(b);
+    partition->pinned[partition->pinned_count++] = b;
     return 0;
 }
 
-static unsigned int fat32_load_cluster_chain(struct fat32_disk *partition, uint8_t *buffer, unsigned int buffer_size, uint32_t cluster_index) {
-    unsigned int bytes_read = 0;
-    uint32_t current_cluster = cluster_index;
-    while(bytes_read < buffer_size) {
-        if(fat32_load_cluster(partition, buffer + bytes_read, buffer_size - bytes_read, current_cluster)) {
-            return 0;
-        }
-        bytes_read += partition->bytes_per_cluster;
-        // Find next cluster index
-        current_cluster = partition->fat[current_cluster];
-        if((current_cluster & 0x0FFFFFF8) == 0x0FFFFFF8) {
-            // End of file/directory
-            break;
-        }
+
+/*
+ * Sets the FAT entry of a cluster, keeping the reserved upper bits. Only the cached FAT block is modified,
+ * the FAT copies on the device are updated by fat32_flush().
+ */
+static int fat32_write_entry(struct fat32_disk *partition, uint32_t cluster, uint32_t value) {
+    if(cluster < 2 || cluster >= partition->cluster_count) {
+        return -1;
+    }
+    struct buffer_head *b = fat32_fat_block(partition, cluster);
+    if(!b || fat32_pin(partition, b)) {
+        return -1;
     }
-    return bytes_read;
+    uint32_t *entry = &((uint32_t*)b->data)[cluster % (partition->dev->block_size / 4)];
+    *entry = (*entry & ~FAT32_CLUSTER_MASK) | (value & FAT32_CLUSTER_MASK);
+    bcache_mark_dirty(b);
+    return 0;
+}
+
+
+// Device block holding the first sector of a cluster
+static unsigned int fat32_cluster_block(struct fat32_disk *partition, uint32_t cluster_index) {
+    unsigned int sector = partition->data_sector + (cluster_index - 2) * partition->bpb->sectors_per_cluster;
+    return (sector * partition->bpb->bytes_per_sector) / partition->dev->block_size;
 }
 
 static char ucs2_to_ascii(uint16_t ucs_byte) {
@@ -142,19 +179,23 @@ static char ucs2_to_ascii(uint16_t ucs_byte) {
  * Parses the 32 byte entry_row and appends the data it contains to the result.
  * Returns 0 when it has completed reading the entry (we count down to the starting index 0).
  * Return 0xFE when a zero entry has been reached -> end of directory table.
+ * Return 0xFD for deleted entries and the volume label, which are skipped.
  */
 static uint8_t parse_directory_entry(struct inode *result, uint8_t *entry_row, uint8_t prev_index) {
-    if(entry_row[0] == 0x00 || entry_row[0] == 0xE5) {
+    if(entry_row[0] == FAT32_DIR_ENTRY_END) {
         return 0xFE;
     }
+    if(entry_row[0] == FAT32_DIR_ENTRY_FREE) {
+        return 0xFD;
+    }
 
-    if((entry_row[11] & 0x0F) == 0x0F) {
+    if((entry_row[11] & FAT32_ATTR_LFN) == FAT32_ATTR_LFN) {
         // Long file name
 
         // Check index
         // An index of over 18 is invalid.
         uint8_t index = entry_row[0] & 0x3F;
-        if(index > 18 || index == 0) {
+        if(index > FAT32_LFN_MAX_ENTRIES || index == 0) {
             return 0xFF;
         }
         // Bit 0x40 indicates it is the first entry.
@@ -189,6 +230,10 @@ static uint8_t parse_directory_entry(struct inode *result, uint8_t *entry_row, u
         return index;
     }
     
+    if(entry_row[11] & FAT32_ATTR_VOLUME_ID) {
+        return 0xFD;
+    }
+
     // It is a short entry. The entry is complete.
     // Mark directories as such.
     if(entry_row[11] & 0x10) {
@@ -227,44 +272,73 @@ static uint8_t parse_directory_entry(struct inode *result, uint8_t *entry_row, u
 
 
 // This is not a real inode operation. It is called by the op "inode_fetch_data" when the inode is a directory.
+// Directory blocks are read through the buffer cache, so listing a directory again does not touch the card.
 static int fat32_inode_read_directory(struct inode *n) {
     struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
     uint32_t n_cluster = n_data->cluster;
     struct fat32_disk *partition = n_data->partition;
+    struct block_dev *dev = partition->dev;
+    unsigned int blocks_per_cluster = partition->bytes_per_cluster / dev->block_size;
 
-    unsigned char *blk_buff = kmalloc(partition->bytes_per_cluster, 0);
     uint8_t prev_index = 0;
+    // Position of the current entry in the directory, and of the first entry of the current file
+    uint32_t entry = 0;
+    uint32_t entry_first = 0;
     struct inode *new_child = alloc_inode();
     new_child->parent_node = n;
     new_child->ops = fat32_inode_ops;
+    new_child->blk_dev = dev;
     new_child->fs_data = kmalloc(sizeof(struct fat32_inode_data), ALLOC_ZERO_INIT);
     ((struct fat32_inode_data*)new_child->fs_data)->partition = partition;
     while(1) {
-        fat32_load_cluster(partition, blk_buff, 0, n_cluster);
-        for(int i = 0; i < 16; i++) {
-            prev_index = parse_directory_entry(new_child, blk_buff, prev_index);
-            if(prev_index == 0) {
-                // Valid child inode
-                inode_insert_child(n, new_child);
-
-                new_child = alloc_inode();
-                new_child->parent_node = n;
-                new_child->ops = fat32_inode_ops;
-                new_child->fs_data = kmalloc(sizeof(struct fat32_inode_data), ALLOC_ZERO_INIT);
-                ((struct fat32_inode_data*)new_child->fs_data)->partition = partition;
-            } else if(prev_index == 0xFF) {
-                print("FAT32 directory entry parse error.\n");
+        unsigned int first_blk = fat32_cluster_block(partition, n_cluster);
+        for(unsigned int blk = 0; blk < blocks_per_cluster; blk++) {
+            struct buffer_head *b = bcache_read(dev, first_blk + blk);
+            if(!b) {
+                print("FAT32: Failed to load cluster (read)\n");
                 free(new_child);
                 return 1;
-            } else if(prev_index == 0xFE) {
-                free(new_child);
-                return 0;
             }
-            blk_buff += 32;
+            unsigned char *blk_buff = b->data;
+            for(int i = 0; i < dev->block_size / FAT32_DIR_ENTRY_SIZE; i++, entry++) {
+                if(prev_index == 0) {
+                    entry_first = entry;
+                }
+                prev_index = parse_directory_entry(new_child, blk_buff, prev_index);
+                if(prev_index == 0) {
+                    // Valid child inode
+                    ((struct fat32_inode_data*)new_child->fs_data)->entry_first = entry_first;
+                    ((struct fat32_inode_data*)new_child->fs_data)->entry_index = entry;
+                    inode_insert_child(n, new_child);
+
+                    new_child = alloc_inode();
+                    new_child->parent_node = n;
+                    new_child->ops = fat32_inode_ops;
+                    new_child->blk_dev = dev;
+                    new_child->fs_data = kmalloc(sizeof(struct fat32_inode_data), ALLOC_ZERO_INIT);
+                    ((struct fat32_inode_data*)new_child->fs_data)->partition = partition;
+                } else if(prev_index == 0xFF) {
+                    print("FAT32 directory entry parse error.\n");
+                    bcache_release(b);
+                    free(new_child);
+                    return 1;
+                } else if(prev_index == 0xFE) {
+                    bcache_release(b);
+                    free(new_child);
+                    return 0;
+                } else if(prev_index == 0xFD) {
+                    prev_index = 0;
+                }
+                blk_buff += FAT32_DIR_ENTRY_SIZE;
+            }
+            bcache_release(b);
         }
         // Find next cluster index
-        n_cluster = partition->fat[n_cluster];
-        if((n_cluster & 0x0FFFFFF8) == 0x0FFFFFF8) {
+        if(fat32_read_entry(partition, n_cluster, &n_cluster)) {
+            free(new_child);
+            return 1;
+        }
+        if((n_cluster & FAT32_END_OF_CHAIN) == FAT32_END_OF_CHAIN || n_cluster < 2) {
             // End of file/directory
             free(new_child);
             return 0;
@@ -274,13 +348,9 @@ static int fat32_inode_read_directory(struct inode *n) {
 
 
 /*
- * Allocates memory for inode (if unallocated and file), and reads the file/folder contents
+ * Reads the entries of a directory. File data is not loaded here, it is read through the page cache.
  */
 static int fat32_inode_fetch_data(struct inode *n) {
-    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
-    uint32_t n_cluster = n_data->cluster;
-    struct fat32_disk *partition = n_data->partition;
-
     if(n->state & INODE_TYPE_DIR) {
         // Load directory
         if(fat32_inode_read_directory(n)) {
@@ -290,28 +360,7 @@ static int fat32_inode_fetch_data(struct inode *n) {
         n->state = (n->state & ~INODE_STATE_MASK) | INODE_STATE_VALID;
         return 0;
     } else if(n->state & INODE_TYPE_FILE) {
-        // Load file
-        if(!n->data) {
-            // Data size is populated in new FAT32 inodes, so we may use it here.
-            // Don't zero the memory.
-            n->data = vmalloc(n->data_size, 0);
-            if(!n->data) {
-                print("fat32_inode_fetch_data: Failed to allocate space for inode\n");
-                return 1;
-            }
-        }
-        unsigned int bytes_loaded = fat32_load_cluster_chain(partition, n->data, n->data_size, n_cluster);
-        if(bytes_loaded < n->data_size) {
-            // We did not load the expected number of bytes.
-            if(bytes_loaded != 0) {
-                print("Unexpected number of bytes in file.   {u} != {u}\n", bytes_loaded, n->data_size);
-            }
-            free(n->data);
-            n->data = 0;
-            n->state = (n->state & ~INODE_STATE_MASK) | INODE_STATE_NEW;
-            return 1;
-        }
-        // Success!
+        // Data size and first cluster are populated in new FAT32 inodes, which is all the page cache needs
         n->state = (n->state & ~INODE_STATE_MASK) | INODE_STATE_VALID;
         return 0;
     } else {
@@ -337,12 +386,733 @@ void print_bpb(struct bios_parameter_block *bpb) {
 }
 
 
+// Starts a new extent, replacing the slots round robin
+static struct fat32_extent *fat32_new_extent(struct fat32_inode_data *n_data, uint32_t file_cluster, uint32_t disk_cluster) {
+    struct fat32_extent *e = &n_data->extents[n_data->extent_next];
+    n_data->extent_next = (n_data->extent_next + 1) % FAT32_EXTENT_CACHE_SIZE;
+    e->file_cluster = file_cluster;
+    e->disk_cluster = disk_cluster;
+    e->length = 1;
+    return e;
+}
+
+
+/*
+ * Returns the extent containing a cluster of the file, and makes it cover at least want clusters from there,
+ * as far as they are consecutive on the device. Missing parts of the chain are walked from the closest known
+ * extent before the cluster, growing the extents as the walk goes.
+ */
+static struct fat32_extent *fat32_find_extent(struct inode *n, uint32_t cluster_index, uint32_t want) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    struct fat32_disk *partition = n_data->partition;
+
+    struct fat32_extent *e = 0;
+    for(int i = 0; i < FAT32_EXTENT_CACHE_SIZE; i++) {
+        struct fat32_extent *it = &n_data->extents[i];
+        if(it->length && it->file_cluster <= cluster_index && (!e || it->file_cluster > e->file_cluster)) {
+            e = it;
+        }
+    }
+    if(e && cluster_index < e->file_cluster + e->length && e->file_cluster + e->length - cluster_index >= want) {
+        partition->extent_hits++;
+        return e;
+    }
+    partition->extent_walks++;
+    if(!e) {
+        if(n_data->cluster < 2) {
+            return 0;
+        }
+        e = fat32_new_extent(n_data, 0, n_data->cluster);
+    }
+    while(1) {
+        uint32_t end = e->file_cluster + e->length;
+        if(cluster_index < end && end - cluster_index >= want) {
+            return e;
+        }
+        uint32_t last = e->disk_cluster + e->length - 1;
+        uint32_t next;
+        if(fat32_read_entry(partition, last, &next)) {
+            return 0;
+        }
+        if((next & FAT32_END_OF_CHAIN) == FAT32_END_OF_CHAIN || next < 2) {
+            // End of file
+            return cluster_index < end ? e : 0;
+        }
+        if(next == last + 1) {
+            e->length++;
+            continue;
+        }
+        if(cluster_index < end) {
+            return e;
+        }
+        e = fat32_new_extent(n_data, end, next);
+    }
+}
+
+
+/*
+ * Maps a file offset to the device block holding it, through the extents of the inode.
+ */
+static int fat32_inode_map_blocks(struct inode *n, uint64_t offset, unsigned int max_blocks, unsigned int *blk, unsigned int *blocks) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    struct fat32_disk *partition = n_data->partition;
+    int block_size = partition->dev->block_size;
+    unsigned int blocks_per_cluster = partition->bytes_per_cluster / block_size;
+    uint32_t cluster_index = offset / partition->bytes_per_cluster;
+    unsigned int in_cluster = (offset % partition->bytes_per_cluster) / block_size;
+
+    uint32_t want = (in_cluster + max_blocks + blocks_per_cluster - 1) / blocks_per_cluster;
+    struct fat32_extent *e = fat32_find_extent(n, cluster_index, want ? want : 1);
+    if(!e) {
+        return -1;
+    }
+    uint32_t cluster = e->disk_cluster + (cluster_index - e->file_cluster);
+    unsigned int run = (e->file_cluster + e->length - cluster_index) * blocks_per_cluster - in_cluster;
+    *blk = fat32_cluster_block(partition, cluster) + in_cluster;
+    *blocks = run < max_blocks ? run : max_blocks;
+    return 0;
+}
+
+
+/*
+ * Finds free clusters for a file. Clusters right after goal are taken first, so that a growing file stays
+ * contiguous. Otherwise the FAT is searched from the allocator hint, for a run of want clusters or the longest run
+ * seen within FAT32_FREE_SCAN_LIMIT entries after the first free cluster.
+ */
+static int fat32_find_free_run(struct fat32_disk *partition, uint32_t goal, uint32_t want, uint32_t *first, uint32_t *length) {
+    uint32_t value;
+    uint32_t run = 0;
+    while(goal >= 2 && run < want && goal + run < partition->cluster_count) {
+        if(fat32_read_entry(partition, goal + run, &value)) {
+            return -1;
+        }
+        if(value) {
+            break;
+        }
+        run++;
+    }
+    if(run) {
+        *first = goal;
+        *length = run;
+        return 0;
+    }
+
+    uint32_t span = partition->cluster_count - 2;
+    uint32_t start = partition->next_free;
+    uint32_t best = 0, best_length = 0, run_first = 0, scanned = 0;
+    for(uint32_t i = 0; i < span && best_length < want; i++) {
+        uint32_t cluster = 2 + (start - 2 + i) % span;
+        if(cluster == 2) {
+            // Runs do not wrap around the end of the FAT
+            run = 0;
+        }
+        if(fat32_read_entry(partition, cluster, &value)) {
+            return -1;
+        }
+        if(best_length && ++scanned > FAT32_FREE_SCAN_LIMIT) {
+            break;
+        }
+        if(value) {
+            run = 0;
+            continue;
+        }
+        if(!run) {
+            run_first = cluster;
+        }
+        run++;
+        if(run > best_length) {
+            best = run_first;
+            best_length = run;
+        }
+    }
+    if(!best_length) {
+        print("FAT32: No free clusters\n");
+        return -1;
+    }
+    *first = best;
+    *length = best_length < want ? best_length : want;
+    return 0;
+}
+
+
+// Clusters in the chain of a file of the given size. Empty files may still own a cluster.
+static uint32_t fat32_file_clusters(struct inode *n, uint64_t size) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    uint32_t bytes_per_cluster = n_data->partition->bytes_per_cluster;
+    uint32_t clusters = (size + bytes_per_cluster - 1) / bytes_per_cluster;
+    return clusters || n_data->cluster < 2 ? clusters : 1;
+}
+
+
+/*
+ * Appends count clusters to a chain of have clusters. The new clusters are linked into the FAT and added to the
+ * extents of the inode.
+ */
+static int fat32_alloc_clusters(struct inode *n, uint32_t have, uint32_t count) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    struct fat32_disk *partition = n_data->partition;
+    struct fat32_extent *e = 0;
+    uint32_t last = 0;
+    if(have) {
+        e = fat32_find_extent(n, have - 1, 1);
+        if(!e) {
+            return -1;
+        }
+        last = e->disk_cluster + (have - 1 - e->file_cluster);
+    }
+    while(count) {
+        uint32_t first, length;
+        if(fat32_find_free_run(partition, last ? last + 1 : 0, count, &first, &length)) {
+            return -1;
+        }
+        for(uint32_t i = 0; i < length; i++) {
+            if(fat32_write_entry(partition, first + i, i + 1 < length ? first + i + 1 : FAT32_CLUSTER_MASK)) {
+                return -1;
+            }
+        }
+        if(last) {
+            if(fat32_write_entry(partition, last, first)) {
+                return -1;
+            }
+        } else {
+            n_data->cluster = first;
+        }
+        if(e && e->file_cluster + e->length == have && e->disk_cluster + e->length == first) {
+            e->length += length;
+        } else {
+            e = fat32_new_extent(n_data, have, first);
+            e->length = length;
+        }
+
+        have += length;
+        count -= length;
+        last = first + length - 1;
+        partition->next_free = last + 1 < partition->cluster_count ? last + 1 : 2;
+        if(partition->free_count != FSINFO_UNKNOWN) {
+            partition->free_count -= length;
+        }
+        partition->fsinfo_dirty = true;
+        partition->clusters_allocated += length;
+    }
+    return 0;
+}
+
+
+// Releases the clusters of a chain past the first keep clusters
+static int fat32_free_clusters(struct inode *n, uint32_t keep) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    struct fat32_disk *partition = n_data->partition;
+    uint32_t cluster;
+    if(keep) {
+        struct fat32_extent *e = fat32_find_extent(n, keep - 1, 1);
+        if(!e) {
+            return -1;
+        }
+        uint32_t last = e->disk_cluster + (keep - 1 - e->file_cluster);
+        if(fat32_read_entry(partition, last, &cluster) || fat32_write_entry(partition, last, FAT32_CLUSTER_MASK)) {
+            return -1;
+        }
+    } else {
+        cluster = n_data->cluster;
+        n_data->cluster = 0;
+    }
+
+    // Forget the freed part of the chain
+    for(int i = 0; i < FAT32_EXTENT_CACHE_SIZE; i++) {
+        struct fat32_extent *e = &n_data->extents[i];
+        if(e->file_cluster >= keep) {
+            e->length = 0;
+        } else if(e->file_cluster + e->length > keep) {
+            e->length = keep - e->file_cluster;
+        }
+    }
+
+    uint32_t freed = 0;
+    // The end of chain marker is past cluster_count
+    while(cluster >= 2 && cluster < partition->cluster_count) {
+        uint32_t next;
+        if(fat32_read_entry(partition, cluster, &next) || fat32_write_entry(partition, cluster, 0)) {
+            return -1;
+        }
+        freed++;
+        cluster = next;
+    }
+    if(freed) {
+        if(partition->free_count != FSINFO_UNKNOWN) {
+            partition->free_count += freed;
+        }
+        partition->fsinfo_dirty = true;
+    }
+    return 0;
+}
+
+
+/*
+ * Returns a 32 byte entry of a directory, in a referenced buffer. Fails past the last cluster of the directory.
+ */
+static uint8_t *fat32_dir_entry(struct inode *dir, uint32_t index, struct buffer_head **b) {
+    int block_size = dir->blk_dev->block_size;
+    uint64_t offset = (uint64_t)index * FAT32_DIR_ENTRY_SIZE;
+    unsigned int blk, blocks;
+    if(fat32_inode_map_blocks(dir, offset, 1, &blk, &blocks)) {
+        return 0;
+    }
+    *b = bcache_read(dir->blk_dev, blk);
+    if(!*b) {
+        return 0;
+    }
+    return (*b)->data + offset % block_size;
+}
+
+
+// Stores the first cluster and the size of a file in its directory entry, and writes the entry
+static int fat32_update_dir_entry(struct inode *n) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    struct buffer_head *b;
+    uint8_t *entry = fat32_dir_entry(n->parent_node, n_data->entry_index, &b);
+    if(!entry) {
+        print("FAT32: Failed to update directory entry\n");
+        return -1;
+    }
+    *(uint16_t*)(entry + 20) = n_data->cluster >> 16;
+    *(uint16_t*)(entry + 26) = n_data->cluster & 0xFFFF;
+    *(uint32_t*)(entry + 28) = n->data_size;
+    int ret = bcache_write(b);
+    bcache_release(b);
+    return ret;
+}
+
+
+// Directory entries of resized files are written by the next flush, after their data
+static void fat32_dirent_mark_dirty(struct inode *n) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    if(!n_data->dirent_dirty) {
+        n_data->dirent_dirty = true;
+        n_data->dirent_next = n_data->partition->dirent_dirty;
+        n_data->partition->dirent_dirty = n;
+    }
+}
+
+
+static void fat32_dirent_forget(struct inode *n) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    if(!n_data->dirent_dirty) {
+        return;
+    }
+    for(struct inode **i = &n_data->partition->dirent_dirty; *i; i = &((struct fat32_inode_data*)(*i)->fs_data)->dirent_next) {
+        if(*i == n) {
+            *i = n_data->dirent_next;
+            break;
+        }
+    }
+    n_data->dirent_dirty = false;
+    n_data->dirent_next = 0;
+}
+
+
+/*
+ * Writes back the modifications of the partition, in an order that keeps the file system consistent on the device
+ * at every step: first the dirty file pages, then the pinned FAT blocks to every FAT copy and the pinned directory
+ * blocks, then the directory entries of resized files, and last the FSInfo sector.
+ * Since metadata blocks stay pinned until here, the buffer cache cannot write them back earlier.
+ */
+static int fat32_flush(struct fat32_disk *partition) {
+    struct block_dev *dev = partition->dev;
+    unsigned int fat_blocks = partition->bpb->sectors_per_fat * partition->bpb->bytes_per_sector / dev->block_size;
+    int ret = 0;
+    if(page_cache_sync(0)) {
+        ret = -1;
+    }
+
+    for(uint32_t i = 0; i < partition->pinned_count; i++) {
+        struct buffer_head *b = partition->pinned[i];
+        if((b->flags & BUFFER_DIRTY) && bcache_write(b)) {
+            ret = -1;
+        }
+        if(b->blk >= partition->fat_block && b->blk < partition->fat_block + fat_blocks) {
+            for(unsigned int k = 1; k < partition->bpb->nr_file_allocation_tables; k++) {
+                if(block_transfer(dev, b->blk + k * fat_blocks, 1, b->data, true)) {
+                    ret = -1;
+                }
+            }
+        }
+        bcache_release(b);
+    }
+    if(partition->pinned_count) {
+        partition->fat_flushes++;
+    }
+    partition->pinned_count = 0;
+
+    while(partition->dirent_dirty) {
+        struct inode *n = partition->dirent_dirty;
+        fat32_dirent_forget(n);
+        if(fat32_update_dir_entry(n)) {
+            ret = -1;
+        }
+    }
+    if(partition->fsinfo_dirty && fat32_write_fsinfo(partition)) {
+        ret = -1;
+    }
+    if(ret) {
+        print("FAT32: Failed to write back file system changes\n");
+    }
+    return ret;
+}
+
+
+static int fat32_inode_resize(struct inode *n, uint64_t size) {
+    if(size > 0xFFFFFFFF) {
+        print("FAT32: Files are limited to 4 GiB\n");
+        return -1;
+    }
+    uint32_t have = fat32_file_clusters(n, n->data_size);
+    uint32_t need = fat32_file_clusters(n, size);
+    if(!size) {
+        need = 0;
+    }
+    if(need > have) {
+        if(fat32_alloc_clusters(n, have, need - have)) {
+            // Do not leave clusters behind that the file size does not account for
+            fat32_free_clusters(n, have);
+            return -1;
+        }
+    } else if(need < have) {
+        if(fat32_free_clusters(n, need)) {
+            return -1;
+        }
+    }
+    n->data_size = size;
+    fat32_dirent_mark_dirty(n);
+    return 0;
+}
+
+
+// Uppercase form of a character allowed in short names, 0 if it is not allowed
+static char fat32_short_char(char c) {
+    if(c >= 'a' && c <= 'z') {
+        return c - 'a' + 'A';
+    }
+    if((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return c;
+    }
+    for(char *allowed = "$%'-_@~`!(){}^#&"; *allowed; allowed++) {
+        if(c == *allowed) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+
+// Fills in the 8.3 form of a name. Returns false if the name needs long file name entries.
+static bool_t fat32_short_name(char *name, uint8_t *short_name) {
+    memset(' ', short_name, 11);
+    int pos = 0, limit = 8;
+    bool_t dot = false;
+    for(char *c = name; *c; c++) {
+        if(*c == '.' && !dot && pos) {
+            dot = true;
+            pos = 8;
+            limit = 11;
+            continue;
+        }
+        if(fat32_short_char(*c) != *c || pos == limit) {
+            return false;
+        }
+        short_name[pos++] = *c;
+    }
+    // A trailing dot leaves an empty extension, which 8.3 names cannot express
+    return pos && !(dot && pos == 8);
+}
+
+
+// Short name stored alongside a long name: two characters of the name, a hash of it and a numeric tail
+static void fat32_alias_name(char *name, uint8_t *short_name, int tail) {
+    memset(' ', short_name, 11);
+    uint16_t hash = 0;
+    char *dot = 0;
+    int pos = 0;
+    for(char *c = name; *c; c++) {
+        hash = hash * 31 + *c;
+        if(*c == '.') {
+            dot = c;
+        } else if(pos < 2 && fat32_short_char(*c)) {
+            short_name[pos++] = fat32_short_char(*c);
+        }
+    }
+    while(pos < 2) {
+        short_name[pos++] = '_';
+    }
+    for(int shift = 12; shift >= 0; shift -= 4) {
+        short_name[pos++] = hex_char_upper((hash >> shift) & 0xF);
+    }
+    short_name[6] = '~';
+    short_name[7] = '0' + tail;
+    pos = 8;
+    for(char *c = dot ? dot + 1 : ""; *c && pos < 11; c++) {
+        if(fat32_short_char(*c)) {
+            short_name[pos++] = fat32_short_char(*c);
+        }
+    }
+}
+
+
+static void fat32_fill_lfn_entry(uint8_t *entry, char *name, int len, uint8_t sequence, uint8_t checksum) {
+    static const uint8_t char_offsets[FAT32_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    memset(0, entry, FAT32_DIR_ENTRY_SIZE);
+    entry[0] = sequence;
+    entry[11] = FAT32_ATTR_LFN;
+    entry[13] = checksum;
+    int start = ((sequence & ~FAT32_LFN_LAST) - 1) * FAT32_LFN_CHARS;
+    for(int i = 0; i < FAT32_LFN_CHARS; i++) {
+        // The name is terminated by a zero character, the rest of the entry is padded
+        uint16_t c = start + i < len ? (uint8_t)name[start + i] : (start + i == len ? 0 : 0xFFFF);
+        *(uint16_t*)(entry + char_offsets[i]) = c;
+    }
+}
+
+
+/*
+ * Adds clusters to a directory, with their entries zeroed. Directory entries are modified through the buffer cache,
+ * so the blocks are cleared there.
+ */
+static int fat32_grow_directory(struct inode *dir, uint32_t have, uint32_t count) {
+    struct fat32_inode_data *dir_data = (struct fat32_inode_data*)dir->fs_data;
+    struct fat32_disk *partition = dir_data->partition;
+    unsigned int blocks_per_cluster = partition->bytes_per_cluster / dir->blk_dev->block_size;
+    if(fat32_alloc_clusters(dir, have, count)) {
+        return -1;
+    }
+    for(uint32_t i = have; i < have + count; i++) {
+        struct fat32_extent *e = fat32_find_extent(dir, i, 1);
+        if(!e) {
+            return -1;
+        }
+        unsigned int first_blk = fat32_cluster_block(partition, e->disk_cluster + (i - e->file_cluster));
+        for(unsigned int blk = 0; blk < blocks_per_cluster; blk++) {
+            struct buffer_head *b = bcache_read(dir->blk_dev, first_blk + blk);
+            if(!b) {
+                return -1;
+            }
+            if(fat32_pin(partition, b)) {
+                bcache_release(b);
+                return -1;
+            }
+            memset(0, b->data, dir->blk_dev->block_size);
+            bcache_mark_dirty(b);
+            bcache_release(b);
+        }
+    }
+    return 0;
+}
+
+
+// Compares file names the way FAT does, ignoring case
+static bool_t fat32_name_equal(char *a, char *b) {
+    for(; *a && *b; a++, b++) {
+        char ca = *a >= 'a' && *a <= 'z' ? *a - 'a' + 'A' : *a;
+        char cb = *b >= 'a' && *b <= 'z' ? *b - 'a' + 'A' : *b;
+        if(ca != cb) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+
+/*
+ * Creates an empty file. Names that do not fit 8.3 get long file name entries followed by a generated short alias.
+ * The entries take the first run of free slots in the directory, which grows if there is none.
+ */
+static struct inode *fat32_inode_create(struct inode *dir, char *name) {
+    struct fat32_inode_data *dir_data = (struct fat32_inode_data*)dir->fs_data;
+    struct fat32_disk *partition = dir_data->partition;
+    int len = strlen(name);
+    if(len == 0 || len > FAT32_LFN_MAX_ENTRIES * FAT32_LFN_CHARS) {
+        print("FAT32: Invalid file name\n");
+        return 0;
+    }
+    // Names differing only in case refer to the same file
+    for(struct inode *child = dir->child_nodes; child; child = child->peer_nodes) {
+        if(fat32_name_equal(child->filename, name)) {
+            print("FAT32: {s} already exists\n", child->filename);
+            return 0;
+        }
+    }
+    uint8_t short_name[11];
+    uint32_t lfn_entries = 0;
+    int tail = 1;
+    if(!fat32_short_name(name, short_name)) {
+        lfn_entries = (len + FAT32_LFN_CHARS - 1) / FAT32_LFN_CHARS;
+        fat32_alias_name(name, short_name, tail);
+    }
+    uint32_t needed = lfn_entries + 1;
+
+    // Look for free slots, and make sure the short name is not taken
+    uint32_t first = 0, run = 0, index = 0;
+    bool_t end = false;
+    while(!end || run < needed) {
+        struct buffer_head *b;
+        uint8_t *entry = fat32_dir_entry(dir, index, &b);
+        if(!entry) {
+            break;
+        }
+        if(entry[0] == FAT32_DIR_ENTRY_END) {
+            end = true;
+        }
+        bool_t taken = !end && entry[0] != FAT32_DIR_ENTRY_FREE && (entry[11] & FAT32_ATTR_LFN) != FAT32_ATTR_LFN &&
+            !strncmp((char*)entry, (char*)short_name, 11);
+        bool_t free_slot = end || entry[0] == FAT32_DIR_ENTRY_FREE;
+        bcache_release(b);
+        if(taken) {
+            if(!lfn_entries || tail == 9) {
+                print("FAT32: No unique short name for {s}\n", name);
+                return 0;
+            }
+            fat32_alias_name(name, short_name, ++tail);
+            first = run = index = 0;
+            end = false;
+            continue;
+        }
+        if(run < needed) {
+            if(!free_slot) {
+                run = 0;
+            } else if(!run++) {
+                first = index;
+            }
+        }
+        index++;
+    }
+    if(run < needed) {
+        // index is the number of entries in the directory
+        uint32_t entries_per_cluster = partition->bytes_per_cluster / FAT32_DIR_ENTRY_SIZE;
+        uint32_t have = index / entries_per_cluster;
+        if(!run) {
+            first = index;
+        }
+        uint32_t count = (needed - run + entries_per_cluster - 1) / entries_per_cluster;
+        if(fat32_grow_directory(dir, have, count)) {
+            print("FAT32: Failed to grow directory\n");
+            return 0;
+        }
+    }
+
+    uint8_t checksum = 0;
+    for(int i = 0; i < 11; i++) {
+        checksum = ((checksum & 1) << 7) + (checksum >> 1) + short_name[i];
+    }
+    for(uint32_t i = 0; i < needed; i++) {
+        struct buffer_head *b;
+        uint8_t *entry = fat32_dir_entry(dir, first + i, &b);
+        if(!entry || fat32_pin(partition, b)) {
+            if(entry) {
+                bcache_release(b);
+            }
+            print("FAT32: Failed to write directory entry\n");
+            return 0;
+        }
+        if(i < lfn_entries) {
+            // Long name parts are stored last part first
+            uint8_t sequence = lfn_entries - i;
+            fat32_fill_lfn_entry(entry, name, len, i ? sequence : sequence | FAT32_LFN_LAST, checksum);
+        } else {
+            memset(0, entry, FAT32_DIR_ENTRY_SIZE);
+            memcpy((char*)entry, (char*)short_name, 11);
+            entry[11] = FAT32_ATTR_ARCHIVE;
+        }
+        bcache_mark_dirty(b);
+        bcache_release(b);
+    }
+
+    struct inode *node = alloc_inode();
+    struct fat32_inode_data *n_data = kmalloc(sizeof(struct fat32_inode_data), ALLOC_ZERO_INIT);
+    if(!node || !n_data) {
+        return 0;
+    }
+    node->state = INODE_TYPE_FILE | INODE_STATE_VALID;
+    node->parent_node = dir;
+    node->ops = fat32_inode_ops;
+    node->blk_dev = dir->blk_dev;
+    node->fs_data = n_data;
+    strncpy(node->filename, name, sizeof(node->filename));
+    n_data->partition = partition;
+    n_data->entry_first = first;
+    n_data->entry_index = first + lfn_entries;
+    inode_insert_child(dir, node);
+    return node;
+}
+
+
+// Releases the clusters of a file and marks its directory entries as deleted
+static int fat32_inode_unlink(struct inode *n) {
+    struct fat32_inode_data *n_data = (struct fat32_inode_data*)n->fs_data;
+    fat32_dirent_forget(n);
+    if(fat32_free_clusters(n, 0)) {
+        return -1;
+    }
+    for(uint32_t i = n_data->entry_first; i <= n_data->entry_index; i++) {
+        struct buffer_head *b;
+        uint8_t *entry = fat32_dir_entry(n->parent_node, i, &b);
+        if(!entry || fat32_pin(n_data->partition, b)) {
+            if(entry) {
+                bcache_release(b);
+            }
+            print("FAT32: Failed to remove directory entry\n");
+            return -1;
+        }
+        entry[0] = FAT32_DIR_ENTRY_FREE;
+        bcache_mark_dirty(b);
+        bcache_release(b);
+    }
+    return 0;
+}
+
+
+// Changes are written for the whole partition, file data cannot be written separately from the FAT it depends on
+static int fat32_inode_push_data(struct inode *n) {
+    return fat32_flush(((struct fat32_inode_data*)n->fs_data)->partition);
+}
+
+
 static struct inode_ops fat32_inode_ops = {
     .fetch_data = fat32_inode_fetch_data,
-    .push_data = 0
+    .push_data = fat32_inode_push_data,
+    .map_blocks = fat32_inode_map_blocks,
+    .resize = fat32_inode_resize,
+    .create = fat32_inode_create,
+    .unlink = fat32_inode_unlink
 };
 
 
+// Loads the allocator hints. They are only hints, values out of range are replaced.
+static void fat32_read_fsinfo(struct fat32_disk *partition) {
+    partition->fsinfo_block = 0;
+    partition->free_count = FSINFO_UNKNOWN;
+    partition->next_free = 2;
+    uint16_t sector = partition->bpb->fsinfo_sector;
+    if(sector == 0 || sector == 0xFFFF) {
+        return;
+    }
+    unsigned int blk = sector * partition->bpb->bytes_per_sector / partition->dev->block_size;
+    struct buffer_head *b = bcache_read(partition->dev, blk);
+    if(!b) {
+        return;
+    }
+    if(*(uint32_t*)b->data == FSINFO_LEAD_SIGNATURE && *(uint32_t*)(b->data + FSINFO_OFF_STRUCT_SIGNATURE) == FSINFO_STRUCT_SIGNATURE) {
+        partition->fsinfo_block = blk;
+        uint32_t free_count = *(uint32_t*)(b->data + FSINFO_OFF_FREE_COUNT);
+        uint32_t next_free = *(uint32_t*)(b->data + FSINFO_OFF_NEXT_FREE);
+        if(free_count <= partition->cluster_count - 2) {
+            partition->free_count = free_count;
+        }
+        if(next_free >= 2 && next_free < partition->cluster_count) {
+            partition->next_free = next_free;
+        }
+    }
+    bcache_release(b);
+}
+
+
 struct fat32_disk* init_fat32_disk(struct block_dev *dev) {
     struct fat32_disk *partition = kmalloc(sizeof(struct fat32_disk), ALLOC_ZERO_INIT);
     partition->bpb = kmalloc(sizeof(struct bios_parameter_block), ALLOC_ZERO_INIT);
@@ -364,10 +1134,13 @@ struct fat32_disk* init_fat32_disk(struct block_dev *dev) {
         partition->sectors = partition->bpb->nr_fat16_sectors;
     }
 
-    print("Loading FAT32 FAT table...\n");
-    if(fat32_load_fat(partition)) {
-        goto init_failure;
+    // The FAT is read on demand
+    partition->fat_block = partition->bpb->nr_reserved_sectors * partition->bpb->bytes_per_sector / dev->block_size;
+    partition->cluster_count = (partition->sectors - partition->data_sector) / partition->bpb->sectors_per_cluster + 2;
+    if(partition->cluster_count > partition->fat_entries) {
+        partition->cluster_count = partition->fat_entries;
     }
+    fat32_read_fsinfo(partition);
 
     // Create root inode
     partition->root_node = alloc_inode();
@@ -378,6 +1151,7 @@ struct fat32_disk* init_fat32_disk(struct block_dev *dev) {
     partition->root_node->state |= INODE_TYPE_DIR;
     partition->root_node->parent_node = 0;
     partition->root_node->ops = fat32_inode_ops;
+    partition->root_node->blk_dev = dev;
     partition->root_node->fs_data = kmalloc(sizeof(struct fat32_inode_data), ALLOC_ZERO_INIT);
     ((struct fat32_inode_data*)partition->root_node->fs_data)->cluster = 2;
     ((struct fat32_inode_data*)partition->root_node->fs_data)->partition = partition;
@@ -388,4 +1162,18 @@ init_failure:
     free(partition);
     free(partition->bpb);
     return 0;
+}
+
+
+void print_fat32_stats(struct fat32_disk *partition) {
+    print("FAT32\n");
+    print("  FAT lookups: {ul}\n", partition->fat_lookups);
+    print("  FAT loads:   {ul}\n", partition->fat_loads);
+    print("  Extent hits: {ul}\n", partition->extent_hits);
+    print("  Chain walks: {ul}\n", partition->extent_walks);
+    print("  Allocated:   {ul} clusters\n", partition->clusters_allocated);
+    print("  FAT flushes: {ul}\n", partition->fat_flushes);
+    if(partition->free_count != FSINFO_UNKNOWN) {
+        print("  Free:        {u} clusters\n", partition->free_count);
+    }
 }
\ No newline at end of file
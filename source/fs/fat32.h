@@ -4,11 +4,36 @@
 #include <kernel/types.h>
 #include <kernel/print.h>
 #include <kernel/block.h>
+#include <kernel/bcache.h>
 
 #define FAT32_BYTES_PER_SECTOR 512
 #define FAT32_NR_FAT 2
 #define FAT32_MAGIC_NUMBER_OFFSET 0x1FE
 #define FAT32_MAGIC_NUMBER 0xAA55
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF
+#define FAT32_END_OF_CHAIN 0x0FFFFFF8
+
+// FAT blocks kept referenced by a partition, indexed by FAT block number
+#define FAT32_FAT_CACHE_SLOTS 8
+// Cluster runs remembered per inode
+#define FAT32_EXTENT_CACHE_SIZE 8
+// Modified FAT and directory blocks held per partition. They are written once this many have changed, or on sync.
+#define FAT32_PINNED_BLOCKS 64
+// FAT entries looked at past the first free cluster when searching for a longer free run
+#define FAT32_FREE_SCAN_LIMIT 65536
+
+#define FAT32_DIR_ENTRY_SIZE 32
+#define FAT32_DIR_ENTRY_END 0x00
+#define FAT32_DIR_ENTRY_FREE 0xE5
+#define FAT32_ATTR_VOLUME_ID 0x08
+#define FAT32_ATTR_DIRECTORY 0x10
+#define FAT32_ATTR_ARCHIVE 0x20
+#define FAT32_ATTR_LFN 0x0F
+// Set in the sequence number of the last long file name entry, which is stored first
+#define FAT32_LFN_LAST 0x40
+#define FAT32_LFN_CHARS 13
+// Long names are read into inode filenames of 256 characters, which limits them to 18 entries
+#define FAT32_LFN_MAX_ENTRIES 18
 
 // https://en.wikipedia.org/wiki/BIOS_parameter_block
 #define BPB_GLOBAL_OFF 0x0B
@@ -25,8 +50,17 @@
 #define BPB_OFF_TOTAL_SECTORS           (BPB_GLOBAL_OFF + 0x15)
 #define BPB_OFF_SECTORS_PER_FAT         (BPB_GLOBAL_OFF + 0x19)
 #define BPB_OFF_ROOT_DIR_CLUSTER        (BPB_GLOBAL_OFF + 0x21)
+#define BPB_OFF_FSINFO_SECTOR           (BPB_GLOBAL_OFF + 0x25)
 #define BPB_OFF_VOLUME_LABEL            (BPB_GLOBAL_OFF + 0x47)
 
+// FSInfo sector, holds hints for the cluster allocator
+#define FSINFO_LEAD_SIGNATURE           0x41615252
+#define FSINFO_STRUCT_SIGNATURE         0x61417272
+#define FSINFO_OFF_STRUCT_SIGNATURE     484
+#define FSINFO_OFF_FREE_COUNT           488
+#define FSINFO_OFF_NEXT_FREE            492
+#define FSINFO_UNKNOWN                  0xFFFFFFFF
+
 
 // This is temporary. We want to keep track of multiple file systems of different types eventually
 extern struct fat32_disk *g_root_fs;
@@ -39,10 +73,11 @@ struct bios_parameter_block {
     uint16_t nr_root_dir_entry;
     // Is zero for fat32 disks. Used for identification
     uint16_t fat16_sectors_per_fat;
-    uint16_t sectors_per_fat;
+    uint32_t sectors_per_fat;
     uint16_t nr_fat16_sectors;
     uint32_t nr_sectors;
     uint32_t root_cluster;
+    uint16_t fsinfo_sector;
     char volume_label[11];
 };
 
@@ -55,15 +90,58 @@ struct fat32_disk {
     unsigned int data_sector;
     unsigned int bytes_per_cluster;
     unsigned int sectors;
-    uint32_t *fat;
+    // First device block of the first FAT
+    unsigned int fat_block;
+    // FAT entries are read on demand through the buffer cache. Recently used FAT blocks stay referenced here.
+    struct buffer_head *fat_cache[FAT32_FAT_CACHE_SLOTS];
+    // Clusters 2 up to this are usable, limited by both the FAT size and the data region
+    uint32_t cluster_count;
+    // Block of the FSInfo sector, 0 if the partition has none
+    unsigned int fsinfo_block;
+    // Number of free clusters, FSINFO_UNKNOWN if not known
+    uint32_t free_count;
+    // Where the search for free clusters starts
+    uint32_t next_free;
+    bool_t fsinfo_dirty;
+    // Modified FAT and directory blocks. They stay referenced, so that the buffer cache cannot write them back
+    // before the file data they refer to.
+    struct buffer_head *pinned[FAT32_PINNED_BLOCKS];
+    uint32_t pinned_count;
+    // Files whose size or first cluster changed since their directory entry was written
+    struct inode *dirent_dirty;
+    uint64_t fat_lookups;
+    uint64_t fat_loads;
+    uint64_t extent_hits;
+    uint64_t extent_walks;
+    uint64_t clusters_allocated;
+    uint64_t fat_flushes;
+};
+
+// Run of clusters that are consecutive both in the file and on the device
+struct fat32_extent {
+    uint32_t file_cluster;
+    uint32_t disk_cluster;
+    // 0 if the slot is unused
+    uint32_t length;
 };
 
 struct fat32_inode_data {
     struct fat32_disk *partition;
     uint32_t cluster;
+    // Parts of the cluster chain found so far, so that seeking within the file does not walk the chain from the start
+    struct fat32_extent extents[FAT32_EXTENT_CACHE_SIZE];
+    // Slot replaced by the next new extent
+    uint8_t extent_next;
+    // Positions in the parent directory of the first long file name entry and of the short entry
+    uint32_t entry_first;
+    uint32_t entry_index;
+    // Position in the list of files with an outdated directory entry
+    bool_t dirent_dirty;
+    struct inode *dirent_next;
 };
 
 struct fat32_disk* init_fat32_disk(struct block_dev *dev);
 void print_bpb(struct bios_parameter_block *bpb);
+void print_fat32_stats(struct fat32_disk *partition);
 
 #endif  // FAT32_H
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <kernel/file.h>
+#include <kernel/alloc.h>
+#include <kernel/page.h>
+#include <kernel/page_cache.h>
+#include <kernel/print.h>
+
+// Windows queued ahead of a sequential reader
+static uint64_t readahead_windows;
+// Windows read because a read landed outside of the windows
+static uint64_t readahead_restarts;
+// Pages queued by readahead
+static uint64_t readahead_pages;
+
+
+/**
+ * @brief Opens a file for streaming reads.
+ * 
+ * @param node File inode
+ * @return The open file, or null
+ */
+struct file *file_open(struct inode *node) {
+    if(!(node->state & INODE_TYPE_FILE)) {
+        return 0;
+    }
+    if(node->state & INODE_STATE_NEW) {
+        if(inode_fetch_data(node)) {
+            return 0;
+        }
+    }
+    struct file *f = kmalloc(sizeof(struct file), ALLOC_ZERO_INIT);
+    if(!f) {
+        return 0;
+    }
+    f->node = node;
+    f->readahead_size = READAHEAD_MIN_BYTES;
+    return f;
+}
+
+
+// Pages queued by readahead are owned by the page cache, so closing does not wait for them
+void file_close(struct file *f) {
+    free(f);
+}
+
+
+void file_seek(struct file *f, uint64_t pos) {
+    f->pos = pos;
+}
+
+
+// Queues the pages of [start, end) that are not cached yet
+static void file_queue_window(struct file *f, uint64_t start, uint64_t end) {
+    readahead_pages += page_cache_prefetch(f->node, start, end - start);
+}
+
+
+// Called before each page a read copies from. Moves the windows along, and reads a new window if the page is outside of them.
+static void file_readahead(struct file *f, uint64_t page, bool_t sequential) {
+    uint64_t file_pages = (f->node->data_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(page >= f->window_end && page < f->next_end) {
+        // Entered the window queued by readahead
+        f->window_start = f->window_end;
+        f->window_end = f->next_end;
+    }
+    if(page < f->window_start || page >= f->window_end) {
+        uint64_t size = sequential ? f->readahead_size : READAHEAD_MIN_BYTES;
+        f->window_start = page;
+        f->window_end = page + size / PAGE_SIZE;
+        if(f->window_end > file_pages) {
+            f->window_end = file_pages;
+        }
+        f->next_end = f->window_end;
+        file_queue_window(f, f->window_start, f->window_end);
+        readahead_restarts++;
+    }
+}
+
+
+// Called after a page has been copied. Queues the window following the current one for sequential readers.
+static void file_readahead_next(struct file *f, bool_t sequential) {
+    uint64_t file_pages = (f->node->data_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(sequential && f->next_end == f->window_end && f->window_end < file_pages) {
+        f->next_end = f->window_end + f->readahead_size / PAGE_SIZE;
+        if(f->next_end > file_pages) {
+            f->next_end = file_pages;
+        }
+        file_queue_window(f, f->window_end, f->next_end);
+        readahead_windows++;
+        if(f->readahead_size < READAHEAD_MAX_BYTES) {
+            f->readahead_size *= 2;
+        }
+    }
+}
+
+
+/**
+ * @brief Reads from the current position of a file and advances it.
+ * 
+ * @param f Open file
+ * @param dest Kernel buffer
+ * @param n Number of bytes to read
+ * @return Number of bytes read, 0 at the end of the file, or -1 on error
+ */
+int64_t file_read(struct file *f, void *dest, uint64_t n) {
+    struct inode *node = f->node;
+    if(f->pos >= node->data_size) {
+        return 0;
+    }
+    if(n > node->data_size - f->pos) {
+        n = node->data_size - f->pos;
+    }
+
+    bool_t sequential = f->pos == f->last_end;
+    if(!sequential) {
+        f->readahead_size = READAHEAD_MIN_BYTES;
+    }
+    uint64_t done = 0;
+    while(done < n) {
+        uint64_t index = f->pos / PAGE_SIZE;
+        file_readahead(f, index, sequential);
+        struct cached_page *page = page_cache_read(node, index);
+        if(!page) {
+            break;
+        }
+        uint64_t in_page = f->pos % PAGE_SIZE;
+        uint64_t count = PAGE_SIZE - in_page;
+        if(count > n - done) {
+            count = n - done;
+        }
+        memcpy((char*)dest + done, (char*)page->data + in_page, count);
+        page_cache_release(page);
+        done += count;
+        f->pos += count;
+        // The page is served before the next window is read, since reading it usually does not overlap
+        file_readahead_next(f, sequential);
+    }
+    f->last_end = f->pos;
+    return done ? (int64_t)done : -1;
+}
+
+
+void print_readahead_stats() {
+    print("Readahead\n");
+    print("  Windows:     {ul}\n", readahead_windows);
+    print("  Restarts:    {ul}\n", readahead_restarts);
+    print("  Pages:       {ul}\n", readahead_pages);
+}
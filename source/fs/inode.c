@@ -1,6 +1,13 @@
 #include <kernel/inode.h>
 #include <kernel/print.h>
 #include <kernel/string.h>
+#include <kernel/page.h>
+#include <kernel/page_cache.h>
+
+// Pages queued per request by inode_read_at()
+#define INODE_READ_BATCH_PAGES 32
+// Dirty pages are written back once there are this many. Metadata is written by inode_push_data().
+#define INODE_WRITEBACK_PAGES 256
 
 
 struct inode* g_root_inode = 0;
@@ -26,11 +33,61 @@ int inode_read(struct inode *node, void* dest, uint32_t n) {
         to_read = n;
     }
 
-    memcpy(dest, (char*)node->data + node->seek_address, to_read);
+    to_read = inode_read_at(node, node->seek_address, dest, to_read);
     node->seek_address += to_read;
     return to_read;
 }
 
+
+/**
+ * @brief Reads file data at an offset through the page cache. Only the pages covering the range are read from the device,
+ * and pages that are not cached yet are queued in batches, so that contiguous data is read with few requests.
+ * 
+ * @param node File inode
+ * @param offset File offset
+ * @param dest Kernel buffer
+ * @param n Number of bytes to read
+ * @return Number of bytes read. Less than n at the end of the file or on a read error.
+ */
+uint64_t inode_read_at(struct inode *node, uint64_t offset, void *dest, uint64_t n) {
+    if(node->state & INODE_STATE_NEW) {
+        if(inode_fetch_data(node)) {
+            return 0;
+        }
+    }
+    if(!(node->state & INODE_TYPE_FILE) || offset >= node->data_size) {
+        return 0;
+    }
+    if(n > node->data_size - offset) {
+        n = node->data_size - offset;
+    }
+
+    uint64_t done = 0;
+    uint64_t prefetched = 0;
+    uint64_t end_page = (offset + n + PAGE_SIZE - 1) / PAGE_SIZE;
+    while(done < n) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        if(index >= prefetched) {
+            uint64_t count = end_page - index < INODE_READ_BATCH_PAGES ? end_page - index : INODE_READ_BATCH_PAGES;
+            page_cache_prefetch(node, index, count);
+            prefetched = index + count;
+        }
+        struct cached_page *page = page_cache_read(node, index);
+        if(!page) {
+            break;
+        }
+        uint64_t in_page = (offset + done) % PAGE_SIZE;
+        uint64_t count = PAGE_SIZE - in_page;
+        if(count > n - done) {
+            count = n - done;
+        }
+        memcpy((char*)dest + done, (char*)page->data + in_page, count);
+        page_cache_release(page);
+        done += count;
+    }
+    return done;
+}
+
 int inode_fetch_data(struct inode *n) {
     if(!n->ops.fetch_data) {
         print("Error: ops.read_data not defined\n");
@@ -136,6 +193,160 @@ struct inode *inode_from_path(struct inode *root, char *path) {
     return 0;
 }
 
+/**
+ * @brief Writes file data at an offset through the page cache. The file grows if the range extends past its end.
+ * Data is written back once enough pages are dirty, or by inode_push_data().
+ * 
+ * @param node File inode
+ * @param offset File offset. At most the file size, files with holes are not supported.
+ * @param src Kernel buffer
+ * @param n Number of bytes to write
+ * @return Number of bytes written, or -1 on error
+ */
+int64_t inode_write_at(struct inode *node, uint64_t offset, void *src, uint64_t n) {
+    if(node->state & INODE_STATE_NEW) {
+        if(inode_fetch_data(node)) {
+            return -1;
+        }
+    }
+    if(!(node->state & INODE_TYPE_FILE) || !node->ops.resize || offset > node->data_size) {
+        return -1;
+    }
+    if(!n) {
+        return 0;
+    }
+    uint64_t old_size = node->data_size;
+    uint64_t end = offset + n;
+    if(end > old_size && node->ops.resize(node, end)) {
+        return -1;
+    }
+
+    uint64_t done = 0;
+    while(done < n) {
+        uint64_t index = (offset + done) / PAGE_SIZE;
+        uint64_t page_start = index * PAGE_SIZE;
+        uint64_t page_end = page_start + PAGE_SIZE < node->data_size ? page_start + PAGE_SIZE : node->data_size;
+        // Old data is only read if the write leaves part of it in place
+        bool_t read = page_start < old_size && (offset > page_start || end < page_end);
+        struct cached_page *page = page_cache_grab(node, index, read);
+        if(!page) {
+            break;
+        }
+        uint64_t in_page = (offset + done) % PAGE_SIZE;
+        uint64_t count = PAGE_SIZE - in_page;
+        if(count > n - done) {
+            count = n - done;
+        }
+        memcpy((char*)page->data + in_page, (char*)src + done, count);
+        page_cache_mark_dirty(page);
+        page_cache_release(page);
+        done += count;
+    }
+    if(done) {
+        node->generation++;
+    }
+    if(done < n && end > old_size) {
+        // Give back the storage that was not written
+        node->ops.resize(node, offset + done > old_size ? offset + done : old_size);
+    }
+    if(page_cache_dirty_pages() >= INODE_WRITEBACK_PAGES) {
+        page_cache_sync(0);
+    }
+    return done ? (int64_t)done : -1;
+}
+
+
+/**
+ * @brief Sets the size of a file. Cached data past the new size is dropped, a grown file reads as zero past the old size.
+ * 
+ * @param node File inode
+ * @param size New size
+ * @return 0 for success
+ */
+int inode_truncate(struct inode *node, uint64_t size) {
+    if(node->state & INODE_STATE_NEW) {
+        if(inode_fetch_data(node)) {
+            return -1;
+        }
+    }
+    if(!(node->state & INODE_TYPE_FILE) || !node->ops.resize) {
+        return -1;
+    }
+    if(size > node->data_size) {
+        void *zero = kmalloc(PAGE_SIZE, ALLOC_ZERO_INIT);
+        if(!zero) {
+            return -1;
+        }
+        while(node->data_size < size) {
+            uint64_t count = size - node->data_size < PAGE_SIZE ? size - node->data_size : PAGE_SIZE;
+            if(inode_write_at(node, node->data_size, zero, count) != count) {
+                free(zero);
+                return -1;
+            }
+        }
+        free(zero);
+        return 0;
+    }
+    page_cache_truncate(node, size);
+    node->generation++;
+    return node->ops.resize(node, size);
+}
+
+
+/**
+ * @brief Creates an empty file in a directory.
+ * 
+ * @param dir Directory inode
+ * @param name File name
+ * @return The new inode, or null if the name is taken or the file could not be created
+ */
+struct inode *inode_create(struct inode *dir, char *name) {
+    if(dir->state & INODE_STATE_NEW) {
+        if(inode_fetch_data(dir)) {
+            return 0;
+        }
+    }
+    if(!(dir->state & INODE_TYPE_DIR) || !dir->ops.create) {
+        return 0;
+    }
+    if(search_children(dir, name)) {
+        print("{s} already exists\n", name);
+        return 0;
+    }
+    return dir->ops.create(dir, name);
+}
+
+
+/**
+ * @brief Removes a file. Its cached pages are dropped, processes that map them keep them.
+ * The inode is detached from its directory, but not freed, since other users may still hold it.
+ * 
+ * @param node File inode
+ * @return 0 for success
+ */
+int inode_unlink(struct inode *node) {
+    if(!(node->state & INODE_TYPE_FILE) || !node->ops.unlink || !node->parent_node) {
+        return -1;
+    }
+    page_cache_truncate(node, 0);
+    node->generation++;
+    if(node->ops.unlink(node)) {
+        return -1;
+    }
+    for(struct inode **i = &node->parent_node->child_nodes; *i; i = &(*i)->peer_nodes) {
+        if(*i == node) {
+            *i = node->peer_nodes;
+            break;
+        }
+    }
+    node->peer_nodes = 0;
+    node->data_size = 0;
+    // No longer a file, later reads and writes through stale pointers fail
+    node->state = INODE_STATE_VALID;
+    return 0;
+}
+
+
 void inode_print(struct inode *n) {
     if(!n) {
         print("Inode pointer invalid\n");
@@ -0,0 +1,726 @@
+#include <kernel/page_cache.h>
+#include <kernel/alloc.h>
+#include <kernel/block.h>
+#include <kernel/exception.h>
+#include <kernel/page.h>
+#include <kernel/print.h>
+#include <kernel/waitqueue.h>
+#include "../alloc/buddy.h"
+
+// Share of the free heap the cache may fill before it recycles its own pages
+#define PAGE_CACHE_MEMORY_DIVISOR 2
+#define PAGE_CACHE_MIN_PAGES 64
+
+// A read of consecutive pages that are stored contiguously on the device
+struct page_cache_request {
+    struct bio bio;
+    struct bio_vec vecs[BIO_MAX_MERGED_VECS];
+    struct cached_page *pages[BIO_MAX_MERGED_VECS];
+    uint32_t count;
+};
+
+static struct cached_page **page_cache_hash;
+static uint32_t page_cache_hash_mask;
+static uint32_t page_cache_capacity;
+static uint32_t page_cache_count;
+// Cold end first
+static struct cached_page *page_cache_lru_head;
+static struct cached_page *page_cache_lru_tail;
+static struct wait_queue page_cache_waiters;
+// Dirty pages in the order they were first written to
+static struct cached_page *page_cache_dirty_head;
+static struct cached_page *page_cache_dirty_tail;
+static uint32_t page_cache_dirty_count;
+
+static uint64_t page_cache_hits;
+static uint64_t page_cache_misses;
+// Lookups that found the page still being read, usually by readahead
+static uint64_t page_cache_waits;
+static uint64_t page_cache_prefetched;
+static uint64_t page_cache_evictions;
+// Evictions requested by the allocator
+static uint64_t page_cache_reclaimed;
+static uint64_t page_cache_writebacks;
+static uint64_t page_cache_write_requests;
+
+
+static uint32_t page_cache_hash_index(struct inode *node, uint64_t index) {
+    uint64_t key = ((uint64_t)node >> 4) ^ (index * 0x9E3779B1u);
+    return (key ^ (key >> 16)) & page_cache_hash_mask;
+}
+
+
+static void page_cache_lru_remove(struct cached_page *page) {
+    if(page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        page_cache_lru_head = page->lru_next;
+    }
+    if(page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        page_cache_lru_tail = page->lru_prev;
+    }
+    page->lru_prev = 0;
+    page->lru_next = 0;
+}
+
+
+static void page_cache_lru_append(struct cached_page *page) {
+    page->lru_next = 0;
+    page->lru_prev = page_cache_lru_tail;
+    if(page_cache_lru_tail) {
+        page_cache_lru_tail->lru_next = page;
+    } else {
+        page_cache_lru_head = page;
+    }
+    page_cache_lru_tail = page;
+}
+
+
+static void page_cache_hash_remove(struct cached_page *page) {
+    for(struct cached_page **i = &page_cache_hash[page_cache_hash_index(page->node, page->index)]; *i; i = &(*i)->hash_next) {
+        if(*i == page) {
+            *i = page->hash_next;
+            break;
+        }
+    }
+    page->hash_next = 0;
+}
+
+
+static struct cached_page *page_cache_lookup(struct inode *node, uint64_t index) {
+    for(struct cached_page *page = page_cache_hash[page_cache_hash_index(node, index)]; page; page = page->hash_next) {
+        if(page->node == node && page->index == index) {
+            return page;
+        }
+    }
+    return 0;
+}
+
+
+// Drops a page that is no longer on the LRU list. The memory is freed once no process maps it.
+static void page_cache_free(struct cached_page *page) {
+    page_cache_hash_remove(page);
+    user_page_put(page->paddr);
+    free(page);
+    page_cache_count--;
+}
+
+
+// Pages mapped by processes are skipped, evicting them would not free memory. Dirty pages are written back first.
+static bool_t page_cache_evictable(struct cached_page *page) {
+    return !page->refcount && !(page->flags & (PAGE_CACHE_BUSY | PAGE_CACHE_DIRTY)) && user_page_refcount(page->paddr) == 1;
+}
+
+
+// Evicts up to the given number of pages from the cold end of the LRU list. Called with interrupts disabled.
+static uint64_t page_cache_evict(uint64_t pages) {
+    uint64_t evicted = 0;
+    struct cached_page *page = page_cache_lru_head;
+    while(page && evicted < pages) {
+        struct cached_page *next = page->lru_next;
+        if(page_cache_evictable(page)) {
+            page_cache_lru_remove(page);
+            page_cache_free(page);
+            evicted++;
+        }
+        page = next;
+    }
+    page_cache_evictions += evicted;
+    return evicted;
+}
+
+
+/**
+ * @brief Sizes the cache from the free heap and allocates its hash table. Pages are allocated on demand.
+ * 
+ * @return 0 on success, -1 if the hash table cannot be allocated
+ */
+int init_page_cache() {
+    uint64_t heap = (uint64_t)buddy_heap_end() - (uint64_t)buddy_heap_start();
+    uint64_t available = heap - memory_allocated();
+    page_cache_capacity = available / PAGE_CACHE_MEMORY_DIVISOR / PAGE_SIZE;
+    if(page_cache_capacity < PAGE_CACHE_MIN_PAGES) {
+        page_cache_capacity = PAGE_CACHE_MIN_PAGES;
+    }
+    // About two pages per bucket when full
+    uint32_t buckets = 1;
+    while(buckets * 2 < page_cache_capacity) {
+        buckets *= 2;
+    }
+    page_cache_hash = kmalloc(buckets * sizeof(struct cached_page*), ALLOC_ZERO_INIT);
+    if(!page_cache_hash) {
+        print("page_cache: error: failed to allocate hash table\n");
+        return -1;
+    }
+    page_cache_hash_mask = buckets - 1;
+    print("Page cache: up to {u} pages, {u} buckets\n", page_cache_capacity, buckets);
+    return 0;
+}
+
+
+// Returns an unreferenced, zeroed page for the file offset. It is inserted into the hash table, but holds no data yet.
+static struct cached_page *page_cache_alloc(struct inode *node, uint64_t index) {
+    if(page_cache_count >= page_cache_capacity) {
+        page_cache_evict(1);
+    }
+    struct cached_page *page = kmalloc(sizeof(struct cached_page), ALLOC_ZERO_INIT);
+    if(!page) {
+        return 0;
+    }
+    page->paddr = user_chunk_alloc(USER_CHUNK_ORDER_PAGE);
+    if(!page->paddr) {
+        free(page);
+        return 0;
+    }
+    page->data = PHYS_TO_KERN(page->paddr);
+    page->node = node;
+    page->index = index;
+    uint32_t i = page_cache_hash_index(node, index);
+    page->hash_next = page_cache_hash[i];
+    page_cache_hash[i] = page;
+    page_cache_count++;
+    return page;
+}
+
+
+// Bytes of file data in a page
+static uint32_t page_cache_page_bytes(struct inode *node, uint64_t index) {
+    uint64_t offset = index * PAGE_SIZE;
+    if(offset >= node->data_size) {
+        return 0;
+    }
+    return node->data_size - offset < PAGE_SIZE ? node->data_size - offset : PAGE_SIZE;
+}
+
+
+// Reads a page synchronously. Pages whose blocks are not stored contiguously take one transfer per run.
+static int page_cache_fill(struct cached_page *page) {
+    struct inode *node = page->node;
+    struct block_dev *dev = node->blk_dev;
+    uint32_t bytes = page_cache_page_bytes(node, page->index);
+    unsigned int blocks = (bytes + dev->block_size - 1) / dev->block_size;
+    unsigned int done = 0;
+    while(done < blocks) {
+        unsigned int blk, run;
+        if(node->ops.map_blocks(node, page->index * PAGE_SIZE + done * dev->block_size, blocks - done, &blk, &run) || !run) {
+            return -1;
+        }
+        if(block_transfer(dev, blk, run, page->data + done * dev->block_size, false)) {
+            return -1;
+        }
+        done += run;
+    }
+    // The last block may extend past the end of the file
+    memset(0, page->data + bytes, PAGE_SIZE - bytes);
+    return 0;
+}
+
+
+// Returns a referenced page. Missing pages are read from the device, or start out zeroed if read is not set.
+static struct cached_page *page_cache_get(struct inode *node, uint64_t index, bool_t read) {
+    if(!node->blk_dev || !node->ops.map_blocks || index * PAGE_SIZE >= node->data_size) {
+        return 0;
+    }
+    uint64_t flags = irq_save();
+    struct cached_page *page = page_cache_lookup(node, index);
+    if(page) {
+        if(!page->refcount) {
+            page_cache_lru_remove(page);
+        }
+        page->refcount++;
+        if(page->flags & PAGE_CACHE_BUSY) {
+            page_cache_waits++;
+            while(page->flags & PAGE_CACHE_BUSY) {
+                wait_queue_sleep(&page_cache_waiters, 0);
+            }
+        } else if(page->flags & PAGE_CACHE_VALID) {
+            page_cache_hits++;
+        }
+        if(page->flags & PAGE_CACHE_VALID) {
+            irq_restore(flags);
+            return page;
+        }
+    } else {
+        page = page_cache_alloc(node, index);
+        if(!page) {
+            irq_restore(flags);
+            print("page_cache: no page available\n");
+            return 0;
+        }
+        page->refcount++;
+    }
+
+    int ret = 0;
+    if(read) {
+        page_cache_misses++;
+        page->flags |= PAGE_CACHE_BUSY;
+        ret = page_cache_fill(page);
+        page->flags &= ~PAGE_CACHE_BUSY;
+    } else {
+        // The page may hold the remains of a failed read
+        memset(0, page->data, PAGE_SIZE);
+    }
+    if(!ret && !(page->flags & PAGE_CACHE_REMOVED)) {
+        page->flags |= PAGE_CACHE_VALID;
+    }
+    wait_queue_wake_all(&page_cache_waiters);
+    irq_restore(flags);
+    if(ret) {
+        page_cache_release(page);
+        return 0;
+    }
+    return page;
+}
+
+
+/**
+ * @brief Returns a referenced page holding file data. Reads the page from the device on a miss.
+ * Release the page with page_cache_release().
+ * 
+ * @param node File inode
+ * @param index File offset / PAGE_SIZE
+ * @return The page, or null past the end of the file, on a read error or if no page is available
+ */
+struct cached_page *page_cache_read(struct inode *node, uint64_t index) {
+    return page_cache_get(node, index, true);
+}
+
+
+/**
+ * @brief Returns a referenced page for modification. Processes that map the page keep its old contents,
+ * the cache continues with a copy. Mark the page dirty after writing to it.
+ * 
+ * @param node File inode
+ * @param index File offset / PAGE_SIZE. Must be within the (already extended) file size.
+ * @param read Read a missing page from the device. Not needed if the caller overwrites all file data in the page.
+ * @return The page, or null on a read error or if no page is available
+ */
+struct cached_page *page_cache_grab(struct inode *node, uint64_t index, bool_t read) {
+    struct cached_page *page = page_cache_get(node, index, read);
+    if(!page) {
+        return 0;
+    }
+    uint64_t flags = irq_save();
+    if(user_page_refcount(page->paddr) > 1) {
+        uint64_t paddr = user_chunk_alloc(USER_CHUNK_ORDER_PAGE);
+        if(!paddr) {
+            irq_restore(flags);
+            page_cache_release(page);
+            return 0;
+        }
+        memcpy(PHYS_TO_KERN(paddr), (char*)page->data, PAGE_SIZE);
+        user_page_put(page->paddr);
+        page->paddr = paddr;
+        page->data = PHYS_TO_KERN(paddr);
+    }
+    irq_restore(flags);
+    return page;
+}
+
+
+/**
+ * @brief Marks a page returned by page_cache_grab() as modified. It is written back by page_cache_sync().
+ * 
+ * @param page Referenced page
+ */
+void page_cache_mark_dirty(struct cached_page *page) {
+    uint64_t flags = irq_save();
+    // Pages dropped by truncation are not written back
+    if(!(page->flags & (PAGE_CACHE_DIRTY | PAGE_CACHE_REMOVED))) {
+        page->flags |= PAGE_CACHE_DIRTY;
+        page->dirty_next = 0;
+        if(page_cache_dirty_tail) {
+            page_cache_dirty_tail->dirty_next = page;
+        } else {
+            page_cache_dirty_head = page;
+        }
+        page_cache_dirty_tail = page;
+        page_cache_dirty_count++;
+    }
+    irq_restore(flags);
+}
+
+
+uint32_t page_cache_dirty_pages() {
+    return page_cache_dirty_count;
+}
+
+
+// Takes the dirty pages of an inode (or of all inodes) off the dirty list. Returns them as a list linked by dirty_next.
+static struct cached_page *page_cache_take_dirty(struct inode *node, uint64_t min_index) {
+    struct cached_page *taken = 0;
+    struct cached_page *taken_tail = 0;
+    struct cached_page *prev = 0;
+    struct cached_page *page = page_cache_dirty_head;
+    while(page) {
+        struct cached_page *next = page->dirty_next;
+        if((!node || page->node == node) && page->index >= min_index) {
+            if(prev) {
+                prev->dirty_next = next;
+            } else {
+                page_cache_dirty_head = next;
+            }
+            if(page_cache_dirty_tail == page) {
+                page_cache_dirty_tail = prev;
+            }
+            page->flags &= ~PAGE_CACHE_DIRTY;
+            page->dirty_next = 0;
+            page_cache_dirty_count--;
+            if(taken_tail) {
+                taken_tail->dirty_next = page;
+            } else {
+                taken = page;
+            }
+            taken_tail = page;
+        } else {
+            prev = page;
+        }
+        page = next;
+    }
+    return taken;
+}
+
+
+/**
+ * @brief Drops a reference to a page. Unreferenced pages stay cached until they are evicted.
+ * 
+ * @param page Page returned by page_cache_read()
+ */
+void page_cache_release(struct cached_page *page) {
+    uint64_t flags = irq_save();
+    page->refcount--;
+    if(!page->refcount) {
+        if(page->flags & PAGE_CACHE_VALID) {
+            page_cache_lru_append(page);
+        } else {
+            // Failed reads are not cached
+            page_cache_free(page);
+        }
+    }
+    irq_restore(flags);
+}
+
+
+// Completion of a prefetch. Failed pages are dropped, or read again by a waiting reader.
+static void page_cache_read_done(struct bio *b) {
+    struct page_cache_request *req = b->data;
+    for(uint32_t i = 0; i < req->count; i++) {
+        struct cached_page *page = req->pages[i];
+        if(!b->status && !(page->flags & PAGE_CACHE_REMOVED)) {
+            uint32_t bytes = page_cache_page_bytes(page->node, page->index);
+            memset(0, page->data + bytes, PAGE_SIZE - bytes);
+            page->flags |= PAGE_CACHE_VALID;
+        }
+        page->flags &= ~PAGE_CACHE_BUSY;
+        page_cache_release(page);
+    }
+    wait_queue_wake_all(&page_cache_waiters);
+    free(req);
+}
+
+
+static void page_cache_submit(struct page_cache_request *req) {
+    if(!req) {
+        return;
+    }
+    if(!req->count) {
+        free(req);
+        return;
+    }
+    req->bio.dev = req->pages[0]->node->blk_dev;
+    req->bio.write = false;
+    req->bio.vecs = req->vecs;
+    req->bio.vec_count = req->count;
+    req->bio.done = page_cache_read_done;
+    req->bio.data = req;
+    bio_submit(&req->bio);
+}
+
+
+/**
+ * @brief Starts reading a range of pages that are not cached yet. Pages stored contiguously on the device are read
+ * with a single request. If the device is idle, the request is dispatched by the caller and completes before
+ * returning. Otherwise it is queued behind the running transfer, and page_cache_read() waits for pages still in flight.
+ * 
+ * @param node File inode
+ * @param index First page
+ * @param count Number of pages. Clamped to the end of the file.
+ * @return Number of pages queued
+ */
+uint32_t page_cache_prefetch(struct inode *node, uint64_t index, uint32_t count) {
+    if(!node->blk_dev || !node->ops.map_blocks) {
+        return 0;
+    }
+    uint64_t file_pages = (node->data_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(index >= file_pages) {
+        return 0;
+    }
+    if(count > file_pages - index) {
+        count = file_pages - index;
+    }
+    int block_size = node->blk_dev->block_size;
+
+    uint32_t queued = 0;
+    struct page_cache_request *req = 0;
+    unsigned int next_blk = 0;
+    uint64_t flags = irq_save();
+    for(uint64_t i = index; i < index + count; i++) {
+        if(page_cache_lookup(node, i)) {
+            page_cache_submit(req);
+            req = 0;
+            continue;
+        }
+        unsigned int blocks = (page_cache_page_bytes(node, i) + block_size - 1) / block_size;
+        unsigned int blk, run;
+        // Pages spanning fragmented clusters are left to page_cache_read()
+        if(node->ops.map_blocks(node, i * PAGE_SIZE, blocks, &blk, &run) || run < blocks) {
+            break;
+        }
+        if(req && (blk != next_blk || req->count == BIO_MAX_MERGED_VECS)) {
+            page_cache_submit(req);
+            req = 0;
+        }
+        if(!req) {
+            req = kmalloc(sizeof(struct page_cache_request), ALLOC_ZERO_INIT);
+            if(!req) {
+                break;
+            }
+            req->bio.blk = blk;
+        }
+        struct cached_page *page = page_cache_alloc(node, i);
+        if(!page) {
+            break;
+        }
+        // The request holds the reference until it has completed
+        page->refcount = 1;
+        page->flags |= PAGE_CACHE_BUSY;
+        req->pages[req->count] = page;
+        req->vecs[req->count].buf = page->data;
+        req->vecs[req->count].blocks = blocks;
+        req->count++;
+        next_blk = blk + blocks;
+        queued++;
+    }
+    page_cache_submit(req);
+    page_cache_prefetched += queued;
+    irq_restore(flags);
+    return queued;
+}
+
+
+// Writes a page whose blocks are not stored contiguously, one transfer per run
+static int page_cache_write_page(struct cached_page *page) {
+    struct inode *node = page->node;
+    struct block_dev *dev = node->blk_dev;
+    unsigned int blocks = (page_cache_page_bytes(node, page->index) + dev->block_size - 1) / dev->block_size;
+    unsigned int done = 0;
+    while(done < blocks) {
+        unsigned int blk, run;
+        if(node->ops.map_blocks(node, page->index * PAGE_SIZE + done * dev->block_size, blocks - done, &blk, &run) || !run) {
+            return -1;
+        }
+        if(block_transfer(dev, blk, run, page->data + done * dev->block_size, true)) {
+            return -1;
+        }
+        done += run;
+    }
+    return 0;
+}
+
+
+// Writes the pages of a request and waits for it. Pages that failed to write are marked dirty again.
+static int page_cache_write_request(struct page_cache_request *req) {
+    if(!req->count) {
+        free(req);
+        return 0;
+    }
+    req->bio.dev = req->pages[0]->node->blk_dev;
+    req->bio.write = true;
+    req->bio.vecs = req->vecs;
+    req->bio.vec_count = req->count;
+    req->bio.done = 0;
+    int ret = bio_submit_wait(&req->bio);
+    page_cache_write_requests++;
+    for(uint32_t i = 0; i < req->count; i++) {
+        if(ret) {
+            page_cache_mark_dirty(req->pages[i]);
+        } else {
+            page_cache_writebacks++;
+        }
+        page_cache_release(req->pages[i]);
+    }
+    free(req);
+    return ret;
+}
+
+
+static bool_t page_cache_before(struct cached_page *a, struct cached_page *b) {
+    return a->node < b->node || (a->node == b->node && a->index < b->index);
+}
+
+
+// Sorts a list linked by dirty_next by inode and index. Pages of appends are already sorted and are appended in constant time.
+static struct cached_page *page_cache_sort_dirty(struct cached_page *list) {
+    struct cached_page *sorted = 0;
+    struct cached_page *tail = 0;
+    while(list) {
+        struct cached_page *page = list;
+        list = list->dirty_next;
+        page->dirty_next = 0;
+        if(!tail || page_cache_before(tail, page)) {
+            if(tail) {
+                tail->dirty_next = page;
+            } else {
+                sorted = page;
+            }
+            tail = page;
+            continue;
+        }
+        struct cached_page **i = &sorted;
+        while(page_cache_before(*i, page)) {
+            i = &(*i)->dirty_next;
+        }
+        page->dirty_next = *i;
+        *i = page;
+    }
+    return sorted;
+}
+
+
+/**
+ * @brief Writes back the dirty pages of an inode. Pages that are consecutive on the device are written with a single request.
+ * 
+ * @param node File inode, or null for all inodes
+ * @return 0 on success, -1 if a page could not be written. It stays dirty.
+ */
+int page_cache_sync(struct inode *node) {
+    int ret = 0;
+    uint64_t flags = irq_save();
+    struct cached_page *page = page_cache_sort_dirty(page_cache_take_dirty(node, 0));
+    // Referenced until written, so that the pages cannot be evicted or freed meanwhile
+    for(struct cached_page *i = page; i; i = i->dirty_next) {
+        if(!i->refcount) {
+            page_cache_lru_remove(i);
+        }
+        i->refcount++;
+    }
+
+    struct page_cache_request *req = 0;
+    unsigned int next_blk = 0;
+    while(page) {
+        struct cached_page *next = page->dirty_next;
+        page->dirty_next = 0;
+        struct block_dev *dev = page->node->blk_dev;
+        unsigned int blocks = (page_cache_page_bytes(page->node, page->index) + dev->block_size - 1) / dev->block_size;
+        unsigned int blk, run;
+        bool_t mapped = blocks && !page->node->ops.map_blocks(page->node, page->index * PAGE_SIZE, blocks, &blk, &run);
+        if(req && (!mapped || run < blocks || blk != next_blk || req->pages[0]->node != page->node || req->count == BIO_MAX_MERGED_VECS)) {
+            ret |= page_cache_write_request(req);
+            req = 0;
+        }
+        if(!blocks) {
+            // Past the end of the file
+            page_cache_release(page);
+        } else if(!mapped || run < blocks) {
+            if(!mapped || page_cache_write_page(page)) {
+                page_cache_mark_dirty(page);
+                ret = -1;
+            }
+            page_cache_release(page);
+        } else {
+            if(!req) {
+                req = kmalloc(sizeof(struct page_cache_request), ALLOC_ZERO_INIT);
+            }
+            if(!req) {
+                page_cache_mark_dirty(page);
+                page_cache_release(page);
+                ret = -1;
+            } else {
+                if(!req->count) {
+                    req->bio.blk = blk;
+                }
+                req->pages[req->count] = page;
+                req->vecs[req->count].buf = page->data;
+                req->vecs[req->count].blocks = blocks;
+                req->count++;
+                next_blk = blk + blocks;
+            }
+        }
+        page = next;
+    }
+    if(req) {
+        ret |= page_cache_write_request(req);
+    }
+    irq_restore(flags);
+    return ret ? -1 : 0;
+}
+
+
+/**
+ * @brief Drops the cached pages of an inode past a new file size, including dirty ones, and zeroes the rest of the last page.
+ * Pages that are still referenced are freed with their last reference, processes mapping a page keep it.
+ * 
+ * @param node File inode
+ * @param size New file size
+ */
+void page_cache_truncate(struct inode *node, uint64_t size) {
+    uint64_t keep = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t flags = irq_save();
+    page_cache_take_dirty(node, keep);
+    for(uint32_t i = 0; i <= page_cache_hash_mask; i++) {
+        struct cached_page *page = page_cache_hash[i];
+        while(page) {
+            struct cached_page *next = page->hash_next;
+            if(page->node == node && page->index >= keep) {
+                if(!page->refcount && !(page->flags & PAGE_CACHE_BUSY)) {
+                    page_cache_lru_remove(page);
+                    page_cache_free(page);
+                } else {
+                    page_cache_hash_remove(page);
+                    page->flags = (page->flags & ~PAGE_CACHE_VALID) | PAGE_CACHE_REMOVED;
+                }
+            }
+            page = next;
+        }
+    }
+    if(size % PAGE_SIZE) {
+        struct cached_page *page = page_cache_lookup(node, keep - 1);
+        if(page && (page->flags & PAGE_CACHE_VALID)) {
+            memset(0, page->data + size % PAGE_SIZE, PAGE_SIZE - size % PAGE_SIZE);
+        }
+    }
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Evicts clean, unused pages to return memory to the allocator.
+ * 
+ * @param pages Number of pages to evict
+ * @return Number of pages evicted
+ */
+uint64_t page_cache_reclaim(uint64_t pages) {
+    uint64_t flags = irq_save();
+    uint64_t evicted = page_cache_evict(pages);
+    page_cache_reclaimed += evicted;
+    irq_restore(flags);
+    return evicted;
+}
+
+
+void print_page_cache_stats() {
+    uint64_t lookups = page_cache_hits + page_cache_misses + page_cache_waits;
+    print("Page cache\n");
+    print("  Pages:       {u} / {u} ({u} KiB)\n", page_cache_count, page_cache_capacity, page_cache_count * (PAGE_SIZE / 1024));
+    print("  Hits:        {ul}\n", page_cache_hits);
+    print("  Misses:      {ul}\n", page_cache_misses);
+    print("  In flight:   {ul}\n", page_cache_waits);
+    print("  Hit rate:    {ul}%\n", lookups ? page_cache_hits * 100 / lookups : 0);
+    print("  Prefetched:  {ul}\n", page_cache_prefetched);
+    print("  Evictions:   {ul}\n", page_cache_evictions);
+    print("  Reclaimed:   {ul}\n", page_cache_reclaimed);
+    print("  Dirty:       {u}\n", page_cache_dirty_count);
+    print("  Write-backs: {ul} in {ul} requests\n", page_cache_writebacks, page_cache_write_requests);
+}
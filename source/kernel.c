@@ -9,9 +9,14 @@
 #include <kernel/pagetable.h>
 #include <kernel/address_space.h>
 #include <kernel/mmap.h>
+#include <kernel/vmap.h>
 #include <kernel/process.h>
 #include <kernel/register.h>
 #include <kernel/device_tree.h>
+#include <kernel/cma.h>
+#include <kernel/dma.h>
+#include <kernel/bcache.h>
+#include <kernel/page_cache.h>
 
 #include "alloc/buddy.h"
 #include "uart.h"
@@ -33,9 +38,11 @@ void kernel_entry_point(uint64_t device_tree_phys_address) {
 
     // Exceptions
     init_exceptions();
-    enable_system_timer_interrupt();
-    //time = read_system_timer();
-    //set_system_timer_interrupt((time + 1000000) & 0xFFFFFFFF);
+    if(init_timers()) {
+        panic();
+    }
+    enable_user_counter_access();
+    enable_user_cycle_counter();
 
     // Populate kernel_page_table pointer
     page_table_init();
@@ -64,12 +71,19 @@ void kernel_entry_point(uint64_t device_tree_phys_address) {
     if(init_buddy_allocator()) {
         panic();
     }
+    if(init_page_descriptors()) {
+        panic();
+    }
     
     struct address_mapping *id_mapping;
     if(!init_kernel_address_space_struct(&id_mapping)) {
         print("Failed to allocate initial address space.");
         panic();
     }
+    if(init_vmap()) {
+        print("Failed to initialize kernel virtual address allocator.\n");
+        panic();
+    }
     // We can now preform memory mappings. Migrate to new UART mappings before we remove the identity maps.
     if(uart_init()) {
         panic();
@@ -86,12 +100,25 @@ void kernel_entry_point(uint64_t device_tree_phys_address) {
         panic();
     }
     print("DTB loaded @ 0x{xl}(phys)\n", device_tree_phys_address);
+    if(init_cma(kernel_dt)) {
+        print("Allocations larger than 4 MiB are unavailable.\n");
+    }
+
+    if(init_dma()) {
+        print("SD card transfers fall back to PIO.\n");
+    }
 
     struct block_dev *primary_sd = alloc_block_dev();
     if(sd_initialize(primary_sd)) {
         print("SD device is required to mount root directory!\n");
         panic();
     }
+    if(init_bcache()) {
+        panic();
+    }
+    if(init_page_cache()) {
+        panic();
+    }
     g_root_fs = init_fat32_disk(primary_sd);
     if(!g_root_fs) {
         print("Failed to load root partition!\n");
@@ -8,33 +8,122 @@
 
 struct address_space* kernel_address_space = 0;
 
+#define ADDRESS_SPACE_INDEX_MIN_CAPACITY 16
+
+
+/**
+ * @brief Binary searches the mapping index.
+ * 
+ * @param s The address space
+ * @param vaddr Virtual address
+ * @return Position of the last mapping starting at or below vaddr, or -1 if there is none
+ */
+static int64_t address_space_index_search(struct address_space *s, uint64_t vaddr) {
+    int64_t low = 0;
+    int64_t high = (int64_t)s->index_count - 1;
+    int64_t found = -1;
+    while(low <= high) {
+        int64_t mid = (low + high) / 2;
+        if(s->index[mid]->vaddress <= vaddr) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+
 /**
- * @brief Checks if two address mappings overlap
+ * @brief Checks whether the range overlaps any mapping of the address space, active or not.
  * 
- * @param map1 
- * @param map2 
+ * @param s The address space
+ * @param vaddr Start of the range
+ * @param size Size of the range
+ * @param ignore Mapping that is not checked. May be null.
  * @return 1 if overlapping
  */
-static int memory_region_overlaps(struct address_mapping *map1, struct address_mapping *map2) {
-    if(!map1->active || !map2->active) {
-        return 0;
+static int address_space_range_used(struct address_space *s, uint64_t vaddr, uint64_t size, struct address_mapping *ignore) {
+    // Only the mapping starting below the range, and those starting within it, can overlap
+    int64_t i = address_space_index_search(s, vaddr);
+    if(i < 0) {
+        i = 0;
     }
-    // Check if start or end of region 1 is inside region 2
-    if(map1->vaddress >= map2->vaddress && map1->vaddress < (map2->vaddress + map2->size)) {
-        return 1;
+    for(; i < s->index_count && s->index[i]->vaddress < vaddr + size; i++) {
+        struct address_mapping *m = s->index[i];
+        if(m != ignore && m->vaddress + m->size > vaddr) {
+            return 1;
+        }
     }
-    if((map1->vaddress + map1->size) > map2->vaddress && (map1->vaddress + map1->size) <= (map2->vaddress + map2->size)) {
-        return 1;
+    return 0;
+}
+
+
+/**
+ * @brief Inserts the mapping into the sorted index and list of the address space.
+ * 
+ * @param s The address space
+ * @param map The new mapping. Must not overlap existing mappings.
+ * @return 0 for success
+ */
+static int address_space_index_insert(struct address_space *s, struct address_mapping *map) {
+    if(s->index_count == s->index_capacity) {
+        uint32_t capacity = s->index_capacity ? s->index_capacity * 2 : ADDRESS_SPACE_INDEX_MIN_CAPACITY;
+        struct address_mapping **index = kmalloc(capacity * sizeof(struct address_mapping*), 0);
+        if(!index) {
+            return 1;
+        }
+        for(uint32_t i = 0; i < s->index_count; i++) {
+            index[i] = s->index[i];
+        }
+        free(s->index);
+        s->index = index;
+        s->index_capacity = capacity;
     }
-    // If region 1 does not start within region 2, then it may still overlap it completely
-    if(map1->vaddress < map2->vaddress && (map1->vaddress + map1->size) > (map2->vaddress + map2->size)) {
-        return 1;
+
+    uint32_t pos = (uint32_t)(address_space_index_search(s, map->vaddress) + 1);
+    for(uint32_t i = s->index_count; i > pos; i--) {
+        s->index[i] = s->index[i - 1];
+    }
+    s->index[pos] = map;
+    s->index_count++;
+
+    // Keep the list in the same order
+    struct address_mapping *prev = pos ? s->index[pos - 1] : 0;
+    map->prev = prev;
+    map->next = prev ? prev->next : s->mappings;
+    if(map->next) {
+        map->next->prev = map;
+    }
+    if(prev) {
+        prev->next = map;
+    } else {
+        s->mappings = map;
     }
-    // Otherwise, region 1 does not overlap region 2
     return 0;
 }
 
 
+static void address_space_index_remove(struct address_space *s, struct address_mapping *map) {
+    int64_t pos = address_space_index_search(s, map->vaddress);
+    if(pos >= 0 && s->index[pos] == map) {
+        s->index_count--;
+        for(uint32_t i = pos; i < s->index_count; i++) {
+            s->index[i] = s->index[i + 1];
+        }
+    }
+
+    if(map->prev) {
+        map->prev->next = map->next;
+    } else {
+        s->mappings = map->next;
+    }
+    if(map->next) {
+        map->next->prev = map->prev;
+    }
+}
+
 /**
  * @brief Maps an unmapped address_mapping into the page table. The mapping may not already be active.
  * 
@@ -48,16 +137,16 @@ int map_memory_region(struct address_space *aspace, struct address_mapping *map)
         return 1;
     }
     // Check for overlaps
-    for(struct address_mapping *other = aspace->mappings; other; other = other->next) {
-        if(memory_region_overlaps(map, other)) {
-            print("Attempted to map overlapping memory region!\n");
-            free(map);
-            return 1;
-        }
+    if(address_space_range_used(aspace, map->vaddress, map->size, map)) {
+        print("Attempted to map overlapping memory region!\n");
+        return 1;
     }
     // No overlaps, add region to page table
-    if(page_table_map_address(aspace->page_table, map->paddress, map->vaddress, map->size)) {
-        free(map);
+    uint64_t attr = 0;
+    if(map->flags & (MAPPING_FLAG_READONLY | MAPPING_FLAG_COW)) {
+        attr |= PT_ATTR_READONLY;
+    }
+    if(page_table_map_address(aspace->page_table, map->paddress, map->vaddress, map->size, attr)) {
         return 1;
     }
     map->active = true;
@@ -72,9 +161,13 @@ int map_memory_region(struct address_space *aspace, struct address_mapping *map)
  * @param vaddr The start of the virtual address block
  * @param paddr The start of the physical address block
  * @param size Size of the memory region to map
- * @return 0 for success
+ * @return The new inactive mapping, or null if the range is already used
  */
 struct address_mapping* create_memory_region(struct address_space *aspace, uint64_t vaddr, uint64_t paddr, uint64_t size) {
+    if(address_space_range_used(aspace, vaddr, size, 0)) {
+        print("Attempted to create overlapping memory region!\n");
+        return 0;
+    }
     // Allocate new mapping
     struct address_mapping *new_map = kmalloc(sizeof(struct address_mapping), 0);
     if(!new_map) {
@@ -86,15 +179,14 @@ struct address_mapping* create_memory_region(struct address_space *aspace, uint6
     new_map->vaddress = vaddr;
     new_map->paddress = paddr;
     new_map->size = size;
+    new_map->flags = 0;
     new_map->active = false; // Otherwise it will not be mapped by map_existing
 
-    // Insert memory region into linked list
-    if(aspace->mappings) {
-        aspace->mappings->prev = new_map;
-    }  
-    new_map->next = aspace->mappings;
-    aspace->mappings = new_map;
-
+    // Insert memory region into the sorted list
+    if(address_space_index_insert(aspace, new_map)) {
+        free(new_map);
+        return 0;
+    }
     return new_map;
 }
 
@@ -152,20 +244,170 @@ int unmap_and_remove_memory_region(struct address_space *aspace, struct address_
     reterr(unmap_memory_region(aspace, mapping));
 
     // Remove from linked list, then free
-    if(mapping->prev) {
-        mapping->prev->next = mapping->next;
+    address_space_index_remove(aspace, mapping);
+    free(mapping);
+    return 0;
+}
+
+
+/**
+ * @brief Changes the flags of a mapping. Active mappings are remapped, so that the new permissions take effect.
+ * 
+ * @param aspace Address space containing the mapping
+ * @param mapping The mapping to modify
+ * @param flags The new mapping flags
+ * @return 0 for success
+ */
+int protect_memory_region(struct address_space *aspace, struct address_mapping *mapping, uint32_t flags) {
+    if(!mapping->active) {
+        mapping->flags = flags;
+        return 0;
+    }
+    reterr(unmap_memory_region(aspace, mapping));
+    mapping->flags = flags;
+    return map_memory_region(aspace, mapping);
+}
+
+
+// Removes an inactive mapping that was created by remap_memory_page()
+static void remap_discard(struct address_space *aspace, struct address_mapping *map) {
+    if(map) {
+        unmap_memory_region(aspace, map);
+        address_space_index_remove(aspace, map);
+        free(map);
+    }
+}
+
+
+/**
+ * @brief Maps a single page of a mapping to a different physical page. The mapping is split into up to three
+ * mappings, so that the page can be given its own flags. The original mapping struct is reused for the part
+ * before the page, or the part after it if there is none.
+ * On failure the original mapping is restored, so the address space is unchanged.
+ * 
+ * @param aspace Address space containing the mapping
+ * @param mapping The mapping containing vaddr
+ * @param vaddr Address within the page to remap
+ * @param paddr The new physical address of the page
+ * @param flags Flags of the new page mapping
+ * @return The mapping of the page or null
+ */
+struct address_mapping* remap_memory_page(struct address_space *aspace, struct address_mapping *mapping, uint64_t vaddr, uint64_t paddr, uint32_t flags) {
+    vaddr &= ~(PAGE_SIZE - 1ul);
+    bool_t was_active = mapping->active;
+    uint64_t map_vaddr = mapping->vaddress;
+    uint64_t map_paddr = mapping->paddress;
+    uint64_t map_size = mapping->size;
+    uint32_t map_flags = mapping->flags;
+    uint64_t head_size = vaddr - map_vaddr;
+    uint64_t tail_size = map_vaddr + map_size - (vaddr + PAGE_SIZE);
+
+    if(unmap_memory_region(aspace, mapping)) {
+        return 0;
+    }
+
+    // The original mapping shrinks to one of the parts, which makes room for the others
+    struct address_mapping *head = 0;
+    struct address_mapping *tail = 0;
+    struct address_mapping *page = 0;
+    if(head_size) {
+        head = mapping;
+        head->size = head_size;
+    } else if(tail_size) {
+        tail = mapping;
+        tail->vaddress = vaddr + PAGE_SIZE;
+        tail->paddress = map_paddr + PAGE_SIZE;
+        tail->size = tail_size;
     } else {
-        aspace->mappings = mapping->next;
+        page = mapping;
+        page->paddress = paddr;
+    }
+
+    struct address_mapping *created_tail = 0;
+    struct address_mapping *created_page = 0;
+    if(tail_size && !tail) {
+        created_tail = tail = create_memory_region(aspace, vaddr + PAGE_SIZE, map_paddr + head_size + PAGE_SIZE, tail_size);
+        if(!tail) {
+            goto restore;
+        }
+        tail->flags = map_flags;
     }
-    if(mapping->next) {
-        mapping->next->prev = mapping->prev;
+    if(!page) {
+        created_page = page = create_memory_region(aspace, vaddr, paddr, PAGE_SIZE);
+        if(!page) {
+            goto restore;
+        }
     }
+    page->flags = flags;
 
-    free(mapping);
+    if(was_active) {
+        if((head && map_memory_region(aspace, head)) || (tail && map_memory_region(aspace, tail)) || map_memory_region(aspace, page)) {
+            goto restore;
+        }
+    }
+    return page;
+
+restore:
+    remap_discard(aspace, created_tail);
+    remap_discard(aspace, created_page);
+    unmap_memory_region(aspace, mapping);
+    mapping->vaddress = map_vaddr;
+    mapping->paddress = map_paddr;
+    mapping->size = map_size;
+    mapping->flags = map_flags;
+    if(was_active) {
+        map_memory_region(aspace, mapping);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Returns the mapping containing the virtual address. Inactive mappings are included.
+ * 
+ * @param s The address space to search
+ * @param vaddr The virtual address
+ * @return The mapping or null
+ */
+struct address_mapping* address_space_find_mapping(struct address_space *s, uint64_t vaddr) {
+    int64_t i = address_space_index_search(s, vaddr);
+    if(i >= 0 && vaddr < s->index[i]->vaddress + s->index[i]->size) {
+        return s->index[i];
+    }
     return 0;
 }
 
 
+/**
+ * @brief Finds the lowest free virtual address range of the given size within [base, limit).
+ * 
+ * @param s The address space to search
+ * @param base Start of the search range
+ * @param limit End of the search range
+ * @param size Size of the free range
+ * @return Start of the free range, or 0 if there is none
+ */
+uint64_t address_space_find_free(struct address_space *s, uint64_t base, uint64_t limit, uint64_t size) {
+    uint64_t candidate = base;
+    int64_t i = address_space_index_search(s, base);
+    if(i < 0) {
+        i = 0;
+    }
+    // Walk the mappings in address order until the gap in front of the next one is large enough
+    for(; i < s->index_count && s->index[i]->vaddress < candidate + size; i++) {
+        uint64_t end = s->index[i]->vaddress + s->index[i]->size;
+        if(end > candidate) {
+            // Overlaps. Try again after this mapping.
+            candidate = end;
+        }
+    }
+    if(candidate + size > limit) {
+        return 0;
+    }
+    return candidate;
+}
+
+
 /**
  * @brief Allocates and returns an address_space struct pointer.
  */
@@ -186,6 +428,22 @@ struct address_space* allocate_address_space() {
     return s;
 }
 
+/**
+ * @brief Unmaps and frees all mappings of the address space, and the address space struct itself.
+ * 
+ * @param s The address space to free
+ */
+void free_address_space(struct address_space *s) {
+    while(s->mappings) {
+        if(unmap_and_remove_memory_region(s, s->mappings)) {
+            print("free_address_space: failed to unmap memory region\n");
+            return;
+        }
+    }
+    free(s->index);
+    free(s);
+}
+
 /**
  * @brief Allocates and populates an address_space struct containing the mappings from early mem.
  * This includes the identity mapping, which can be removed from the page table by means of the mapping added here.
@@ -212,23 +470,27 @@ struct address_space* init_kernel_address_space_struct(struct address_mapping **
         return 0;
     }
 
-    new_id_map->next = new_map;
-    new_id_map->prev = 0;
     new_id_map->vaddress = 0;
     new_id_map->paddress = 0;
     new_id_map->size = PAGE_SIZE * PAGE_TABLE_ENTRIES * PAGE_TABLE_ENTRIES;
+    new_id_map->flags = 0;
     new_id_map->active = true;
 
-     // Insert memory region into linked list
-    kaddrspace->mappings = new_id_map;
-
-    new_map->next = 0;
-    new_map->prev = new_id_map;
     new_map->vaddress = VA_OFFSET;
     new_map->paddress = 0;
     new_map->size = PAGE_SIZE * PAGE_TABLE_ENTRIES * PAGE_TABLE_ENTRIES;
+    new_map->flags = 0;
     new_map->active = true;
 
+    // Insert memory regions into the sorted list
+    if(address_space_index_insert(kaddrspace, new_id_map) || address_space_index_insert(kaddrspace, new_map)) {
+        free(kaddrspace->index);
+        free(kaddrspace);
+        free(new_map);
+        free(new_id_map);
+        return 0;
+    }
+
     kernel_address_space = kaddrspace;
     *id_mapping = new_id_map;
     return kaddrspace;
@@ -245,15 +507,12 @@ struct address_space* init_kernel_address_space_struct(struct address_mapping **
  * @return Output address
  */
 void* address_space_virtual_to_physical(struct address_space *s, void* address) {
-    struct address_mapping *i = s->mappings;
-    while(i) {
-        if((uint64_t)address > i->vaddress && (uint64_t)address < i->vaddress + i->size) {
-            return (void*)(i->paddress + ((uint64_t)address - i->vaddress));
-        }
-        i = i->next;
+    struct address_mapping *m = address_space_find_mapping(s, (uint64_t)address);
+    if(!m) {
+        return 0;
     }
-    return 0;
-} 
+    return (void*)(m->paddress + ((uint64_t)address - m->vaddress));
+}
 
 
 void print_address_space(struct address_space* s) {
@@ -0,0 +1,47 @@
+#include <kernel/cache.h>
+#include <kernel/register.h>
+
+
+static uint64_t dcache_line_size() {
+    // CTR_EL0.DminLine: log2 of the number of words in the smallest data cache line
+    return 4ul << ((read_system_reg(CTR_EL0) >> 16) & 0xF);
+}
+
+
+void dcache_clean_range(void *start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    for(uint64_t a = (uint64_t)start & ~(line - 1); a < (uint64_t)start + size; a += line) {
+        asm volatile("dc cvac, %0" : : "r"(a) : "memory");
+    }
+    asm volatile("dsb sy" : : : "memory");
+}
+
+
+void dcache_clean_invalidate_range(void *start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    for(uint64_t a = (uint64_t)start & ~(line - 1); a < (uint64_t)start + size; a += line) {
+        asm volatile("dc civac, %0" : : "r"(a) : "memory");
+    }
+    asm volatile("dsb sy" : : : "memory");
+}
+
+
+/**
+ * @brief Discards cached data of a buffer that a device has written to.
+ * Lines only partially covered by the buffer are cleaned as well, so that neighbouring data is kept.
+ * 
+ * @param start Start of the buffer
+ * @param size Size of the buffer
+ */
+void dcache_invalidate_range(void *start, uint64_t size) {
+    uint64_t line = dcache_line_size();
+    uint64_t end = (uint64_t)start + size;
+    for(uint64_t a = (uint64_t)start & ~(line - 1); a < end; a += line) {
+        if(a < (uint64_t)start || a + line > end) {
+            asm volatile("dc civac, %0" : : "r"(a) : "memory");
+        } else {
+            asm volatile("dc ivac, %0" : : "r"(a) : "memory");
+        }
+    }
+    asm volatile("dsb sy" : : : "memory");
+}
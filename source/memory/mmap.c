@@ -2,34 +2,11 @@
 #include <kernel/alloc.h>
 #include <kernel/print.h>
 #include <kernel/page.h>
+#include <kernel/vmap.h>
 
 #include <kernel/mmap.h>
 
 
-#define MMAP_BASE_ADDR          0x0000A00000000000ul
-#define MMAP_MAX_MAPPING_SIZE   0x0000000100000000ul
-#define MMAP_MAX_MAPPINGS 1024
-#define MMAP_MAPPING_LIST_LENGTH (MMAP_MAX_MAPPINGS / 64)
-static uint64_t mmap_free_mask[MMAP_MAPPING_LIST_LENGTH]; 
-
-/**
- * @brief Returns the next free virtual address slot
- * 
- * @return uint64_t 
- */
-static uint64_t mmap_get_free_vaddr() {
-    for(int i = 0; i < MMAP_MAX_MAPPINGS; i++) {
-        int list_idx = i / 64;
-        int bit_idx = i % 64;
-        if(!(mmap_free_mask[list_idx] & (1ul << bit_idx))) {
-            mmap_free_mask[list_idx] |= 1ul << bit_idx;
-            return MMAP_BASE_ADDR + (MMAP_MAX_MAPPING_SIZE * (uint64_t)i);
-        }
-    }
-    print("mmap: error: out of virtual addresses!\n");
-    return 0;
-}
-
 void* mmap(uint64_t pa, uint64_t size) {
     // Preform checks
     if((pa & (PAGE_SIZE - 1)) || (size & (PAGE_SIZE - 1))) {
@@ -37,12 +14,8 @@ void* mmap(uint64_t pa, uint64_t size) {
         return 0;
     }
 
-    if(size > MMAP_MAX_MAPPING_SIZE) {
-        print("mmap: error: max mapping size exceeded!\n");
-        return 0;
-    }
     // Reserve new virtual address region
-    uint64_t vaddr = mmap_get_free_vaddr();
+    uint64_t vaddr = vmap_reserve(size);
     if(!vaddr) {
         print("mmap: error: failed to obtain free virtual address\n");
         return 0;
@@ -52,6 +25,7 @@ void* mmap(uint64_t pa, uint64_t size) {
     struct address_mapping* new_mapping = create_memory_region(kernel_address_space, vaddr, pa, size);
     if(!new_mapping) {
         print("mmap: error: failed to create map for {x} bytes from 0x{xl} -> 0x{xl}\n", size, pa, vaddr);
+        vmap_release(vaddr);
         return 0;
     }
 
@@ -60,9 +34,28 @@ void* mmap(uint64_t pa, uint64_t size) {
         print("mmap: error: failed to create map for {x} bytes from 0x{xl} -> 0x{xl}\n", size, pa, vaddr);
         // This tolerates the mapping not being mapped. It will remove it from the linked list.
         unmap_and_remove_memory_region(kernel_address_space, new_mapping);
-        free(new_mapping);
+        vmap_release(vaddr);
         return 0;
     }
 
     return (void*)vaddr;
+}
+
+
+/**
+ * @brief Removes a mapping created by mmap() and releases its virtual addresses.
+ * 
+ * @param vaddr Address returned by mmap()
+ * @return 0 for success
+ */
+int munmap(void *vaddr) {
+    struct address_mapping *m = address_space_find_mapping(kernel_address_space, (uint64_t)vaddr);
+    if(!m || m->vaddress != (uint64_t)vaddr) {
+        print("munmap: error: 0x{xl} is not mapped\n", (uint64_t)vaddr);
+        return 1;
+    }
+    if(unmap_and_remove_memory_region(kernel_address_space, m)) {
+        return 1;
+    }
+    return vmap_release((uint64_t)vaddr);
 }
\ No newline at end of file
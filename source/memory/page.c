@@ -1,4 +1,10 @@
 #include <kernel/page.h>
+#include <kernel/alloc.h>
+#include <kernel/print.h>
+#include <kernel/pagetable.h>
+
+
+static struct page_descriptor *page_descriptors = 0;
 
 
 uint64_t round_up_to_page(uint64_t a) {
@@ -6,4 +12,99 @@ uint64_t round_up_to_page(uint64_t a) {
         return 0;
     }
     return ((a - 1) & ~(PAGE_SIZE-1)) + PAGE_SIZE;
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Allocates the descriptor array for all physical pages. Requires the buddy allocator.
+ * The occupancy of the page tables created during boot is counted here.
+ * 
+ * @return 0 for success
+ */
+int init_page_descriptors() {
+    page_descriptors = kmalloc(PHYS_PAGE_COUNT * sizeof(struct page_descriptor), ALLOC_ZERO_INIT);
+    if(!page_descriptors) {
+        print("Failed to allocate page descriptors!\n");
+        return 1;
+    }
+    page_table_count_entries(kernel_page_table);
+    return 0;
+}
+
+
+/**
+ * @brief Returns the descriptor of the physical page containing paddr.
+ * 
+ * @param paddr Physical address
+ * @return The descriptor, or null if the address is not in RAM
+ */
+struct page_descriptor *page_descriptor(uint64_t paddr) {
+    if(!page_descriptors || paddr >= PHYS_MEMORY_SIZE) {
+        return 0;
+    }
+    return &page_descriptors[paddr / PAGE_SIZE];
+}
+
+
+/**
+ * @brief Allocates a zero initialized chunk of user memory. Each page of the chunk starts out with one reference,
+ * and the chunk is freed once all of its pages have been released with user_page_put().
+ * 
+ * @param order The chunk spans 2^order pages
+ * @return Physical address of the chunk, or 0 on failure
+ */
+uint64_t user_chunk_alloc(uint8_t order) {
+    uint64_t pages = 1ul << order;
+    // Buddy blocks are naturally aligned, so are the chunks
+    void *chunk = kmalloc(pages * PAGE_SIZE, ALLOC_ZERO_INIT | ALLOC_PAGE_ALIGN);
+    if(!chunk) {
+        return 0;
+    }
+    uint64_t paddr = (uint64_t)KERN_TO_PHYS(chunk);
+    for(uint64_t i = 0; i < pages; i++) {
+        struct page_descriptor *d = page_descriptor(paddr + i * PAGE_SIZE);
+        d->chunk_order = order;
+        d->map_count = 1;
+    }
+    page_descriptor(paddr)->chunk_live_pages = pages;
+    return paddr;
+}
+
+
+/**
+ * @brief Adds a reference to a user page.
+ * 
+ * @param paddr Physical address within the page
+ */
+void user_page_get(uint64_t paddr) {
+    page_descriptor(paddr)->map_count++;
+}
+
+
+/**
+ * @brief Drops a reference to a user page. The chunk containing the page is freed when none of its pages are referenced.
+ * 
+ * @param paddr Physical address within the page
+ */
+void user_page_put(uint64_t paddr) {
+    struct page_descriptor *d = page_descriptor(paddr);
+    if(!d->map_count) {
+        print("user_page_put: error: page 0x{xl} is not referenced\n", paddr);
+        return;
+    }
+    d->map_count--;
+    if(d->map_count) {
+        return;
+    }
+    uint64_t chunk = paddr & ~((PAGE_SIZE << d->chunk_order) - 1);
+    struct page_descriptor *head = page_descriptor(chunk);
+    head->chunk_live_pages--;
+    if(!head->chunk_live_pages) {
+        free(PHYS_TO_KERN(chunk));
+    }
+}
+
+
+uint16_t user_page_refcount(uint64_t paddr) {
+    return page_descriptor(paddr)->map_count;
+}
@@ -7,6 +7,13 @@
 
 // There are 4 page table levels. 0 is the uppermost level. 3 is the most detailled level
 
+// Unmapping more leaf entries than this flushes the whole TLB, instead of invalidating each address
+#define TLB_INVALIDATE_THRESHOLD 32
+
+// Runs of level 3 entries marked with the contiguous hint
+#define CONTIGUOUS_RUN_ENTRIES 16
+#define CONTIGUOUS_RUN_SIZE (CONTIGUOUS_RUN_ENTRIES * PAGE_SIZE)
+
 extern uint64_t *_kernel_page_table;
 uint64_t *kernel_page_table;
 
@@ -39,10 +46,113 @@ static uint64_t get_address_from_descriptor(uint64_t desc) {
 }
 
 
-static void tlb_invalidate_el1() {
-	__asm__ __volatile__("tlbi vmalle1");
+// Addresses removed from the page table, whose TLB entries are invalidated in one batch
+struct tlb_batch {
+    uint64_t va[TLB_INVALIDATE_THRESHOLD];
+    // Whether the walk cache must be invalidated as well, because a table was freed
+    bool_t table[TLB_INVALIDATE_THRESHOLD];
+    uint32_t count;
+    bool_t overflow;
+};
+
+
+static void tlb_batch_add(struct tlb_batch *b, uint64_t va, bool_t table) {
+    if(b->count == TLB_INVALIDATE_THRESHOLD) {
+        b->overflow = true;
+        return;
+    }
+    b->va[b->count] = va;
+    b->table[b->count] = table;
+    b->count++;
+}
+
+
+static void tlb_batch_flush(struct tlb_batch *b) {
+    // The cleared descriptors must be visible to the table walker before invalidating
+    __asm__ __volatile__("dsb ishst");
+    if(b->overflow) {
+        __asm__ __volatile__("tlbi vmalle1is");
+    } else {
+        for(uint32_t i = 0; i < b->count; i++) {
+            // Operand: VA[55:12]. Block entries are invalidated by any address within them.
+            uint64_t operand = (b->va[i] >> 12) & 0xFFFFFFFFFFFul;
+            if(b->table[i]) {
+                __asm__ __volatile__("tlbi vae1is, %0" :: "r"(operand));
+            } else {
+                __asm__ __volatile__("tlbi vale1is, %0" :: "r"(operand));
+            }
+        }
+    }
+    __asm__ __volatile__("dsb ish");
+    __asm__ __volatile__("isb");
+}
+
+
+/*
+ * Removes the contiguous hint from a run of level 3 entries. Changing the hint of live entries requires
+ * break-before-make: the run is invalidated and its TLB entries flushed, before the entries are written back.
+ */
+static void page_table_split_contiguous(uint64_t *table, uint16_t first, uint64_t run_va) {
+    uint64_t saved[CONTIGUOUS_RUN_ENTRIES];
+    for(uint16_t e = 0; e < CONTIGUOUS_RUN_ENTRIES; e++) {
+        saved[e] = table[first + e];
+        table[first + e] = 0;
+    }
+    __asm__ __volatile__("dsb ishst");
+    for(uint16_t e = 0; e < CONTIGUOUS_RUN_ENTRIES; e++) {
+        uint64_t operand = ((run_va + e * PAGE_SIZE) >> 12) & 0xFFFFFFFFFFFul;
+        __asm__ __volatile__("tlbi vale1is, %0" :: "r"(operand));
+    }
     __asm__ __volatile__("dsb ish");
     __asm__ __volatile__("isb");
+    for(uint16_t e = 0; e < CONTIGUOUS_RUN_ENTRIES; e++) {
+        table[first + e] = saved[e] & ~PT_ATTR_CONTIGUOUS;
+    }
+    __asm__ __volatile__("dsb ishst");
+}
+
+
+static struct page_descriptor *table_descriptor(uint64_t *table) {
+    return page_descriptor((uint64_t)PT_KERN_TO_PHYS(table));
+}
+
+
+/**
+ * @brief Counts the valid entries of the page table and all of its subtables into their page descriptors.
+ * 
+ * @param table Kernel address of a table
+ * @param level Level of the table
+ */
+static void page_table_count_level(uint64_t *table, int level) {
+    uint16_t entries = 0;
+    for(int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        if(!(table[i] & 0b1)) {
+            continue;
+        }
+        entries++;
+        if(is_table_entry(table[i], level)) {
+            uint64_t *next_table = PT_ADDRESS_TO_KERN((uint64_t*)get_address_from_descriptor(table[i]));
+            page_table_count_level(next_table, level + 1);
+            struct page_descriptor *d = table_descriptor(next_table);
+            if(d) {
+                d->table_parent_index = i;
+            }
+        }
+    }
+    struct page_descriptor *d = table_descriptor(table);
+    if(d) {
+        d->table_entries = entries;
+    }
+}
+
+
+/**
+ * @brief Initializes the occupancy counters of an existing page table. Called once the page descriptors exist.
+ * 
+ * @param root_table Kernel address of the root table
+ */
+void page_table_count_entries(uint64_t *root_table) {
+    page_table_count_level(root_table, 0);
 }
 
 void page_table_init() {
@@ -62,6 +172,16 @@ static void page_table_insert_table_descriptor(uint64_t* table, uint64_t* next_t
     // Valid bit and index to next table
     descriptor |= 0b11;
     table[index] = descriptor;
+
+    struct page_descriptor *d = table_descriptor(table);
+    if(d) {
+        d->table_entries++;
+    }
+    struct page_descriptor *next_d = page_descriptor((uint64_t)next_table);
+    if(next_d) {
+        next_d->table_entries = 0;
+        next_d->table_parent_index = index;
+    }
 }
 
 
@@ -71,8 +191,9 @@ static void page_table_insert_table_descriptor(uint64_t* table, uint64_t* next_t
  * @param pa The physical address to map to
  * @param va The virtual address we are mapping
  * @param level The level of the table we are inserting into
+ * @param attr Additional descriptor attributes (PT_ATTR_*)
  */
-static void page_table_insert_descriptor(uint64_t* table, uint64_t pa, uint64_t va, int level) {
+static void page_table_insert_descriptor(uint64_t* table, uint64_t pa, uint64_t va, int level, uint64_t attr) {
     uint16_t index = address_index(va, level);
     uint64_t descriptor = pa;
     // Valid bit
@@ -85,8 +206,14 @@ static void page_table_insert_descriptor(uint64_t* table, uint64_t pa, uint64_t
     descriptor |= 0b1 << 10;
     // Allow access from EL0
     descriptor |= 0b1 << 6;
+    descriptor |= attr;
     table[index] = descriptor;
     // MAIR index = 0b000, default permisions: allow all access.
+
+    struct page_descriptor *d = table_descriptor(table);
+    if(d) {
+        d->table_entries++;
+    }
 }
 
 
@@ -123,24 +250,48 @@ uint64_t page_table_virtual_to_physical(uint64_t* table, uint64_t a) {
  * @param pa The physical address we are mapping to
  * @param va The virtual address we are inserting
  * @param size The length of the mapping
+ * @param attr Additional descriptor attributes (PT_ATTR_*)
  */
-int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint64_t size) {
+int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint64_t size, uint64_t attr) {
     if((pa & (PAGE_SIZE - 1)) || (va & (PAGE_SIZE - 1)) || (size & (PAGE_SIZE - 1))) {
         print("Failed to map page table address, invalid page alignment!\n");
         return -1;
     }
 
     uint64_t current_address = va;
+    // Remaining entries of the current contiguous run
+    int contiguous_left = 0;
     while(current_address < (va + size)) {
-        // The largest block according to the alignment
+        uint64_t offset  = current_address - va;
+        // The largest block according to the alignment of both addresses
         // Alignment should never equal -1, since we checked the address alignment at the start of the function.
         int alignment = page_table_alignment(current_address);
+        int pa_alignment = page_table_alignment(pa + offset);
+        if(pa_alignment > alignment) {
+            alignment = pa_alignment;
+        }
+        // Level 0 block descriptors do not exist with a 4 KiB granule
+        if(alignment < 1) {
+            alignment = 1;
+        }
         // The largest block according to the remaining space to map
         uint64_t block_size = page_table_block_size(alignment);
         while(block_size > (va + size - current_address)) {
             alignment++;
             block_size = page_table_block_size(alignment);
         }
+        // Aligned runs of 16 pages get the contiguous hint
+        uint64_t leaf_attr = attr;
+        if(alignment == 3) {
+            if(!contiguous_left && !((current_address | (pa + offset)) & (CONTIGUOUS_RUN_SIZE - 1))
+                && va + size - current_address >= CONTIGUOUS_RUN_SIZE) {
+                contiguous_left = CONTIGUOUS_RUN_ENTRIES;
+            }
+            if(contiguous_left) {
+                leaf_attr |= PT_ATTR_CONTIGUOUS;
+                contiguous_left--;
+            }
+        }
         // We found the largest block suitable block
         // Generate page table entries
         uint64_t* current_table = root_table;
@@ -155,14 +306,21 @@ int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint6
                 current_table = PT_ADDRESS_TO_KERN((uint64_t*)(current_table[table_index] & ~0b11));
             } else {
                 // No entry present. Create a new table and point to it
-                uint64_t *new_table = kmalloc(PAGE_SIZE, ALLOC_ZERO_INIT);
+                uint64_t *new_table = kmalloc(PAGE_SIZE, ALLOC_ZERO_INIT | ALLOC_PAGE_ALIGN);
+                if(!new_table) {
+                    print("Failed to allocate page table!\n");
+                    return -1;
+                }
                 page_table_insert_table_descriptor(current_table, PT_KERN_TO_PHYS(new_table), current_address, i);
                 current_table = new_table;
             }
         }
         // Create the leaf node.
-        uint64_t offset  = current_address - va;
-        page_table_insert_descriptor(current_table, pa + offset, current_address, alignment);
+        if(current_table[address_index(current_address, alignment)] & 0b1) {
+            print("Conflicting entry already present in page table! (address: {xl})\n", current_address);
+            return -1;
+        }
+        page_table_insert_descriptor(current_table, pa + offset, current_address, alignment, leaf_attr);
 
         current_address += block_size;
     }
@@ -172,37 +330,47 @@ int page_table_map_address(uint64_t* root_table, uint64_t pa, uint64_t va, uint6
 
 
 /**
- * @brief Removes child from parent page table if child is empty
+ * @brief Removes an entry from a table. Tables left empty are freed and removed from their parent, up to the root.
  * 
- * @param parent 
- * @param child 
+ * @param tables The tables on the path to the entry. tables[0] is the root table.
+ * @param level Level of the table containing the entry
+ * @param index Index of the entry
+ * @return 1 if a table was freed
  */
-static void prune_if_empty(uint64_t* parent, uint64_t* child) {
-    for(int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
-        if(child[i]) {
-            return;
+static int page_table_remove_entry(uint64_t **tables, int level, uint16_t index) {
+    int freed = 0;
+    tables[level][index] = 0;
+    while(level > 0) {
+        struct page_descriptor *d = table_descriptor(tables[level]);
+        if(!d) {
+            // Tables without a descriptor are not pruned
+            break;
         }
+        d->table_entries--;
+        if(d->table_entries) {
+            break;
+        }
+        // The parent entry is found through the back index, without searching the parent
+        uint16_t parent_index = d->table_parent_index;
+        // TODO: Make all page tables dynamically allocated, so that all pages are managed by the allocator.
+        try_free(tables[level]);
+        level--;
+        tables[level][parent_index] = 0;
+        freed = 1;
     }
-    // No entry is present -> prune
-    for(int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
-        uint64_t* table = PT_ADDRESS_TO_KERN((uint64_t*)(parent[i] & ~0b11));
-        // print("{xl} != {xl}\n", (uint64_t)table, (uint64_t)child);
-        if((uint64_t)table == (uint64_t)child) {
-            // We have found the parent entry for the empty child
-            // TODO: Make all page tables dynamically allocated, so that all pages are managed by the allocator.
-            try_free(child);
-            parent[i] = 0;
-            return;
+    if(level == 0) {
+        struct page_descriptor *d = table_descriptor(tables[0]);
+        if(d) {
+            d->table_entries--;
         }
     }
-    print("Corrupted page table in prune_if_empty()\n");
-    panic();
-    return;
+    return freed;
 }
 
 
 /*!
  * Removes the mapping for the specified virtual address range.
+ * The TLB entries of the range are invalidated by address, unless the range contains many entries.
  * @param root_table Pointer to the page table we are modifing
  * @param va The virtual address to remove
  * @param size The length of the mapping
@@ -213,6 +381,9 @@ int page_table_unmap_address(uint64_t* root_table, uint64_t va, uint64_t size) {
         return -1;
     }
 
+    struct tlb_batch batch;
+    batch.count = 0;
+    batch.overflow = false;
     uint64_t current_address = va;
     while(current_address < (va + size)) {
         // Search for the current address in the page table
@@ -223,26 +394,29 @@ int page_table_unmap_address(uint64_t* root_table, uint64_t va, uint64_t size) {
             uint64_t* current_table = tables[i];
             uint16_t table_index = address_index(current_address, i);
             if(is_leaf_entry(current_table[table_index], i)) {
+                // A contiguous run that is only partially unmapped has to lose the hint in all of its entries
+                uint64_t run_start = current_address & ~(CONTIGUOUS_RUN_SIZE - 1);
+                if((current_table[table_index] & PT_ATTR_CONTIGUOUS) && (run_start < va || run_start + CONTIGUOUS_RUN_SIZE > va + size)) {
+                    page_table_split_contiguous(current_table, table_index & ~(CONTIGUOUS_RUN_ENTRIES - 1), run_start);
+                }
                 // Page table leaf node that we want to remove
-                current_table[table_index] = 0;
+                int freed = page_table_remove_entry(tables, i, table_index);
+                tlb_batch_add(&batch, current_address, freed);
                 current_address += page_table_block_size(i);
-                for(int i_remove = i; i_remove > 0; i_remove--) {
-                    // Travel up the page tables to prune any that are empty
-                    prune_if_empty(tables[i_remove - 1], tables[i_remove]);
-                }
                 break;
             } else if(is_table_entry(current_table[table_index], i)) {
                 // Page table index to next table -> follow
                 tables[i+1] = PT_ADDRESS_TO_KERN((uint64_t*)(current_table[table_index] & ~0b11));
             } else {
                 print("page_table_unmap_address: warning: attempting to unmap non-mapped regions.\n");
-                current_address += page_table_block_size(i);
+                // Skip to the next entry of this level
+                current_address = (current_address & ~(page_table_block_size(i) - 1)) + page_table_block_size(i);
                 break;
             }
             i++;
         }
     }
-    tlb_invalidate_el1();
+    tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -0,0 +1,259 @@
+#include <kernel/vmap.h>
+#include <kernel/alloc.h>
+#include <kernel/print.h>
+#include <kernel/page.h>
+
+#define VMAP_GUARD_SIZE PAGE_SIZE
+#define VMAP_MIN_CAPACITY 16
+
+
+struct vmap_range {
+    uint64_t start;
+    uint64_t size;
+};
+
+
+// Dynamic array of ranges, sorted by start address
+struct vmap_range_array {
+    struct vmap_range *ranges;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+
+static struct vmap_range_array vmap_free_ranges;
+// The same free ranges, sorted by size and then by start address, so that reservations find a fitting range by binary search
+static struct vmap_range_array vmap_free_sizes;
+static struct vmap_range_array vmap_used_ranges;
+
+
+/**
+ * @brief Binary searches the range array.
+ * 
+ * @return Position of the last range starting at or below addr, or -1 if there is none
+ */
+static int64_t vmap_search(struct vmap_range_array *a, uint64_t addr) {
+    int64_t low = 0;
+    int64_t high = (int64_t)a->count - 1;
+    int64_t found = -1;
+    while(low <= high) {
+        int64_t mid = (low + high) / 2;
+        if(a->ranges[mid].start <= addr) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+
+/**
+ * @brief Binary searches the array sorted by size.
+ * 
+ * @return Position of the first range that is larger than size, or as large and not starting below start
+ */
+static uint32_t vmap_size_search(struct vmap_range_array *a, uint64_t size, uint64_t start) {
+    uint32_t low = 0;
+    uint32_t high = a->count;
+    while(low < high) {
+        uint32_t mid = (low + high) / 2;
+        struct vmap_range *r = &a->ranges[mid];
+        if(r->size < size || (r->size == size && r->start < start)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+
+// Makes room for count ranges, so that later insertions cannot fail
+static int vmap_grow(struct vmap_range_array *a, uint32_t count) {
+    if(count <= a->capacity) {
+        return 0;
+    }
+    uint32_t capacity = a->capacity ? a->capacity : VMAP_MIN_CAPACITY;
+    while(capacity < count) {
+        capacity *= 2;
+    }
+    struct vmap_range *ranges = kmalloc(capacity * sizeof(struct vmap_range), 0);
+    if(!ranges) {
+        return 1;
+    }
+    for(uint32_t i = 0; i < a->count; i++) {
+        ranges[i] = a->ranges[i];
+    }
+    if(a->ranges) {
+        free(a->ranges);
+    }
+    a->ranges = ranges;
+    a->capacity = capacity;
+    return 0;
+}
+
+
+static int vmap_insert_at(struct vmap_range_array *a, uint32_t pos, uint64_t start, uint64_t size) {
+    if(vmap_grow(a, a->count + 1)) {
+        return 1;
+    }
+    for(uint32_t i = a->count; i > pos; i--) {
+        a->ranges[i] = a->ranges[i - 1];
+    }
+    a->ranges[pos].start = start;
+    a->ranges[pos].size = size;
+    a->count++;
+    return 0;
+}
+
+
+static void vmap_remove_at(struct vmap_range_array *a, uint32_t pos) {
+    a->count--;
+    for(uint32_t i = pos; i < a->count; i++) {
+        a->ranges[i] = a->ranges[i + 1];
+    }
+}
+
+
+// Adds a free range to both free arrays. The caller has grown them with vmap_grow_free().
+static void vmap_free_insert(uint64_t start, uint64_t size) {
+    vmap_insert_at(&vmap_free_ranges, (uint32_t)(vmap_search(&vmap_free_ranges, start) + 1), start, size);
+    vmap_insert_at(&vmap_free_sizes, vmap_size_search(&vmap_free_sizes, size, start), start, size);
+}
+
+
+static void vmap_free_remove(uint64_t start, uint64_t size) {
+    vmap_remove_at(&vmap_free_ranges, (uint32_t)vmap_search(&vmap_free_ranges, start));
+    vmap_remove_at(&vmap_free_sizes, vmap_size_search(&vmap_free_sizes, size, start));
+}
+
+
+static int vmap_grow_free(uint32_t extra) {
+    if(vmap_grow(&vmap_free_ranges, vmap_free_ranges.count + extra)) {
+        return 1;
+    }
+    return vmap_grow(&vmap_free_sizes, vmap_free_sizes.count + extra);
+}
+
+
+/**
+ * @brief Initializes the allocator with a single free range spanning the vmap region.
+ * 
+ * @return 0 for success
+ */
+int init_vmap() {
+    if(vmap_grow_free(1)) {
+        return 1;
+    }
+    vmap_free_insert(VMAP_BASE_ADDR, VMAP_END_ADDR - VMAP_BASE_ADDR);
+    return 0;
+}
+
+
+/**
+ * @brief Reserves a page aligned range of kernel virtual addresses. The smallest fitting free range is used.
+ * 
+ * @param size Size of the range. Rounded up to whole pages.
+ * @return Start of the range, or 0 on failure
+ */
+uint64_t vmap_reserve(uint64_t size) {
+    return vmap_reserve_aligned(size, PAGE_SIZE);
+}
+
+
+/**
+ * @brief Reserves a range of kernel virtual addresses starting at a multiple of align.
+ * The free ranges are searched by size, the smallest range that fits after alignment is used.
+ * The space skipped in front of the range stays free.
+ * 
+ * @param size Size of the range. Rounded up to whole pages.
+ * @param align Alignment of the start address. Must be a power of two of at least PAGE_SIZE.
+ * @return Start of the range, or 0 on failure
+ */
+uint64_t vmap_reserve_aligned(uint64_t size, uint64_t align) {
+    if(!size) {
+        return 0;
+    }
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1ul);
+    uint64_t needed = size + VMAP_GUARD_SIZE;
+    // Splitting a free range adds at most one range
+    if(vmap_grow_free(1) || vmap_grow(&vmap_used_ranges, vmap_used_ranges.count + 1)) {
+        return 0;
+    }
+    // Page aligned reservations fit the first candidate. Larger alignments may skip some.
+    for(uint32_t i = vmap_size_search(&vmap_free_sizes, needed, 0); i < vmap_free_sizes.count; i++) {
+        struct vmap_range r = vmap_free_sizes.ranges[i];
+        uint64_t start = (r.start + align - 1) & ~(align - 1);
+        uint64_t pad = start - r.start;
+        if(r.size < pad + needed) {
+            continue;
+        }
+        uint64_t rest = r.size - pad - needed;
+        vmap_insert_at(&vmap_used_ranges, (uint32_t)(vmap_search(&vmap_used_ranges, start) + 1), start, needed);
+        vmap_free_remove(r.start, r.size);
+        if(pad) {
+            vmap_free_insert(r.start, pad);
+        }
+        if(rest) {
+            vmap_free_insert(start + needed, rest);
+        }
+        return start;
+    }
+    print("vmap: error: out of virtual addresses!\n");
+    return 0;
+}
+
+
+/**
+ * @brief Returns the usable size of a reservation, without its guard page.
+ * 
+ * @param vaddr Start of the reservation
+ * @return Size in bytes, or 0 if vaddr was not reserved
+ */
+uint64_t vmap_reserved_size(uint64_t vaddr) {
+    int64_t pos = vmap_search(&vmap_used_ranges, vaddr);
+    if(pos < 0 || vmap_used_ranges.ranges[pos].start != vaddr) {
+        return 0;
+    }
+    return vmap_used_ranges.ranges[pos].size - VMAP_GUARD_SIZE;
+}
+
+
+/**
+ * @brief Returns a reservation to the free ranges. It is merged with adjacent free ranges.
+ * The caller must have removed all mappings within the range.
+ * 
+ * @param vaddr Start of the reservation
+ * @return 0 for success
+ */
+int vmap_release(uint64_t vaddr) {
+    int64_t used = vmap_search(&vmap_used_ranges, vaddr);
+    if(used < 0 || vmap_used_ranges.ranges[used].start != vaddr) {
+        print("vmap: error: 0x{xl} is not reserved\n", vaddr);
+        return 1;
+    }
+    uint64_t size = vmap_used_ranges.ranges[used].size;
+
+    if(vmap_grow_free(1)) {
+        // Keep the reservation, the range is leaked rather than handed out twice
+        return 1;
+    }
+    struct vmap_range_array *f = &vmap_free_ranges;
+    int64_t prev = vmap_search(f, vaddr);
+    uint32_t next = (uint32_t)(prev + 1);
+    uint64_t start = vaddr;
+    if(next < f->count && vaddr + size == f->ranges[next].start) {
+        size += f->ranges[next].size;
+        vmap_free_remove(f->ranges[next].start, f->ranges[next].size);
+    }
+    if(prev >= 0 && f->ranges[prev].start + f->ranges[prev].size == vaddr) {
+        start = f->ranges[prev].start;
+        size += f->ranges[prev].size;
+        vmap_free_remove(f->ranges[prev].start, f->ranges[prev].size);
+    }
+    vmap_free_insert(start, size);
+    vmap_remove_at(&vmap_used_ranges, used);
+    return 0;
+}
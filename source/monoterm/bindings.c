@@ -4,6 +4,12 @@ extern monoterm_func monoterm_help;
 extern monoterm_func monoterm_clear;
 extern monoterm_func monoterm_ls;
 extern monoterm_func monoterm_cat;
+extern monoterm_func monoterm_touch;
+extern monoterm_func monoterm_append;
+extern monoterm_func monoterm_rm;
+extern monoterm_func monoterm_truncate;
+extern monoterm_func monoterm_sync;
+extern monoterm_func monoterm_logbench;
 //extern monoterm_func monoterm_restart;
 extern monoterm_func monoterm_elfdump;
 extern monoterm_func monoterm_run;
@@ -21,6 +27,12 @@ struct monoterm_cmd monoterm_cmds[] = {
     {.cmd = "clear", .cmd_func = monoterm_clear, .desc = "Clear terminal"},
     {.cmd = "ls", .cmd_func = monoterm_ls, .desc = "Lists files"},
     {.cmd = "cat", .cmd_func = monoterm_cat, .desc = "Outputs file contents to console"},
+    {.cmd = "touch", .cmd_func = monoterm_touch, .desc = "Creates an empty file"},
+    {.cmd = "append", .cmd_func = monoterm_append, .desc = "Appends a line of text to a file"},
+    {.cmd = "rm", .cmd_func = monoterm_rm, .desc = "Removes a file"},
+    {.cmd = "truncate", .cmd_func = monoterm_truncate, .desc = "Sets the size of a file"},
+    {.cmd = "sync", .cmd_func = monoterm_sync, .desc = "Writes modified file data and metadata to disk"},
+    {.cmd = "logbench", .cmd_func = monoterm_logbench, .desc = "Measures append throughput of a log file"},
     {.cmd = "elfdump", .cmd_func = monoterm_elfdump, .desc = "Prints ELF header"},
     {.cmd = "run", .cmd_func = monoterm_run, .desc = "Executes ELF file"},
     {.cmd = "ps", .cmd_func = monoterm_ps, .desc = "Print processes known to the kernel"},
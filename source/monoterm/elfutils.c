@@ -91,34 +91,8 @@ int monoterm_run(int argc, char *argv[]) {
         return 1;
     }
 
-    struct elf_data *elf = alloc_elf_data();
-    if(!elf) {
-        return 1;
-    }
-    if(load_elf(elf_file, elf)) {
-        free(elf);
-        return 1;
-    }
-
-    // Create the process
-    struct process *p = allocate_process();
+    struct process *p = elf_spawn_process(elf_file, argc - 1, &argv[1]);
     if(!p) {
-        free(elf);
-        print("Failed to allocate process struct\n");
-        return 1;
-    }
-
-    if(elf_create_process(elf, p)) {
-        free(elf);
-        destroy_process(p);
-        print("Failed to create process!\n");
-        return 1;
-    }
-
-    // Put argc and argv into the context and onto the stack to call main
-    if(process_entry_point_args(p, argc - 1, &argv[1])) {
-        free(elf);
-        destroy_process(p);
         return 1;
     }
 
@@ -1,6 +1,14 @@
 #include <kernel/print.h>
 #include <kernel/term.h>
 #include <kernel/inode.h>
+#include <kernel/file.h>
+#include <kernel/page_cache.h>
+#include <kernel/string.h>
+#include <kernel/timer.h>
+
+#define CAT_CHUNK_SIZE 4096
+// Line length written by logbench, a typical log record
+#define LOGBENCH_LINE_SIZE 128
 
 
 int monoterm_ls(int argc, char *argv[]) {
@@ -70,21 +78,221 @@ int monoterm_cat(int argc, char *argv[]) {
         print("Target is a directory.\n");
         return 1;
     }
-    inode_fetch_data(file);
 
-    if(!(file->state & INODE_STATE_VALID)) {
+    // Streamed in chunks, so that readahead overlaps with printing
+    struct file *f = file_open(file);
+    char *chunk = kmalloc(CAT_CHUNK_SIZE, 0);
+    if(!f || !chunk) {
+        print("Failed to open file.\n");
+        if(f) {
+            file_close(f);
+        }
+        if(chunk) {
+            free(chunk);
+        }
+        return 1;
+    }
+    int64_t n;
+    while((n = file_read(f, chunk, CAT_CHUNK_SIZE)) > 0) {
+        for(int64_t i = 0; i < n; i++) {
+            char c = chunk[i];
+            if(c == '\n') {
+                print("\n");
+            } else if(c != '\r') {
+                print("{c}", c);
+            }
+        }
+    }
+    file_close(f);
+    free(chunk);
+    if(n < 0) {
         print("Failed to read file.\n");
         return 1;
     }
+    return 0;
+}
+
+
+/*
+ * Splits a path into its directory inode and the file name in it.
+ * Returns the directory, or null if it does not exist.
+ */
+static struct inode *resolve_parent(char *path, char **name) {
+    char parent[256];
+    int slash = -1;
+    for(int i = 0; path[i]; i++) {
+        if(path[i] == '/') {
+            slash = i;
+        }
+    }
+    *name = path + slash + 1;
+    if(slash <= 0 || slash >= (int)sizeof(parent)) {
+        parent[0] = '/';
+        parent[1] = 0;
+    } else {
+        strncpy(parent, path, slash);
+        parent[slash] = 0;
+    }
+    struct inode *dir = inode_from_path(g_root_inode, parent);
+    if(!dir || !(dir->state & INODE_TYPE_DIR)) {
+        print("Could not resolve path.\n");
+        return 0;
+    }
+    return dir;
+}
+
+
+// Returns the file at a path, creating it if it does not exist yet
+static struct inode *open_or_create(char *path) {
+    char *name;
+    struct inode *dir = resolve_parent(path, &name);
+    if(!dir) {
+        return 0;
+    }
+    struct inode *file = inode_from_path(g_root_inode, path);
+    if(file && file != dir) {
+        if(!(file->state & INODE_TYPE_FILE)) {
+            print("Target is a directory.\n");
+            return 0;
+        }
+        return file;
+    }
+    file = inode_create(dir, name);
+    if(!file) {
+        print("Failed to create {s}\n", path);
+    }
+    return file;
+}
+
+
+int monoterm_touch(int argc, char *argv[]) {
+    if(argc != 2) {
+        print("Invalid number of arguments.\nUsage: touch [file]\n");
+        return 1;
+    }
+    struct inode *file = open_or_create(argv[1]);
+    if(!file || inode_push_data(file)) {
+        return 1;
+    }
+    return 0;
+}
+
 
-    for(unsigned int i = 0; i < file->data_size; i++) {
-        char c = ((char*)file->data)[i];
-        if(c == '\n') {
-            print("\n");
-        } else if(c != '\r') {
-            print("{c}", c);
+int monoterm_append(int argc, char *argv[]) {
+    if(argc < 3) {
+        print("Invalid number of arguments.\nUsage: append [file] [text]\n");
+        return 1;
+    }
+    struct inode *file = open_or_create(argv[1]);
+    if(!file) {
+        return 1;
+    }
+    // Arguments are joined by single spaces and the line is terminated
+    for(int i = 2; i < argc; i++) {
+        int len = strlen(argv[i]);
+        char *separator = i + 1 < argc ? " " : "\n";
+        if(inode_write_at(file, file->data_size, argv[i], len) != len || inode_write_at(file, file->data_size, separator, 1) != 1) {
+            print("Failed to write file.\n");
+            return 1;
         }
     }
+    return inode_push_data(file) ? 1 : 0;
+}
+
+
+int monoterm_rm(int argc, char *argv[]) {
+    if(argc != 2) {
+        print("Invalid number of arguments.\nUsage: rm [file]\n");
+        return 1;
+    }
+    struct inode *file = inode_from_path(g_root_inode, argv[1]);
+    if(!file || !(file->state & INODE_TYPE_FILE)) {
+        print("Invalid file\n");
+        return 1;
+    }
+    struct inode *dir = file->parent_node;
+    if(inode_unlink(file) || inode_push_data(dir)) {
+        print("Failed to remove file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+int monoterm_truncate(int argc, char *argv[]) {
+    int size;
+    if(argc != 3 || atoi(argv[2], &size) || size < 0) {
+        print("Usage: truncate [file] [size]\n");
+        return 1;
+    }
+    struct inode *file = inode_from_path(g_root_inode, argv[1]);
+    if(!file || !(file->state & INODE_TYPE_FILE)) {
+        print("Invalid file\n");
+        return 1;
+    }
+    if(inode_truncate(file, size) || inode_push_data(file)) {
+        print("Failed to resize file.\n");
+        return 1;
+    }
+    return 0;
+}
+
 
+int monoterm_sync(int argc, char *argv[]) {
+    if(page_cache_sync(0) || inode_push_data(g_root_inode)) {
+        print("Write-back failed.\n");
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+
+/*
+ * Appends fixed size lines to a new file, the way a logging service would, and reports the throughput
+ * including the final write-back. The file is removed afterwards.
+ */
+int monoterm_logbench(int argc, char *argv[]) {
+    int mib = 4;
+    if(argc > 2 || (argc == 2 && (atoi(argv[1], &mib) || mib <= 0))) {
+        print("Usage: logbench [MiB]\n");
+        return 1;
+    }
+    char *path = "/LOGBENCH.TXT";
+    if(inode_from_path(g_root_inode, path)) {
+        print("{s} already exists\n", path);
+        return 1;
+    }
+    struct inode *file = open_or_create(path);
+    if(!file) {
+        return 1;
+    }
+    char line[LOGBENCH_LINE_SIZE];
+    memset('.', line, LOGBENCH_LINE_SIZE);
+    line[LOGBENCH_LINE_SIZE - 1] = '\n';
+
+    uint64_t total = (uint64_t)mib * 1024 * 1024;
+    uint64_t start = read_system_timer();
+    int ret = 0;
+    for(uint64_t written = 0; written < total; written += LOGBENCH_LINE_SIZE) {
+        // Number the lines, like a timestamp would
+        line[utos(written / LOGBENCH_LINE_SIZE, line, 16)] = ' ';
+        if(inode_write_at(file, written, line, LOGBENCH_LINE_SIZE) != LOGBENCH_LINE_SIZE) {
+            print("Failed to write file.\n");
+            ret = 1;
+            break;
+        }
+    }
+    if(!ret && inode_push_data(file)) {
+        print("Write-back failed.\n");
+        ret = 1;
+    }
+    uint64_t elapsed = read_system_timer() - start;
+    if(!ret) {
+        print("Wrote {u} MiB in {ul} ms, {ul} KiB/s\n", mib, elapsed / 1000, elapsed ? total * 1000000 / 1024 / elapsed : 0);
+    }
+    if(inode_unlink(file) || inode_push_data(g_root_inode)) {
+        print("Failed to remove {s}\n", path);
+        ret = 1;
+    }
+    return ret;
+}
@@ -1,4 +1,7 @@
 #include <kernel/print.h>
+#include <kernel/bcache.h>
+#include <kernel/file.h>
+#include <kernel/page_cache.h>
 #include "../fs/fat32.h"
 #include "bindings.h"
 
@@ -7,16 +10,28 @@ int monoterm_fsinfo(int argc, char *argv[]) {
     if(argc == 1) {
         print("Partition Size    {ul}kiB\n", (g_root_fs->sectors * g_root_fs->bpb->bytes_per_sector) / 1024);
         print_bpb(g_root_fs->bpb);
+        print_fat32_stats(g_root_fs);
+        print_bcache_stats();
+        print_page_cache_stats();
+        print_block_queue_stats(g_root_fs->dev);
+        print_readahead_stats();
         return 0;
     } else if(argc == 2) {
         if(!strcmp(argv[1], "bpb")) {
             print_bpb(g_root_fs->bpb);
             return 0;
+        } else if(!strcmp(argv[1], "cache")) {
+            print_fat32_stats(g_root_fs);
+            print_bcache_stats();
+            print_page_cache_stats();
+            print_block_queue_stats(g_root_fs->dev);
+            print_readahead_stats();
+            return 0;
         } else {
             print("Unknown option \"{s}\"\n", argv[1]);
             return 1;
         }
     }
-    print("Usage: fsinfo [bpb]\n");
+    print("Usage: fsinfo [bpb|cache]\n");
     return 1;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <kernel/pagetable.h>
 #include <kernel/address_space.h>
 #include <kernel/types.h>
+#include <kernel/cma.h>
 #include "bindings.h"
 #include "../alloc/buddy.h"
 
@@ -18,6 +19,7 @@ static void print_memory_usage() {
     print("{ul} bytes allocated\n", memory_allocated());
     print("{ul} mem_blk structs used\n", buddy_used_block_structs());
     print("{ul} mem_blk structs free\n", buddy_free_block_structs());
+    print_cma_usage();
 }
 
 static void print_regions() {
@@ -28,7 +28,7 @@ static int dump_process(char *pid_str) {
             print_thread_context(p->kern_thread);
             print("User registers\n");
             if(p->exception_stack_pointer) {
-                print_register_block(p->exception_stack_pointer);
+                print_exception_frame(p->exception_stack_pointer);
             }
             return 0;
         }
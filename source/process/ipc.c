@@ -0,0 +1,121 @@
+#include <kernel/ipc.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+#include <kernel/waitqueue.h>
+
+/*
+* Synchronous message passing between threads.
+* A client calls a server with a message in x2 to x7, and blocks until the server replies.
+* If the server is already waiting, the kernel switches directly between the two threads.
+* The message registers are copied between the exception frames, without touching memory buffers.
+*/
+
+
+static void ipc_copy_message(uint64_t *to_frame, uint64_t *from_frame) {
+    for(int i = IPC_MSG_FIRST_REG; i < IPC_MSG_FIRST_REG + IPC_MSG_WORDS; i++) {
+        to_frame[i] = from_frame[i];
+    }
+}
+
+
+// Passes the message of the client to the server. The client then waits for the reply.
+static void ipc_deliver(struct process *client, struct process *server) {
+    ipc_copy_message(server->exception_stack_pointer, client->exception_stack_pointer);
+    server->ipc_sender = client->pid;
+    client->ipc_state = IPC_STATE_WAIT_REPLY;
+    client->ipc_partner = server;
+}
+
+
+/**
+ * @brief Sends the message in x2 to x7 to the thread dest_pid, and waits for its reply. The reply is returned in x2 to x7.
+ * 
+ * @param dest_pid PID of the server thread
+ * @return 0 for success, -1 if the server does not exist or exited before replying
+ */
+int syscall_ipc_call(uint16_t dest_pid) {
+    struct process *client = kernel_curr_process;
+    struct process *server = process_from_pid(dest_pid);
+    if(!server || server == client || server->state == PROCESS_STATE_TERMINATED) {
+        return -1;
+    }
+
+    client->ipc_status = 0;
+    if(server->ipc_state == IPC_STATE_RECEIVING) {
+        ipc_deliver(client, server);
+        server->ipc_state = IPC_STATE_NONE;
+        // Fast path. Hand the time slice directly to the server, without searching for the next process.
+        switch_to_process(server, PROCESS_STATE_BLOCKED);
+    } else {
+        client->ipc_state = IPC_STATE_SENDING;
+        client->ipc_partner = server;
+        wait_queue_sleep(&server->ipc_senders, 0);
+    }
+    return client->ipc_status;
+}
+
+
+/**
+ * @brief Replies to a waiting client with the message in x2 to x7, then waits for the next call.
+ * The received message is returned in x2 to x7.
+ * 
+ * @param reply_to PID of the client to reply to, or 0 to only wait
+ * @return PID of the calling client, or -1 if reply_to is not waiting for a reply from this thread
+ */
+int syscall_ipc_reply_wait(uint16_t reply_to) {
+    struct process *server = kernel_curr_process;
+    struct process *client = 0;
+    if(reply_to) {
+        client = process_from_pid(reply_to);
+        if(!client || client->ipc_state != IPC_STATE_WAIT_REPLY || client->ipc_partner != server) {
+            return -1;
+        }
+        ipc_copy_message(client->exception_stack_pointer, server->exception_stack_pointer);
+        client->ipc_state = IPC_STATE_NONE;
+        client->ipc_partner = 0;
+    }
+
+    // Callers that arrived while we were busy are served first
+    struct process *next = server->ipc_senders.head;
+    if(next) {
+        wait_queue_remove(&server->ipc_senders, next);
+        ipc_deliver(next, server);
+        if(client) {
+            wait_queue_wake(client);
+        }
+        return server->ipc_sender;
+    }
+
+    server->ipc_state = IPC_STATE_RECEIVING;
+    // A client that was terminated while waiting for the reply must not run again
+    if(client && client->state == PROCESS_STATE_BLOCKED) {
+        // Fast path. Resume the client directly.
+        switch_to_process(client, PROCESS_STATE_BLOCKED);
+    } else {
+        switch_to_next_process(PROCESS_STATE_BLOCKED);
+    }
+    return server->ipc_sender;
+}
+
+
+/**
+ * @brief Fails all IPC calls to a thread that is being destroyed.
+ * 
+ * @param p The thread
+ */
+void ipc_abort(struct process *p) {
+    for(struct process *i = process_list_head; i; i = i->next) {
+        if(i->ipc_partner != p) {
+            continue;
+        }
+        if(i->wait_queue) {
+            wait_queue_remove(i->wait_queue, i);
+        }
+        i->ipc_status = -1;
+        i->ipc_state = IPC_STATE_NONE;
+        i->ipc_partner = 0;
+        if(i->state == PROCESS_STATE_BLOCKED) {
+            i->state = PROCESS_STATE_WAITING;
+        }
+    }
+}
@@ -10,6 +10,12 @@
 #include <kernel/pagetable.h>
 #include <kernel/mem.h>
 #include <kernel/device_types.h>
+#include <kernel/exception.h>
+#include <kernel/pipe.h>
+#include <kernel/util.h>
+#include <kernel/ipc.h>
+#include <kernel/poll.h>
+#include <kernel/timerfd.h>
 #include <init_sysregs.h>
 
 
@@ -49,7 +55,10 @@ struct process* allocate_process() {
     }
 
     p->user_thread->sp = USERSPACE_STACK_ADDRESS;
+    p->user_thread->pstate = PSTATE_USER_DEFAULT;
 
+    p->leader = p;
+    p->thread_count = 1;
     p->pid = global_pid_counter;
     global_pid_counter++;
 
@@ -75,6 +84,7 @@ int32_t process_new_stream_descriptor(struct process* p, void* dev, uint8_t dev_
     new_stream->dev = dev;
     new_stream->dev_type = dev_type;
     new_stream->id = p->stream_count;
+    stream_descriptor_get(new_stream);
     p->stream_count++;
     
     // Insert into linked list
@@ -85,6 +95,162 @@ int32_t process_new_stream_descriptor(struct process* p, void* dev, uint8_t dev_
 }
 
 
+/**
+ * @brief Allocates a new thread in the thread group of leader. The thread shares the address space, memory and streams
+ * of the leader. Its kernel stack and user context must be set up by the caller.
+ * 
+ * @param leader The thread group leader
+ * @return The new thread or null
+ */
+struct process* allocate_thread(struct process *leader) {
+    struct process *p = kmalloc(sizeof(struct process), ALLOC_ZERO_INIT);
+    if(!p) {
+        return 0;
+    }
+    p->kern_thread = allocate_kthread();
+    if(!p->kern_thread) {
+        free(p);
+        return 0;
+    }
+    p->user_thread = allocate_kthread();
+    if(!p->user_thread) {
+        free(p->kern_thread);
+        free(p);
+        return 0;
+    }
+    p->user_thread->pstate = PSTATE_USER_DEFAULT;
+
+    p->leader = leader;
+    p->addr_space = leader->addr_space;
+    leader->thread_count++;
+    p->pid = global_pid_counter;
+    global_pid_counter++;
+
+    // Put into global process list
+    p->next = process_list_head;
+    process_list_head = p;
+
+    return p;
+}
+
+
+/**
+ * @brief Takes a reference to the device of a new stream descriptor.
+ * 
+ * @param s Stream descriptor
+ */
+void stream_descriptor_get(struct stream_descriptor *s) {
+    if(s->dev_type == DEVICE_TYPE_PIPE) {
+        pipe_end_get(s->dev);
+    } else if(s->dev_type == DEVICE_TYPE_EPOLL) {
+        epoll_set_get(s->dev);
+    } else if(s->dev_type == DEVICE_TYPE_TIMER) {
+        timer_stream_get(s->dev);
+    }
+}
+
+
+/**
+ * @brief Releases the device reference of a stream descriptor that is being closed.
+ * 
+ * @param s Stream descriptor
+ */
+void stream_descriptor_put(struct stream_descriptor *s) {
+    if(s->dev_type == DEVICE_TYPE_PIPE) {
+        pipe_end_put(s->dev);
+    } else if(s->dev_type == DEVICE_TYPE_EPOLL) {
+        epoll_set_put(s->dev);
+    } else if(s->dev_type == DEVICE_TYPE_TIMER) {
+        timer_stream_put(s->dev);
+    }
+}
+
+
+/**
+ * @brief Removes the stream descriptor with the given id and releases its device.
+ * 
+ * @param p Process
+ * @param id Stream id
+ * @return 0 for success
+ */
+int32_t process_close_stream(struct process* p, int32_t id) {
+    struct stream_descriptor *prev = 0;
+    for(struct stream_descriptor *i = p->streams; i; i = i->next) {
+        if(i->id == id) {
+            if(prev) {
+                prev->next = i->next;
+            } else {
+                p->streams = i->next;
+            }
+            stream_descriptor_put(i);
+            free(i);
+            return 0;
+        }
+        prev = i;
+    }
+    return 1;
+}
+
+
+/**
+ * @brief Finds the process or thread with the given pid.
+ * 
+ * @param pid PID
+ * @return The process or null
+ */
+struct process* process_from_pid(uint16_t pid) {
+    for(struct process *i = process_list_head; i; i = i->next) {
+        if(i->pid == pid) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Returns the stream descriptor with the given id.
+ * 
+ * @param p Process
+ * @param id Stream id
+ * @return The stream descriptor or null
+ */
+struct stream_descriptor* process_get_stream(struct process* p, int32_t id) {
+    for(struct stream_descriptor *i = p->streams; i; i = i->next) {
+        if(i->id == id) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Duplicates the stream descriptors of a process. The copies keep their stream ids and refer to the same devices.
+ * 
+ * @param dest Process receiving the copies. Should not have any open streams.
+ * @param src Process whose streams are copied
+ * @return 0 for success
+ */
+int32_t process_copy_streams(struct process* dest, struct process* src) {
+    for(struct stream_descriptor *i = src->streams; i; i = i->next) {
+        struct stream_descriptor *new_stream = (struct stream_descriptor*)kmalloc(sizeof(struct stream_descriptor), 0);
+        if(!new_stream) {
+            return 1;
+        }
+        new_stream->dev = i->dev;
+        new_stream->dev_type = i->dev_type;
+        new_stream->id = i->id;
+        stream_descriptor_get(new_stream);
+
+        new_stream->next = dest->streams;
+        dest->streams = new_stream;
+    }
+    dest->stream_count = src->stream_count;
+    return 0;
+}
+
+
 int32_t process_entry_point_args(struct process* p, int32_t argc, char** argv) {
     if(p->state != PROCESS_STATE_NEW) {
         print("process_entry_point_args: process {d} must be in state 'new'\n", p->pid);
@@ -128,6 +294,51 @@ int32_t process_entry_point_args(struct process* p, int32_t argc, char** argv) {
 }
 
 
+/**
+ * @brief Drops a reference to process memory. The memory is freed with the last reference.
+ * 
+ * @param mem Process memory
+ */
+void process_memory_put(struct process_memory *mem) {
+    mem->refcount--;
+    if(mem->refcount) {
+        return;
+    }
+    if(mem->release) {
+        mem->release(mem);
+    } else {
+        free(mem->memory);
+        free(mem);
+    }
+}
+
+
+/**
+ * @brief Removes one reference to the process memory from the processes allocation list.
+ * 
+ * @param p Process
+ * @param mem Process memory referenced by p
+ * @return 0 for success
+ */
+int process_remove_memory_handle(struct process *p, struct process_memory *mem) {
+    struct process_memory_handle *prev = 0;
+    for(struct process_memory_handle *al = p->allocated_list; al; al = al->next) {
+        if(al->mem == mem) {
+            if(prev) {
+                prev->next = al->next;
+            } else {
+                p->allocated_list = al->next;
+            }
+            free(al);
+            process_memory_put(mem);
+            return 0;
+        }
+        prev = al;
+    }
+    return 1;
+}
+
+
 /**
  * @brief Frees the process_memory_handle structs and their contents.
  * Is used to deallocate all the process associated memory.
@@ -136,7 +347,7 @@ int32_t process_entry_point_args(struct process* p, int32_t argc, char** argv) {
  */
 void free_process_memory(struct process *p) {
     while(p->allocated_list) {
-        free(p->allocated_list->memory);
+        process_memory_put(p->allocated_list->mem);
         struct process_memory_handle *next = p->allocated_list->next;
         free(p->allocated_list);
         p->allocated_list = next;
@@ -174,10 +385,12 @@ void free_process_streams(struct process *p) {
     struct stream_descriptor *i = p->streams;
     while(i) {
         struct stream_descriptor *next_i = i->next;
+        stream_descriptor_put(i);
         free(i);
         p->stream_count--;
         i = next_i;
     }
+    p->streams = 0;
 }
 
 
@@ -187,12 +400,22 @@ void free_process_streams(struct process *p) {
  * @param p The process to terminate.
  */
 void destroy_process(struct process *p) {
+    if(p->wait_queue) {
+        wait_queue_remove(p->wait_queue, p);
+    }
+    ipc_abort(p);
+    poll_abort(p);
+    // Threads own their kernel stack. Everything else belongs to the leader.
     free_process_memory(p);
-    remove_process_mappings(p); // TODO, this does not remove them from the list
-    free_process_streams(p);
+    if(p->leader == p) {
+        process_release_pages(p);
+        free_address_space(p->addr_space);
+        free_process_streams(p);
+    } else {
+        p->leader->thread_count--;
+    }
     free(p->kern_thread);
     free(p->user_thread);
-    free(p->addr_space);
 
     // Remove process from linked list
     struct process *i_prev = 0;
@@ -215,6 +438,28 @@ void destroy_process(struct process *p) {
 }
 
 
+/**
+ * @brief Marks all threads of the group as terminated, except for the calling thread.
+ * They are cleaned up by the scheduler.
+ * 
+ * @param leader The thread group leader
+ */
+void terminate_thread_group(struct process *leader) {
+    for(struct process *i = process_list_head; i; i = i->next) {
+        if(i->leader == leader && i != kernel_curr_process) {
+            if(i->wait_queue) {
+                wait_queue_remove(i->wait_queue, i);
+            }
+            // Servers must not reply to the thread, and its own clients fail
+            i->ipc_state = IPC_STATE_NONE;
+            i->ipc_partner = 0;
+            ipc_abort(i);
+            i->state = PROCESS_STATE_TERMINATED;
+        }
+    }
+}
+
+
 void switch_to_user_thread() {
     #ifdef DEBUG_THREADING
     print("Switching to user thread\n");
@@ -223,6 +468,7 @@ void switch_to_user_thread() {
     write_system_reg(ELR_EL1, (uint64_t)(kernel_curr_process->user_thread->link_reg));
     // Configure user space processor state
     write_system_reg(SP_EL0, (uint64_t)(kernel_curr_process->user_thread->sp));
+    write_system_reg(SPSR_EL1, (uint64_t)(kernel_curr_process->user_thread->pstate));
 
     // Load the userspace thread state
     load_user_context(kernel_curr_process->user_thread);
@@ -235,12 +481,19 @@ void switch_to_user_thread() {
  * @param new_state The state of this process after yielding.
  */
 void switch_to_process(struct process *p, uint8_t new_state) {
-    // Unmap user mappings. This is equivalent to all process specific mappings.
-    // This call only sets the adress_mapping to unused and removes it from the global page table.
-    remove_process_mappings(kernel_curr_process);
+    // Threads of the same process share their mappings
+    if(p->addr_space != kernel_curr_process->addr_space) {
+        // Unmap user mappings. This is equivalent to all process specific mappings.
+        // This call only sets the adress_mapping to unused and removes it from the global page table.
+        remove_process_mappings(kernel_curr_process);
+
+        // Add new user mappings to page table
+        restore_process_mappings(p);
+    }
 
-    // Add new user mappings to page table
-    restore_process_mappings(p);
+    // Each thread has its own thread pointer
+    kernel_curr_process->tls = read_system_reg(TPIDR_EL0);
+    write_system_reg(TPIDR_EL0, p->tls);
 
     #ifdef DEBUG_THREADING
     print("Switching to process with PID {d}\n", p->pid);
@@ -265,27 +518,228 @@ void *new_process_memory_region(struct process *p, uint64_t size) {
         return 0;
     }
 
-    struct process_memory_handle *al = kmalloc(sizeof(struct process_memory_handle), 0);
-    if(!al) {
+    struct process_memory *mem = kmalloc(sizeof(struct process_memory), 0);
+    if(!mem) {
         free(header_memory);
         free_process_memory(p);
         return 0;
     }
-    struct process_memory_handle *old_al = p->allocated_list;
-    al->next = old_al;
-    al->memory = header_memory;
-    p->allocated_list = al;
+    mem->memory = header_memory;
+    // Allocations are page aligned, so the remainder of the last page also belongs to us.
+    mem->size = round_up_to_page(size);
+    mem->refcount = 0;
+    mem->release = 0;
+
+    if(process_add_memory_handle(p, mem)) {
+        free(header_memory);
+        free(mem);
+        free_process_memory(p);
+        return 0;
+    }
     return header_memory;
 }
 
 
-struct address_mapping* new_mapped_process_memory(struct process *p, uint64_t target_addr, uint64_t size) {
-    // Append memory region to the processes allocation lists
-    void* new_mem = new_process_memory_region(p, size);
-    if(!new_mem) {
-        return 0;
+/**
+ * @brief Adds a reference to the process memory to the processes allocation list.
+ * 
+ * @param p Process
+ * @param mem Memory that the process should hold a reference to
+ * @return 0 for success
+ */
+int process_add_memory_handle(struct process *p, struct process_memory *mem) {
+    struct process_memory_handle *al = kmalloc(sizeof(struct process_memory_handle), 0);
+    if(!al) {
+        return 1;
+    }
+    mem->refcount++;
+    al->mem = mem;
+    al->next = p->allocated_list;
+    p->allocated_list = al;
+    return 0;
+}
+
+
+/**
+ * @brief Finds the process memory containing the physical address.
+ * 
+ * @param p Process
+ * @param paddr Physical address
+ * @return The process memory or null
+ */
+struct process_memory* process_find_memory(struct process *p, uint64_t paddr) {
+    for(struct process_memory_handle *al = p->allocated_list; al; al = al->next) {
+        uint64_t start = (uint64_t)KERN_TO_PHYS(al->mem->memory);
+        if(paddr >= start && paddr < start + al->mem->size) {
+            return al->mem;
+        }
+    }
+    return 0;
+}
+
+
+static void user_pages_put(uint64_t paddr, uint64_t size) {
+    for(uint64_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        user_page_put(paddr + offset);
+    }
+}
+
+
+/**
+ * @brief Backs a range of the process address space with newly allocated, zeroed user pages.
+ * Each chunk gets its own mapping. Chunks are as large as the alignment of the range allows:
+ * 2 MiB blocks, 64 KiB runs, or single pages.
+ * 
+ * @param p Process
+ * @param vaddr Page aligned start of the range
+ * @param size Size of the range. Rounded up to whole pages.
+ * @param activate Also enter the mappings into the page table
+ * @return 0 for success. Chunks mapped before a failure stay in the address space and are released with it.
+ */
+int process_map_pages(struct process *p, uint64_t vaddr, uint64_t size, bool_t activate) {
+    uint64_t end = vaddr + round_up_to_page(size);
+    while(vaddr < end) {
+        uint8_t order = USER_CHUNK_ORDER_PAGE;
+        if(!(vaddr & (HUGE_PAGE_SIZE - 1)) && end - vaddr >= HUGE_PAGE_SIZE) {
+            order = USER_CHUNK_ORDER_HUGE;
+        } else if(!(vaddr & ((PAGE_SIZE << USER_CHUNK_ORDER_RUN) - 1)) && end - vaddr >= (PAGE_SIZE << USER_CHUNK_ORDER_RUN)) {
+            order = USER_CHUNK_ORDER_RUN;
+        }
+        uint64_t paddr = user_chunk_alloc(order);
+        // Fall back to smaller chunks if physical memory is fragmented
+        while(!paddr && order != USER_CHUNK_ORDER_PAGE) {
+            order = order == USER_CHUNK_ORDER_HUGE ? USER_CHUNK_ORDER_RUN : USER_CHUNK_ORDER_PAGE;
+            paddr = user_chunk_alloc(order);
+        }
+        if(!paddr) {
+            print("Failed to allocate process memory!\n");
+            return 1;
+        }
+        uint64_t chunk_size = PAGE_SIZE << order;
+        struct address_mapping *m = create_memory_region(p->addr_space, vaddr, paddr, chunk_size);
+        if(!m) {
+            user_pages_put(paddr, chunk_size);
+            return 1;
+        }
+        m->flags = MAPPING_FLAG_PAGES;
+        if(activate && map_memory_region(p->addr_space, m)) {
+            return 1;
+        }
+        vaddr += chunk_size;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Maps user pages that are also referenced elsewhere, such as pages of the page cache, into a process.
+ * The caller passes one reference to each page on to the mapping. The references are dropped if the mapping fails.
+ * Like the mappings of process_map_pages(), the mapping is created inactive.
+ * 
+ * @param p Process
+ * @param vaddr Page aligned virtual address
+ * @param paddr Physical address of a physically contiguous run of user pages
+ * @param size Size of the run. Multiple of the page size.
+ * @param flags MAPPING_FLAG_* flags of the mapping. MAPPING_FLAG_PAGES is implied.
+ * @return 0 for success
+ */
+int process_map_shared_pages(struct process *p, uint64_t vaddr, uint64_t paddr, uint64_t size, uint32_t flags) {
+    struct address_mapping *m = create_memory_region(p->addr_space, vaddr, paddr, size);
+    if(!m) {
+        user_pages_put(paddr, size);
+        return 1;
+    }
+    m->flags = flags | MAPPING_FLAG_PAGES;
+    return 0;
+}
+
+
+/**
+ * @brief Drops the page references of all mappings backed by user pages. Called before the address space is freed.
+ * 
+ * @param p Process
+ */
+void process_release_pages(struct process *p) {
+    for(struct address_mapping *m = p->addr_space->mappings; m; m = m->next) {
+        if(m->flags & MAPPING_FLAG_PAGES) {
+            user_pages_put(m->paddress, m->size);
+        }
+    }
+}
+
+
+// True if the process holds the only reference to every page of the mapping
+static bool_t user_pages_exclusive(struct address_mapping *m) {
+    for(uint64_t offset = 0; offset < m->size; offset += PAGE_SIZE) {
+        if(user_page_refcount(m->paddress + offset) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Resolves a write to a copy-on-write mapping. The faulting page is copied, unless the process
+ * holds the last reference to the memory, in which case the mapping is simply made writable again.
+ * 
+ * @param p Process that caused the fault
+ * @param address Faulting virtual address
+ * @return 0 if the fault was resolved and the access may be retried
+ */
+int process_resolve_cow_fault(struct process *p, uint64_t address) {
+    struct address_mapping *m = address_space_find_mapping(p->addr_space, address);
+    if(!m || !(m->flags & MAPPING_FLAG_COW) || !(m->flags & MAPPING_FLAG_PAGES)) {
+        return 1;
+    }
+    uint64_t page_vaddr = address & ~(PAGE_SIZE - 1ul);
+    uint64_t page_paddr = m->paddress + (page_vaddr - m->vaddress);
+    uint32_t flags = m->flags & ~MAPPING_FLAG_COW;
+
+    // Pages that are no longer shared are made writable again, without copying
+    if(user_pages_exclusive(m)) {
+        return protect_memory_region(p->addr_space, m, flags);
+    }
+    if(user_page_refcount(page_paddr) == 1) {
+        return remap_memory_page(p->addr_space, m, page_vaddr, page_paddr, flags) ? 0 : 1;
     }
-    return create_memory_region_virt(p->addr_space, target_addr, (uint64_t)new_mem, size);
+
+    uint64_t new_page = user_chunk_alloc(USER_CHUNK_ORDER_PAGE);
+    if(!new_page) {
+        return 1;
+    }
+    memcpy(PHYS_TO_KERN(new_page), PHYS_TO_KERN(page_paddr), PAGE_SIZE);
+    if(!remap_memory_page(p->addr_space, m, page_vaddr, new_page, flags)) {
+        print("Failed to remap copy-on-write page at 0x{xl}\n", page_vaddr);
+        user_page_put(new_page);
+        return 1;
+    }
+    user_page_put(page_paddr);
+    return 0;
+}
+
+
+/**
+ * @brief Resolves copy-on-write mappings in a user buffer, before the kernel writes to it.
+ * Kernel writes to read-only pages are not handled as copy-on-write faults.
+ * 
+ * @param p Process owning the buffer
+ * @param address Start of the user buffer
+ * @param size Size of the user buffer
+ * @return 0 if the buffer is writable
+ */
+int process_prepare_user_write(struct process *p, uint64_t address, uint64_t size) {
+    uint64_t end = address + size;
+    for(uint64_t page = address & ~(PAGE_SIZE - 1ul); page < end; page += PAGE_SIZE) {
+        struct address_mapping *m = address_space_find_mapping(p->addr_space, page);
+        if(!m || (m->flags & MAPPING_FLAG_READONLY)) {
+            return 1;
+        }
+        if(m->flags & MAPPING_FLAG_COW) {
+            reterr(process_resolve_cow_fault(p, page));
+        }
+    }
+    return 0;
 }
 
 
@@ -307,6 +761,9 @@ static const char* process_state_string(struct process *p) {
     case PROCESS_STATE_FAULTED:
         state = "faulted";
         break;
+    case PROCESS_STATE_BLOCKED:
+        state = "blocked";
+        break;
     }
     return state;
 }
@@ -321,6 +778,9 @@ void print_process(struct process *p) {
     print("--- Process with PID {d} ---\n", p->pid);
 
     print("State      :{s}\n", process_state_string(p));
+    if(p->leader != p) {
+        print("Thread of  :{d}\n", p->leader->pid);
+    }
 
     print("User Thread\n");
     print("  PC       :0x{xl}\n", p->user_thread->link_reg);
@@ -358,5 +818,14 @@ void print_process(struct process *p) {
  * @param p the process
  */
 void print_process_brief(struct process *p) {
-    print("Process with PID {d}, state [{s}]\n", p->pid, process_state_string(p));
+    struct process *leader = p->leader;
+    uint64_t user_memory = 0;
+    for(struct address_mapping *m = leader->addr_space->mappings; m; m = m->next) {
+        if(m->flags & MAPPING_FLAG_PAGES) {
+            user_memory += m->size;
+        }
+    }
+    // User memory is allocated page by page, so the only internal fragmentation left is the unused end of the heap
+    print("Process with PID {d}, state [{s}], {ul} KiB user memory, {ul} KiB unused\n", p->pid, process_state_string(p),
+        user_memory / 1024, (leader->user_heap_size - leader->user_heap_used) / 1024);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <kernel/process.h>
 #include <kernel/print.h>
 #include <kernel/scheduler.h>
+#include <kernel/exception.h>
 
 
 /**
@@ -10,13 +11,37 @@
  * @param new_state The state of this process after yielding.
  */
 void switch_to_next_process(uint8_t new_state) {
-    for(struct process *p = process_list_head; p; p = p->next) {
-        if(p->state == PROCESS_STATE_WAITING) {
-            // Execute this process
-            switch_to_process(p, new_state);
-        } else if(p->state == PROCESS_STATE_TERMINATED) {
-            // Garbage collection is performed as we encounter terminated processes.
-            destroy_process(p);
+    // Round robin. Start searching after the current process and wrap around.
+    struct process *next;
+    struct process *start = kernel_curr_process->next;
+    // The current process is only picked up again if it is woken while we idle
+    kernel_curr_process->state = new_state;
+    bool_t blocked = false;
+    for(int pass = 0; pass < 2; pass++) {
+        struct process *end = pass ? kernel_curr_process->next : 0;
+        for(struct process *p = pass ? process_list_head : start; p != end; p = next) {
+            next = p->next;
+            if(p->state == PROCESS_STATE_WAITING) {
+                // Execute this process
+                switch_to_process(p, new_state);
+                return;
+            } else if(p->state == PROCESS_STATE_TERMINATED && p != kernel_curr_process) {
+                // Garbage collection is performed as we encounter terminated processes.
+                // The current process is still running on its kernel stack, so it is collected later.
+                // A leader holds the shared resources, so it is collected after all of its threads.
+                if(p->leader != p || p->thread_count == 1) {
+                    destroy_process(p);
+                }
+            } else if(p->state == PROCESS_STATE_BLOCKED) {
+                blocked = true;
+            }
+        }
+        if(pass == 1 && blocked) {
+            // Everything is waiting for a device or timer. Sleep until an interrupt wakes a process, then search again.
+            wait_for_interrupt();
+            blocked = false;
+            pass = -1;
+            start = kernel_curr_process->next;
         }
     }
     print("Scheduler: No runnable process found!\n");
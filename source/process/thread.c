@@ -3,6 +3,7 @@
 #include <kernel/register.h>
 #include <kernel/alloc.h>
 #include <kernel/process.h>
+#include <kernel/exception.h>
 
 
 struct kthread *allocate_kthread() {
@@ -20,7 +21,7 @@ void print_thread_context(struct kthread *t) {
 }
 
 
-void print_register_block(uint64_t* registers) {
+static void print_gp_registers(uint64_t* registers) {
     for(int i = 0; i < 15; i++) {
         int reg1 = 2*i + 0;
         int reg2 = 2*i + 1;
@@ -31,5 +32,17 @@ void print_register_block(uint64_t* registers) {
         }
         
     }
+}
+
+
+void print_register_block(uint64_t* registers) {
+    print_gp_registers(registers);
     print(" SP:{xl}        PC:{xl}\n", registers[30], registers[31]);
+}
+
+
+void print_exception_frame(uint64_t* frame) {
+    print_gp_registers(frame);
+    print("X30:{xl}        SP:{xl}\n", frame[EXCEPTION_FRAME_X30], frame[EXCEPTION_FRAME_SP_EL0]);
+    print(" PC:{xl}    PSTATE:{xl}\n", frame[EXCEPTION_FRAME_ELR], frame[EXCEPTION_FRAME_SPSR]);
 }
\ No newline at end of file
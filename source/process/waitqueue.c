@@ -0,0 +1,132 @@
+#include <kernel/waitqueue.h>
+#include <kernel/process.h>
+#include <kernel/scheduler.h>
+
+
+/**
+ * @brief Appends the process to the wait queue. Does not change its state.
+ * 
+ * @param q The wait queue
+ * @param p The process. Must not be on a wait queue.
+ * @param key Value used to select waiters when waking
+ */
+void wait_queue_add(struct wait_queue *q, struct process *p, uint64_t key) {
+    p->wait_key = key;
+    p->wait_next = 0;
+    if(q->tail) {
+        q->tail->wait_next = p;
+    } else {
+        q->head = p;
+    }
+    q->tail = p;
+    p->wait_queue = q;
+}
+
+
+/**
+ * @brief Blocks the current process on the wait queue, until it is woken up.
+ * 
+ * @param q The wait queue
+ * @param key Value used to select waiters when waking. May be zero if the queue is not keyed.
+ */
+void wait_queue_sleep(struct wait_queue *q, uint64_t key) {
+    wait_queue_add(q, kernel_curr_process, key);
+    switch_to_next_process(PROCESS_STATE_BLOCKED);
+}
+
+
+/**
+ * @brief Removes the process from the wait queue, without changing its state.
+ * 
+ * @param q The wait queue containing p
+ * @param p The process to remove
+ */
+void wait_queue_remove(struct wait_queue *q, struct process *p) {
+    struct process *prev = 0;
+    for(struct process *i = q->head; i; i = i->wait_next) {
+        if(i == p) {
+            if(prev) {
+                prev->wait_next = i->wait_next;
+            } else {
+                q->head = i->wait_next;
+            }
+            if(q->tail == i) {
+                q->tail = prev;
+            }
+            p->wait_next = 0;
+            p->wait_queue = 0;
+            return;
+        }
+        prev = i;
+    }
+}
+
+
+/**
+ * @brief Returns the first process waiting with the key.
+ * 
+ * @param q The wait queue
+ * @param key Wait key
+ * @return The process or null
+ */
+struct process *wait_queue_find(struct wait_queue *q, uint64_t key) {
+    for(struct process *i = q->head; i; i = i->wait_next) {
+        if(i->wait_key == key) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Removes the process from its wait queue and makes it runnable.
+ * 
+ * @param p A blocked process
+ */
+void wait_queue_wake(struct process *p) {
+    if(p->wait_queue) {
+        wait_queue_remove(p->wait_queue, p);
+    }
+    if(p->state == PROCESS_STATE_BLOCKED) {
+        p->state = PROCESS_STATE_WAITING;
+    }
+}
+
+
+/**
+ * @brief Wakes up to n processes waiting with the key, in the order they started waiting.
+ * 
+ * @param q The wait queue
+ * @param key Wait key
+ * @param n Maximum number of processes to wake
+ * @return Number of processes woken
+ */
+int wait_queue_wake_key(struct wait_queue *q, uint64_t key, int n) {
+    int woken = 0;
+    while(woken < n) {
+        struct process *p = wait_queue_find(q, key);
+        if(!p) {
+            break;
+        }
+        wait_queue_wake(p);
+        woken++;
+    }
+    return woken;
+}
+
+
+/**
+ * @brief Wakes all processes on the wait queue.
+ * 
+ * @param q The wait queue
+ * @return Number of processes woken
+ */
+int wait_queue_wake_all(struct wait_queue *q) {
+    int woken = 0;
+    while(q->head) {
+        wait_queue_wake(q->head);
+        woken++;
+    }
+    return woken;
+}
@@ -0,0 +1,47 @@
+#include <kernel/print.h>
+#include <kernel/process.h>
+
+#include "clone.h"
+
+
+/**
+ * @brief Creates a new thread in the calling process. The thread starts executing at entry with arg in x0.
+ * Returning from the entry function is not allowed, threads must call thread_exit.
+ * 
+ * @param entry User space entry point of the thread
+ * @param stack Top of the user stack of the thread. Allocated by the caller.
+ * @param arg Argument passed to the entry point
+ * @param tls Initial value of the thread pointer (TPIDR_EL0)
+ * @return The thread id, or -1 on failure
+ */
+int syscall_clone(uint64_t entry, uint64_t stack, uint64_t arg, uint64_t tls) {
+    struct process *leader = kernel_curr_process->leader;
+    if(stack & 0xF) {
+        print("clone: Stack must be 16 byte aligned\n");
+        return -1;
+    }
+
+    struct process *t = allocate_thread(leader);
+    if(!t) {
+        return -1;
+    }
+
+    t->kern_thread->stack_size = KERNEL_STACK_SIZE;
+    void* kernel_stack = new_process_memory_region(t, t->kern_thread->stack_size);
+    if(!kernel_stack) {
+        print("clone: Failed to allocate kernel stack\n");
+        destroy_process(t);
+        return -1;
+    }
+    t->kernel_stack = kernel_stack;
+    t->kern_thread->sp = (uint64_t)kernel_stack + t->kern_thread->stack_size;
+    t->kern_thread->link_reg = (uint64_t)(switch_to_user_thread);
+
+    t->user_thread->link_reg = entry;
+    t->user_thread->sp = stack;
+    t->user_thread->registers[0] = arg;
+    t->tls = tls;
+
+    t->state = PROCESS_STATE_WAITING;
+    return t->pid;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <kernel/types.h>
+
+int syscall_clone(uint64_t entry, uint64_t stack, uint64_t arg, uint64_t tls);
@@ -1,9 +1,12 @@
 #include <kernel/print.h>
+#include <kernel/process.h>
 
 #include "close.h"
 
 
 int syscall_close(int fd) {
-    // Streams cannot be closed. This is a no-op in our os currently.
+    if(process_close_stream(kernel_curr_process->leader, fd)) {
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,106 @@
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/address_space.h>
+#include <kernel/exception.h>
+#include <kernel/thread.h>
+#include <kernel/page.h>
+#include <kernel/mem.h>
+#include <kernel/util.h>
+#include <kernel/register.h>
+
+#include "fork.h"
+
+
+/**
+ * @brief Shares the memory of the parent with the child. Writable private mappings are turned into
+ * copy-on-write mappings in both processes, so no memory is copied until either process writes to it.
+ * 
+ * @param child The new process
+ * @param parent The calling process
+ * @return 0 for success
+ */
+static int fork_address_space(struct process *child, struct process *parent) {
+    // Shared memory regions
+    for(struct process_memory_handle *h = parent->allocated_list; h; h = h->next) {
+        // The kernel stack is not shared
+        if(h->mem->memory == parent->kernel_stack) {
+            continue;
+        }
+        reterr(process_add_memory_handle(child, h->mem));
+    }
+
+    for(struct address_mapping *m = parent->addr_space->mappings; m; m = m->next) {
+        uint32_t flags = m->flags;
+        if(!(flags & (MAPPING_FLAG_READONLY | MAPPING_FLAG_SHARED)) && (flags & MAPPING_FLAG_PAGES)) {
+            flags |= MAPPING_FLAG_COW;
+        }
+        if(flags != m->flags) {
+            reterr(protect_memory_region(parent->addr_space, m, flags));
+        }
+
+        struct address_mapping *copy = create_memory_region(child->addr_space, m->vaddress, m->paddress, m->size);
+        if(!copy) {
+            return 1;
+        }
+        copy->flags = flags;
+        if(flags & MAPPING_FLAG_PAGES) {
+            for(uint64_t offset = 0; offset < m->size; offset += PAGE_SIZE) {
+                user_page_get(m->paddress + offset);
+            }
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Creates a copy of the calling process. The child resumes execution by returning from this syscall with 0.
+ * Only the calling thread is copied.
+ * 
+ * @return The PID of the child process, or -1 on failure
+ */
+int syscall_fork() {
+    struct process *parent = kernel_curr_process->leader;
+    uint64_t *parent_frame = kernel_curr_process->exception_stack_pointer;
+
+    struct process *child = allocate_process();
+    if(!child) {
+        return -1;
+    }
+
+    if(fork_address_space(child, parent)) {
+        print("fork: Failed to duplicate address space\n");
+        destroy_process(child);
+        return -1;
+    }
+    child->user_heap_size = parent->user_heap_size;
+    child->user_heap_used = parent->user_heap_used;
+    child->user_thread->stack_size = parent->user_thread->stack_size;
+    child->tls = read_system_reg(TPIDR_EL0);
+
+    // The child returns to user space through a copy of the parents exception frame
+    child->kern_thread->stack_size = KERNEL_STACK_SIZE;
+    void* kernel_stack = new_process_memory_region(child, child->kern_thread->stack_size);
+    if(!kernel_stack) {
+        print("fork: Failed to allocate kernel stack\n");
+        destroy_process(child);
+        return -1;
+    }
+    uint64_t *child_frame = (uint64_t*)((uint64_t)kernel_stack + child->kern_thread->stack_size - EXCEPTION_FRAME_SIZE);
+    memcpy((char*)child_frame, (char*)parent_frame, EXCEPTION_FRAME_SIZE);
+    child_frame[0] = 0;
+    child->kernel_stack = kernel_stack;
+    child->kern_thread->sp = (uint64_t)child_frame;
+    child->kern_thread->link_reg = (uint64_t)(ret_from_fork);
+
+    // Inherit the stream descriptors instead of the defaults
+    free_process_streams(child);
+    if(process_copy_streams(child, parent)) {
+        print("fork: Failed to copy stream descriptors\n");
+        destroy_process(child);
+        return -1;
+    }
+
+    child->state = PROCESS_STATE_WAITING;
+    return child->pid;
+}
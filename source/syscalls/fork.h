@@ -0,0 +1,5 @@
+#pragma once
+
+#include <kernel/types.h>
+
+int syscall_fork();
@@ -0,0 +1,86 @@
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/waitqueue.h>
+#include <kernel/address_space.h>
+#include <kernel/syscall.h>
+
+#include "futex.h"
+
+#define FUTEX_HASH_BITS 6
+
+
+// Waiters are keyed by physical address, so that processes sharing memory can use the same futex.
+static struct wait_queue futex_queues[1 << FUTEX_HASH_BITS];
+
+
+static struct wait_queue *futex_queue(uint64_t key) {
+    // Fibonacci hashing. The lowest two bits are always zero.
+    uint64_t hash = ((key >> 2) * 0x9E3779B97F4A7C15ul) >> (64 - FUTEX_HASH_BITS);
+    return &futex_queues[hash];
+}
+
+
+static uint64_t futex_key(uint32_t *uaddr) {
+    if((uint64_t)uaddr & 0x3) {
+        return 0;
+    }
+    return (uint64_t)address_space_virtual_to_physical(kernel_curr_process->addr_space, uaddr);
+}
+
+
+static int futex_requeue(uint64_t key, uint64_t key2, int n) {
+    struct wait_queue *q = futex_queue(key);
+    struct wait_queue *q2 = futex_queue(key2);
+    int moved = 0;
+    while(moved < n) {
+        struct process *p = wait_queue_find(q, key);
+        if(!p) {
+            break;
+        }
+        wait_queue_remove(q, p);
+        wait_queue_add(q2, p, key2);
+        moved++;
+    }
+    return moved;
+}
+
+
+/**
+ * @brief Waits on or wakes processes waiting on a user space address.
+ * 
+ * FUTEX_WAIT: Blocks if *uaddr equals val. Returns 0 when woken, 1 if the value did not match.
+ * FUTEX_WAKE: Wakes up to val waiters. Returns the number of woken waiters.
+ * FUTEX_REQUEUE: Wakes up to val waiters, and moves up to val2 of the remaining waiters to uaddr2.
+ * Returns the number of woken and moved waiters.
+ * 
+ * @return See above, or -1 on failure
+ */
+int syscall_futex(uint32_t *uaddr, int op, uint32_t val, uint32_t val2, uint32_t *uaddr2) {
+    uint64_t key = futex_key(uaddr);
+    if(!key) {
+        return -1;
+    }
+
+    switch(op) {
+    case FUTEX_WAIT:
+        // The value cannot change between this check and sleeping, since only the current process is running.
+        if(*uaddr != val) {
+            return 1;
+        }
+        wait_queue_sleep(futex_queue(key), key);
+        return 0;
+    case FUTEX_WAKE:
+        return wait_queue_wake_key(futex_queue(key), key, val);
+    case FUTEX_REQUEUE: {
+        uint64_t key2 = futex_key(uaddr2);
+        if(!key2) {
+            return -1;
+        }
+        int woken = wait_queue_wake_key(futex_queue(key), key, val);
+        return woken + futex_requeue(key, key2, val2);
+    }
+    default:
+        print("futex: Unknown operation {d}\n", op);
+        return -1;
+    }
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <kernel/types.h>
+
+int syscall_futex(uint32_t *uaddr, int op, uint32_t val, uint32_t val2, uint32_t *uaddr2);
@@ -0,0 +1,41 @@
+#include <kernel/print.h>
+#include <kernel/device_types.h>
+#include <kernel/process.h>
+#include <kernel/alloc.h>
+#include <kernel/pipe.h>
+
+#include "pipe.h"
+
+
+/**
+ * @brief Creates a pipe. fds[0] refers to the read end, fds[1] to the write end.
+ * 
+ * @param fds User array receiving the stream ids
+ * @return 0 for success, -1 on failure
+ */
+int syscall_pipe(int *fds) {
+    struct process *p = kernel_curr_process->leader;
+    if(process_prepare_user_write(p, (uint64_t)fds, 2 * sizeof(int))) {
+        return -1;
+    }
+    struct pipe *pipe = alloc_pipe();
+    if(!pipe) {
+        return -1;
+    }
+
+    int32_t read_fd = p->stream_count;
+    if(process_new_stream_descriptor(p, &pipe->read_end, DEVICE_TYPE_PIPE)) {
+        free(pipe->buffer);
+        free(pipe);
+        return -1;
+    }
+    int32_t write_fd = p->stream_count;
+    if(process_new_stream_descriptor(p, &pipe->write_end, DEVICE_TYPE_PIPE)) {
+        // Frees the pipe
+        process_close_stream(p, read_fd);
+        return -1;
+    }
+    fds[0] = read_fd;
+    fds[1] = write_fd;
+    return 0;
+}
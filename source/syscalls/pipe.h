@@ -0,0 +1,3 @@
+#pragma once
+
+int syscall_pipe(int *fds);
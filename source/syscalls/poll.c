@@ -0,0 +1,219 @@
+#include <kernel/print.h>
+#include <kernel/device_types.h>
+#include <kernel/process.h>
+#include <kernel/alloc.h>
+#include <kernel/poll.h>
+#include <kernel/timer.h>
+#include <kernel/timerfd.h>
+
+#include "poll.h"
+
+#define POLL_ALWAYS (POLLERR | POLLHUP | POLLNVAL)
+// Shorter periods would keep the core in the timer interrupt
+#define TIMERFD_MIN_INTERVAL_US 100
+
+
+// Converts a timeout in milliseconds to the deadline expected by poll_set_sleep.
+static uint64_t poll_deadline(int timeout_ms) {
+    if(timeout_ms < 0) {
+        return 0;
+    }
+    return read_system_timer() + (uint64_t)timeout_ms * 1000;
+}
+
+
+/**
+ * @brief Waits until one of the streams is ready. The thread is attached to all streams while it sleeps,
+ * and wakes up as soon as one of them is notified.
+ * 
+ * @param fds User array of streams and events of interest. revents is filled in.
+ * @param nfds Number of entries in fds
+ * @param timeout_ms Timeout in milliseconds. 0 returns immediately, a negative value waits indefinitely.
+ * @return Number of ready streams, 0 on timeout, or -1 on failure
+ */
+int syscall_poll(struct pollfd *fds, int nfds, int timeout_ms) {
+    struct process *p = kernel_curr_process;
+    struct process *leader = p->leader;
+    if(nfds < 0 || process_prepare_user_write(leader, (uint64_t)fds, nfds * sizeof(struct pollfd))) {
+        return -1;
+    }
+    uint64_t deadline = poll_deadline(timeout_ms);
+    struct poll_set *set = kmalloc(sizeof(struct poll_set), ALLOC_ZERO_INIT);
+    // Without streams, poll only waits for the timeout
+    struct poll_entry **entries = 0;
+    if(nfds) {
+        entries = kmalloc(nfds * sizeof(struct poll_entry*), ALLOC_ZERO_INIT);
+    }
+    if(!set || (nfds && !entries)) {
+        if(set) {
+            free(set);
+        }
+        if(entries) {
+            free(entries);
+        }
+        return -1;
+    }
+
+    // Attach to all streams before checking them, so that no notification can be missed
+    int count = -1;
+    for(int i = 0; i < nfds; i++) {
+        struct stream_descriptor *s = process_get_stream(leader, fds[i].fd);
+        if(s) {
+            entries[i] = poll_set_add(set, fds[i].fd, s->dev, s->dev_type, (uint16_t)fds[i].events, i);
+            if(!entries[i]) {
+                goto cleanup;
+            }
+        }
+    }
+    p->poll_set = set;
+
+    while(1) {
+        count = 0;
+        for(int i = 0; i < nfds; i++) {
+            struct poll_head *head;
+            // Negative stream ids are ignored
+            uint32_t mask = fds[i].fd < 0 ? 0 : POLLNVAL;
+            if(entries[i]) {
+                mask = stream_poll(entries[i]->dev, entries[i]->dev_type, &head) & ((uint16_t)fds[i].events | POLL_ALWAYS);
+            }
+            fds[i].revents = mask;
+            if(mask) {
+                count++;
+            }
+        }
+        if(count || !timeout_ms || poll_set_sleep(set, deadline)) {
+            break;
+        }
+    }
+
+cleanup:
+    p->poll_set = 0;
+    poll_set_clear(set);
+    free(set);
+    if(entries) {
+        free(entries);
+    }
+    return count;
+}
+
+
+/**
+ * @brief Creates an epoll instance. It keeps a set of watched streams between calls to epoll_wait.
+ * 
+ * @return Stream id of the instance, or -1 on failure
+ */
+int syscall_epoll_create() {
+    struct process *p = kernel_curr_process->leader;
+    struct poll_set *set = alloc_epoll_set();
+    if(!set) {
+        return -1;
+    }
+    int32_t fd = p->stream_count;
+    if(process_new_stream_descriptor(p, set, DEVICE_TYPE_EPOLL)) {
+        free(set);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * @brief Adds, modifies or removes a stream in the interest set of an epoll instance.
+ * 
+ * @param epfd Stream id of the epoll instance
+ * @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ * @param fd Watched stream
+ * @param event Events of interest and user data. Unused for EPOLL_CTL_DEL.
+ * @return 0 for success, -1 on failure
+ */
+int syscall_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    struct process *p = kernel_curr_process->leader;
+    struct stream_descriptor *ep = process_get_stream(p, epfd);
+    struct stream_descriptor *s = process_get_stream(p, fd);
+    if(!ep || ep->dev_type != DEVICE_TYPE_EPOLL || !s || s->dev_type == DEVICE_TYPE_EPOLL) {
+        return -1;
+    }
+    struct poll_set *set = ep->dev;
+    struct poll_entry *e = poll_set_find(set, fd);
+
+    switch(op) {
+    case EPOLL_CTL_ADD:
+        if(e || !event) {
+            return -1;
+        }
+        return poll_set_add(set, fd, s->dev, s->dev_type, event->events, event->data) ? 0 : -1;
+    case EPOLL_CTL_MOD:
+        if(!e || !event) {
+            return -1;
+        }
+        poll_set_remove(set, e);
+        return poll_set_add(set, fd, s->dev, s->dev_type, event->events, event->data) ? 0 : -1;
+    case EPOLL_CTL_DEL:
+        if(!e) {
+            return -1;
+        }
+        poll_set_remove(set, e);
+        return 0;
+    default:
+        print("epoll_ctl: unknown operation {d}\n", op);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Waits until streams of the epoll instance are ready. Only streams that were notified are checked.
+ * 
+ * @param epfd Stream id of the epoll instance
+ * @param events User array receiving the ready streams
+ * @param max_events Size of the array
+ * @param timeout_ms Timeout in milliseconds. 0 returns immediately, a negative value waits indefinitely.
+ * @return Number of events, 0 on timeout, or -1 on failure
+ */
+int syscall_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout_ms) {
+    struct process *p = kernel_curr_process->leader;
+    struct stream_descriptor *ep = process_get_stream(p, epfd);
+    if(!ep || ep->dev_type != DEVICE_TYPE_EPOLL || max_events <= 0
+        || process_prepare_user_write(p, (uint64_t)events, max_events * sizeof(struct epoll_event))) {
+        return -1;
+    }
+    struct poll_set *set = ep->dev;
+    uint64_t deadline = poll_deadline(timeout_ms);
+    // Another thread may close the instance while we sleep
+    epoll_set_get(set);
+    int count;
+    while(1) {
+        count = epoll_set_harvest(set, events, max_events);
+        if(count || !timeout_ms || poll_set_sleep(set, deadline)) {
+            break;
+        }
+    }
+    epoll_set_put(set);
+    return count;
+}
+
+
+/**
+ * @brief Creates a timer stream. It becomes readable when the timer expires.
+ * 
+ * @param initial_us Delay of the first expiry in microseconds
+ * @param interval_us Period of the following expiries, or 0 for a one shot timer
+ * @return Stream id, or -1 on failure
+ */
+int syscall_timerfd_create(uint64_t initial_us, uint64_t interval_us) {
+    struct process *p = kernel_curr_process->leader;
+    if(!initial_us || (interval_us && interval_us < TIMERFD_MIN_INTERVAL_US)) {
+        return -1;
+    }
+    struct timer_stream *t = alloc_timer_stream(initial_us, interval_us);
+    if(!t) {
+        return -1;
+    }
+    int32_t fd = p->stream_count;
+    if(process_new_stream_descriptor(p, t, DEVICE_TYPE_TIMER)) {
+        timer_cancel(&t->timer);
+        free(t);
+        return -1;
+    }
+    return fd;
+}
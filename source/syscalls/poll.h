@@ -0,0 +1,10 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/syscall.h>
+
+int syscall_poll(struct pollfd *fds, int nfds, int timeout_ms);
+int syscall_epoll_create();
+int syscall_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int syscall_epoll_wait(int epfd, struct epoll_event *events, int max_events, int timeout_ms);
+int syscall_timerfd_create(uint64_t initial_us, uint64_t interval_us);
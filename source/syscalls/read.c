@@ -0,0 +1,27 @@
+#include <kernel/print.h>
+#include <kernel/device_types.h>
+#include <kernel/chardev.h>
+#include <kernel/process.h>
+#include <kernel/pipe.h>
+#include <kernel/timerfd.h>
+
+#include "read.h"
+
+
+int syscall_read(int file, char *ptr, int len) {
+    struct stream_descriptor *i = process_get_stream(kernel_curr_process->leader, file);
+    if(!i || len < 0 || process_prepare_user_write(kernel_curr_process->leader, (uint64_t)ptr, len)) {
+        return -1;
+    }
+    switch(i->dev_type) {
+    case DEVICE_TYPE_CHAR:
+        return read_char(i->dev, ptr, len);
+    case DEVICE_TYPE_PIPE:
+        return pipe_read(i->dev, ptr, len);
+    case DEVICE_TYPE_TIMER:
+        return timerfd_read(i->dev, ptr, len);
+    default:
+        print("Cannot read from this device type!\n");
+    }
+    return -1;
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+int syscall_read(int file, char *ptr, int len);
@@ -5,27 +5,22 @@
 
 
 uint64_t syscall_sbrk(int incr) {
-    struct process *p = kernel_curr_process;
+    struct process *p = kernel_curr_process->leader;
 
     uint64_t user_addr = USERSPACE_HEAP_ADDRESS + p->user_heap_used;
     int64_t required_space = p->user_heap_used + incr - p->user_heap_size;
     if(required_space > 0) {
         // print("sbrk requires {l} more bytes.\n", required_space);
         required_space = round_up_to_page(required_space);
-        struct address_mapping *new_mem = new_mapped_process_memory(p, user_addr, required_space);
-        if(!new_mem) {
+        // Large increments are backed by 2 MiB blocks, as soon as the heap end is 2 MiB aligned
+        if(process_map_pages(p, USERSPACE_HEAP_ADDRESS + p->user_heap_size, required_space, true)) {
             print("Failed to allocate new process memory.\n");
             // TODO: Just cause a fault
             panic();
         }
-        if(map_memory_region(p->addr_space, new_mem)) {
-            print("Failed to map new process memory.\n");
-            // TODO: Just cause a fault
-            panic();
-        }
         p->user_heap_size += required_space;
     }
     p->user_heap_used += incr;
 
     return user_addr;
-}
\ No newline at end of file
+}
@@ -0,0 +1,140 @@
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/address_space.h>
+#include <kernel/alloc.h>
+#include <kernel/page.h>
+
+#include "shm.h"
+
+
+// Shared memory regions. Each region is process memory that can be mapped into any number of address spaces.
+// A region is referenced by its creator and by every mapping. It is freed with the last reference.
+struct shm_region {
+    // Must be the first member, the release callback casts back to the region.
+    struct process_memory mem;
+    int id;
+    struct shm_region *next;
+};
+
+static struct shm_region *shm_regions = 0;
+static int shm_next_id = 1;
+
+
+static void shm_release(struct process_memory *mem) {
+    struct shm_region *region = (struct shm_region*)mem;
+    struct shm_region *prev = 0;
+    for(struct shm_region *i = shm_regions; i; i = i->next) {
+        if(i == region) {
+            if(prev) {
+                prev->next = i->next;
+            } else {
+                shm_regions = i->next;
+            }
+            break;
+        }
+        prev = i;
+    }
+    free(region->mem.memory);
+    free(region);
+}
+
+
+static struct shm_region *shm_find(int id) {
+    for(struct shm_region *i = shm_regions; i; i = i->next) {
+        if(i->id == id) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Creates a zero initialized shared memory region. The region exists until it is unmapped
+ * everywhere and the creating process has exited.
+ * 
+ * @param size Size of the region in bytes
+ * @return The region id, or -1 on failure
+ */
+int syscall_shm_create(uint64_t size) {
+    if(!size || size > USERSPACE_SHM_END - USERSPACE_SHM_ADDRESS) {
+        return -1;
+    }
+    struct shm_region *region = kmalloc(sizeof(struct shm_region), ALLOC_ZERO_INIT);
+    if(!region) {
+        return -1;
+    }
+    region->mem.size = round_up_to_page(size);
+    region->mem.memory = kmalloc(region->mem.size, ALLOC_ZERO_INIT | ALLOC_PAGE_ALIGN);
+    if(!region->mem.memory) {
+        free(region);
+        return -1;
+    }
+    region->mem.release = shm_release;
+    region->id = shm_next_id++;
+
+    if(process_add_memory_handle(kernel_curr_process->leader, &region->mem)) {
+        free(region->mem.memory);
+        free(region);
+        return -1;
+    }
+    region->next = shm_regions;
+    shm_regions = region;
+    return region->id;
+}
+
+
+/**
+ * @brief Maps the shared memory region into the address space of the calling process. The memory is cacheable.
+ * 
+ * @param id Region id
+ * @return Virtual address of the mapping, or 0 on failure
+ */
+uint64_t syscall_shm_map(int id) {
+    struct process *p = kernel_curr_process->leader;
+    struct shm_region *region = shm_find(id);
+    if(!region) {
+        return 0;
+    }
+
+    uint64_t vaddr = address_space_find_free(p->addr_space, USERSPACE_SHM_ADDRESS, USERSPACE_SHM_END, region->mem.size);
+    if(!vaddr) {
+        print("shm_map: Out of virtual address space\n");
+        return 0;
+    }
+    struct address_mapping *m = create_memory_region_virt(p->addr_space, vaddr, (uint64_t)region->mem.memory, region->mem.size);
+    if(!m) {
+        return 0;
+    }
+    m->flags = MAPPING_FLAG_SHARED;
+    if(map_memory_region(p->addr_space, m)) {
+        unmap_and_remove_memory_region(p->addr_space, m);
+        return 0;
+    }
+    if(process_add_memory_handle(p, &region->mem)) {
+        unmap_and_remove_memory_region(p->addr_space, m);
+        return 0;
+    }
+    return vaddr;
+}
+
+
+/**
+ * @brief Removes a shared memory mapping from the calling process.
+ * 
+ * @param vaddr Address returned by shm_map
+ * @return 0 for success, -1 on failure
+ */
+int syscall_shm_unmap(uint64_t vaddr) {
+    struct process *p = kernel_curr_process->leader;
+    struct address_mapping *m = address_space_find_mapping(p->addr_space, vaddr);
+    if(!m || m->vaddress != vaddr || !(m->flags & MAPPING_FLAG_SHARED)) {
+        return -1;
+    }
+    struct process_memory *mem = process_find_memory(p, m->paddress);
+    if(!mem || unmap_and_remove_memory_region(p->addr_space, m)) {
+        return -1;
+    }
+    process_remove_memory_handle(p, mem);
+    return 0;
+}
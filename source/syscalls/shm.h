@@ -0,0 +1,7 @@
+#pragma once
+
+#include <kernel/types.h>
+
+int syscall_shm_create(uint64_t size);
+uint64_t syscall_shm_map(int id);
+int syscall_shm_unmap(uint64_t vaddr);
@@ -0,0 +1,83 @@
+#include <kernel/print.h>
+#include <kernel/process.h>
+#include <kernel/inode.h>
+#include <kernel/alloc.h>
+#include <kernel/elf.h>
+
+#include "spawn.h"
+
+
+static int apply_fd_action(struct process *child, struct process *parent, struct spawn_fd_action *a) {
+    switch(a->action) {
+    case SPAWN_FD_DUP: {
+        struct stream_descriptor *src = process_get_stream(parent, a->parent_fd);
+        if(!src) {
+            return 1;
+        }
+        struct stream_descriptor *s = process_get_stream(child, a->fd);
+        if(s) {
+            stream_descriptor_put(s);
+        } else {
+            s = kmalloc(sizeof(struct stream_descriptor), 0);
+            if(!s) {
+                return 1;
+            }
+            s->id = a->fd;
+            s->next = child->streams;
+            child->streams = s;
+            if(a->fd >= child->stream_count) {
+                child->stream_count = a->fd + 1;
+            }
+        }
+        s->dev = src->dev;
+        s->dev_type = src->dev_type;
+        stream_descriptor_get(s);
+        return 0;
+    }
+    case SPAWN_FD_CLOSE:
+        process_close_stream(child, a->fd);
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+
+/**
+ * @brief Creates a new process from an ELF file, and runs it until it yields. The ELF file is
+ * only parsed on the first spawn, later spawns reuse the cached segment layout.
+ * 
+ * @param path Path to the ELF file
+ * @param argv Null terminated argument list
+ * @param actions File actions applied to the default streams of the new process
+ * @param n_actions Number of file actions
+ * @return PID of the new process, or -1 on failure
+ */
+int syscall_spawn(char *path, char **argv, struct spawn_fd_action *actions, int n_actions) {
+    struct inode* elf_file = inode_from_path(g_root_inode, path);
+    if(!elf_file) {
+        return -1;
+    }
+
+    int32_t argc = 0;
+    while(argv && argv[argc]) {
+        argc++;
+    }
+
+    struct process *p = elf_spawn_process(elf_file, argc, argv);
+    if(!p) {
+        return -1;
+    }
+
+    for(int i = 0; i < n_actions; i++) {
+        if(apply_fd_action(p, kernel_curr_process->leader, &actions[i])) {
+            print("spawn: Invalid file action\n");
+            destroy_process(p);
+            return -1;
+        }
+    }
+
+    int pid = p->pid;
+    switch_to_process(p, PROCESS_STATE_WAITING);
+    return pid;
+}
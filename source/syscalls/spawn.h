@@ -0,0 +1,6 @@
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/syscall.h>
+
+int syscall_spawn(char *path, char **argv, struct spawn_fd_action *actions, int n_actions);
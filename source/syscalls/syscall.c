@@ -7,8 +7,17 @@
 #include "write.h"
 #include "close.h"
 #include "sbrk.h"
+#include "fork.h"
+#include "spawn.h"
+#include "clone.h"
+#include "futex.h"
+#include "read.h"
+#include "pipe.h"
+#include "shm.h"
+#include "poll.h"
 
 #include <kernel/syscall.h>
+#include <kernel/ipc.h>
 
 
 uint64_t handle_syscall(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
@@ -18,13 +27,21 @@ uint64_t handle_syscall(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3,
         #ifdef TRACE_SYSCALLS
         print("exit({d})\n", (int)a1);
         #endif
-        // The true flag indicates that we are terminating the process
+        // Exiting terminates all threads of the process
+        terminate_thread_group(kernel_curr_process->leader);
         switch_to_next_process(PROCESS_STATE_TERMINATED);
         print("ERROR: Resumed exited thread!\n");
         panic();
         //return syscall_exit((int)a1);
         break;
 
+    case __NR_read:
+        #ifdef TRACE_SYSCALLS
+        print("read({d}, {p}, {d})\n", (int)a1, (char*)a2, (int)a3);
+        #endif
+        return syscall_read((int)a1, (char*)a2, (int)a3);
+        break;
+
     case __NR_write:
         #ifdef TRACE_SYSCALLS
         print("write({d}, {p}, {d})\n", (int)a1, (char*)a2, (int)a3);
@@ -46,6 +63,128 @@ uint64_t handle_syscall(uint64_t syscall, uint64_t a1, uint64_t a2, uint64_t a3,
         return syscall_sbrk((int)a1);
         break;
 
+    case __NR_fork:
+        #ifdef TRACE_SYSCALLS
+        print("fork()\n");
+        #endif
+        return syscall_fork();
+        break;
+
+    case __NR_spawn:
+        #ifdef TRACE_SYSCALLS
+        print("spawn({s}, {p}, {p}, {d})\n", (char*)a1, (char**)a2, (struct spawn_fd_action*)a3, (int)a4);
+        #endif
+        return syscall_spawn((char*)a1, (char**)a2, (struct spawn_fd_action*)a3, (int)a4);
+        break;
+
+    case __NR_clone:
+        #ifdef TRACE_SYSCALLS
+        print("clone(0x{xl}, 0x{xl}, 0x{xl}, 0x{xl})\n", a1, a2, a3, a4);
+        #endif
+        return syscall_clone(a1, a2, a3, a4);
+        break;
+
+    case __NR_thread_exit:
+        #ifdef TRACE_SYSCALLS
+        print("thread_exit()\n");
+        #endif
+        switch_to_next_process(PROCESS_STATE_TERMINATED);
+        print("ERROR: Resumed exited thread!\n");
+        panic();
+        break;
+
+    case __NR_yield:
+        #ifdef TRACE_SYSCALLS
+        print("yield()\n");
+        #endif
+        yield();
+        return 0;
+        break;
+
+    case __NR_futex:
+        #ifdef TRACE_SYSCALLS
+        print("futex({p}, {d}, {u}, {u}, {p})\n", (uint32_t*)a1, (int)a2, (uint32_t)a3, (uint32_t)a4, (uint32_t*)a5);
+        #endif
+        return syscall_futex((uint32_t*)a1, (int)a2, (uint32_t)a3, (uint32_t)a4, (uint32_t*)a5);
+        break;
+
+    case __NR_pipe:
+        #ifdef TRACE_SYSCALLS
+        print("pipe({p})\n", (int*)a1);
+        #endif
+        return syscall_pipe((int*)a1);
+        break;
+
+    case __NR_shm_create:
+        #ifdef TRACE_SYSCALLS
+        print("shm_create({ul})\n", a1);
+        #endif
+        return syscall_shm_create(a1);
+        break;
+
+    case __NR_shm_map:
+        #ifdef TRACE_SYSCALLS
+        print("shm_map({d})\n", (int)a1);
+        #endif
+        return syscall_shm_map((int)a1);
+        break;
+
+    case __NR_shm_unmap:
+        #ifdef TRACE_SYSCALLS
+        print("shm_unmap(0x{xl})\n", a1);
+        #endif
+        return syscall_shm_unmap(a1);
+        break;
+
+    case __NR_ipc_call:
+        #ifdef TRACE_SYSCALLS
+        print("ipc_call({d})\n", (int)a1);
+        #endif
+        return syscall_ipc_call((uint16_t)a1);
+        break;
+
+    case __NR_ipc_reply_wait:
+        #ifdef TRACE_SYSCALLS
+        print("ipc_reply_wait({d})\n", (int)a1);
+        #endif
+        return syscall_ipc_reply_wait((uint16_t)a1);
+        break;
+
+    case __NR_poll:
+        #ifdef TRACE_SYSCALLS
+        print("poll({p}, {d}, {d})\n", (struct pollfd*)a1, (int)a2, (int)a3);
+        #endif
+        return syscall_poll((struct pollfd*)a1, (int)a2, (int)a3);
+        break;
+
+    case __NR_epoll_create:
+        #ifdef TRACE_SYSCALLS
+        print("epoll_create()\n");
+        #endif
+        return syscall_epoll_create();
+        break;
+
+    case __NR_epoll_ctl:
+        #ifdef TRACE_SYSCALLS
+        print("epoll_ctl({d}, {d}, {d}, {p})\n", (int)a1, (int)a2, (int)a3, (struct epoll_event*)a4);
+        #endif
+        return syscall_epoll_ctl((int)a1, (int)a2, (int)a3, (struct epoll_event*)a4);
+        break;
+
+    case __NR_epoll_wait:
+        #ifdef TRACE_SYSCALLS
+        print("epoll_wait({d}, {p}, {d}, {d})\n", (int)a1, (struct epoll_event*)a2, (int)a3, (int)a4);
+        #endif
+        return syscall_epoll_wait((int)a1, (struct epoll_event*)a2, (int)a3, (int)a4);
+        break;
+
+    case __NR_timerfd_create:
+        #ifdef TRACE_SYSCALLS
+        print("timerfd_create({ul}, {ul})\n", a1, a2);
+        #endif
+        return syscall_timerfd_create(a1, a2);
+        break;
+
     default:
         print("Unknown syscall with number {ul}\n", syscall);
         // Exception link register (fault address)
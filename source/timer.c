@@ -1,6 +1,7 @@
 #include <kernel/types.h>
 #include <kernel/register.h>
 #include <kernel/exception.h>
+#include <kernel/timer.h>
 
 
 #define TIMER_BASE 0x3F003000
@@ -13,6 +14,12 @@
 #define TIMER_C2  (TIMER_BASE + 0x14)  // Used by GPU
 #define TIMER_C3  (TIMER_BASE + 0x18)
 
+// Deadlines closer than this are run right away, as the compare value could pass before it is written.
+#define TIMER_MIN_DELAY_US 20
+
+// Pending timers, sorted by expiry
+static struct timer *timer_list = 0;
+
 uint64_t read_system_timer() {
     uint32_t lower, upper;
     upper = get32(TIMER_CHI);
@@ -25,6 +32,29 @@ uint64_t read_system_timer() {
     return (uint64_t)upper << 32ul | lower;
 }
 
+/**
+ * @brief Allows user space to read the virtual counter (CNTVCT_EL0) and its frequency.
+ * This lets applications take timestamps without a syscall.
+ */
+void enable_user_counter_access() {
+    uint64_t cntkctl = read_system_reg(CNTKCTL_EL1);
+    // EL0VCTEN
+    cntkctl |= (1ul << 1);
+    write_system_reg(CNTKCTL_EL1, cntkctl);
+}
+
+/**
+ * @brief Starts the PMU cycle counter and allows user space to read it (PMCCNTR_EL0).
+ */
+void enable_user_cycle_counter() {
+    // PMCR_EL0: E (enable), C (reset cycle counter)
+    write_system_reg(PMCR_EL0, read_system_reg(PMCR_EL0) | (1ul << 0) | (1ul << 2));
+    // PMCNTENSET_EL0: Enable the cycle counter
+    write_system_reg(PMCNTENSET_EL0, 1ul << 31);
+    // PMUSERENR_EL0: EN (EL0 access), CR (EL0 cycle counter reads)
+    write_system_reg(PMUSERENR_EL0, (1ul << 0) | (1ul << 2));
+}
+
 void enable_system_timer_interrupt() {
     enable_peripheral_interrupt(PERIPHERAL_INTERRUPT_CLOCK1);
 }
@@ -38,4 +68,87 @@ void set_system_timer_interrupt(uint32_t compare_val) {
     put32(TIMER_CS, 1 << 1);
     // Set the compare value
     put32(TIMER_C1, compare_val);
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief Runs the callbacks of all expired timers, then programs the compare register for the next one.
+ * Must be called with IRQs masked.
+ */
+static void timer_run_expired() {
+    while(timer_list) {
+        struct timer *t = timer_list;
+        if(t->expires > read_system_timer() + TIMER_MIN_DELAY_US) {
+            // The compare register only matches the lower 32 bits of the counter
+            set_system_timer_interrupt(t->expires & 0xFFFFFFFF);
+            return;
+        }
+        timer_list = t->next;
+        t->next = 0;
+        t->pending = false;
+        t->callback(t);
+    }
+}
+
+
+static void timer_interrupt(void *data) {
+    // Acknowledge the interrupt
+    put32(TIMER_CS, 1 << 1);
+    timer_run_expired();
+}
+
+
+/**
+ * @brief Installs the system timer interrupt handler, which drives all software timers.
+ * 
+ * @return 0 for success
+ */
+int init_timers() {
+    put32(TIMER_CS, 1 << 1);
+    return register_interrupt_handler(PERIPHERAL_INTERRUPT_CLOCK1, timer_interrupt, 0);
+}
+
+
+/**
+ * @brief Arms the timer. An already pending timer is rescheduled.
+ * 
+ * @param t Timer with callback set
+ * @param expires System timer value in microseconds at which the callback runs
+ */
+void timer_add(struct timer *t, uint64_t expires) {
+    uint64_t flags = irq_save();
+    if(t->pending) {
+        timer_cancel(t);
+    }
+    t->expires = expires;
+    t->pending = true;
+    struct timer **i = &timer_list;
+    while(*i && (*i)->expires <= expires) {
+        i = &(*i)->next;
+    }
+    t->next = *i;
+    *i = t;
+    if(timer_list == t) {
+        timer_run_expired();
+    }
+    irq_restore(flags);
+}
+
+
+/**
+ * @brief Disarms the timer. Does nothing if the timer is not pending.
+ * 
+ * @param t Timer
+ */
+void timer_cancel(struct timer *t) {
+    uint64_t flags = irq_save();
+    for(struct timer **i = &timer_list; *i; i = &(*i)->next) {
+        if(*i == t) {
+            *i = t->next;
+            break;
+        }
+    }
+    t->next = 0;
+    t->pending = false;
+    irq_restore(flags);
+}
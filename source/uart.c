@@ -3,6 +3,9 @@
 #include <kernel/chardev.h>
 #include <kernel/register.h>
 #include <kernel/pagetable.h>
+#include <kernel/exception.h>
+#include <kernel/process.h>
+#include <kernel/waitqueue.h>
 
 #include "uart.h"
 
@@ -31,6 +34,18 @@ static uint64_t uart_baseaddr = UART_PHYSICAL_ADDR;
 #define AUX_MU_STAT_REG (uart_baseaddr + 0x15064ul)
 #define AUX_MU_BAUD_REG (uart_baseaddr + 0x15068ul)
 
+// Receive interrupt enable. Bits 3:2 are documented as unused, but are required to receive interrupts.
+#define AUX_MU_IER_RX_INT 0b1101
+
+#define UART_RX_BUFFER_SIZE 256 // Must be a power of two
+
+// Received characters are buffered by the interrupt handler
+static char uart_rx_buffer[UART_RX_BUFFER_SIZE];
+static uint32_t uart_rx_head = 0;
+static uint32_t uart_rx_tail = 0;
+static bool_t uart_rx_interrupts = false;
+static struct wait_queue uart_read_queue;
+
 //GPIO14  TXD0 and TXD1
 //GPIO15  RXD0 and RXD1
 //alt function 5 for uart1
@@ -75,19 +90,75 @@ static int64_t uart_chardev_write(struct char_dev *dev, char *buf, int64_t count
     return count;
 }
 
+/**
+ * @brief Reads received characters. Blocks until at least one character is available.
+ * 
+ * @return Number of characters read
+ */
 static int64_t uart_chardev_read(struct char_dev *dev, char *buf, int64_t count) {
-    for(int64_t i = 0; i < count; i++) {
-        buf[i] = uart_recv();
+    if(count <= 0) {
+        return 0;
     }
-    return count;
+    if(!uart_rx_interrupts) {
+        for(int64_t i = 0; i < count; i++) {
+            buf[i] = uart_recv();
+        }
+        return count;
+    }
+
+    uint64_t flags = irq_save();
+    while(uart_rx_head == uart_rx_tail) {
+        if(kernel_curr_process) {
+            wait_queue_sleep(&uart_read_queue, 0);
+        } else {
+            wait_for_interrupt();
+        }
+    }
+    int64_t n = 0;
+    while(n < count && uart_rx_head != uart_rx_tail) {
+        buf[n++] = uart_rx_buffer[uart_rx_tail & (UART_RX_BUFFER_SIZE - 1)];
+        uart_rx_tail++;
+    }
+    irq_restore(flags);
+    return n;
+}
+
+static uint32_t uart_chardev_poll(struct char_dev *dev) {
+    uint32_t mask = POLLOUT;
+    if(uart_rx_interrupts ? uart_rx_head != uart_rx_tail : (get32(AUX_MU_LSR_REG) & 0x01)) {
+        mask |= POLLIN;
+    }
+    return mask;
 }
 
 struct char_dev global_uart = {
     .read = uart_chardev_read,
     .write = uart_chardev_write,
+    .poll = uart_chardev_poll,
     .driver_str = "BCM_UART"
 };
 
+
+/**
+ * @brief Moves the receive FIFO into the buffer, then wakes readers and pollers.
+ * Characters are dropped while the buffer is full.
+ */
+static void uart_interrupt(void *data) {
+    bool_t received = false;
+    while(get32(AUX_MU_LSR_REG) & 0x01) {
+        char c = get32(AUX_MU_IO_REG) & 0xFF;
+        if(uart_rx_head - uart_rx_tail < UART_RX_BUFFER_SIZE) {
+            uart_rx_buffer[uart_rx_head & (UART_RX_BUFFER_SIZE - 1)] = c;
+            uart_rx_head++;
+        }
+        received = true;
+    }
+    if(received) {
+        wait_queue_wake_all(&uart_read_queue);
+        poll_notify(&global_uart.pollers, POLLIN);
+    }
+}
+
 unsigned int uart_lcr ( void )
 {
     return(get32(AUX_MU_LSR_REG));
@@ -96,6 +167,7 @@ unsigned int uart_lcr ( void )
 
 unsigned int uart_check ( void )
 {
+    if(uart_rx_interrupts) return(uart_rx_head != uart_rx_tail);
     if(get32(AUX_MU_LSR_REG)&0x01) return(1);
     return(0);
 }
@@ -155,5 +227,15 @@ int uart_init() {
     }
     uart_baseaddr = new_uart_baseaddr;
     print("UART peripheral remapped @ 0x{xl}\n", uart_baseaddr);
+
+    // Switch from polling to interrupt driven receiving
+    if(register_interrupt_handler(PERIPHERAL_INTERRUPT_AUX_INT, uart_interrupt, 0)) {
+        print("uart: error: failed to register interrupt handler\n");
+        return -1;
+    }
+    uint64_t flags = irq_save();
+    uart_rx_interrupts = true;
+    put32(AUX_MU_IER_REG, AUX_MU_IER_RX_INT);
+    irq_restore(flags);
     return 0;
 }
\ No newline at end of file